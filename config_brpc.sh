@@ -38,10 +38,12 @@ else
     LDD=ldd
 fi
 
-TEMP=`getopt -o v: --long headers:,libs:,cc:,cxx:,with-glog,with-thrift,with-rdma,with-mesalink,nodebugsymbols -n 'config_brpc' -- "$@"`
+TEMP=`getopt -o v: --long headers:,libs:,cc:,cxx:,with-glog,with-thrift,with-rdma,with-lz4,with-zstd,with-mesalink,nodebugsymbols -n 'config_brpc' -- "$@"`
 WITH_GLOG=0
 WITH_THRIFT=0
 WITH_RDMA=0
+WITH_LZ4=0
+WITH_ZSTD=0
 WITH_MESALINK=0
 DEBUGSYMBOLS=-g
 
@@ -66,6 +68,8 @@ while true; do
         --with-glog ) WITH_GLOG=1; shift 1 ;;
         --with-thrift) WITH_THRIFT=1; shift 1 ;;
         --with-rdma) WITH_RDMA=1; shift 1 ;;
+        --with-lz4) WITH_LZ4=1; shift 1 ;;
+        --with-zstd) WITH_ZSTD=1; shift 1 ;;
         --with-mesalink) WITH_MESALINK=1; shift 1 ;;
         --nodebugsymbols ) DEBUGSYMBOLS=; shift 1 ;;
         -- ) shift; break ;;
@@ -366,6 +370,28 @@ if [ $WITH_RDMA != 0 ]; then
     append_to_output "WITH_RDMA=1"
 fi
 
+if [ $WITH_LZ4 != 0 ]; then
+    LZ4_LIB=$(find_dir_of_lib_or_die lz4)
+    LZ4_HDR=$(find_dir_of_header_or_die lz4frame.h)
+    append_to_output_libs "$LZ4_LIB"
+    append_to_output_headers "$LZ4_HDR"
+
+    CPPFLAGS="${CPPFLAGS} -DBRPC_WITH_LZ4"
+
+    append_to_output "DYNAMIC_LINKINGS+=-llz4"
+fi
+
+if [ $WITH_ZSTD != 0 ]; then
+    ZSTD_LIB=$(find_dir_of_lib_or_die zstd)
+    ZSTD_HDR=$(find_dir_of_header_or_die zstd.h)
+    append_to_output_libs "$ZSTD_LIB"
+    append_to_output_headers "$ZSTD_HDR"
+
+    CPPFLAGS="${CPPFLAGS} -DBRPC_WITH_ZSTD"
+
+    append_to_output "DYNAMIC_LINKINGS+=-lzstd"
+fi
+
 if [ $WITH_MESALINK != 0 ]; then
     CPPFLAGS="${CPPFLAGS} -DUSE_MESALINK"
 fi
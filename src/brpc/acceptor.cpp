@@ -22,6 +22,7 @@
 
 
 #include <inttypes.h>
+#include <algorithm>                        // std::find
 #include <gflags/gflags.h>
 #include "butil/fd_guard.h"                 // fd_guard 
 #include "butil/fd_utility.h"               // make_close_on_exec
@@ -41,10 +42,11 @@ Acceptor::Acceptor(bthread_keytable_pool_t* pool)
     , _idle_timeout_sec(-1)
     , _close_idle_tid(INVALID_BTHREAD)
     , _listened_fd(-1)
-    , _acception_id(0)
+    , _nacception(0)
     , _empty_cond(&_map_mutex)
     , _ssl_ctx(NULL) 
-    , _use_rdma(false) {
+    , _use_rdma(false)
+    , _bthread_tag(BTHREAD_TAG_DEFAULT) {
 }
 
 Acceptor::~Acceptor() {
@@ -53,7 +55,8 @@ Acceptor::~Acceptor() {
 }
 
 int Acceptor::StartAccept(int listened_fd, int idle_timeout_sec,
-                          const std::shared_ptr<SocketSSLContext>& ssl_ctx) {
+                          const std::shared_ptr<SocketSSLContext>& ssl_ctx,
+                          int event_dispatcher_index) {
     if (listened_fd < 0) {
         LOG(FATAL) << "Invalid listened_fd=" << listened_fd;
         return -1;
@@ -81,15 +84,11 @@ int Acceptor::StartAccept(int listened_fd, int idle_timeout_sec,
     _idle_timeout_sec = idle_timeout_sec;
     _ssl_ctx = ssl_ctx;
     
-    // Creation of _acception_id is inside lock so that OnNewConnections
+    // Creation of the acception is inside lock so that OnNewConnections
     // (which may run immediately) should see sane fields set below.
-    SocketOptions options;
-    options.fd = listened_fd;
-    options.user = this;
-    options.on_edge_triggered_events = OnNewConnections;
-    if (Socket::Create(options, &_acception_id) != 0) {
+    _acception_ids.clear();
+    if (CreateAcception(listened_fd, event_dispatcher_index) != 0) {
         // Close-idle-socket thread will be stopped inside destructor
-        LOG(FATAL) << "Fail to create _acception_id";
         return -1;
     }
     
@@ -98,6 +97,41 @@ int Acceptor::StartAccept(int listened_fd, int idle_timeout_sec,
     return 0;
 }
 
+int Acceptor::AddListener(int listened_fd, int event_dispatcher_index) {
+    if (listened_fd < 0) {
+        LOG(FATAL) << "Invalid listened_fd=" << listened_fd;
+        return -1;
+    }
+    BAIDU_SCOPED_LOCK(_map_mutex);
+    if (_status != RUNNING) {
+        LOG(ERROR) << "Acceptor is not running: status=" << status();
+        return -1;
+    }
+    return CreateAcception(listened_fd, event_dispatcher_index);
+}
+
+int Acceptor::CreateAcception(int listened_fd, int event_dispatcher_index) {
+    SocketOptions options;
+    options.fd = listened_fd;
+    options.user = this;
+    options.on_edge_triggered_events = OnNewConnections;
+    options.event_dispatcher_index = event_dispatcher_index;
+    options.bthread_tag = _bthread_tag;
+    SocketId acception_id;
+    if (Socket::Create(options, &acception_id) != 0) {
+        LOG(FATAL) << "Fail to create acception of listened_fd=" << listened_fd;
+        return -1;
+    }
+    _acception_ids.push_back(acception_id);
+    ++_nacception;
+    return 0;
+}
+
+size_t Acceptor::ListenerCount() {
+    BAIDU_SCOPED_LOCK(_map_mutex);
+    return _acception_ids.size();
+}
+
 void* Acceptor::CloseIdleConnections(void* arg) {
     Acceptor* am = static_cast<Acceptor*>(arg);
     std::vector<SocketId> checking_fds;
@@ -128,8 +162,9 @@ void Acceptor::StopAccept(int /*closewait_ms*/) {
         _status = STOPPING;
     }
 
-    // Don't set _acception_id to 0 because BeforeRecycle needs it.
-    Socket::SetFailed(_acception_id);
+    for (size_t i = 0; i < _acception_ids.size(); ++i) {
+        Socket::SetFailed(_acception_ids[i]);
+    }
 
     // SetFailed all existing connections. Connections added after this piece
     // of code will be SetFailed directly in OnNewConnectionsUntilEAGAIN
@@ -171,7 +206,7 @@ void Acceptor::Join() {
     if (_status != STOPPING && _status != RUNNING) {  // no need to join.
         return;
     }
-    // `_listened_fd' will be set to -1 once it has been recycled
+    // `_listened_fd' will be set to -1 once all acceptions have been recycled
     while (_listened_fd > 0 || !_socket_map.empty()) {
         _empty_cond.Wait();
     }
@@ -281,6 +316,9 @@ void Acceptor::OnNewConnectionsUntilEAGAIN(Socket* acception) {
         butil::sockaddr2endpoint(&in_addr, in_len, &options.remote_side);
         options.user = acception->user();
         options.initial_ssl_ctx = am->_ssl_ctx;
+        // Keep the connection in the dispatcher of the listener.
+        options.event_dispatcher_index = acception->_event_dispatcher_index;
+        options.bthread_tag = am->_bthread_tag;
 #if BRPC_WITH_RDMA
         if (am->_use_rdma) {
             options.on_edge_triggered_events = rdma::RdmaEndpoint::OnNewDataFromTcp;
@@ -342,12 +380,16 @@ void Acceptor::OnNewConnections(Socket* acception) {
 
 void Acceptor::BeforeRecycle(Socket* sock) {
     BAIDU_SCOPED_LOCK(_map_mutex);
-    if (sock->id() == _acception_id) {
-        // Set _listened_fd to -1 when acception socket has been recycled
-        // so that we are ensured no more events will arrive (and `Join'
-        // will return to its caller)
-        _listened_fd = -1;
-        _empty_cond.Broadcast();
+    if (sock->_on_edge_triggered_events == OnNewConnections &&
+        std::find(_acception_ids.begin(), _acception_ids.end(),
+                  sock->id()) != _acception_ids.end()) {
+        // Set _listened_fd to -1 when all acception sockets have been
+        // recycled so that we are ensured no more events will arrive (and
+        // `Join' will return to its caller)
+        if (--_nacception == 0) {
+            _listened_fd = -1;
+            _empty_cond.Broadcast();
+        }
         return;
     }
     // If a Socket could not be addressed shortly after its creation, it
@@ -53,9 +53,21 @@ public:
     // by calling `StopAccept' and `Join'. Connections that has no data
     // transmission for `idle_timeout_sec' will be closed automatically iff
     // `idle_timeout_sec' > 0
+    // If `event_dispatcher_index' is non-negative, `listened_fd' and all
+    // connections accepted from it are dispatched by the global
+    // EventDispatcher at the index, see SocketOptions.event_dispatcher_index.
     // Return 0 on success, -1 otherwise.
     int StartAccept(int listened_fd, int idle_timeout_sec,
-                    const std::shared_ptr<SocketSSLContext>& ssl_ctx);
+                    const std::shared_ptr<SocketSSLContext>& ssl_ctx,
+                    int event_dispatcher_index = -1);
+
+    // [thread-safe] Accept connections from one more `listened_fd' after a
+    // successful `StartAccept', typically another socket listening to the
+    // same port with SO_REUSEPORT. Ownership of `listened_fd' is transferred
+    // on success. `event_dispatcher_index' is same as in `StartAccept'.
+    // Stopped along with other listened fds by `StopAccept'.
+    // Return 0 on success, -1 otherwise.
+    int AddListener(int listened_fd, int event_dispatcher_index);
 
     // [thread-safe] Stop accepting connections.
     // `closewait_ms' is not used anymore.
@@ -67,6 +79,9 @@ public:
     // The parameter to StartAccept. Negative when acceptor is stopped.
     int listened_fd() const { return _listened_fd; }
 
+    // Number of fds being accepted, namely 1 + successful AddListener().
+    size_t ListenerCount();
+
     // Get number of existing connections.
     size_t ConnectionCount() const;
 
@@ -88,6 +103,10 @@ private:
     // Initialize internal structure. 
     int Initialize();
 
+    // Create the Socket accepting connections from `listened_fd'.
+    // Called with _map_mutex held.
+    int CreateAcception(int listened_fd, int event_dispatcher_index);
+
     // Remove the accepted socket `sock' from inside
     void BeforeRecycle(Socket* sock) override;
 
@@ -97,8 +116,10 @@ private:
     bthread_t _close_idle_tid;
 
     int _listened_fd;
-    // The Socket tso accept connections.
-    SocketId _acception_id;
+    // The Sockets to accept connections, one for each listened fd.
+    std::vector<SocketId> _acception_ids;
+    // Number of Sockets in `_acception_ids' not recycled yet.
+    int _nacception;
 
     butil::Mutex _map_mutex;
     butil::ConditionVariable _empty_cond;
@@ -110,6 +131,9 @@ private:
 
     // Whether to use rdma or not
     bool _use_rdma;
+
+    // Worker group to run the listened fds and accepted connections in.
+    bthread_tag_t _bthread_tag;
 };
 
 } // namespace brpc
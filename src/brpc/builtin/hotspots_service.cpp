@@ -30,6 +30,7 @@
 #include "brpc/builtin/pprof_perl.h"
 #include "brpc/builtin/hotspots_service.h"
 #include "brpc/details/tcmalloc_extension.h"
+#include "brpc/details/cpu_profile_ring.h"
 
 extern "C" {
 int __attribute__((weak)) ProfilerStart(const char* fname);
@@ -39,6 +40,8 @@ void __attribute__((weak)) ProfilerStop();
 namespace bthread {
 bool ContentionProfilerStart(const char* filename);
 void ContentionProfilerStop();
+bool ButexWaitProfilerStart(const char* filename);
+void ButexWaitProfilerStop();
 }
 
 namespace brpc {
@@ -110,7 +113,7 @@ DEFINE_int32(max_profiling_seconds, 300, "upper limit of running time of profile
 BRPC_VALIDATE_GFLAG(max_profiling_seconds, NonNegativeInteger);
 
 DEFINE_int32(max_profiles_kept, 32,
-             "max profiles kept for cpu/heap/growth/contention respectively");
+             "max profiles kept for cpu/heap/growth/contention/offcpu respectively");
 BRPC_VALIDATE_GFLAG(max_profiles_kept, PassValidate);
 
 static const char* const PPROF_FILENAME = "pprof.pl";
@@ -151,7 +154,8 @@ struct ProfilingEnvironment {
 };
 
 // Different ProfilingType have different env.
-static ProfilingEnvironment g_env[4] = {
+static ProfilingEnvironment g_env[5] = {
+    { PTHREAD_MUTEX_INITIALIZER, 0, NULL, NULL, NULL },
     { PTHREAD_MUTEX_INITIALIZER, 0, NULL, NULL, NULL },
     { PTHREAD_MUTEX_INITIALIZER, 0, NULL, NULL, NULL },
     { PTHREAD_MUTEX_INITIALIZER, 0, NULL, NULL, NULL },
@@ -213,21 +217,43 @@ static bool WriteSmallFile(const char* filepath_in,
     return true;
 }
 
-static int ReadSeconds(const Controller* cntl) {
-    int seconds = DEFAULT_PROFILING_SECONDS;
-    const std::string* param =
-        cntl->http_request().uri().GetQuery("seconds");
-    if (param != NULL) {
-        char* endptr = NULL;
-        const long sec = strtol(param->c_str(), &endptr, 10);
-        if (endptr == param->c_str() + param->length()) {
-            seconds = sec;
-        } else {
-            return -1;
-        }
+// Read integer in query `key', `default_value' if the query is absent.
+// Returns -1 if the query is invalid.
+static int ReadIntQuery(const Controller* cntl, const char* key,
+                        int default_value) {
+    const std::string* param = cntl->http_request().uri().GetQuery(key);
+    if (param == NULL) {
+        return default_value;
+    }
+    char* endptr = NULL;
+    const long value = strtol(param->c_str(), &endptr, 10);
+    if (endptr != param->c_str() + param->length()) {
+        return -1;
+    }
+    return value;
+}
+
+// True if the profiler collects samples for `seconds'.
+static bool IsSampledInSeconds(ProfilingType type) {
+    return type == PROFILING_CPU || type == PROFILING_CONTENTION ||
+        type == PROFILING_OFFCPU;
+}
+
+// True if the profile is in the format of contention profiles, which can be
+// shown in number of waits(ccount) instead of time spent.
+static bool IsContentionProfile(ProfilingType type) {
+    return type == PROFILING_CONTENTION || type == PROFILING_OFFCPU;
+}
+
+static int ReadSeconds(const Controller* cntl, ProfilingType type) {
+    const int seconds =
+        ReadIntQuery(cntl, "seconds", DEFAULT_PROFILING_SECONDS);
+    if (type == PROFILING_CPU && IsContinuousCpuProfilerRunning()) {
+        // Samples are already in memory, the limit is how long they're kept.
+        return std::min(seconds, std::max(FLAGS_max_profiling_seconds,
+                                          FLAGS_cpu_profiler_continuous_seconds));
     }
-    seconds = std::min(seconds, FLAGS_max_profiling_seconds);
-    return seconds;
+    return std::min(seconds, FLAGS_max_profiling_seconds);
 }
 
 static const char* GetBaseName(const std::string* full_base_name) {
@@ -393,10 +419,12 @@ static bool has_GOOGLE_PPROF_BINARY_PATH() {
 }
 #endif
 
+// `base_prof' overrides query `base' if it's not NULL.
 static void DisplayResult(Controller* cntl,
                           google::protobuf::Closure* done,
                           const char* prof_name,
-                          const butil::IOBuf& result_prefix) {
+                          const butil::IOBuf& result_prefix,
+                          const std::string* base_prof = NULL) {
     ClosureGuard done_guard(done);
     butil::IOBuf prof_result;
     if (cntl->IsCanceled()) {
@@ -407,7 +435,10 @@ static void DisplayResult(Controller* cntl,
     butil::IOBuf& resp = cntl->response_attachment();
     const bool use_html = UseHTML(cntl->http_request());
     const bool show_ccount = cntl->http_request().uri().GetQuery("ccount");
-    const std::string* base_name = cntl->http_request().uri().GetQuery("base");
+    const std::string* base_name = base_prof;
+    if (base_name == NULL) {
+        base_name = cntl->http_request().uri().GetQuery("base");
+    }
     const std::string* display_type_query = cntl->http_request().uri().GetQuery("display_type");
     DisplayType display_type = DisplayType::kDot;
 #if defined(OS_LINUX)
@@ -600,6 +631,43 @@ static void DisplayResult(Controller* cntl,
     }
 }
 
+// Write samples of the continuous cpu profiler in the `seconds' seconds
+// ended `offset' seconds ago into `prof_name'. Returns 0 on success,
+// -1 otherwise and the reason is printed into `os'.
+static int WriteContinuousCpuProfile(const char* prof_name, int seconds,
+                                     int offset, butil::IOBufBuilder& os) {
+    const CpuProfileRing* ring = GetContinuousCpuProfile();
+    const int64_t end_us = butil::gettimeofday_us() - offset * 1000000L;
+    butil::IOBuf profile;
+    int64_t actual_begin_us = 0;
+    int64_t actual_end_us = 0;
+    const int64_t nsample = (ring == NULL ? -1 :
+        ring->DumpProfile(end_us - seconds * 1000000L, end_us, &profile,
+                          &actual_begin_us, &actual_end_us));
+    if (nsample < 0) {
+        int64_t begin_us = 0;
+        if (ring == NULL || !ring->GetTimeRange(&begin_us, &actual_end_us)) {
+            os << "No samples of the continuous cpu profiler yet, try again"
+                " after " << FLAGS_cpu_profiler_period_seconds << " seconds";
+        } else {
+            os << "No samples of the continuous cpu profiler in the range,"
+                " samples in recent "
+               << (butil::gettimeofday_us() - begin_us) / 1000000L
+               << " seconds are available";
+        }
+        return -1;
+    }
+    if (!WriteSmallFile(prof_name, profile)) {
+        os << "Fail to write " << prof_name;
+        return -1;
+    }
+    RPC_VLOG << "Wrote " << nsample << " samples in "
+             << (actual_end_us - actual_begin_us) / 1000000L << " seconds ended "
+             << (butil::gettimeofday_us() - actual_end_us) / 1000000L
+             << " seconds ago into " << prof_name;
+    return 0;
+}
+
 static void DoProfiling(ProfilingType type,
                         ::google::protobuf::RpcController* cntl_base,
                         ::google::protobuf::Closure* done) {
@@ -637,8 +705,8 @@ static void DoProfiling(ProfilingType type,
         return;
     }
 
-    const int seconds = ReadSeconds(cntl);
-    if ((type == PROFILING_CPU || type == PROFILING_CONTENTION)) {
+    const int seconds = ReadSeconds(cntl, type);
+    if (IsSampledInSeconds(type)) {
         if (seconds < 0) {
             os << "Invalid seconds" << (use_html ? "</body></html>" : "\n");
             os.move_to(cntl->response_attachment());
@@ -656,7 +724,7 @@ static void DoProfiling(ProfilingType type,
         client_info << "(no auth)";
     }
     client_info << " requests for profiling " << ProfilingType2String(type);
-    if (type == PROFILING_CPU || type == PROFILING_CONTENTION) {
+    if (IsSampledInSeconds(type)) {
         LOG(INFO) << client_info.str() << " for " << seconds << " seconds";
     } else {
         LOG(INFO) << client_info.str();
@@ -729,7 +797,41 @@ static void DoProfiling(ProfilingType type,
         return NotifyWaiters(type, cntl, view);
     }
 #endif
-    if (type == PROFILING_CPU) {
+    std::string base_prof_name;
+    if (type == PROFILING_CPU && IsContinuousCpuProfilerRunning()) {
+        const int offset = ReadIntQuery(cntl, "offset", 0);
+        const int base_offset = ReadIntQuery(cntl, "base_offset", -1);
+        if (offset < 0 || (base_offset < 0 &&
+            cntl->http_request().uri().GetQuery("base_offset") != NULL)) {
+            os << "Invalid offset or base_offset"
+               << (use_html ? "</body></html>" : "\n");
+            os.move_to(resp);
+            cntl->http_response().set_status_code(HTTP_STATUS_BAD_REQUEST);
+            return NotifyWaiters(type, cntl, view);
+        }
+        if (base_offset >= 0) {
+            // Name of the base is different from prof_name and still ends
+            // with the type to be listed.
+            base_prof_name = prof_name;
+            base_prof_name.insert(base_prof_name.size() - strlen(".cpu"),
+                                  "_base");
+            if (WriteContinuousCpuProfile(base_prof_name.c_str(), seconds,
+                                          base_offset, os) != 0) {
+                os << (use_html ? "</body></html>" : "\n");
+                os.move_to(resp);
+                cntl->http_response().set_status_code(
+                    HTTP_STATUS_SERVICE_UNAVAILABLE);
+                return NotifyWaiters(type, cntl, view);
+            }
+        }
+        if (WriteContinuousCpuProfile(prof_name, seconds, offset, os) != 0) {
+            os << (use_html ? "</body></html>" : "\n");
+            os.move_to(resp);
+            cntl->http_response().set_status_code(
+                HTTP_STATUS_SERVICE_UNAVAILABLE);
+            return NotifyWaiters(type, cntl, view);
+        }
+    } else if (type == PROFILING_CPU) {
         if ((void*)ProfilerStart == NULL || (void*)ProfilerStop == NULL) {
             os << "CPU profiler is not enabled"
                << (use_html ? "</body></html>" : "\n");
@@ -770,6 +872,18 @@ static void DoProfiling(ProfilingType type,
             PLOG(WARNING) << "Profiling has been interrupted";
         }
         bthread::ContentionProfilerStop();
+    } else if (type == PROFILING_OFFCPU) {
+        if (!bthread::ButexWaitProfilerStart(prof_name)) {
+            os << "Another profiler (not via /hotspots/offcpu) is running, "
+                "try again later" << (use_html ? "</body></html>" : "\n");
+            os.move_to(resp);
+            cntl->http_response().set_status_code(HTTP_STATUS_SERVICE_UNAVAILABLE);
+            return NotifyWaiters(type, cntl, view);
+        }
+        if (bthread_usleep(seconds * 1000000L) != 0) {
+            PLOG(WARNING) << "Profiling has been interrupted";
+        }
+        bthread::ButexWaitProfilerStop();
     } else if (type == PROFILING_HEAP) {
         MallocExtension* malloc_ext = MallocExtension::instance();
         if (malloc_ext == NULL || !has_TCMALLOC_SAMPLE_PARAMETER()) {
@@ -824,10 +938,13 @@ static void DoProfiling(ProfilingType type,
     // NOTE: Must be called before DisplayResult which calls done->Run() and
     // deletes cntl.
     ConsumeWaiters(type, cntl, &waiters);    
-    DisplayResult(cntl, done_guard.release(), prof_name, os.buf());
+    const std::string* base_prof =
+        (base_prof_name.empty() ? NULL : &base_prof_name);
+    DisplayResult(cntl, done_guard.release(), prof_name, os.buf(), base_prof);
 
     for (size_t i = 0; i < waiters.size(); ++i) {
-        DisplayResult(waiters[i].cntl, waiters[i].done, prof_name, os.buf());
+        DisplayResult(waiters[i].cntl, waiters[i].done, prof_name, os.buf(),
+                      base_prof);
     }
 }
 
@@ -843,7 +960,7 @@ static void StartProfiling(ProfilingType type,
     const char* extra_desc = "";
     if (type == PROFILING_CPU) {
         enabled = cpu_profiler_enabled;
-    } else if (type == PROFILING_CONTENTION) {
+    } else if (type == PROFILING_CONTENTION || type == PROFILING_OFFCPU) {
         enabled = true;
     } else if (type == PROFILING_HEAP) {
         enabled = IsHeapProfilerEnabled();
@@ -877,8 +994,13 @@ static void StartProfiling(ProfilingType type,
         return DoProfiling(type, cntl, done_guard.release());
     }
 
-    const int seconds = ReadSeconds(cntl);
+    const int seconds = ReadSeconds(cntl, type);
     const std::string* view = cntl->http_request().uri().GetQuery("view");
+    // Samples of the continuous cpu profiler are shown instantly.
+    const bool continuous = (type == PROFILING_CPU && view == NULL &&
+                             IsContinuousCpuProfilerRunning());
+    const int offset = ReadIntQuery(cntl, "offset", 0);
+    const int base_offset = ReadIntQuery(cntl, "base_offset", -1);
     const bool show_ccount = cntl->http_request().uri().GetQuery("ccount");
     const std::string* base_name = cntl->http_request().uri().GetQuery("base");
     const std::string* display_type_query = cntl->http_request().uri().GetQuery("display_type");
@@ -923,7 +1045,7 @@ static void StartProfiling(ProfilingType type,
         "  var past_prof = document.getElementById('view_prof').value;\n"
         "  var base_prof = document.getElementById('base_prof').value;\n"
         "  var display_type = document.getElementById('display_type').value;\n";
-    if (type == PROFILING_CONTENTION) {
+    if (IsContentionProfile(type)) {
         os << "  var show_ccount = document.getElementById('ccount_cb').checked;\n";
     }
     os << "  var targetURL = '/hotspots/" << type_str << "';\n"
@@ -934,7 +1056,7 @@ static void StartProfiling(ProfilingType type,
         "  if (base_prof != '') {\n"
         "    targetURL += '&base=' + base_prof;\n"
         "  }\n";
-    if (type == PROFILING_CONTENTION) {
+    if (IsContentionProfile(type)) {
         os <<
         "  if (show_ccount) {\n"
         "    targetURL += '&ccount';\n"
@@ -987,13 +1109,19 @@ static void StartProfiling(ProfilingType type,
         "  }\n"
         "  $.ajax({\n"
         "    url: \"/hotspots/" << type_str << "_non_responsive?console=1";
-    if (type == PROFILING_CPU || type == PROFILING_CONTENTION) {
+    if (IsSampledInSeconds(type)) {
         os << "&seconds=" << seconds;
     }
     if (profiling_client.id != 0) {
         os << "&profiling_id=" << profiling_client.id;
     }
     os << "&display_type=" << DisplayTypeToString(display_type);
+    if (continuous) {
+        os << "&offset=" << offset;
+        if (base_offset >= 0) {
+            os << "&base_offset=" << base_offset;
+        }
+    }
     if (show_ccount) {
         os << "&ccount";
     }
@@ -1082,7 +1210,7 @@ static void StartProfiling(ProfilingType type,
         "<option value=flame" << (display_type == DisplayType::kFlameGraph ? " selected" : "") << ">flame</option>"
 #endif
         "<option value=text" << (display_type == DisplayType::kText ? " selected" : "") << ">text</option></select>";
-    if (type == PROFILING_CONTENTION) {
+    if (IsContentionProfile(type)) {
         os << "&nbsp;&nbsp;&nbsp;<label for='ccount_cb'>"
             "<input id='ccount_cb' type='checkbox'"
            << (show_ccount ? " checked=''" : "") <<
@@ -1112,7 +1240,7 @@ static void StartProfiling(ProfilingType type,
         return;
     }
 
-    if ((type == PROFILING_CPU || type == PROFILING_CONTENTION) && view == NULL) {
+    if (IsSampledInSeconds(type) && view == NULL) {
         if (seconds < 0) {
             os << "Invalid seconds</body></html>";
             os.move_to(cntl->response_attachment());
@@ -1136,11 +1264,20 @@ static void StartProfiling(ProfilingType type,
                       / 1000000.0);
         os << "Your request is merged with the request from "
            << profiling_client.point;
-        if (type == PROFILING_CPU || type == PROFILING_CONTENTION) {
+        if (IsSampledInSeconds(type)) {
             os << ", showing in about " << wait_seconds << " seconds ...";
         }
     } else {
-        if ((type == PROFILING_CPU || type == PROFILING_CONTENTION) && view == NULL) {
+        if (continuous) {
+            os << "Loading samples of the continuous cpu profiler in the "
+               << seconds << " seconds ended " << offset << " seconds ago";
+            if (base_offset >= 0) {
+                os << " compared with the " << seconds << " seconds ended "
+                   << base_offset << " seconds ago";
+            }
+            os << " ...";
+        } else if (IsSampledInSeconds(type) &&
+                   view == NULL) {
             os << "Profiling " << ProfilingType2String(type) << " for "
                << seconds << " seconds ...";
         } else {
@@ -1190,6 +1327,14 @@ void HotspotsService::contention(
     return StartProfiling(PROFILING_CONTENTION, cntl_base, done);
 }
 
+void HotspotsService::offcpu(
+    ::google::protobuf::RpcController* cntl_base,
+    const ::brpc::HotspotsRequest*,
+    ::brpc::HotspotsResponse*,
+    ::google::protobuf::Closure* done) {
+    return StartProfiling(PROFILING_OFFCPU, cntl_base, done);
+}
+
 void HotspotsService::cpu_non_responsive(
     ::google::protobuf::RpcController* cntl_base,
     const ::brpc::HotspotsRequest*,
@@ -1222,6 +1367,14 @@ void HotspotsService::contention_non_responsive(
     return DoProfiling(PROFILING_CONTENTION, cntl_base, done);
 }
 
+void HotspotsService::offcpu_non_responsive(
+    ::google::protobuf::RpcController* cntl_base,
+    const ::brpc::HotspotsRequest*,
+    ::brpc::HotspotsResponse*,
+    ::google::protobuf::Closure* done) {
+    return DoProfiling(PROFILING_OFFCPU, cntl_base, done);
+}
+
 void HotspotsService::GetTabInfo(TabInfoList* info_list) const {
     TabInfo* info = info_list->add();
     info->path = "/hotspots/cpu";
@@ -1235,6 +1388,9 @@ void HotspotsService::GetTabInfo(TabInfoList* info_list) const {
     info = info_list->add();
     info->path = "/hotspots/contention";
     info->tab_name = "contention";
+    info = info_list->add();
+    info->path = "/hotspots/offcpu";
+    info->tab_name = "offcpu";
 }
 
 } // namespace brpc
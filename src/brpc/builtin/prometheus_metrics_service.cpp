@@ -24,6 +24,10 @@
 #include <vector>
 #include <iomanip>
 #include <map>
+#include <gflags/gflags.h>
+#include "butil/containers/flat_map.h"      // FlatMap
+#include "butil/string_printf.h"            // string_printf
+#include "butil/time.h"                     // gettimeofday_us
 #include "brpc/controller.h"                // Controller
 #include "brpc/server.h"                    // Server
 #include "brpc/closure_guard.h"             // ClosureGuard
@@ -67,6 +71,9 @@ public:
 private:
     DISALLOW_COPY_AND_ASSIGN(PrometheusMetricsDumper);
 
+    // Return true iff desc is printed by bvar::Histogram.
+    bool DumpHistogram(const std::string& name, const butil::StringPiece& desc);
+
     // Return true iff name ends with suffix output by LatencyHistogramRecorder.
     bool DumpLatencyHistogramRecorderSuffix(const butil::StringPiece& name,
                                    const butil::StringPiece& desc);
@@ -95,6 +102,9 @@ bool PrometheusMetricsDumper::dump(const std::string& name,
         // there is no necessary to monitor string in prometheus
         return true;
     }
+    if (DumpHistogram(name, desc)) {
+        return true;
+    }
     if (DumpLatencyHistogramRecorderSuffix(name, desc)) {
         // Has encountered name with suffix exposed by LatencyHistogramRecorder,
         // Leave it to DumpLatencyHistogramRecorderSuffix to output Summary.
@@ -106,6 +116,59 @@ bool PrometheusMetricsDumper::dump(const std::string& name,
     return true;
 }
 
+// Append lines of a histogram in text format, `labels' are in form of
+// `key1="value1",key2="value2"'.
+static void AppendHistogramText(std::string* out,
+                                const butil::StringPiece& family,
+                                const butil::StringPiece& labels,
+                                const bvar::HistogramSnapshot& s) {
+    const size_t nbucket = s.buckets().size();
+    int64_t cumulative = 0;
+    for (size_t i = 0; i < nbucket; ++i) {
+        cumulative += s.count(i);
+        out->append(family.data(), family.size()).append("_bucket{");
+        out->append(labels.data(), labels.size());
+        if (!labels.empty()) {
+            out->push_back(',');
+        }
+        if (i + 1 == nbucket) {
+            out->append("le=\"+Inf\"} ");
+        } else {
+            butil::string_appendf(out, "le=\"%" PRId64 "\"} ",
+                                  s.buckets().upper_bound(i));
+        }
+        butil::string_appendf(out, "%" PRId64 "\n", cumulative);
+    }
+    const char* const suffixes[] = { "_sum", "_count" };
+    const int64_t values[] = { s.sum(), cumulative };
+    for (size_t i = 0; i < arraysize(suffixes); ++i) {
+        out->append(family.data(), family.size()).append(suffixes[i]);
+        if (!labels.empty()) {
+            out->push_back('{');
+            out->append(labels.data(), labels.size());
+            out->push_back('}');
+        }
+        butil::string_appendf(out, " %" PRId64 "\n", values[i]);
+    }
+}
+
+bool PrometheusMetricsDumper::DumpHistogram(const std::string& name,
+                                            const butil::StringPiece& desc) {
+    if (!desc.starts_with("{count=")) {
+        return false;
+    }
+    bvar::HistogramSnapshot s;
+    if (s.parse(desc) != 0) {
+        return false;
+    }
+    std::string text;
+    text.append("# HELP ").append(name).append("\n# TYPE ").append(name)
+        .append(" histogram\n");
+    AppendHistogramText(&text, name, butil::StringPiece(), s);
+    *_os << text;
+    return true;
+}
+
 const PrometheusMetricsDumper::SummaryItems*
 PrometheusMetricsDumper::ProcessLatencyHistogramRecorderSuffix(const butil::StringPiece& name,
                                                       const butil::StringPiece& desc) {
@@ -190,17 +253,57 @@ bool PrometheusMetricsDumper::DumpLatencyHistogramRecorderSuffix(
     return true;
 }
 
+// Query parameters and header of the cached exposition.
+static const char* const FORMAT_STR = "format";
+static const char* const CHANGED_SINCE_STR = "changed_since";
+static const char* const DUMP_ID_HEADER = "x-bvar-dump-id";
+
 void PrometheusMetricsService::default_method(::google::protobuf::RpcController* cntl_base,
                                               const ::brpc::MetricsRequest*,
                                               ::brpc::MetricsResponse*,
                                               ::google::protobuf::Closure* done) {
     ClosureGuard done_guard(done);
     Controller *cntl = static_cast<Controller*>(cntl_base);
-    cntl->http_response().set_content_type("text/plain");
-    if (DumpPrometheusMetricsToIOBuf(&cntl->response_attachment()) != 0) {
+    const std::string* format_str =
+        cntl->http_request().uri().GetQuery(FORMAT_STR);
+    const std::string* changed_since_str =
+        cntl->http_request().uri().GetQuery(CHANGED_SINCE_STR);
+    if (format_str == NULL && changed_since_str == NULL) {
+        cntl->http_response().set_content_type("text/plain");
+        if (DumpPrometheusMetricsToIOBuf(&cntl->response_attachment()) != 0) {
+            cntl->SetFailed("Fail to dump metrics");
+            return;
+        }
+        return;
+    }
+    MetricsFormat format = METRICS_FORMAT_OPENMETRICS;
+    if (format_str == NULL || *format_str == "openmetrics") {
+        format = METRICS_FORMAT_OPENMETRICS;
+    } else if (*format_str == "protobuf") {
+        format = METRICS_FORMAT_PROTOBUF;
+    } else {
+        cntl->SetFailed(EREQUEST, "Unknown format=%s", format_str->c_str());
+        return;
+    }
+    uint64_t changed_since = 0;
+    if (changed_since_str != NULL) {
+        char* endptr = NULL;
+        changed_since = strtoull(changed_since_str->c_str(), &endptr, 10);
+        if (*endptr != '\0') {
+            cntl->SetFailed(EREQUEST, "Invalid %s=%s", CHANGED_SINCE_STR,
+                            changed_since_str->c_str());
+            return;
+        }
+    }
+    uint64_t dump_id = 0;
+    if (DumpMetricsToIOBuf(&cntl->response_attachment(), format,
+                           changed_since, &dump_id) != 0) {
         cntl->SetFailed("Fail to dump metrics");
         return;
     }
+    cntl->http_response().set_content_type(MetricsContentType(format));
+    cntl->http_response().SetHeader(DUMP_ID_HEADER,
+                                    butil::string_printf("%" PRIu64, dump_id));
 }
 
 int DumpPrometheusMetricsToIOBuf(butil::IOBuf* output) {
@@ -223,4 +326,410 @@ int DumpPrometheusMetricsToIOBuf(butil::IOBuf* output) {
     return 0;
 }
 
+// ============= Cached exposition ==============
+
+// Append `value' in base 128 varint of protobuf.
+static void AppendVarint(std::string* out, uint64_t value) {
+    while (value >= 0x80) {
+        out->push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back((char)value);
+}
+
+static void AppendLengthDelimited(std::string* out, int field,
+                                  const butil::StringPiece& data) {
+    AppendVarint(out, (field << 3) | 2);
+    AppendVarint(out, data.size());
+    out->append(data.data(), data.size());
+}
+
+static void AppendDouble(std::string* out, double value) {
+    // Doubles are little-endian in protobuf.
+    out->append((const char*)&value, sizeof(value));
+}
+
+// Append the Metric field of MetricFamily with a classic histogram.
+// `labels' are encoded label fields of Metric.
+static void AppendHistogramProto(std::string* out, const std::string& labels,
+                                 const bvar::HistogramSnapshot& s) {
+    std::string histogram;
+    std::string bucket;
+    // Buckets except the last one, whose upper bound is +Inf.
+    const size_t nbucket = s.buckets().size() - 1;
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < nbucket; ++i) {
+        cumulative += s.count(i);
+        bucket.clear();
+        // cumulative_count = 1, upper_bound = 2
+        AppendVarint(&bucket, (1 << 3) | 0);
+        AppendVarint(&bucket, cumulative);
+        AppendVarint(&bucket, (2 << 3) | 1);
+        AppendDouble(&bucket, (double)s.buckets().upper_bound(i));
+        AppendLengthDelimited(&histogram, 3, bucket);
+    }
+    std::string metric = labels;
+    // sample_count = 1, sample_sum = 2, bucket = 3
+    std::string head;
+    AppendVarint(&head, (1 << 3) | 0);
+    AppendVarint(&head, cumulative + s.count(nbucket));
+    AppendVarint(&head, (2 << 3) | 1);
+    AppendDouble(&head, (double)s.sum());
+    AppendLengthDelimited(&metric, 7, head + histogram);
+    AppendLengthDelimited(out, 4, metric);
+}
+
+// Parse `name{key1="value1",key2="value2"}' made by MultiDimension.
+// Returns 0 on success, -1 otherwise.
+static int ParseSeriesName(
+    const std::string& series, butil::StringPiece* family,
+    std::vector<std::pair<butil::StringPiece, butil::StringPiece> >* labels) {
+    labels->clear();
+    const size_t brace = series.find('{');
+    if (brace == std::string::npos) {
+        *family = series;
+        return family->empty() ? -1 : 0;
+    }
+    *family = butil::StringPiece(series.data(), brace);
+    if (family->empty() || series[series.size() - 1] != '}') {
+        return -1;
+    }
+    size_t pos = brace + 1;
+    const size_t end = series.size() - 1;
+    while (pos < end) {
+        const size_t eq = series.find('=', pos);
+        if (eq == std::string::npos || eq + 1 >= end || series[eq + 1] != '"') {
+            return -1;
+        }
+        // Label values are not escaped, a value ends with `",' or `"}'.
+        size_t quote = eq + 1;
+        do {
+            quote = series.find('"', quote + 1);
+            if (quote == std::string::npos || quote > end - 1) {
+                return -1;
+            }
+        } while (quote + 1 != end && series[quote + 1] != ',');
+        labels->push_back(std::make_pair(
+            butil::StringPiece(series.data() + pos, eq - pos),
+            butil::StringPiece(series.data() + eq + 2, quote - eq - 2)));
+        pos = quote + 2;
+    }
+    return 0;
+}
+
+struct MetricFamilyCache;
+
+struct MetricSeriesCache {
+    MetricFamilyCache* family;
+    // `name{labels} ' of OpenMetrics. For histograms, the labels only.
+    std::string text_prefix;
+    // The Metric field of MetricFamily without value of the gauge, which
+    // is always 8 bytes. For histograms, the label fields only.
+    std::string pb_prefix;
+    // Encoded histogram in last dump.
+    std::string histogram_text;
+    std::string histogram_pb;
+    // Description of the variable in last dump.
+    std::string value_str;
+    double value;
+    uint64_t changed_dump_id;
+    uint64_t seen_dump_id;
+};
+
+struct MetricFamilyCache {
+    std::string name;
+    bool histogram;
+    // `# TYPE name gauge' of OpenMetrics.
+    std::string text_header;
+    // Name and type fields of MetricFamily.
+    std::string pb_header;
+    // Number of MetricSeriesCache pointing to this family.
+    size_t nseries;
+    // Series to be written in current dump.
+    std::vector<const MetricSeriesCache*> pending;
+};
+
+// Dumps variables with encoded names and labels cached. Not thread-safe.
+class CachedMetricsDumper : public bvar::Dumper {
+public:
+    CachedMetricsDumper();
+    ~CachedMetricsDumper();
+
+    int Dump(butil::IOBuf* output, MetricsFormat format,
+             uint64_t changed_since, uint64_t* dump_id);
+
+    bool dump(const std::string& name, const butil::StringPiece& desc) override;
+
+private:
+    MetricSeriesCache* NewSeries(const std::string& name, bool histogram);
+    void Flush(butil::IOBufAppender* out, MetricsFormat format);
+    void RemoveUnseenSeries(size_t nseen);
+
+    typedef butil::FlatMap<std::string, MetricSeriesCache*> SeriesMap;
+    typedef butil::FlatMap<std::string, MetricFamilyCache*> FamilyMap;
+    SeriesMap _series;
+    FamilyMap _families;
+    uint64_t _last_dump_id;
+    // States of current dump.
+    uint64_t _dump_id;
+    uint64_t _changed_since;
+    size_t _nseen;
+    std::vector<MetricFamilyCache*> _pending_families;
+    std::vector<std::pair<butil::StringPiece, butil::StringPiece> > _labels;
+};
+
+CachedMetricsDumper::CachedMetricsDumper()
+    : _last_dump_id(0)
+    , _dump_id(0)
+    , _changed_since(0)
+    , _nseen(0) {
+    CHECK_EQ(0, _series.init(1024, 80));
+    CHECK_EQ(0, _families.init(1024, 80));
+}
+
+CachedMetricsDumper::~CachedMetricsDumper() {
+    for (SeriesMap::iterator it = _series.begin(); it != _series.end(); ++it) {
+        delete it->second;
+    }
+    for (FamilyMap::iterator it = _families.begin(); it != _families.end(); ++it) {
+        delete it->second;
+    }
+}
+
+MetricSeriesCache* CachedMetricsDumper::NewSeries(const std::string& name,
+                                                  bool histogram) {
+    butil::StringPiece family_name;
+    if (ParseSeriesName(name, &family_name, &_labels) != 0) {
+        return NULL;
+    }
+    const std::string family_str = family_name.as_string();
+    MetricFamilyCache** pfamily = _families.seek(family_str);
+    MetricFamilyCache* family = NULL;
+    if (pfamily != NULL) {
+        family = *pfamily;
+        if (family->histogram != histogram) {
+            return NULL;
+        }
+    } else {
+        family = new MetricFamilyCache;
+        family->name = family_str;
+        family->histogram = histogram;
+        family->nseries = 0;
+        family->text_header.append("# TYPE ").append(family_str)
+            .append(histogram ? " histogram\n" : " gauge\n");
+        AppendLengthDelimited(&family->pb_header, 1, family_str);
+        // type = HISTOGRAM or GAUGE
+        AppendVarint(&family->pb_header, (3 << 3) | 0);
+        AppendVarint(&family->pb_header, histogram ? 4 : 1);
+        _families[family_str] = family;
+    }
+    MetricSeriesCache* s = new MetricSeriesCache;
+    s->family = family;
+    ++family->nseries;
+    std::string metric;
+    std::string label_pair;
+    for (size_t i = 0; i < _labels.size(); ++i) {
+        label_pair.clear();
+        AppendLengthDelimited(&label_pair, 1, _labels[i].first);
+        AppendLengthDelimited(&label_pair, 2, _labels[i].second);
+        AppendLengthDelimited(&metric, 1, label_pair);
+    }
+    if (histogram) {
+        const size_t brace = name.find('{');
+        if (brace != std::string::npos) {
+            s->text_prefix.assign(name, brace + 1, name.size() - brace - 2);
+        }
+        s->pb_prefix.swap(metric);
+    } else {
+        s->text_prefix.reserve(name.size() + 1);
+        s->text_prefix.append(name).push_back(' ');
+        // gauge = { value = <8 bytes double> }
+        metric.append("\x12\x09\x09", 3);
+        AppendVarint(&s->pb_prefix, (4 << 3) | 2);
+        AppendVarint(&s->pb_prefix, metric.size() + sizeof(double));
+        s->pb_prefix.append(metric);
+    }
+    s->value = 0;
+    s->changed_dump_id = 0;
+    s->seen_dump_id = 0;
+    _series[name] = s;
+    return s;
+}
+
+bool CachedMetricsDumper::dump(const std::string& name,
+                               const butil::StringPiece& desc) {
+    // Only numbers and histograms are dumped. Strings are quoted and
+    // vectors are surrounded by brackets.
+    char buf[64];
+    const bool histogram = desc.starts_with("{count=");
+    if (!histogram && (desc.empty() || desc.size() >= sizeof(buf) ||
+                       desc[0] == '"' || desc[0] == '[')) {
+        return true;
+    }
+    MetricSeriesCache** ps = _series.seek(name);
+    MetricSeriesCache* s = (ps ? *ps : NewSeries(name, histogram));
+    if (s == NULL || s->seen_dump_id == _dump_id ||
+        s->family->histogram != histogram) {
+        return true;
+    }
+    if (histogram) {
+        if (desc != s->value_str) {
+            bvar::HistogramSnapshot snapshot;
+            if (snapshot.parse(desc) != 0) {
+                return true;
+            }
+            s->histogram_text.clear();
+            AppendHistogramText(&s->histogram_text, s->family->name,
+                                s->text_prefix, snapshot);
+            s->histogram_pb.clear();
+            AppendHistogramProto(&s->histogram_pb, s->pb_prefix, snapshot);
+            s->value_str.assign(desc.data(), desc.size());
+            s->changed_dump_id = _dump_id;
+        }
+    } else if (desc != s->value_str) {
+        memcpy(buf, desc.data(), desc.size());
+        buf[desc.size()] = '\0';
+        char* endptr = NULL;
+        const double value = strtod(buf, &endptr);
+        if (endptr != buf + desc.size()) {
+            return true;
+        }
+        s->value = value;
+        s->value_str.assign(desc.data(), desc.size());
+        s->changed_dump_id = _dump_id;
+    }
+    s->seen_dump_id = _dump_id;
+    ++_nseen;
+    if (_changed_since != 0 && s->changed_dump_id <= _changed_since) {
+        return true;
+    }
+    MetricFamilyCache* family = s->family;
+    if (family->pending.empty()) {
+        _pending_families.push_back(family);
+    }
+    family->pending.push_back(s);
+    return true;
+}
+
+void CachedMetricsDumper::Flush(butil::IOBufAppender* out,
+                                MetricsFormat format) {
+    std::string len;
+    for (size_t i = 0; i < _pending_families.size(); ++i) {
+        MetricFamilyCache* family = _pending_families[i];
+        if (format == METRICS_FORMAT_OPENMETRICS) {
+            out->append(family->text_header);
+            for (size_t j = 0; j < family->pending.size(); ++j) {
+                const MetricSeriesCache* s = family->pending[j];
+                if (family->histogram) {
+                    out->append(s->histogram_text);
+                    continue;
+                }
+                out->append(s->text_prefix);
+                out->append(s->value_str);
+                out->push_back('\n');
+            }
+        } else {
+            size_t size = family->pb_header.size();
+            for (size_t j = 0; j < family->pending.size(); ++j) {
+                const MetricSeriesCache* s = family->pending[j];
+                size += (family->histogram ? s->histogram_pb.size() :
+                         s->pb_prefix.size() + sizeof(double));
+            }
+            len.clear();
+            AppendVarint(&len, size);
+            out->append(len);
+            out->append(family->pb_header);
+            for (size_t j = 0; j < family->pending.size(); ++j) {
+                const MetricSeriesCache* s = family->pending[j];
+                if (family->histogram) {
+                    out->append(s->histogram_pb);
+                    continue;
+                }
+                out->append(s->pb_prefix);
+                // Doubles are little-endian in protobuf.
+                out->append(&s->value, sizeof(double));
+            }
+        }
+        family->pending.clear();
+    }
+    _pending_families.clear();
+    if (format == METRICS_FORMAT_OPENMETRICS) {
+        out->append("# EOF\n");
+    }
+}
+
+void CachedMetricsDumper::RemoveUnseenSeries(size_t nseen) {
+    if (_series.size() <= nseen) {
+        return;
+    }
+    std::vector<std::string> unseen;
+    for (SeriesMap::iterator it = _series.begin(); it != _series.end(); ++it) {
+        if (it->second->seen_dump_id != _dump_id) {
+            unseen.push_back(it->first);
+        }
+    }
+    for (size_t i = 0; i < unseen.size(); ++i) {
+        MetricSeriesCache* s = _series[unseen[i]];
+        _series.erase(unseen[i]);
+        if (--s->family->nseries == 0) {
+            // Family names are prefixes of series names.
+            butil::StringPiece family_name;
+            if (ParseSeriesName(unseen[i], &family_name, &_labels) == 0) {
+                _families.erase(family_name.as_string());
+            }
+            delete s->family;
+        }
+        delete s;
+    }
+}
+
+int CachedMetricsDumper::Dump(butil::IOBuf* output, MetricsFormat format,
+                              uint64_t changed_since, uint64_t* dump_id) {
+    // Identifiers are timestamps so that they're still increasing after
+    // restarting of the process, and `changed_since' got from the previous
+    // process makes everything dumped.
+    _dump_id = std::max(_last_dump_id + 1, (uint64_t)butil::gettimeofday_us());
+    _last_dump_id = _dump_id;
+    _changed_since = changed_since;
+    _nseen = 0;
+    if (bvar::Variable::dump_exposed_unsorted(
+            this, bvar::DISPLAY_ON_PLAIN_TEXT) < 0) {
+        return -1;
+    }
+    if (bvar::FLAGS_bvar_max_dump_multi_dimension_metric_number > 0) {
+        const int ndump_md = bvar::MVariable::dump_exposed(this, NULL);
+        if (ndump_md < 0) {
+            return -1;
+        }
+    }
+    butil::IOBufAppender out;
+    Flush(&out, format);
+    out.move_to(*output);
+    RemoveUnseenSeries(_nseen);
+    if (dump_id) {
+        *dump_id = _dump_id;
+    }
+    return 0;
+}
+
+const char* MetricsContentType(MetricsFormat format) {
+    if (format == METRICS_FORMAT_PROTOBUF) {
+        return "application/vnd.google.protobuf; "
+            "proto=io.prometheus.client.MetricFamily; encoding=delimited";
+    }
+    return "application/openmetrics-text; version=1.0.0; charset=utf-8";
+}
+
+static pthread_mutex_t s_cached_dumper_mutex = PTHREAD_MUTEX_INITIALIZER;
+static CachedMetricsDumper* s_cached_dumper = NULL;
+
+int DumpMetricsToIOBuf(butil::IOBuf* output, MetricsFormat format,
+                       uint64_t changed_since, uint64_t* dump_id) {
+    BAIDU_SCOPED_LOCK(s_cached_dumper_mutex);
+    if (s_cached_dumper == NULL) {
+        s_cached_dumper = new CachedMetricsDumper;
+    }
+    return s_cached_dumper->Dump(output, format, changed_since, dump_id);
+}
+
 } // namespace brpc
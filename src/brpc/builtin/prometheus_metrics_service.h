@@ -33,6 +33,28 @@ public:
 
 int DumpPrometheusMetricsToIOBuf(butil::IOBuf* output);
 
+enum MetricsFormat {
+    // OpenMetrics text format.
+    METRICS_FORMAT_OPENMETRICS = 1,
+    // Protobuf format of prometheus: length-delimited
+    // io.prometheus.client.MetricFamily.
+    METRICS_FORMAT_PROTOBUF = 2,
+};
+
+// Content-Type of responses in `format'.
+const char* MetricsContentType(MetricsFormat format);
+
+// Dump numeric bvars and mbvars as gauges into `output' in `format'.
+// Encoded names and labels of series are cached across calls, so that only
+// values are written for series seen before.
+// If `changed_since' is not 0, only series whose values changed after the
+// dump identified by `changed_since' are written.
+// Identifier of this dump is stored into `dump_id' if it's not NULL, which
+// can be used as `changed_since' of later calls.
+// Returns 0 on success, -1 otherwise.
+int DumpMetricsToIOBuf(butil::IOBuf* output, MetricsFormat format,
+                       uint64_t changed_since, uint64_t* dump_id);
+
 } // namepace brpc
 
 #endif  // BRPC_PROMETHEUS_METRICS_SERVICE_H
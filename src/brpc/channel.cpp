@@ -29,6 +29,7 @@
 #include "brpc/global.h"
 #include "brpc/span.h"
 #include "brpc/details/load_balancer_with_naming.h"
+#include "brpc/details/channel_limiter.h"
 #include "brpc/controller.h"
 #include "brpc/channel.h"
 #include "brpc/details/usercode_backup_pool.h"       // TooManyUserCode
@@ -54,6 +55,9 @@ ChannelOptions::ChannelOptions()
     , auth(NULL)
     , retry_policy(NULL)
     , ns_filter(NULL)
+    , subset_size(0)
+    , grow_subset_on_unhealthy(false)
+    , max_qps(0)
 {}
 
 ChannelSSLOptions* ChannelOptions::mutable_ssl_options() {
@@ -230,6 +234,20 @@ int Channel::InitChannelOptions(const ChannelOptions* options) {
     if (!cg.empty() && (::isspace(cg.front()) || ::isspace(cg.back()))) {
         butil::TrimWhitespace(cg, butil::TRIM_ALL, &cg);
     }
+
+    if (_options.max_concurrency.type() != AdaptiveMaxConcurrency::UNLIMITED() ||
+        _options.max_qps > 0) {
+        ChannelLimiter* limiter = new (std::nothrow) ChannelLimiter;
+        if (NULL == limiter) {
+            LOG(FATAL) << "Fail to new ChannelLimiter";
+            return -1;
+        }
+        _limiter.reset(limiter);
+        if (limiter->Init(_options.max_concurrency, _options.max_qps) != 0) {
+            _limiter.reset();
+            return -1;
+        }
+    }
     return 0;
 }
 
@@ -385,7 +403,11 @@ int Channel::Init(const char* ns_url,
     if (CreateSocketSSLContext(_options, &ns_opt.ssl_ctx) != 0) {
         return -1;
     }
-    if (lb->Init(ns_url, lb_name, _options.ns_filter, &ns_opt) != 0) {
+    SubsetOptions subset_opt;
+    subset_opt.subset_size = std::max(_options.subset_size, 0);
+    subset_opt.grow_on_unhealthy = _options.grow_subset_on_unhealthy;
+    if (lb->Init(ns_url, lb_name, _options.ns_filter, &ns_opt,
+                 &subset_opt) != 0) {
         LOG(ERROR) << "Fail to initialize LoadBalancerWithNaming";
         delete lb;
         return -1;
@@ -510,6 +532,7 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
 
     // Share the lb with controller.
     cntl->_lb = _lb;
+    cntl->_limiter = _limiter;
 
     // Ensure that serialize_request is done before pack_request in all
     // possible executions, including:
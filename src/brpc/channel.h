@@ -30,6 +30,7 @@
 #include "brpc/channel_base.h"              // ChannelBase
 #include "brpc/adaptive_protocol_type.h"    // AdaptiveProtocolType
 #include "brpc/adaptive_connection_type.h"  // AdaptiveConnectionType
+#include "brpc/adaptive_max_concurrency.h"  // AdaptiveMaxConcurrency
 #include "brpc/socket_id.h"                 // SocketId
 #include "brpc/controller.h"                // brpc::Controller
 #include "brpc/details/profiler_linker.h"
@@ -127,12 +128,43 @@ struct ChannelOptions {
     // Default: NULL
     const NamingServiceFilter* ns_filter;
 
+    // Add at most so many servers from the NamingService into the load
+    // balancer, which are chosen by rendezvous hashing with a per-process
+    // key(-subset_client_id), so that each server is connected by a fraction
+    // of clients in large clusters. Servers added to or removed from the
+    // NamingService change the subset minimally. Only for Channels with
+    // NamingService. 0 means all servers.
+    // Default: 0
+    int subset_size;
+
+    // Keep subset_size healthy servers in the subset by adding next servers
+    // in the order of rendezvous hashing when some servers in the subset are
+    // unhealthy, which is checked every -subset_refresh_interval_ms.
+    // Default: false
+    bool grow_subset_on_unhealthy;
+
     // Channels with same connection_group share connections.
     // In other words, set to a different value to stop sharing connections.
     // Case-sensitive, leading and trailing spaces are ignored.
     // Default: ""
     std::string connection_group;
 
+    // Max number of inflight calls over this Channel, retries and backup
+    // requests are counted as well. Calls exceeding the limit fail with
+    // ELIMIT immediately instead of piling onto overloaded servers.
+    // Set to "auto" to adjust the limit according to latencies of calls
+    // with the algorithm of the server-side "auto" limiter, or a number for
+    // a constant limit.
+    // Default: "unlimited"
+    AdaptiveMaxConcurrency max_concurrency;
+
+    // Max number of calls(including retries and backup requests) sent per
+    // second over this Channel, limited by a token bucket which allows
+    // bursts of requests in 100ms. Calls exceeding the limit fail with
+    // ELIMIT immediately. <=0 means unlimited.
+    // Default: 0
+    int max_qps;
+
 private:
     // SSLOptions is large and not often used, allocate it on heap to
     // prevent ChannelOptions from being bloated in most cases.
@@ -232,6 +264,9 @@ protected:
     // It will be destroyed after channel's destruction and all
     // the RPC above has finished
     butil::intrusive_ptr<SharedLoadBalancer> _lb;
+    // Shared with controllers in the same way as _lb. NULL when calls are
+    // not limited.
+    butil::intrusive_ptr<ChannelLimiter> _limiter;
     ChannelOptions _options;
     int _preferred_index;
 };
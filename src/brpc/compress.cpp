@@ -24,7 +24,7 @@
 namespace brpc {
 
 static const int MAX_HANDLER_SIZE = 1024;
-static CompressHandler s_handler_map[MAX_HANDLER_SIZE] = { { NULL, NULL, NULL } };
+static CompressHandler s_handler_map[MAX_HANDLER_SIZE] = { { NULL, NULL, NULL, NULL, NULL } };
 
 int RegisterCompressHandler(CompressType type, 
                             CompressHandler handler) {
@@ -86,6 +86,7 @@ bool ParseFromCompressedData(const butil::IOBuf& data,
     if (NULL != handler) {
         return handler->Decompress(data, msg);
     }
+    LOG_EVERY_SECOND(ERROR) << "Unregistered CompressType=" << compress_type;
     return false;
 }
 
@@ -99,7 +100,123 @@ bool SerializeAsCompressedData(const google::protobuf::Message& msg,
     if (NULL != handler) {
         return handler->Compress(msg, buf);
     }
+    LOG_EVERY_SECOND(ERROR) << "Unregistered CompressType=" << compress_type;
     return false;
 }
 
+StreamingCompressor* NewStreamingCompressor(
+    CompressType compress_type, const google::protobuf::Descriptor* type) {
+    const CompressHandler* handler = FindCompressHandler(compress_type);
+    if (handler == NULL || handler->NewCompressor == NULL) {
+        return NULL;
+    }
+    return handler->NewCompressor(type);
+}
+
+StreamingDecompressor* NewStreamingDecompressor(CompressType compress_type) {
+    const CompressHandler* handler = FindCompressHandler(compress_type);
+    if (handler == NULL || handler->NewDecompressor == NULL) {
+        return NULL;
+    }
+    return handler->NewDecompressor();
+}
+
+bool StreamingCompress(StreamingCompressor* c, const butil::IOBuf& in,
+                       butil::IOBuf* out) {
+    butil::IOBufAppender appender;
+    const size_t nblock = in.backing_block_num();
+    for (size_t i = 0; i < nblock; ++i) {
+        const butil::StringPiece block = in.backing_block(i);
+        if (!c->Update(block.data(), block.size(), &appender)) {
+            return false;
+        }
+    }
+    if (!c->Finish(&appender)) {
+        return false;
+    }
+    out->append(butil::IOBuf::Movable(appender.buf()));
+    return true;
+}
+
+bool StreamingDecompress(StreamingDecompressor* d, const butil::IOBuf& in,
+                         butil::IOBuf* out) {
+    butil::IOBufAppender appender;
+    const size_t nblock = in.backing_block_num();
+    for (size_t i = 0; i < nblock; ++i) {
+        const butil::StringPiece block = in.backing_block(i);
+        if (!d->Update(block.data(), block.size(), &appender)) {
+            return false;
+        }
+    }
+    if (!d->Finish(&appender)) {
+        return false;
+    }
+    out->append(butil::IOBuf::Movable(appender.buf()));
+    return true;
+}
+
+// Serialized data is compressed once this many bytes are buffered.
+static const size_t COMPRESS_BATCH_SIZE = 64 * 1024;
+
+// Serialize messages into blocks which are handed to a StreamingCompressor
+// and recycled once enough of them are filled.
+class CompressingOutputStream : public google::protobuf::io::ZeroCopyOutputStream {
+public:
+    CompressingOutputStream(StreamingCompressor* c, butil::IOBufAppender* out)
+        : _c(c), _out(out), _stream(&_buf) {}
+
+    bool Next(void** data, int* size) override {
+        // Calling Next() means that the previous buffer was fully written.
+        if (_buf.size() >= COMPRESS_BATCH_SIZE && !Flush()) {
+            return false;
+        }
+        return _stream.Next(data, size);
+    }
+
+    void BackUp(int count) override { _stream.BackUp(count); }
+
+    google::protobuf::int64 ByteCount() const override {
+        return _stream.ByteCount();
+    }
+
+    bool Flush() {
+        const size_t nblock = _buf.backing_block_num();
+        for (size_t i = 0; i < nblock; ++i) {
+            const butil::StringPiece block = _buf.backing_block(i);
+            if (!_c->Update(block.data(), block.size(), _out)) {
+                return false;
+            }
+        }
+        _buf.clear();
+        return true;
+    }
+
+private:
+    StreamingCompressor* _c;
+    butil::IOBufAppender* _out;
+    butil::IOBuf _buf;
+    butil::IOBufAsZeroCopyOutputStream _stream;
+};
+
+bool StreamingCompress(StreamingCompressor* c,
+                       const google::protobuf::Message& msg,
+                       butil::IOBuf* out) {
+    butil::IOBufAppender appender;
+    {
+        CompressingOutputStream stream(c, &appender);
+        if (!msg.SerializeToZeroCopyStream(&stream)) {
+            LOG(WARNING) << "Fail to serialize input pb=" << &msg;
+            return false;
+        }
+        if (!stream.Flush()) {
+            return false;
+        }
+    }
+    if (!c->Finish(&appender)) {
+        return false;
+    }
+    out->append(butil::IOBuf::Movable(appender.buf()));
+    return true;
+}
+
 } // namespace brpc
@@ -21,10 +21,47 @@
 
 #include <google/protobuf/message.h>              // Message
 #include "butil/iobuf.h"                           // butil::IOBuf
+#include "butil/strings/string_piece.h"            // butil::StringPiece
 #include "brpc/options.pb.h"                     // CompressType
 
 namespace brpc {
 
+// Compress data piece by piece, e.g. a large attachment being generated,
+// so that memory used by compression is bounded by the compressor rather
+// than growing with the input. Compressed data is written into blocks of
+// the output IOBuf directly. Not thread-safe.
+class StreamingCompressor {
+public:
+    virtual ~StreamingCompressor() {}
+
+    // Compress `n' bytes starting from `data'. Compressed data, if any, is
+    // appended to `out'.
+    // Returns true on success, false otherwise
+    virtual bool Update(const void* data, size_t n,
+                        butil::IOBufAppender* out) = 0;
+
+    // Flush data buffered inside and end the stream. The compressor should
+    // not be used anymore after calling this function.
+    // Returns true on success, false otherwise
+    virtual bool Finish(butil::IOBufAppender* out) = 0;
+};
+
+// Decompress data compressed by StreamingCompressor piece by piece.
+// Not thread-safe.
+class StreamingDecompressor {
+public:
+    virtual ~StreamingDecompressor() {}
+
+    // Decompress `n' bytes starting from `data'. Decompressed data, if any,
+    // is appended to `out'.
+    // Returns true on success, false otherwise
+    virtual bool Update(const void* data, size_t n,
+                        butil::IOBufAppender* out) = 0;
+
+    // Returns false if the compressed data fed is truncated.
+    virtual bool Finish(butil::IOBufAppender* out) = 0;
+};
+
 struct CompressHandler {
     // Compress serialized `msg' into `buf'.
     // Returns true on success, false otherwise
@@ -36,12 +73,32 @@ struct CompressHandler {
 
     // Name of the compression algorithm, must be string constant.
     const char* name;
+
+    // [Optional] Create a StreamingCompressor for messages of `type' (NULL
+    // when compressing arbitrary data), which is deleted by the caller.
+    // Returns NULL on error.
+    StreamingCompressor* (*NewCompressor)(const google::protobuf::Descriptor* type);
+
+    // [Optional] Create a StreamingDecompressor which is deleted by the
+    // caller. Returns NULL on error.
+    StreamingDecompressor* (*NewDecompressor)();
 };
 
 // [NOT thread-safe] Register `handler' using key=`type'
 // Returns 0 on success, -1 otherwise
 int RegisterCompressHandler(CompressType type, CompressHandler handler);
 
+// [NOT thread-safe] Compress messages of all methods of `service' with
+// COMPRESS_TYPE_ZSTD using the pre-trained dictionary `dict'(e.g. by
+// `zstd --train' on samples of serialized messages), which works for all
+// protocols supporting zstd, on both client and server sides. Receivers
+// find the dictionary by the id stored in each compressed frame, so peers
+// must register the same dictionary. Call before starting servers and
+// channels.
+// Returns 0 on success, -1 otherwise (including brpc not built with zstd).
+int RegisterZstdDictionary(const google::protobuf::ServiceDescriptor* service,
+                           const butil::StringPiece& dict);
+
 // Returns the `name' of the CompressType if registered
 const char* CompressTypeToCStr(CompressType type);
 
@@ -60,6 +117,30 @@ bool SerializeAsCompressedData(const google::protobuf::Message& msg,
                                butil::IOBuf* buf,
                                CompressType compress_type);
 
+// Create a StreamingCompressor/StreamingDecompressor of registered
+// `compress_type', NULL if the type does not support streaming(e.g.
+// COMPRESS_TYPE_SNAPPY whose format starts with the uncompressed size).
+// `type' is type of messages to be compressed, NULL for arbitrary data.
+StreamingCompressor* NewStreamingCompressor(
+    CompressType compress_type,
+    const google::protobuf::Descriptor* type = NULL);
+StreamingDecompressor* NewStreamingDecompressor(CompressType compress_type);
+
+// Compress/Decompress all blocks of `in' in place with `c'/`d' and finish
+// it, the output is appended to `out'.
+// Returns true on success, false otherwise
+bool StreamingCompress(StreamingCompressor* c, const butil::IOBuf& in,
+                       butil::IOBuf* out);
+bool StreamingDecompress(StreamingDecompressor* d, const butil::IOBuf& in,
+                         butil::IOBuf* out);
+
+// Serialize `msg' into `c' and finish it. Serialized data is compressed
+// every a few blocks, the full serialized `msg' is never held.
+// Returns true on success, false otherwise
+bool StreamingCompress(StreamingCompressor* c,
+                       const google::protobuf::Message& msg,
+                       butil::IOBuf* out);
+
 } // namespace brpc
 
 
@@ -39,6 +39,7 @@
 #include "brpc/load_balancer.h"
 #include "brpc/closure_guard.h"
 #include "brpc/details/controller_private_accessor.h"
+#include "brpc/details/channel_limiter.h"
 #include "brpc/controller.h"
 #include "brpc/span.h"
 #include "brpc/server.h"   // Server::_session_local_data_pool
@@ -202,6 +203,7 @@ void Controller::ResetNonPods() {
     }
     delete _sender;
     _lb.reset(NULL);
+    _limiter.reset(NULL);
     _current_call.Reset();
     ExcludedServers::Destroy(_accessed);
     _request_buf.clear();
@@ -257,6 +259,9 @@ void Controller::ResetPods() {
     _timeout_id = 0;
     _begin_time_us = 0;
     _end_time_us = 0;
+    _start_parse_us = 0;
+    _end_parse_us = 0;
+    _start_callback_us = 0;
     _tos = 0;
     _preferred_index = -1;
     _request_compress_type = COMPRESS_TYPE_NONE;
@@ -290,6 +295,7 @@ Controller::Call::Call(Controller::Call* rhs)
     : nretry(rhs->nretry)
     , need_feedback(rhs->need_feedback)
     , enable_circuit_breaker(rhs->enable_circuit_breaker)
+    , counted_by_limiter(rhs->counted_by_limiter)
     , peer_id(rhs->peer_id)
     , begin_time_us(rhs->begin_time_us)
     , sending_sock(rhs->sending_sock.release())
@@ -298,6 +304,7 @@ Controller::Call::Call(Controller::Call* rhs)
     // setting all the fields to next call and _current_call.OnComplete
     // will behave incorrectly.
     rhs->need_feedback = false;
+    rhs->counted_by_limiter = false;
     rhs->peer_id = INVALID_SOCKET_ID;
     rhs->stream_user_data = NULL;
 }
@@ -310,6 +317,7 @@ void Controller::Call::Reset() {
     nretry = 0;
     need_feedback = false;
     enable_circuit_breaker = false;
+    counted_by_limiter = false;
     peer_id = INVALID_SOCKET_ID;
     begin_time_us = 0;
     sending_sock.reset(NULL);
@@ -596,7 +604,8 @@ void Controller::OnVersionedRPCReturned(const CompletionInfo& info,
     }
 
     if ((!_error_code && _retry_policy == NULL) ||
-        _current_call.nretry >= _max_retry) {
+        _current_call.nretry >= _max_retry ||
+        has_flag(FLAGS_REJECTED_BY_CHANNEL_LIMITER)) {
         goto END_OF_RPC;
     }
     if (_error_code == EBACKUPREQUEST) {
@@ -623,13 +632,29 @@ void Controller::OnVersionedRPCReturned(const CompletionInfo& info,
             }
             _accessed->Add(_current_call.peer_id);
         }
+        if (_limiter) {
+            std::string reason;
+            if (!_limiter->OnRequested(&reason)) {
+                // Don't send the backup request and keep waiting for the
+                // original call.
+                _error_code = saved_error;
+                CHECK_EQ(0, bthread_id_unlock(info.id));
+                return;
+            }
+        }
         // _current_call does not end yet.
         CHECK(_unfinished_call == NULL);  // only one backup request now.
         _unfinished_call = new (std::nothrow) Call(&_current_call);
         if (_unfinished_call == NULL) {
+            if (_limiter) {
+                // The backup request is not sent.
+                _limiter->OnResponded(ECANCELED, 0);
+            }
             SetFailed(ENOMEM, "Fail to new Call");
             goto END_OF_RPC;
         }
+        // Counted by _limiter above, IssueRPC() does not check again.
+        _current_call.counted_by_limiter = (_limiter.get() != NULL);
         ++_current_call.nretry;
         add_flag(FLAGS_BACKUP_REQUEST);
         return IssueRPC(butil::gettimeofday_us());
@@ -825,6 +850,12 @@ void Controller::Call::OnComplete(
         c->_lb->Feedback(info);
     }
 
+    if (counted_by_limiter) {
+        c->_limiter->OnResponded(error_code,
+                                 butil::gettimeofday_us() - begin_time_us);
+        counted_by_limiter = false;
+    }
+
     // Release the `Socket' we used to send/receive data
     sending_sock.reset(NULL);
 }
@@ -901,6 +932,7 @@ void Controller::EndRPC(const CompletionInfo& info) {
     }
     // RPC finished, now it's safe to release `LoadBalancerWithNaming'
     _lb.reset();
+    _limiter.reset();
     if (_span) {
         _span->set_ending_cid(info.id);
         _span->set_async(_done);
@@ -1025,6 +1057,16 @@ void Controller::IssueRPC(int64_t start_realtime_us) {
         return;
     }
 
+    if (_limiter && !_current_call.counted_by_limiter) {
+        std::string reason;
+        if (!_limiter->OnRequested(&reason)) {
+            SetFailed(ELIMIT, "%s", reason.c_str());
+            add_flag(FLAGS_REJECTED_BY_CHANNEL_LIMITER);
+            return HandleSendFailed();
+        }
+        _current_call.counted_by_limiter = true;
+    }
+
     // Pick a target server for sending RPC
     _current_call.need_feedback = false;
     _current_call.enable_circuit_breaker = has_enabled_circuit_breaker();
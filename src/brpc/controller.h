@@ -64,6 +64,7 @@ namespace brpc {
 class Span;
 class Server;
 class SharedLoadBalancer;
+class ChannelLimiter;
 class ExcludedServers;
 class RPCSender;
 class StreamSettings;
@@ -144,6 +145,9 @@ friend void policy::ProcessThriftRequest(InputMessageBase*);
     static const uint32_t FLAGS_HEALTH_CHECK_CALL = (1 << 19);
     static const uint32_t FLAGS_PB_SINGLE_REPEATED_TO_ARRAY = (1 << 20);
     static const uint32_t FLAGS_MANAGE_HTTP_BODY_ON_ERROR = (1 << 21);
+    // The call was rejected by ChannelOptions.max_concurrency/max_qps, which
+    // is not retried since retries would be rejected by the same limits.
+    static const uint32_t FLAGS_REJECTED_BY_CHANNEL_LIMITER = (1 << 22);
 
 public:
     struct Inheritable {
@@ -667,6 +671,7 @@ private:
         bool need_feedback;             // The LB needs feedback.
         bool enable_circuit_breaker;    // The channel enabled circuit_breaker
         bool touched_by_stream_creator; 
+        bool counted_by_limiter;        // Counted by the limiter of channel
         SocketId peer_id;               // main server id
         int64_t begin_time_us;          // sent real time.
         // The actual `Socket' for sending RPC. It's socket id will be
@@ -762,6 +767,12 @@ private:
     // Begin/End time of a single RPC call (since Epoch in microseconds)
     int64_t _begin_time_us;
     int64_t _end_time_us;
+    // Server-side only: when the request was started to be parsed, was
+    // parsed and when the method was called (butil::cpuwide_time_us()), 0 if
+    // not reached.
+    int64_t _start_parse_us;
+    int64_t _end_parse_us;
+    int64_t _start_callback_us;
     short _tos;    // Type of service.
     // The index of parse function which `InputMessenger' will use
     int _preferred_index;
@@ -775,6 +786,7 @@ private:
     uint64_t _request_code;
     SocketId _single_server_id;
     butil::intrusive_ptr<SharedLoadBalancer> _lb;
+    butil::intrusive_ptr<ChannelLimiter> _limiter;
 
     // for passing parameters to created bthread, don't modify it otherwhere.
     CompletionInfo _tmp_completion_info;
@@ -0,0 +1,108 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <algorithm>                                 // std::max
+#include "butil/logging.h"
+#include "butil/string_printf.h"
+#include "butil/time.h"                              // cpuwide_time_ns
+#include "brpc/errno.pb.h"                           // ELIMIT
+#include "brpc/details/channel_limiter.h"
+
+
+namespace brpc {
+
+ChannelLimiter::ChannelLimiter()
+    : _max_qps(0)
+    , _token_interval_ns(0)
+    , _max_burst_ns(0)
+    , _refilled_ns(0)
+    , _nconcurrency(0) {
+}
+
+ChannelLimiter::~ChannelLimiter() {
+}
+
+int ChannelLimiter::Init(const AdaptiveMaxConcurrency& max_concurrency,
+                         int max_qps) {
+    if (max_concurrency.type() != AdaptiveMaxConcurrency::UNLIMITED()) {
+        const ConcurrencyLimiter* cl =
+            ConcurrencyLimiterExtension()->Find(max_concurrency.type().c_str());
+        if (cl == NULL) {
+            LOG(ERROR) << "Fail to find ConcurrencyLimiter by `"
+                       << max_concurrency.value() << "'";
+            return -1;
+        }
+        _cl.reset(cl->New(max_concurrency));
+        if (_cl == NULL) {
+            LOG(ERROR) << "Fail to new ConcurrencyLimiter";
+            return -1;
+        }
+    }
+    if (max_qps > 0) {
+        _max_qps = max_qps;
+        _token_interval_ns = 1000000000L / max_qps;
+        // Allow bursts of requests in 100ms.
+        const int64_t burst = std::max(max_qps / 10, 1);
+        _max_burst_ns = (burst - 1) * _token_interval_ns;
+    }
+    return 0;
+}
+
+bool ChannelLimiter::TryAcquireToken() {
+    const int64_t now_ns = butil::cpuwide_time_ns();
+    int64_t refilled_ns = _refilled_ns.load(butil::memory_order_relaxed);
+    while (true) {
+        const int64_t start_ns = std::max(refilled_ns, now_ns);
+        if (start_ns - now_ns > _max_burst_ns) {
+            // The bucket is empty.
+            return false;
+        }
+        if (_refilled_ns.compare_exchange_weak(
+                refilled_ns, start_ns + _token_interval_ns,
+                butil::memory_order_relaxed)) {
+            return true;
+        }
+    }
+}
+
+bool ChannelLimiter::OnRequested(std::string* reason) {
+    const int cc = _nconcurrency.fetch_add(1, butil::memory_order_relaxed) + 1;
+    if (_cl != NULL && !_cl->OnRequested(cc)) {
+        _nconcurrency.fetch_sub(1, butil::memory_order_relaxed);
+        butil::string_printf(reason, "Reached max_concurrency=%d of the channel",
+                             _cl->MaxConcurrency());
+        return false;
+    }
+    if (_max_qps > 0 && !TryAcquireToken()) {
+        _nconcurrency.fetch_sub(1, butil::memory_order_relaxed);
+        butil::string_printf(reason, "Reached max_qps=%d of the channel",
+                             _max_qps);
+        return false;
+    }
+    return true;
+}
+
+void ChannelLimiter::OnResponded(int error_code, int64_t latency_us) {
+    _nconcurrency.fetch_sub(1, butil::memory_order_relaxed);
+    // Calls canceled because the backup request(or the original one)
+    // succeeded don't reflect latencies of servers.
+    if (_cl != NULL && error_code != ECANCELED) {
+        _cl->OnResponded(error_code, latency_us);
+    }
+}
+
+} // namespace brpc
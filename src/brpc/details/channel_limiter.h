@@ -0,0 +1,77 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_CHANNEL_LIMITER_H
+#define BRPC_CHANNEL_LIMITER_H
+
+#include <memory>                                  // std::unique_ptr
+#include <string>
+#include "butil/atomicops.h"
+#include "brpc/shared_object.h"                    // SharedObject
+#include "brpc/concurrency_limiter.h"              // ConcurrencyLimiter
+#include "brpc/adaptive_max_concurrency.h"         // AdaptiveMaxConcurrency
+
+
+namespace brpc {
+
+// Limits requests sent over a Channel, see ChannelOptions.max_concurrency
+// and ChannelOptions.max_qps. Each call(including retries and backup
+// requests) is counted, and shared by Controllers so that calls finished
+// after destruction of the Channel are still fed back.
+class ChannelLimiter : public SharedObject {
+public:
+    ChannelLimiter();
+    ~ChannelLimiter();
+
+    // Returns 0 on success, -1 otherwise.
+    int Init(const AdaptiveMaxConcurrency& max_concurrency, int max_qps);
+
+    // Called before sending a call. Returns true if the call can be sent,
+    // otherwise the reason is written into `reason' and the call should
+    // fail with ELIMIT.
+    bool OnRequested(std::string* reason);
+
+    // Called when a call allowed by OnRequested() ends.
+    void OnResponded(int error_code, int64_t latency_us);
+
+    int MaxConcurrency() const { return _cl ? _cl->MaxConcurrency() : 0; }
+
+    int current_concurrency() const
+    { return _nconcurrency.load(butil::memory_order_relaxed); }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ChannelLimiter);
+
+    // Take a token from the bucket refilled at max_qps.
+    bool TryAcquireToken();
+
+    std::unique_ptr<ConcurrencyLimiter> _cl;
+    int _max_qps;
+    // Nanoseconds to refill a token.
+    int64_t _token_interval_ns;
+    // Nanoseconds to refill the bucket from empty to full.
+    int64_t _max_burst_ns;
+    // The time when taken tokens are all refilled, namely "theoretical
+    // arrival time" in GCRA which is an equivalent form of the token bucket.
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<int64_t> _refilled_ns;
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<int> _nconcurrency;
+};
+
+} // namespace brpc
+
+
+#endif // BRPC_CHANNEL_LIMITER_H
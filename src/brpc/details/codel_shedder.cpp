@@ -0,0 +1,101 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <math.h>                                    // sqrt
+#include <gflags/gflags.h>
+#include "butil/scoped_lock.h"                       // BAIDU_SCOPED_LOCK
+#include "brpc/reloadable_flags.h"
+#include "brpc/details/codel_shedder.h"
+
+
+namespace brpc {
+
+DEFINE_int32(server_codel_target_ms, 5, "Queueing delay considered acceptable"
+             " by CoDel shedding of servers, see ServerOptions.codel_shedding");
+BRPC_VALIDATE_GFLAG(server_codel_target_ms, PositiveInteger);
+
+DEFINE_int32(server_codel_interval_ms, 100, "Queueing delays above "
+             "-server_codel_target_ms for this long start CoDel shedding");
+BRPC_VALIDATE_GFLAG(server_codel_interval_ms, PositiveInteger);
+
+CoDelShedder::CoDelShedder()
+    : _dropping(false)
+    , _first_above_us(0)
+    , _drop_next_us(0)
+    , _count(0)
+    , _last_count(0) {
+}
+
+int64_t CoDelShedder::ControlLaw(int64_t t_us, int64_t interval_us) const {
+    return t_us + (int64_t)(interval_us / sqrt((double)_count));
+}
+
+bool CoDelShedder::OnDequeued(int64_t sojourn_us, int64_t now_us) {
+    const int64_t target_us = FLAGS_server_codel_target_ms * 1000L;
+    const int64_t interval_us = FLAGS_server_codel_interval_ms * 1000L;
+    if (sojourn_us < target_us && !_dropping.load(butil::memory_order_relaxed)) {
+        // Fast path taken by most requests of a healthy server.
+        if (_first_above_us.load(butil::memory_order_relaxed) != 0) {
+            _first_above_us.store(0, butil::memory_order_relaxed);
+        }
+        return false;
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    bool ok_to_drop = false;
+    if (sojourn_us < target_us) {
+        _first_above_us.store(0, butil::memory_order_relaxed);
+    } else {
+        const int64_t first_above_us =
+            _first_above_us.load(butil::memory_order_relaxed);
+        if (first_above_us == 0) {
+            _first_above_us.store(now_us + interval_us,
+                                  butil::memory_order_relaxed);
+        } else if (now_us >= first_above_us) {
+            ok_to_drop = true;
+        }
+    }
+    if (_dropping.load(butil::memory_order_relaxed)) {
+        if (!ok_to_drop) {
+            // The delay is below the target.
+            _dropping.store(false, butil::memory_order_relaxed);
+            return false;
+        }
+        if (now_us >= _drop_next_us) {
+            ++_count;
+            _drop_next_us = ControlLaw(_drop_next_us, interval_us);
+            return true;
+        }
+        return false;
+    }
+    if (!ok_to_drop) {
+        return false;
+    }
+    _dropping.store(true, butil::memory_order_relaxed);
+    // Start with the drop rate of last dropping state if it ended recently,
+    // which is likely not enough to control the queue.
+    const uint32_t delta = _count - _last_count;
+    if (delta > 1 && now_us - _drop_next_us < 16 * interval_us) {
+        _count = delta;
+    } else {
+        _count = 1;
+    }
+    _drop_next_us = ControlLaw(now_us, interval_us);
+    _last_count = _count;
+    return true;
+}
+
+} // namespace brpc
@@ -0,0 +1,69 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_CODEL_SHEDDER_H
+#define BRPC_CODEL_SHEDDER_H
+
+#include <stdint.h>
+#include <gflags/gflags_declare.h>
+#include "butil/macros.h"
+#include "butil/atomicops.h"
+#include "butil/synchronization/lock.h"              // butil::Mutex
+
+
+namespace brpc {
+
+DECLARE_int32(server_codel_target_ms);
+DECLARE_int32(server_codel_interval_ms);
+
+// Decides which requests to drop by CoDel(Controlled Delay, RFC 8289)
+// according to their queueing delays. A queue with a standing delay, namely
+// delays of all requests in an interval are above the target, is considered
+// overloaded and requests are dropped at increasing rates until the delay
+// is below the target again. Bursts shorter than the interval are absorbed.
+class CoDelShedder {
+public:
+    CoDelShedder();
+
+    // Called when a request leaves the queue after waiting `sojourn_us'.
+    // Returns true if the request should be dropped.
+    bool OnDequeued(int64_t sojourn_us, int64_t now_us);
+
+    // True if requests with long delays are being dropped.
+    bool dropping() const { return _dropping.load(butil::memory_order_relaxed); }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(CoDelShedder);
+
+    // Time to drop the next request, the interval between drops shrinks
+    // with the square root of number of drops.
+    int64_t ControlLaw(int64_t t_us, int64_t interval_us) const;
+
+    butil::Mutex _mutex;
+    // Read without lock in the fast path.
+    butil::atomic<bool> _dropping;
+    butil::atomic<int64_t> _first_above_us;
+    // Following fields are protected by _mutex.
+    int64_t _drop_next_us;
+    uint32_t _count;
+    uint32_t _last_count;
+};
+
+} // namespace brpc
+
+
+#endif // BRPC_CODEL_SHEDDER_H
@@ -156,6 +156,22 @@ public:
         return *this;
     }
 
+    ControllerPrivateAccessor& set_start_parse_us(int64_t start_parse_us) {
+        _cntl->_start_parse_us = start_parse_us;
+        return *this;
+    }
+    int64_t start_parse_us() const { return _cntl->_start_parse_us; }
+
+    void set_end_parse_us(int64_t end_parse_us) {
+        _cntl->_end_parse_us = end_parse_us;
+    }
+    int64_t end_parse_us() const { return _cntl->_end_parse_us; }
+
+    void set_start_callback_us(int64_t start_callback_us) {
+        _cntl->_start_callback_us = start_callback_us;
+    }
+    int64_t start_callback_us() const { return _cntl->_start_callback_us; }
+
     ControllerPrivateAccessor& set_health_check_call() {
         _cntl->add_flag(Controller::FLAGS_HEALTH_CHECK_CALL);
         return *this;
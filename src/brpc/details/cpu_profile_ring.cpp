@@ -0,0 +1,316 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <unistd.h>                             // usleep
+#include <algorithm>                            // std::min
+#include <memory>                               // std::unique_ptr
+#include <gflags/gflags.h>
+#include "butil/atomicops.h"
+#include "butil/file_util.h"                    // butil::ReadFileToString
+#include "butil/logging.h"
+#include "butil/scoped_lock.h"
+#include "butil/time.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/builtin/common.h"                // GetProgramChecksum
+#include "brpc/details/cpu_profile_ring.h"
+
+extern "C" {
+int __attribute__((weak)) ProfilerStart(const char* fname);
+void __attribute__((weak)) ProfilerStop();
+}
+
+namespace brpc {
+
+static bool StartContinuousCpuProfiler(const char*, bool);
+
+DEFINE_bool(cpu_profiler_continuous, false, "Keep running the CPU profiler "
+            "at background so that /hotspots/cpu shows samples in recent "
+            "-cpu_profiler_continuous_seconds seconds instantly. Other users "
+            "of the CPU profiler(e.g. /pprof/profile) fail when this flag is "
+            "on. Set CPUPROFILE_FREQUENCY to lower the sampling frequency");
+BRPC_VALIDATE_GFLAG(cpu_profiler_continuous, StartContinuousCpuProfiler);
+
+DEFINE_int32(cpu_profiler_continuous_seconds, 600, "Samples of the CPU "
+             "profiler in so many seconds are kept in memory when "
+             "-cpu_profiler_continuous is on");
+BRPC_VALIDATE_GFLAG(cpu_profiler_continuous_seconds, PositiveInteger);
+
+DEFINE_int32(cpu_profiler_period_seconds, 10, "Samples of the continuous CPU "
+             "profiler are aggregated in periods of so many seconds, which "
+             "is the granularity of time ranges shown in /hotspots/cpu");
+BRPC_VALIDATE_GFLAG(cpu_profiler_period_seconds, PositiveInteger);
+
+// Stacks deeper than this are considered as corrupted.
+static const uintptr_t MAX_STACK_DEPTH = 1024;
+
+CpuProfileRing::CpuProfileRing() : _sampling_period_us(0) {
+    pthread_mutex_init(&_mutex, NULL);
+}
+
+CpuProfileRing::~CpuProfileRing() {
+    for (size_t i = 0; i < _periods.size(); ++i) {
+        delete _periods[i];
+    }
+    _periods.clear();
+    pthread_mutex_destroy(&_mutex);
+}
+
+int CpuProfileRing::AddProfile(const butil::StringPiece& profile,
+                               int64_t start_us, int64_t end_us) {
+    // The profile is an array of words, see ReadCPUProfile() in pprof.
+    //   header:  0, 3, 0, <sampling period>, 0
+    //   samples: <count>, <depth>, <pc1>, ..., <pcN>
+    //   trailer: 0, 1, 0
+    // followed by the text of /proc/self/maps.
+    const uintptr_t* const slots = (const uintptr_t*)profile.data();
+    const size_t nslot = profile.size() / sizeof(uintptr_t);
+    if (nslot < 5 || slots[0] != 0 || slots[1] < 3 || slots[1] + 2 > nslot) {
+        LOG(WARNING) << "Invalid header of cpu profile";
+        return -1;
+    }
+    const uintptr_t sampling_period_us = slots[3];
+    std::unique_ptr<Period> period(new Period);
+    period->start_us = start_us;
+    period->end_us = end_us;
+    if (period->samples.init(1024) != 0) {
+        LOG(WARNING) << "Fail to init samples";
+        return -1;
+    }
+    size_t i = 2 + slots[1];
+    while (true) {
+        if (i + 2 > nslot) {
+            LOG(WARNING) << "Cpu profile is truncated";
+            return -1;
+        }
+        const uintptr_t count = slots[i];
+        const uintptr_t depth = slots[i + 1];
+        i += 2;
+        if (depth == 0 || depth > MAX_STACK_DEPTH || i + depth > nslot) {
+            LOG(WARNING) << "Invalid depth=" << depth << " in cpu profile";
+            return -1;
+        }
+        if (slots[i] == 0) {
+            // The trailer.
+            i += depth;
+            break;
+        }
+        period->samples[std::string((const char*)(slots + i),
+                                    depth * sizeof(uintptr_t))] += count;
+        i += depth;
+    }
+    const butil::StringPiece maps = profile.substr(i * sizeof(uintptr_t));
+
+    BAIDU_SCOPED_LOCK(_mutex);
+    _sampling_period_us = sampling_period_us;
+    maps.CopyToString(&_maps);
+    _periods.push_back(period.release());
+    return 0;
+}
+
+void CpuProfileRing::RemoveOlderThan(int64_t min_end_us) {
+    std::deque<Period*> removed;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        while (!_periods.empty() && _periods.front()->end_us < min_end_us) {
+            removed.push_back(_periods.front());
+            _periods.pop_front();
+        }
+    }
+    for (size_t i = 0; i < removed.size(); ++i) {
+        delete removed[i];
+    }
+}
+
+static void AppendSlot(butil::IOBuf* out, uintptr_t slot) {
+    out->append(&slot, sizeof(slot));
+}
+
+int64_t CpuProfileRing::DumpProfile(int64_t begin_us, int64_t end_us,
+                                    butil::IOBuf* out,
+                                    int64_t* actual_begin_us,
+                                    int64_t* actual_end_us) const {
+    SampleMap merged;
+    if (merged.init(1024) != 0) {
+        LOG(WARNING) << "Fail to init samples";
+        return -1;
+    }
+    bool found = false;
+    int64_t first_us = 0;
+    int64_t last_us = 0;
+    uintptr_t sampling_period_us = 0;
+    std::string maps;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        for (size_t i = 0; i < _periods.size(); ++i) {
+            const Period* p = _periods[i];
+            if (p->end_us <= begin_us || p->start_us >= end_us) {
+                continue;
+            }
+            if (!found) {
+                found = true;
+                first_us = p->start_us;
+            }
+            last_us = p->end_us;
+            for (SampleMap::const_iterator it = p->samples.begin();
+                 it != p->samples.end(); ++it) {
+                merged[it->first] += it->second;
+            }
+        }
+        sampling_period_us = _sampling_period_us;
+        maps = _maps;
+    }
+    if (!found) {
+        return -1;
+    }
+    if (actual_begin_us) {
+        *actual_begin_us = first_us;
+    }
+    if (actual_end_us) {
+        *actual_end_us = last_us;
+    }
+    out->clear();
+    AppendSlot(out, 0);
+    AppendSlot(out, 3);
+    AppendSlot(out, 0);
+    AppendSlot(out, sampling_period_us);
+    AppendSlot(out, 0);
+    int64_t nsample = 0;
+    for (SampleMap::const_iterator it = merged.begin();
+         it != merged.end(); ++it) {
+        AppendSlot(out, it->second);
+        AppendSlot(out, it->first.size() / sizeof(uintptr_t));
+        out->append(it->first);
+        nsample += it->second;
+    }
+    AppendSlot(out, 0);
+    AppendSlot(out, 1);
+    AppendSlot(out, 0);
+    out->append(maps);
+    return nsample;
+}
+
+bool CpuProfileRing::GetTimeRange(int64_t* begin_us, int64_t* end_us) const {
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (_periods.empty()) {
+        return false;
+    }
+    *begin_us = _periods.front()->start_us;
+    *end_us = _periods.back()->end_us;
+    return true;
+}
+
+static pthread_mutex_t s_profiler_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Modified with s_profiler_mutex locked.
+static bool s_profiler_wanted = false;
+static bool s_profiler_running = false;
+static CpuProfileRing* s_profile_ring = NULL;
+// Stop sleeping ASAP after the flag is turned off.
+static butil::static_atomic<bool> s_stop_sleeping = BUTIL_STATIC_ATOMIC_INIT(false);
+
+static void SleepForSeconds(int seconds) {
+    const int64_t end_us = butil::gettimeofday_us() + seconds * 1000000L;
+    while (!s_stop_sleeping.load(butil::memory_order_relaxed)) {
+        const int64_t left_us = end_us - butil::gettimeofday_us();
+        if (left_us <= 0) {
+            break;
+        }
+        usleep(std::min(left_us, (int64_t)100000));
+    }
+}
+
+static void* RunContinuousCpuProfiler(void*) {
+    std::string path = FLAGS_rpc_profiling_dir;
+    path.push_back('/');
+    path.append(GetProgramChecksum());
+    butil::File::Error error;
+    if (!butil::CreateDirectoryAndGetError(butil::FilePath(path), &error)) {
+        LOG(ERROR) << "Fail to create directory=`" << path << "', " << error;
+    }
+    // Not ended with ".cpu" to be hidden from /hotspots/cpu.
+    path.append("/continuous.cpu_period");
+    while (true) {
+        {
+            BAIDU_SCOPED_LOCK(s_profiler_mutex);
+            if (!s_profiler_wanted) {
+                s_profiler_running = false;
+                break;
+            }
+        }
+        const int64_t start_us = butil::gettimeofday_us();
+        if (!ProfilerStart(path.c_str())) {
+            LOG_EVERY_SECOND(WARNING) << "Another cpu profiler is running,"
+                " continuous cpu profiling is paused";
+            SleepForSeconds(1);
+            continue;
+        }
+        SleepForSeconds(FLAGS_cpu_profiler_period_seconds);
+        ProfilerStop();
+        const int64_t end_us = butil::gettimeofday_us();
+        std::string profile;
+        if (!butil::ReadFileToString(butil::FilePath(path), &profile)) {
+            LOG(WARNING) << "Fail to read " << path;
+        } else if (s_profile_ring->AddProfile(profile, start_us, end_us) == 0) {
+            s_profile_ring->RemoveOlderThan(
+                end_us - FLAGS_cpu_profiler_continuous_seconds * 1000000L);
+        }
+        butil::DeleteFile(butil::FilePath(path), false);
+    }
+    return NULL;
+}
+
+static bool StartContinuousCpuProfiler(const char*, bool value) {
+    BAIDU_SCOPED_LOCK(s_profiler_mutex);
+    s_profiler_wanted = value;
+    if (!value) {
+        s_stop_sleeping.store(true, butil::memory_order_relaxed);
+        return true;
+    }
+    if ((void*)ProfilerStart == NULL || (void*)ProfilerStop == NULL) {
+        LOG(ERROR) << "CPU profiler is not enabled, read docs/cn/cpu_profiler.md";
+        s_profiler_wanted = false;
+        return false;
+    }
+    s_stop_sleeping.store(false, butil::memory_order_relaxed);
+    if (s_profiler_running) {
+        return true;
+    }
+    if (s_profile_ring == NULL) {
+        s_profile_ring = new CpuProfileRing;
+    }
+    pthread_t th;
+    if (pthread_create(&th, NULL, RunContinuousCpuProfiler, NULL) != 0) {
+        PLOG(ERROR) << "Fail to create thread of continuous cpu profiler";
+        s_profiler_wanted = false;
+        return false;
+    }
+    pthread_detach(th);
+    s_profiler_running = true;
+    return true;
+}
+
+const CpuProfileRing* GetContinuousCpuProfile() {
+    BAIDU_SCOPED_LOCK(s_profiler_mutex);
+    return s_profile_ring;
+}
+
+bool IsContinuousCpuProfilerRunning() {
+    BAIDU_SCOPED_LOCK(s_profiler_mutex);
+    return s_profiler_running;
+}
+
+} // namespace brpc
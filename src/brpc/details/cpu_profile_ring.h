@@ -0,0 +1,97 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef  BRPC_CPU_PROFILE_RING_H
+#define  BRPC_CPU_PROFILE_RING_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <gflags/gflags_declare.h>
+#include "butil/macros.h"                  // DISALLOW_COPY_AND_ASSIGN
+#include "butil/iobuf.h"                   // butil::IOBuf
+#include "butil/strings/string_piece.h"    // butil::StringPiece
+#include "butil/containers/flat_map.h"     // butil::FlatMap
+
+
+namespace brpc {
+
+DECLARE_bool(cpu_profiler_continuous);
+DECLARE_int32(cpu_profiler_continuous_seconds);
+DECLARE_int32(cpu_profiler_period_seconds);
+
+// Aggregated samples of the CPU profiler in consecutive periods of time.
+// Samples are kept as unsymbolized stacks, which are symbolized by pprof
+// only when they're displayed.
+class CpuProfileRing {
+public:
+    CpuProfileRing();
+    ~CpuProfileRing();
+
+    // Add samples in `profile' written by the CPU profiler of gperftools
+    // during [start_us, end_us) (microseconds since the Epoch).
+    // Returns 0 on success, -1 otherwise.
+    int AddProfile(const butil::StringPiece& profile,
+                   int64_t start_us, int64_t end_us);
+
+    // Remove periods ended before `min_end_us'.
+    void RemoveOlderThan(int64_t min_end_us);
+
+    // Merge samples of the periods overlapping [begin_us, end_us) into a
+    // profile in the format of gperftools, which can be read by pprof.
+    // `actual_begin_us' and `actual_end_us' are set with the range of the
+    // merged periods if they're not NULL.
+    // Returns number of merged samples, -1 when no period was merged.
+    int64_t DumpProfile(int64_t begin_us, int64_t end_us, butil::IOBuf* out,
+                        int64_t* actual_begin_us = NULL,
+                        int64_t* actual_end_us = NULL) const;
+
+    // Get the range of all periods. Returns false when there's no period.
+    bool GetTimeRange(int64_t* begin_us, int64_t* end_us) const;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(CpuProfileRing);
+
+    // Stack (array of pc) -> number of samples.
+    typedef butil::FlatMap<std::string, int64_t> SampleMap;
+    struct Period {
+        int64_t start_us;
+        int64_t end_us;
+        SampleMap samples;
+    };
+
+    mutable pthread_mutex_t _mutex;
+    std::deque<Period*> _periods;
+    // Sampling period of the last profile.
+    uintptr_t _sampling_period_us;
+    // Memory mappings (/proc/self/maps) in the last profile.
+    std::string _maps;
+};
+
+// Samples collected by -cpu_profiler_continuous, NULL if the flag was never
+// turned on.
+const CpuProfileRing* GetContinuousCpuProfile();
+
+// True if the CPU profiler is running continuously.
+bool IsContinuousCpuProfilerRunning();
+
+} // namespace brpc
+
+
+#endif  // BRPC_CPU_PROFILE_RING_H
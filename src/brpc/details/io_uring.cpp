@@ -0,0 +1,806 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <gflags/gflags.h>
+#include "butil/logging.h"
+#include "butil/scoped_lock.h"                   // BAIDU_SCOPED_LOCK
+#include "brpc/details/io_uring.h"
+
+#ifdef BRPC_HAS_IO_URING
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+#include "butil/fd_utility.h"                    // make_close_on_exec
+#include "brpc/socket.h"
+#include "brpc/details/has_epollrdhup.h"
+#endif
+
+namespace brpc {
+
+DEFINE_bool(event_dispatcher_io_uring_recv, false,
+            "Receive data of sockets with io_uring multishot recv into IOBuf "
+            "blocks provided to the kernel, so that reading a socket does "
+            "not cost a syscall. Only works with "
+            "-event_dispatcher_use_io_uring on Linux 6.0+");
+DEFINE_int32(event_dispatcher_io_uring_recv_buffers, 1024,
+             "Number of IOBuf blocks provided to the kernel by each "
+             "EventDispatcher, must be power of 2 and no more than 32768");
+
+#ifdef BRPC_HAS_IO_URING
+
+// user_data of completions which are not bound to any PollRequest, e.g.
+// POLL_REMOVE and NOP(for waking up).
+static const uint64_t INTERNAL_USER_DATA = 0;
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+                              unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                   flags, NULL, 0);
+}
+
+static void* MapRing(int fd, size_t size, off_t offset) {
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, offset);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+IoUring::IoUring()
+    : _fd(-1)
+    , _features(0)
+    , _sq_ring(NULL)
+    , _sq_ring_size(0)
+    , _sq_head(NULL)
+    , _sq_tail(NULL)
+    , _sq_mask(NULL)
+    , _sq_array(NULL)
+    , _sqes(NULL)
+    , _sqes_size(0)
+    , _sqe_tail(0)
+    , _cq_ring(NULL)
+    , _cq_ring_size(0)
+    , _cq_head(NULL)
+    , _cq_tail(NULL)
+    , _cq_mask(NULL)
+    , _cqes(NULL) {
+}
+
+IoUring::~IoUring() {
+    if (_sqes) {
+        munmap(_sqes, _sqes_size);
+    }
+    if (_cq_ring && _cq_ring != _sq_ring) {
+        munmap(_cq_ring, _cq_ring_size);
+    }
+    if (_sq_ring) {
+        munmap(_sq_ring, _sq_ring_size);
+    }
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+int IoUring::Init(unsigned entries, unsigned cq_entries) {
+    if (_fd >= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    if (cq_entries > entries) {
+        p.flags |= IORING_SETUP_CQSIZE;
+        p.cq_entries = cq_entries;
+    }
+    const int fd = sys_io_uring_setup(entries, &p);
+    if (fd < 0) {
+        return -1;
+    }
+    _fd = fd;
+    _features = p.features;
+    butil::make_close_on_exec(_fd);
+
+    _sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    _cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (_features & IORING_FEAT_SINGLE_MMAP) {
+        _sq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+        _cq_ring_size = _sq_ring_size;
+    }
+    _sq_ring = MapRing(_fd, _sq_ring_size, IORING_OFF_SQ_RING);
+    if (_sq_ring == NULL) {
+        return -1;
+    }
+    if (_features & IORING_FEAT_SINGLE_MMAP) {
+        _cq_ring = _sq_ring;
+    } else {
+        _cq_ring = MapRing(_fd, _cq_ring_size, IORING_OFF_CQ_RING);
+        if (_cq_ring == NULL) {
+            return -1;
+        }
+    }
+    _sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    _sqes = (io_uring_sqe*)MapRing(_fd, _sqes_size, IORING_OFF_SQES);
+    if (_sqes == NULL) {
+        return -1;
+    }
+
+    char* sq = (char*)_sq_ring;
+    _sq_head = (unsigned*)(sq + p.sq_off.head);
+    _sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    _sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    _sq_array = (unsigned*)(sq + p.sq_off.array);
+    // SQEs are always submitted in order, fix the indirection array.
+    for (unsigned i = 0; i < p.sq_entries; ++i) {
+        _sq_array[i] = i;
+    }
+    _sqe_tail = *_sq_tail;
+
+    char* cq = (char*)_cq_ring;
+    _cq_head = (unsigned*)(cq + p.cq_off.head);
+    _cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    _cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    _cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+io_uring_sqe* IoUring::GetSqe() {
+    const unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+    if (_sqe_tail - head > *_sq_mask) {
+        return NULL;
+    }
+    io_uring_sqe* sqe = &_sqes[_sqe_tail & *_sq_mask];
+    ++_sqe_tail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IoUring::Submit(unsigned wait_nr) {
+    const unsigned to_submit = _sqe_tail - *_sq_tail;
+    if (to_submit == 0 && wait_nr == 0) {
+        return 0;
+    }
+    // Make SQEs visible to the kernel before the new tail.
+    __atomic_store_n(_sq_tail, _sqe_tail, __ATOMIC_RELEASE);
+    const int rc = sys_io_uring_enter(
+        _fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    return rc;
+}
+
+int IoUring::WaitCqe() {
+    if (*_cq_head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    if (sys_io_uring_enter(_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int IoUring::PeekCqes(io_uring_cqe* cqes, int max) {
+    unsigned head = *_cq_head;
+    const unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+    int n = 0;
+    for (; head != tail && n < max; ++head, ++n) {
+        cqes[n] = _cqes[head & *_cq_mask];
+    }
+    // Return the slots to the kernel after copying.
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+int IoUring::Register(unsigned opcode, const void* arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, _fd, opcode, arg, nr_args);
+}
+
+static bool g_io_uring_supported = false;
+static pthread_once_t g_io_uring_supported_once = PTHREAD_ONCE_INIT;
+
+static void CheckIoUringSupported() {
+    IoUring ring;
+    if (ring.Init(8, 16) != 0) {
+        PLOG(WARNING) << "io_uring is not available";
+        return;
+    }
+    // Multishot poll and IORING_FEAT_RSRC_TAGS both came with Linux 5.13,
+    // which is the only way to detect the former.
+    const unsigned required = IORING_FEAT_NODROP | IORING_FEAT_RSRC_TAGS;
+    if ((ring.features() & required) != required) {
+        LOG(WARNING) << "io_uring of this kernel is too old, features="
+                     << ring.features();
+        return;
+    }
+    g_io_uring_supported = true;
+}
+
+bool IoUringSupported() {
+    pthread_once(&g_io_uring_supported_once, CheckIoUringSupported);
+    return g_io_uring_supported;
+}
+
+#ifdef BRPC_HAS_IO_URING_RECV
+
+static bool g_io_uring_recv_supported = false;
+static pthread_once_t g_io_uring_recv_supported_once = PTHREAD_ONCE_INIT;
+
+static void CheckIoUringRecvSupported() {
+    if (!IoUringSupported()) {
+        return;
+    }
+    // Multishot recv can't be detected by features or IORING_REGISTER_PROBE,
+    // and some kernels accept registering a provided buffer ring but never
+    // pick buffers from it. Receive a byte from a socketpair to make sure.
+    IoUring ring;
+    if (ring.Init(8, 16) != 0) {
+        return;
+    }
+    IoUringBufferRing br;
+    if (br.Init(&ring, 0, 1) != 0) {
+        PLOG(WARNING) << "Fail to register provided buffer ring";
+        return;
+    }
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        return;
+    }
+    int rc = -1;
+    io_uring_cqe cqe;
+    memset(&cqe, 0, sizeof(cqe));
+    io_uring_sqe* sqe = ring.GetSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fds[0];
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = br.bgid();
+    if (write(fds[1], "x", 1) == 1 && ring.Submit(1) == 1) {
+        rc = ring.PeekCqes(&cqe, 1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    if (rc != 1 || cqe.res != 1 || !(cqe.flags & IORING_CQE_F_BUFFER)) {
+        LOG(WARNING) << "io_uring of this kernel can't receive into provided "
+            "buffers, res=" << cqe.res << " flags=" << cqe.flags;
+        return;
+    }
+    g_io_uring_recv_supported = true;
+}
+
+bool IoUringRecvSupported() {
+    pthread_once(&g_io_uring_recv_supported_once, CheckIoUringRecvSupported);
+    return g_io_uring_recv_supported;
+}
+
+#else
+
+bool IoUringRecvSupported() {
+    return false;
+}
+
+#endif  // BRPC_HAS_IO_URING_RECV
+
+#ifdef BRPC_HAS_IO_URING_RECV
+
+// Unused tail of a block smaller than this is dropped instead of being
+// provided again, otherwise receiving a message costs too many completions.
+static const size_t MIN_PROVIDED_BUFFER_SIZE = 1024;
+
+IoUringBufferRing::IoUringBufferRing()
+    : _ring(NULL)
+    , _bgid(0)
+    , _nbuf(0)
+    , _br(NULL)
+    , _br_size(0)
+    , _tail(0) {
+}
+
+IoUringBufferRing::~IoUringBufferRing() {
+    if (_ring) {
+        // Stop the kernel from picking buffers before releasing them.
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = _bgid;
+        _ring->Register(IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        _ring = NULL;
+    }
+    if (_br) {
+        munmap(_br, _br_size);
+        _br = NULL;
+    }
+    _bufs.clear();
+}
+
+int IoUringBufferRing::Init(IoUring* ring, uint16_t bgid, unsigned nbuf) {
+    if (nbuf == 0 || nbuf > 32768 || (nbuf & (nbuf - 1)) != 0) {
+        LOG(ERROR) << "Invalid number of buffers=" << nbuf;
+        errno = EINVAL;
+        return -1;
+    }
+    _br_size = nbuf * sizeof(io_uring_buf);
+    _br = mmap(NULL, _br_size, PROT_READ | PROT_WRITE,
+               MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (_br == MAP_FAILED) {
+        _br = NULL;
+        return -1;
+    }
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)_br;
+    reg.ring_entries = nbuf;
+    reg.bgid = bgid;
+    if (ring->Register(IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        return -1;
+    }
+    _ring = ring;
+    _bgid = bgid;
+    _nbuf = nbuf;
+    _bufs.resize(nbuf);
+    for (unsigned i = 0; i < nbuf; ++i) {
+        if (Provide(i) != 0) {
+            return -1;
+        }
+    }
+    Commit();
+    return 0;
+}
+
+int IoUringBufferRing::Provide(uint16_t bid) {
+    butil::IOBuf& buf = _bufs[bid];
+    const void* data = NULL;
+    size_t size = 0;
+    if (buf.size() >= MIN_PROVIDED_BUFFER_SIZE) {
+        // Provide the unused tail of the block again. The block was fully
+        // reserved by the output stream below, so nothing else writes into
+        // it while the kernel does.
+        const butil::StringPiece tail = buf.backing_block(0);
+        data = tail.data();
+        size = tail.size();
+    } else {
+        buf.clear();
+        butil::IOBufAsZeroCopyOutputStream os(
+            &buf, butil::IOBuf::BRPC_DEFAULT_BLOCK_SIZE);
+        void* block = NULL;
+        int block_size = 0;
+        if (!os.Next(&block, &block_size)) {
+            LOG(ERROR) << "Fail to allocate buffer of bid=" << bid;
+            errno = ENOMEM;
+            return -1;
+        }
+        data = block;
+        size = block_size;
+    }
+    // Don't use io_uring_buf_ring::bufs, which is declared as a flexible
+    // array after an empty struct occupying bytes in C++. The ring is an
+    // array of io_uring_buf with the tail overlaid on bufs[0].resv.
+    io_uring_buf* b = (io_uring_buf*)_br + (_tail & (_nbuf - 1));
+    b->addr = (uint64_t)data;
+    b->len = size;
+    b->bid = bid;
+    ++_tail;
+    return 0;
+}
+
+void IoUringBufferRing::Take(uint16_t bid, uint32_t len, butil::IOBuf* out) {
+    if (bid >= _nbuf) {
+        LOG(ERROR) << "Invalid bid=" << bid;
+        return;
+    }
+    // The rest of the block stays in `_bufs[bid]' and is provided again.
+    _bufs[bid].cutn(out, len);
+    // The buffer is lost from the ring on failure, which is fine since the
+    // kernel just reports ENOBUFS when running out of buffers.
+    Provide(bid);
+}
+
+void IoUringBufferRing::Commit() {
+    __atomic_store_n(&((io_uring_buf_ring*)_br)->tail, _tail,
+                     __ATOMIC_RELEASE);
+}
+
+#endif  // BRPC_HAS_IO_URING_RECV
+
+// Number of SQEs should be enough to hold registrations between two
+// submissions. CQ is larger since multishot polls generate completions
+// without submissions. Overflowed completions are kept by the kernel
+// (IORING_FEAT_NODROP) or end the multishot poll, which is re-armed.
+static const unsigned POLLER_SQ_ENTRIES = 1024;
+static const unsigned POLLER_CQ_ENTRIES = 16384;
+
+IoUringPoller::IoUringPoller()
+#ifdef BRPC_HAS_IO_URING_RECV
+    : _buf_ring(NULL)
+#endif
+{}
+
+IoUringPoller::~IoUringPoller() {
+    // Polls are cancelled by the kernel when the ring is closed.
+    for (PollMap::iterator it = _polls.begin(); it != _polls.end(); ++it) {
+        delete it->second.in;
+        delete it->second.out;
+    }
+    _polls.clear();
+#ifdef BRPC_HAS_IO_URING_RECV
+    delete _buf_ring;
+    _buf_ring = NULL;
+#endif
+}
+
+int IoUringPoller::Init() {
+    if (!IoUringSupported()) {
+        errno = ENOSYS;
+        return -1;
+    }
+    if (_polls.init(1024) != 0) {
+        LOG(ERROR) << "Fail to init _polls";
+        return -1;
+    }
+    if (_ring.Init(POLLER_SQ_ENTRIES, POLLER_CQ_ENTRIES) != 0) {
+        PLOG(ERROR) << "Fail to create io_uring";
+        return -1;
+    }
+#ifdef BRPC_HAS_IO_URING_RECV
+    if (FLAGS_event_dispatcher_io_uring_recv) {
+        if (!IoUringRecvSupported()) {
+            LOG(WARNING) << "io_uring of this kernel can't receive into "
+                "provided buffers, sockets will be read by themselves";
+            return 0;
+        }
+        IoUringBufferRing* br = new IoUringBufferRing;
+        if (br->Init(&_ring, 0, FLAGS_event_dispatcher_io_uring_recv_buffers)
+            != 0) {
+            PLOG(WARNING) << "Fail to register provided buffers, sockets "
+                "will be read by themselves";
+            delete br;
+            return 0;
+        }
+        _buf_ring = br;
+    }
+#endif
+    return 0;
+}
+
+bool IoUringPoller::recv_enabled() const {
+#ifdef BRPC_HAS_IO_URING_RECV
+    return _buf_ring != NULL;
+#else
+    return false;
+#endif
+}
+
+io_uring_sqe* IoUringPoller::GetSqeOrFlush() {
+    io_uring_sqe* sqe = _ring.GetSqe();
+    if (sqe == NULL) {
+        if (_ring.Submit(0) < 0) {
+            return NULL;
+        }
+        sqe = _ring.GetSqe();
+        if (sqe == NULL) {
+            errno = EAGAIN;
+        }
+    }
+    return sqe;
+}
+
+int IoUringPoller::ArmPoll(PollRequest* req) {
+    io_uring_sqe* sqe = GetSqeOrFlush();
+    if (sqe == NULL) {
+        return -1;
+    }
+#ifdef BRPC_HAS_IO_URING_RECV
+    if (req->events == 0) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = req->fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = _buf_ring->bgid();
+        sqe->user_data = (uint64_t)req;
+        req->armed = true;
+        return 0;
+    }
+#endif
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = req->fd;
+    sqe->poll32_events = req->events;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = (uint64_t)req;
+    req->armed = true;
+    return 0;
+}
+
+int IoUringPoller::CancelPoll(PollRequest* req) {
+    req->removed = true;
+    if (!req->armed) {
+        // The final completion has been reaped.
+        delete req;
+        return 0;
+    }
+    io_uring_sqe* sqe = GetSqeOrFlush();
+    if (sqe == NULL) {
+        // Leak `req' rather than crashing on a completion of freed memory.
+        PLOG(ERROR) << "Fail to cancel poll on fd=" << req->fd;
+        return -1;
+    }
+    sqe->opcode = (req->events ? IORING_OP_POLL_REMOVE : IORING_OP_ASYNC_CANCEL);
+    sqe->addr = (uint64_t)req;
+    sqe->user_data = INTERNAL_USER_DATA;
+    return 0;
+}
+
+int IoUringPoller::AddPoll(PollRequest** slot, SocketId socket_id, int fd,
+                           uint32_t events) {
+    PollRequest* req = new (std::nothrow) PollRequest;
+    if (req == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    req->socket_id = socket_id;
+    req->fd = fd;
+    req->events = events;
+    req->armed = false;
+    req->removed = false;
+    if (ArmPoll(req) != 0 || _ring.Submit(0) < 0) {
+        // Never reached the kernel when ArmPoll failed. Otherwise the
+        // submission failed as a whole and no completion will come.
+        delete req;
+        return -1;
+    }
+    *slot = req;
+    return 0;
+}
+
+int IoUringPoller::AddConsumer(SocketId socket_id, int fd) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    PollEntry& e = _polls[fd];
+    if (e.in != NULL) {
+        errno = EEXIST;
+        return -1;
+    }
+    uint32_t events = EPOLLIN;
+#ifdef BRPC_SOCKET_HAS_EOF
+    events |= has_epollrdhup;
+#endif
+    const int rc = AddPoll(&e.in, socket_id, fd, events);
+    if (e.in == NULL && e.out == NULL) {
+        _polls.erase(fd);
+    }
+    return rc;
+}
+
+int IoUringPoller::AddRecvConsumer(SocketId socket_id, int fd) {
+    if (!recv_enabled()) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    PollEntry& e = _polls[fd];
+    if (e.in != NULL) {
+        errno = EEXIST;
+        return -1;
+    }
+    // Zero `events' marks multishot recv.
+    const int rc = AddPoll(&e.in, socket_id, fd, 0);
+    if (e.in == NULL && e.out == NULL) {
+        _polls.erase(fd);
+    }
+    return rc;
+}
+
+int IoUringPoller::RemoveConsumer(int fd) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    PollEntry e;
+    if (_polls.erase(fd, &e) == 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (e.in) {
+        CancelPoll(e.in);
+    }
+    if (e.out) {
+        CancelPoll(e.out);
+    }
+    return _ring.Submit(0) < 0 ? -1 : 0;
+}
+
+int IoUringPoller::AddEpollOut(SocketId socket_id, int fd, bool pollin) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    PollEntry* e = _polls.seek(fd);
+    if (pollin) {
+        if (e == NULL || e->in == NULL) {
+            // Same as EPOLL_CTL_MOD on a fd removed by RemoveConsumer.
+            errno = ENOENT;
+            return -1;
+        }
+        if (e->out != NULL) {
+            return 0;
+        }
+        return AddPoll(&e->out, socket_id, fd, EPOLLOUT);
+    }
+    if (e != NULL) {
+        errno = EEXIST;
+        return -1;
+    }
+    PollEntry& ne = _polls[fd];
+    ne.in = NULL;
+    ne.out = NULL;
+    // Hangups are watched by the poll of EPOLLIN when there's one.
+    uint32_t events = EPOLLOUT;
+#ifdef BRPC_SOCKET_HAS_EOF
+    events |= has_epollrdhup;
+#endif
+    if (AddPoll(&ne.out, socket_id, fd, events) != 0) {
+        _polls.erase(fd);
+        return -1;
+    }
+    return 0;
+}
+
+int IoUringPoller::RemoveEpollOut(SocketId, int fd, bool pollin) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    PollEntry* e = _polls.seek(fd);
+    if (e == NULL || e->out == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    CancelPoll(e->out);
+    e->out = NULL;
+    if (!pollin || e->in == NULL) {
+        if (e->in) {
+            CancelPoll(e->in);
+        }
+        _polls.erase(fd);
+    }
+    return _ring.Submit(0) < 0 ? -1 : 0;
+}
+
+void IoUringPoller::Wakeup() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    io_uring_sqe* sqe = GetSqeOrFlush();
+    if (sqe == NULL) {
+        PLOG(ERROR) << "Fail to wake up io_uring poller";
+        return;
+    }
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = INTERNAL_USER_DATA;
+    if (_ring.Submit(0) < 0) {
+        PLOG(ERROR) << "Fail to wake up io_uring poller";
+    }
+}
+
+uint32_t IoUringPoller::OnRecvCompletion(PollRequest* req,
+                                         const io_uring_cqe& cqe) {
+#ifdef BRPC_HAS_IO_URING_RECV
+    butil::IOBuf data;
+    int error = 0;
+    if (cqe.res > 0) {
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            _buf_ring->Take(cqe.flags >> IORING_CQE_BUFFER_SHIFT,
+                            cqe.res, &data);
+        }
+    } else if (cqe.res == 0) {
+        error = -1;  // EOF
+    } else if (cqe.res == -ENOBUFS || cqe.res == -ECANCELED) {
+        // Out of buffers which are committed before re-arming, or removed.
+        return 0;
+    } else {
+        error = -cqe.res;
+    }
+    if (req->removed) {
+        return 0;
+    }
+    _recv_results.push_back(RecvResult());
+    RecvResult& r = _recv_results.back();
+    r.socket_id = req->socket_id;
+    r.data.swap(data);
+    r.error = error;
+    return EPOLLIN;
+#else
+    return 0;
+#endif
+}
+
+int IoUringPoller::Wait(epoll_event* events, int max) {
+    if (_ring.WaitCqe() != 0) {
+        return -1;
+    }
+    io_uring_cqe cqes[64];
+    const int ncqe = _ring.PeekCqes(cqes, std::min(max, (int)ARRAY_SIZE(cqes)));
+    int n = 0;
+    bool rearmed = false;
+    std::unique_lock<butil::Mutex> mu(_mutex);
+    for (int i = 0; i < ncqe; ++i) {
+        const io_uring_cqe& cqe = cqes[i];
+        if (cqe.user_data == INTERNAL_USER_DATA) {
+            continue;
+        }
+        PollRequest* req = (PollRequest*)cqe.user_data;
+        uint32_t ev = 0;
+        // Broken requests are not re-armed, e.g. on EBADF or EOF, rather
+        // than failing again and again.
+        bool broken = false;
+        if (req->events == 0) {
+            ev = OnRecvCompletion(req, cqe);
+            broken = (cqe.res <= 0 && cqe.res != -ENOBUFS
+                      && cqe.res != -ECANCELED);
+        } else if (cqe.res > 0) {
+            ev = cqe.res;
+        } else if (cqe.res < 0 && cqe.res != -ECANCELED) {
+            ev = EPOLLERR;
+            broken = true;
+        }
+        if (ev && !req->removed) {
+            events[n].events = ev;
+            events[n].data.u64 = req->socket_id;
+            ++n;
+        }
+        if (cqe.flags & IORING_CQE_F_MORE) {
+            continue;
+        }
+        // The request was terminated, either cancelled by us or by the
+        // kernel (e.g. when the CQ ring overflowed).
+        req->armed = false;
+        if (req->removed) {
+            delete req;
+        } else if (broken) {
+            // Deleted in RemoveConsumer.
+        } else if (ArmPoll(req) == 0) {
+            rearmed = true;
+        } else {
+            PLOG(ERROR) << "Fail to re-arm request on fd=" << req->fd;
+        }
+    }
+#ifdef BRPC_HAS_IO_URING_RECV
+    if (_buf_ring) {
+        // Buffers taken in this round are provided again.
+        _buf_ring->Commit();
+    }
+#endif
+    if (rearmed && _ring.Submit(0) < 0) {
+        PLOG(ERROR) << "Fail to submit re-armed requests";
+    }
+    mu.unlock();
+
+    // Data must be appended before the events are reported.
+    for (size_t i = 0; i < _recv_results.size(); ++i) {
+        RecvResult& r = _recv_results[i];
+        SocketUniquePtr s;
+        if (Socket::Address(r.socket_id, &s) == 0) {
+            s->AppendIoUringRecv(&r.data, r.error);
+        }
+    }
+    _recv_results.clear();
+    return n;
+}
+
+#else  // BRPC_HAS_IO_URING
+
+bool IoUringSupported() {
+    return false;
+}
+
+bool IoUringRecvSupported() {
+    return false;
+}
+
+#endif  // BRPC_HAS_IO_URING
+
+} // namespace brpc
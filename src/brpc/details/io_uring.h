@@ -0,0 +1,257 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_DETAILS_IO_URING_H
+#define BRPC_DETAILS_IO_URING_H
+
+#include "butil/build_config.h"
+
+#if defined(OS_LINUX)
+#include <sys/epoll.h>                          // epoll_event
+#include <linux/version.h>                      // LINUX_VERSION_CODE
+#endif
+#include <vector>
+
+#include "butil/macros.h"
+#include "butil/synchronization/lock.h"          // butil::Mutex
+#include "butil/containers/flat_map.h"
+#include "butil/iobuf.h"
+#include "brpc/socket_id.h"                      // SocketId
+
+// Multishot poll (Linux 5.13) is the minimum feature we rely on. Note that
+// <linux/io_uring.h> is not included here since <linux/fs.h> included by it
+// defines macros(e.g. BLOCK_SIZE) conflicting with butil.
+#if defined(OS_LINUX) && LINUX_VERSION_CODE >= KERNEL_VERSION(5, 13, 0)
+#define BRPC_HAS_IO_URING 1
+#endif
+
+// Provided buffer rings(5.19) and multishot recv(6.0) are required to let
+// the kernel receive data into buffers chosen by itself.
+#if defined(BRPC_HAS_IO_URING) && LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+#define BRPC_HAS_IO_URING_RECV 1
+#endif
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace brpc {
+
+// True iff the running kernel supports everything the io_uring backend of
+// EventDispatcher relies on. The result is computed once.
+bool IoUringSupported();
+
+// True iff IoUringSupported() and the kernel is able to receive data into
+// provided buffer rings with multishot recv.
+bool IoUringRecvSupported();
+
+#ifdef BRPC_HAS_IO_URING
+
+// A minimal io_uring instance driven by raw syscalls (liburing is not
+// required). Submission side is NOT thread-safe, callers should serialize
+// GetSqe() and Submit(). Completion side should be consumed by a single
+// thread.
+class IoUring {
+public:
+    IoUring();
+    ~IoUring();
+
+    // Create the ring with `entries' SQEs and at least `cq_entries' CQEs.
+    // Returns 0 on success, -1 otherwise and errno is set.
+    int Init(unsigned entries, unsigned cq_entries);
+
+    int fd() const { return _fd; }
+    unsigned features() const { return _features; }
+
+    // Get a zeroed SQE or NULL when the submission queue is full.
+    io_uring_sqe* GetSqe();
+
+    // Submit all SQEs got by GetSqe() and wait for at least `wait_nr'
+    // completions. Returns number of submitted SQEs, -1 otherwise.
+    int Submit(unsigned wait_nr);
+
+    // Block until at least one completion is available.
+    // Returns 0 on success, -1 otherwise and errno is set.
+    int WaitCqe();
+
+    // Copy at most `max' completions into `cqes' and consume them.
+    // Returns number of copied completions.
+    int PeekCqes(io_uring_cqe* cqes, int max);
+
+    // Wrapper of io_uring_register(2).
+    int Register(unsigned opcode, const void* arg, unsigned nr_args);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(IoUring);
+
+    int _fd;
+    unsigned _features;
+
+    // Submission queue.
+    void* _sq_ring;
+    size_t _sq_ring_size;
+    unsigned* _sq_head;
+    unsigned* _sq_tail;
+    unsigned* _sq_mask;
+    unsigned* _sq_array;
+    io_uring_sqe* _sqes;
+    size_t _sqes_size;
+    // SQEs got by GetSqe() but not submitted yet.
+    unsigned _sqe_tail;
+
+    // Completion queue, mapped together with SQ when the kernel supports
+    // IORING_FEAT_SINGLE_MMAP.
+    void* _cq_ring;
+    size_t _cq_ring_size;
+    unsigned* _cq_head;
+    unsigned* _cq_tail;
+    unsigned* _cq_mask;
+    io_uring_cqe* _cqes;
+};
+
+#ifdef BRPC_HAS_IO_URING_RECV
+
+// A ring of buffers provided to the kernel(IORING_REGISTER_PBUF_RING), from
+// which the kernel picks one for each completed recv. Buffers are regions of
+// IOBuf blocks, so that received data is handed to sockets by reference and
+// never copied. Not thread-safe.
+class IoUringBufferRing {
+public:
+    IoUringBufferRing();
+    ~IoUringBufferRing();
+
+    // Register `nbuf'(power of 2) buffers into `ring' as group `bgid'.
+    // Returns 0 on success, -1 otherwise and errno is set.
+    int Init(IoUring* ring, uint16_t bgid, unsigned nbuf);
+
+    uint16_t bgid() const { return _bgid; }
+
+    // Cut first `len' bytes of buffer `bid' which was filled by the kernel
+    // into `out', and provide the rest of the block as buffer `bid' again,
+    // or a new block when the rest is too small.
+    void Take(uint16_t bid, uint32_t len, butil::IOBuf* out);
+
+    // Make buffers provided by Take() visible to the kernel.
+    void Commit();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(IoUringBufferRing);
+
+    int Provide(uint16_t bid);
+
+    IoUring* _ring;
+    uint16_t _bgid;
+    unsigned _nbuf;
+    // Shared with the kernel, actually `struct io_uring_buf_ring'.
+    void* _br;
+    size_t _br_size;
+    uint16_t _tail;
+    // Buffer `i' references the memory provided to the kernel with bid=i,
+    // which is the unused part of an IOBuf block.
+    std::vector<butil::IOBuf> _bufs;
+};
+
+#endif  // BRPC_HAS_IO_URING_RECV
+
+// Edge-triggered readiness notification of file descriptors implemented by
+// multishot IORING_OP_POLL_ADD. Interfaces mirror the epoll part of
+// EventDispatcher so that the dispatcher loop stays unchanged. Registering
+// and removing polls are batched into the ring instead of costing an
+// epoll_ctl each, and polls never need to be re-armed in the common case.
+class IoUringPoller {
+public:
+    IoUringPoller();
+    ~IoUringPoller();
+
+    // Returns 0 on success, -1 otherwise.
+    int Init();
+
+    int AddConsumer(SocketId socket_id, int fd);
+    int RemoveConsumer(int fd);
+
+    // True if the poller was initialized with a provided buffer ring, see
+    // -event_dispatcher_io_uring_recv.
+    bool recv_enabled() const;
+
+    // Besides notifying readiness, receive data of `fd' with multishot recv
+    // into the provided buffer ring and hand the data to the Socket before
+    // notifying. Removed by RemoveConsumer() as well.
+    int AddRecvConsumer(SocketId socket_id, int fd);
+    int AddEpollOut(SocketId socket_id, int fd, bool pollin);
+    int RemoveEpollOut(SocketId socket_id, int fd, bool pollin);
+
+    // Wait for events and store at most `max' of them into `events' in
+    // the same form as epoll_wait. Returns number of events (which may be
+    // 0 on internal completions), -1 otherwise and errno is set.
+    int Wait(epoll_event* events, int max);
+
+    // Make a blocking Wait() return.
+    void Wakeup();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(IoUringPoller);
+
+    struct PollRequest {
+        SocketId socket_id;
+        int fd;
+        // 0 for multishot recv.
+        uint32_t events;
+        // Poll is being watched by the kernel.
+        bool armed;
+        // Removed by user, deleted on the final completion.
+        bool removed;
+    };
+    struct PollEntry {
+        PollRequest* in;
+        PollRequest* out;
+    };
+    typedef butil::FlatMap<int, PollEntry> PollMap;
+    // Data received for a Socket, handed to it after releasing _mutex.
+    struct RecvResult {
+        SocketId socket_id;
+        butil::IOBuf data;
+        int error;
+    };
+
+    // Following functions are called with _mutex held.
+    int AddPoll(PollRequest** slot, SocketId socket_id, int fd,
+                uint32_t events);
+    int ArmPoll(PollRequest* req);
+    int CancelPoll(PollRequest* req);
+    // Take data of a multishot recv completion from the buffer ring into
+    // _recv_results. Returns events to report.
+    uint32_t OnRecvCompletion(PollRequest* req, const io_uring_cqe& cqe);
+    io_uring_sqe* GetSqeOrFlush();
+
+    butil::Mutex _mutex;
+    IoUring _ring;
+    PollMap _polls;
+#ifdef BRPC_HAS_IO_URING_RECV
+    IoUringBufferRing* _buf_ring;
+#endif
+    // Only used by Wait(). Sockets are addressed without holding _mutex,
+    // since dereferencing a Socket may recycle it, which calls
+    // RemoveConsumer().
+    std::vector<RecvResult> _recv_results;
+};
+
+#endif  // BRPC_HAS_IO_URING
+
+} // namespace brpc
+
+
+#endif  // BRPC_DETAILS_IO_URING_H
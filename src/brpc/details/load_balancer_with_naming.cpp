@@ -16,11 +16,66 @@
 // under the License.
 
 
+#include <unistd.h>                                  // getpid
+#include <algorithm>                                 // std::sort
+#include <gflags/gflags.h>
+#include "butil/endpoint.h"                          // butil::my_ip_cstr
+#include "butil/string_printf.h"
+#include "butil/time.h"                              // milliseconds_from_now
+#include "butil/third_party/murmurhash3/murmurhash3.h"
+#include "brpc/log.h"
+#include "brpc/socket.h"
+#include "brpc/periodic_task.h"
+#include "brpc/reloadable_flags.h"
 #include "brpc/details/load_balancer_with_naming.h"
 
 
 namespace brpc {
 
+DEFINE_string(subset_client_id, "", "Key of this process in rendezvous "
+              "hashing of subsetting(ChannelOptions.subset_size), processes "
+              "with different keys choose different subsets. Empty means "
+              "<local-ip>:<pid>");
+
+DEFINE_int32(subset_refresh_interval_ms, 1000, "Check health of servers "
+             "in subsets every so many milliseconds, for channels with "
+             "ChannelOptions.grow_subset_on_unhealthy on");
+BRPC_VALIDATE_GFLAG(subset_refresh_interval_ms, PositiveInteger);
+
+static uint32_t GetSubsetSeed() {
+    std::string key = FLAGS_subset_client_id;
+    if (key.empty()) {
+        key = butil::string_printf("%s:%d", butil::my_ip_cstr(), (int)getpid());
+    }
+    uint32_t seed = 0;
+    butil::MurmurHash3_x86_32(key.data(), key.size(), 0, &seed);
+    return seed;
+}
+
+// Refresh the subset periodically until the channel is destroyed.
+class SubsetRefreshTask : public PeriodicTask {
+public:
+    explicit SubsetRefreshTask(LoadBalancerWithNaming* lb) : _lb(lb) {}
+
+    bool OnTriggeringTask(timespec* next_abstime) override {
+        if (_lb->ref_count() == 1) {
+            // Only referenced by this task, nobody uses the lb anymore.
+            return false;
+        }
+        _lb->RefreshSubset();
+        *next_abstime = butil::milliseconds_from_now(
+            FLAGS_subset_refresh_interval_ms);
+        return true;
+    }
+
+    void OnDestroyingTask() override {
+        delete this;
+    }
+
+private:
+    butil::intrusive_ptr<LoadBalancerWithNaming> _lb;
+};
+
 LoadBalancerWithNaming::~LoadBalancerWithNaming() {
     if (_nsthread_ptr.get()) {
         _nsthread_ptr->RemoveWatcher(this);
@@ -29,10 +84,14 @@ LoadBalancerWithNaming::~LoadBalancerWithNaming() {
 
 int LoadBalancerWithNaming::Init(const char* ns_url, const char* lb_name,
                                  const NamingServiceFilter* filter,
-                                 const GetNamingServiceThreadOptions* options) {
+                                 const GetNamingServiceThreadOptions* options,
+                                 const SubsetOptions* subset_options) {
     if (SharedLoadBalancer::Init(lb_name) != 0) {
         return -1;
     }
+    if (subset_options) {
+        _subset_options = *subset_options;
+    }
     if (GetNamingServiceThread(&_nsthread_ptr, ns_url, options) != 0) {
         LOG(ERROR) << "Fail to get NamingServiceThread";
         return -1;
@@ -41,17 +100,110 @@ int LoadBalancerWithNaming::Init(const char* ns_url, const char* lb_name,
         LOG(ERROR) << "Fail to add watcher into _server_list";
         return -1;
     }
+    if (_subset_options.subset_size > 0 &&
+        _subset_options.grow_on_unhealthy) {
+        PeriodicTaskManager::StartTaskAt(
+            new SubsetRefreshTask(this),
+            butil::milliseconds_from_now(FLAGS_subset_refresh_interval_ms));
+    }
     return 0;
 }
 
 void LoadBalancerWithNaming::OnAddedServers(
     const std::vector<ServerId>& servers) {
-    AddServersInBatch(servers);
+    if (_subset_options.subset_size == 0) {
+        AddServersInBatch(servers);
+        return;
+    }
+    static const uint32_t seed = GetSubsetSeed();
+    BAIDU_SCOPED_LOCK(_subset_mutex);
+    for (size_t i = 0; i < servers.size(); ++i) {
+        SocketUniquePtr ptr;
+        if (Socket::AddressFailedAsWell(servers[i].id, &ptr) == -1) {
+            continue;
+        }
+        // Hash addresses rather than SocketIds so that the subset is same
+        // after restarting.
+        std::string key = endpoint2str(ptr->remote_side()).c_str();
+        key.append(servers[i].tag);
+        uint64_t hash[2];
+        butil::MurmurHash3_x64_128(key.data(), key.size(), seed, hash);
+        const Candidate c = { servers[i], hash[0] };
+        _candidates.push_back(c);
+    }
+    std::sort(_candidates.begin(), _candidates.end());
+    UpdateSubset();
 }
 
 void LoadBalancerWithNaming::OnRemovedServers(
     const std::vector<ServerId>& servers) {
-    RemoveServersInBatch(servers);
+    if (_subset_options.subset_size == 0) {
+        RemoveServersInBatch(servers);
+        return;
+    }
+    std::vector<ServerId> removed(servers);
+    std::sort(removed.begin(), removed.end());
+    BAIDU_SCOPED_LOCK(_subset_mutex);
+    size_t j = 0;
+    for (size_t i = 0; i < _candidates.size(); ++i) {
+        if (!std::binary_search(removed.begin(), removed.end(),
+                                _candidates[i].server)) {
+            _candidates[j++] = _candidates[i];
+        }
+    }
+    _candidates.resize(j);
+    UpdateSubset();
+}
+
+void LoadBalancerWithNaming::RefreshSubset() {
+    BAIDU_SCOPED_LOCK(_subset_mutex);
+    UpdateSubset();
+}
+
+void LoadBalancerWithNaming::UpdateSubset() {
+    const size_t subset_size = _subset_options.subset_size;
+    std::vector<ServerId> subset;
+    subset.reserve(subset_size);
+    size_t nhealthy = 0;
+    for (size_t i = 0; i < _candidates.size(); ++i) {
+        if (!_subset_options.grow_on_unhealthy) {
+            if (subset.size() >= subset_size) {
+                break;
+            }
+            subset.push_back(_candidates[i].server);
+            continue;
+        }
+        if (nhealthy >= subset_size) {
+            break;
+        }
+        // Unhealthy servers are kept in the subset so that they're used
+        // again after being revived.
+        subset.push_back(_candidates[i].server);
+        SocketUniquePtr ptr;
+        if (Socket::Address(_candidates[i].server.id, &ptr) == 0 &&
+            ptr->IsAvailable()) {
+            ++nhealthy;
+        }
+    }
+    std::sort(subset.begin(), subset.end());
+    std::vector<ServerId> added;
+    std::set_difference(subset.begin(), subset.end(),
+                        _subset.begin(), _subset.end(),
+                        std::back_inserter(added));
+    std::vector<ServerId> removed;
+    std::set_difference(_subset.begin(), _subset.end(),
+                        subset.begin(), subset.end(),
+                        std::back_inserter(removed));
+    _subset.swap(subset);
+    // Add before removing so that the load balancer is never emptied.
+    if (!added.empty()) {
+        RPC_VLOG << "Subset: added " << added.size();
+        AddServersInBatch(added);
+    }
+    if (!removed.empty()) {
+        RPC_VLOG << "Subset: removed " << removed.size();
+        RemoveServersInBatch(removed);
+    }
 }
 
 void LoadBalancerWithNaming::Describe(std::ostream& os,
@@ -61,6 +213,10 @@ void LoadBalancerWithNaming::Describe(std::ostream& os,
     } else {
         os << "NULL";
     }
+    if (_subset_options.subset_size > 0) {
+        BAIDU_SCOPED_LOCK(_subset_mutex);
+        os << " subset=" << _subset.size() << '/' << _candidates.size();
+    }
     os << " lb=";
     SharedLoadBalancer::Describe(os, options);
 }
@@ -19,30 +19,72 @@
 #ifndef BRPC_LOAD_BALANCER_WITH_NAMING_H
 #define BRPC_LOAD_BALANCER_WITH_NAMING_H
 
+#include <gflags/gflags_declare.h>
 #include "butil/intrusive_ptr.hpp"
+#include "butil/synchronization/lock.h"                 // butil::Mutex
 #include "brpc/load_balancer.h"
 #include "brpc/details/naming_service_thread.h"         // NamingServiceWatcher
 
 
 namespace brpc {
 
+DECLARE_string(subset_client_id);
+DECLARE_int32(subset_refresh_interval_ms);
+
+// See ChannelOptions.subset_size and grow_subset_on_unhealthy.
+struct SubsetOptions {
+    SubsetOptions() : subset_size(0), grow_on_unhealthy(false) {}
+
+    size_t subset_size;
+    bool grow_on_unhealthy;
+};
+
 class LoadBalancerWithNaming : public SharedLoadBalancer,
                                public NamingServiceWatcher {
 public:
     LoadBalancerWithNaming() {}
     ~LoadBalancerWithNaming();
 
+    // When subsetting is enabled with `subset_options', only a subset of
+    // servers from the naming service are added into the load balancer.
+    // NOTE: this object must be created by new when the subset grows on
+    // unhealthy servers, which references this object in a periodic task.
     int Init(const char* ns_url, const char* lb_name,
              const NamingServiceFilter* filter,
-             const GetNamingServiceThreadOptions* options);
+             const GetNamingServiceThreadOptions* options,
+             const SubsetOptions* subset_options = NULL);
     
     void OnAddedServers(const std::vector<ServerId>& servers);
     void OnRemovedServers(const std::vector<ServerId>& servers);
 
+    // Choose the subset again according to health of servers.
+    void RefreshSubset();
+
     void Describe(std::ostream& os, const DescribeOptions& options);
 
 private:
+    struct Candidate {
+        ServerId server;
+        // Score of rendezvous hashing, servers with higher scores are
+        // chosen first.
+        uint64_t score;
+
+        bool operator<(const Candidate& rhs) const {
+            return score != rhs.score ? score > rhs.score : server < rhs.server;
+        }
+    };
+
+    // Update the subset with _candidates and modify the load balancer.
+    // Called with _subset_mutex locked.
+    void UpdateSubset();
+
     butil::intrusive_ptr<NamingServiceThread> _nsthread_ptr;
+    SubsetOptions _subset_options;
+    butil::Mutex _subset_mutex;
+    // All servers from the naming service, sorted by scores.
+    std::vector<Candidate> _candidates;
+    // Servers in the load balancer, sorted.
+    std::vector<ServerId> _subset;
 };
 
 } // namespace brpc
@@ -22,13 +22,30 @@
 
 
 #include <limits>
+#include <gflags/gflags.h>
 #include "butil/macros.h"
 #include "brpc/controller.h"
 #include "brpc/details/server_private_accessor.h"
 #include "brpc/details/method_status.h"
 
+namespace bvar {
+DECLARE_bool(bvar_latency_use_sketch);
+}
+
 namespace brpc {
 
+DEFINE_bool(method_stage_latency, true, "Record latencies of stages (queueing,"
+            " parsing, processing, serializing and writing) of calls to "
+            "methods. Only effective to methods added after this flag is set "
+            "and protocols supporting it(baidu_std)");
+
+static const int64_t EXPECTED_LATENCY_REFRESH_US = 100000;
+
+// Indexed by MethodStatus::Stage.
+static const char* const g_stage_names[] = {
+    "queue", "parse", "process", "serialize", "write"
+};
+
 __attribute__((no_sanitize("thread")))
 static int cast_int(void* arg) {
     return *(int*)arg;
@@ -42,12 +59,33 @@ static int cast_cl(void* arg) {
     return 0;
 }
 
+template <int64_t numerator, int64_t denominator>
+static int64_t get_latency_percentile(void* arg) {
+    return static_cast<MethodStatus*>(arg)->LatencyPercentile(
+        (double)numerator / denominator);
+}
+
 MethodStatus::MethodStatus()
     : _nconcurrency(0)
     , _nconcurrency_bvar(cast_int, &_nconcurrency)
     , _eps_bvar(&_nerror_bvar)
     , _max_concurrency_bvar(cast_cl, &_cl)
+    , _latency_99_bvar(get_latency_percentile<99, 100>, this)
+    , _latency_999_bvar(get_latency_percentile<999, 1000>, this)
+    , _latency_9999_bvar(get_latency_percentile<9999, 10000>, this)
+    , _expected_latency_us(0)
+    , _expected_latency_update_us(0)
 {
+    if (bvar::FLAGS_bvar_latency_use_sketch) {
+        _latency_sketch.reset(new bvar::detail::PercentileSketch);
+        _latency_sketch_window.reset(new bvar::detail::PercentileSketchWindow(
+                                         _latency_sketch.get(), -1));
+    }
+    BAIDU_CASSERT(arraysize(g_stage_names) == STAGE_COUNT,
+                  g_stage_names_match_stages);
+    if (FLAGS_method_stage_latency) {
+        _stage_latency.reset(new StageLatency[STAGE_COUNT]);
+    }
 }
 
 MethodStatus::~MethodStatus() {
@@ -71,9 +109,57 @@ int MethodStatus::Expose(const butil::StringPiece& prefix) {
             return -1;
         }
     }
+    if (_latency_sketch) {
+        _latency_sketch->set_debug_name(prefix);
+        if (_latency_99_bvar.expose_as(prefix, "latency_99") != 0) {
+            return -1;
+        }
+        if (_latency_999_bvar.expose_as(prefix, "latency_999") != 0) {
+            return -1;
+        }
+        if (_latency_9999_bvar.expose_as(prefix, "latency_9999") != 0) {
+            return -1;
+        }
+    }
+    if (_stage_latency) {
+        for (int i = 0; i < STAGE_COUNT; ++i) {
+            const std::string name =
+                std::string(g_stage_names[i]) + "_latency";
+            if (_stage_latency[i].window.expose_as(prefix, name) != 0) {
+                return -1;
+            }
+        }
+    }
     return 0;
 }
 
+int64_t MethodStatus::LatencyPercentile(double ratio) const {
+    if (!_latency_sketch_window) {
+        return 0;
+    }
+    return _latency_sketch_window->get_value().get_number(ratio);
+}
+
+int64_t MethodStatus::ExpectedLatency(int64_t now_us) const {
+    if (NULL == _stage_latency) {
+        return 0;
+    }
+    int64_t update_us =
+        _expected_latency_update_us.load(butil::memory_order_relaxed);
+    if (now_us - update_us >= EXPECTED_LATENCY_REFRESH_US &&
+        _expected_latency_update_us.compare_exchange_strong(
+            update_us, now_us, butil::memory_order_relaxed)) {
+        // Only one thread reads the windows which are not cheap.
+        int64_t latency_us = 0;
+        for (int i = STAGE_PROCESS; i < STAGE_COUNT; ++i) {
+            latency_us +=
+                _stage_latency[i].window.get_value().get_average_int();
+        }
+        _expected_latency_us.store(latency_us, butil::memory_order_relaxed);
+    }
+    return _expected_latency_us.load(butil::memory_order_relaxed);
+}
+
 template <typename T>
 void OutputTextValue(std::ostream& os,
                      const char* prefix,
@@ -139,8 +225,27 @@ void MethodStatus::Describe(
     //     OutputTextValue(os, "latency_9999: ",
     //                     _latency_rec.latency_percentile(0.9999));
     // }
+    if (_latency_sketch_window) {
+        const bvar::detail::QuantileSketch sketch =
+            _latency_sketch_window->get_value();
+        OutputValue(os, "latency_99: ", _latency_99_bvar.name(),
+                    sketch.get_number(0.99), options, false);
+        OutputValue(os, "latency_999: ", _latency_999_bvar.name(),
+                    sketch.get_number(0.999), options, false);
+        OutputValue(os, "latency_9999: ", _latency_9999_bvar.name(),
+                    sketch.get_number(0.9999), options, false);
+    }
     OutputValue(os, "max_latency: ", _latency_rec.max_latency_name(),
                 _latency_rec.max_latency(), options, false);
+    if (_stage_latency) {
+        for (int i = 0; i < STAGE_COUNT; ++i) {
+            const std::string label =
+                std::string(g_stage_names[i]) + "_latency: ";
+            OutputValue(os, label.c_str(), _stage_latency[i].window.name(),
+                        _stage_latency[i].window.get_value().get_average_int(),
+                        options, false);
+        }
+    }
 
     // Concurrency
     OutputValue(os, "concurrency: ", _nconcurrency_bvar.name(),
@@ -26,6 +26,7 @@
 
 #include "butil/macros.h"                  // DISALLOW_COPY_AND_ASSIGN
 #include "bvar/bvar.h"                    // vars
+#include "bvar/detail/quantile_sketch.h"  // PercentileSketch
 #include "brpc/describable.h"
 #include "brpc/concurrency_limiter.h"
 
@@ -34,6 +35,30 @@ namespace brpc {
 
 class Controller;
 class Server;
+
+// Timestamps (butil::cpuwide_time_us()) of the stages of a call processed
+// by the server, 0 for the stages not reached.
+struct ServerStageTimes {
+    // InputMessenger cut the request from the socket.
+    int64_t received_us;
+    // The protocol started to process the request.
+    int64_t start_parse_us;
+    // The request was parsed.
+    int64_t end_parse_us;
+    // The method was called, later than end_parse_us when the method is
+    // called in a new bthread (see ServiceOptions.bthread_priority).
+    int64_t start_callback_us;
+    // done->Run() was called by the user.
+    int64_t start_send_us;
+    // Started and finished serializing (and compressing) the response.
+    int64_t start_serialize_us;
+    int64_t end_serialize_us;
+    // The response started to be written.
+    int64_t start_write_us;
+    // Socket::Write() returned.
+    int64_t end_write_us;
+};
+
 // Record accessing stats of a method.
 class MethodStatus : public Describable {
 public:
@@ -53,6 +78,11 @@ public:
     // did the time keeping and the cost is better saved. 
     void OnResponded(int error_code, int64_t latency_us);
 
+    // Call this when the response of a successful call was written to
+    // record latencies of stages. No-op unless -method_stage_latency was
+    // on when this MethodStatus was created.
+    void OnStagesDone(const ServerStageTimes& times);
+
     // Expose internal vars.
     // Return 0 on success, -1 otherwise.
     int Expose(const butil::StringPiece& prefix);
@@ -63,6 +93,18 @@ public:
     // Current max_concurrency of the method.
     int MaxConcurrency() const { return _cl ? _cl->MaxConcurrency() : 0; }
 
+    // Get |ratio|-ile latency of successful calls in recent
+    // -bvar_dump_interval seconds, E.g. 0.99 means 99%-ile.
+    // Always 0 unless -bvar_latency_use_sketch was on when this
+    // MethodStatus was created.
+    int64_t LatencyPercentile(double ratio) const;
+
+    // Average microseconds from calling the method to writing the response
+    // in recent -bvar_dump_interval seconds, refreshed every 100ms. Always
+    // 0 unless -method_stage_latency was on when this MethodStatus was
+    // created.
+    int64_t ExpectedLatency(int64_t now_us) const;
+
 private:
 friend class Server;
     DISALLOW_COPY_AND_ASSIGN(MethodStatus);
@@ -71,6 +113,28 @@ friend class Server;
     // before the server is started. 
     void SetConcurrencyLimiter(ConcurrencyLimiter* cl);
 
+    // Record the latency between two timestamps of ServerStageTimes.
+    void OnStage(int stage, int64_t begin_us, int64_t end_us) {
+        if (begin_us > 0 && end_us >= begin_us) {
+            _stage_latency[stage].recorder << end_us - begin_us;
+        }
+    }
+
+    enum Stage {
+        STAGE_QUEUE = 0,
+        STAGE_PARSE,
+        STAGE_PROCESS,
+        STAGE_SERIALIZE,
+        STAGE_WRITE,
+        STAGE_COUNT
+    };
+    // Average latency of a stage in recent -bvar_dump_interval seconds.
+    struct StageLatency {
+        StageLatency() : window(&recorder, -1) {}
+        bvar::IntRecorder recorder;
+        bvar::detail::RecorderWindow window;
+    };
+
     std::unique_ptr<ConcurrencyLimiter> _cl;
     butil::atomic<int> _nconcurrency;
     bvar::Adder<int64_t>  _nerror_bvar;
@@ -78,6 +142,18 @@ friend class Server;
     bvar::PassiveStatus<int>  _nconcurrency_bvar;
     bvar::PerSecond<bvar::Adder<int64_t>> _eps_bvar;
     bvar::PassiveStatus<int32_t> _max_concurrency_bvar;
+    // Latencies are recorded into the sketch as well when
+    // -bvar_latency_use_sketch is on.
+    std::unique_ptr<bvar::detail::PercentileSketch> _latency_sketch;
+    std::unique_ptr<bvar::detail::PercentileSketchWindow> _latency_sketch_window;
+    bvar::PassiveStatus<int64_t> _latency_99_bvar;
+    bvar::PassiveStatus<int64_t> _latency_999_bvar;
+    bvar::PassiveStatus<int64_t> _latency_9999_bvar;
+    // Indexed by Stage, NULL when -method_stage_latency is off.
+    std::unique_ptr<StageLatency[]> _stage_latency;
+    // Cached result of ExpectedLatency() and when it was computed.
+    mutable butil::atomic<int64_t> _expected_latency_us;
+    mutable butil::atomic<int64_t> _expected_latency_update_us;
 };
 
 class ConcurrencyRemover {
@@ -109,6 +185,9 @@ inline void MethodStatus::OnResponded(int error_code, int64_t latency) {
     _nconcurrency.fetch_sub(1, butil::memory_order_relaxed);
     if (0 == error_code) {
         _latency_rec << latency;
+        if (_latency_sketch) {
+            *_latency_sketch << latency;
+        }
     } else {
         _nerror_bvar << 1;
     }
@@ -117,6 +196,23 @@ inline void MethodStatus::OnResponded(int error_code, int64_t latency) {
     }
 }
 
+inline void MethodStatus::OnStagesDone(const ServerStageTimes& t) {
+    if (NULL == _stage_latency) {
+        return;
+    }
+    // Waiting for the bthread calling the method is queueing as well.
+    if (t.received_us > 0 && t.start_parse_us >= t.received_us &&
+        t.end_parse_us > 0 && t.start_callback_us >= t.end_parse_us) {
+        _stage_latency[STAGE_QUEUE].recorder
+            << (t.start_parse_us - t.received_us) +
+               (t.start_callback_us - t.end_parse_us);
+    }
+    OnStage(STAGE_PARSE, t.start_parse_us, t.end_parse_us);
+    OnStage(STAGE_PROCESS, t.start_callback_us, t.start_send_us);
+    OnStage(STAGE_SERIALIZE, t.start_serialize_us, t.end_serialize_us);
+    OnStage(STAGE_WRITE, t.start_write_us, t.end_write_us);
+}
+
 } // namespace brpc
 
 #endif  //BRPC_METHOD_STATUS_H
@@ -56,6 +56,13 @@ public:
         }
     }
 
+    // Returns true if the request to `mp' is admitted by deadline-aware
+    // admission and CoDel shedding of the server.
+    bool AdmitRequest(const Server::MethodProperty* mp, Controller* c,
+                      int64_t received_us) const {
+        return _server->AdmitRequest(mp, c, received_us);
+    }
+
     // Find by MethodDescriptor::full_name
     const Server::MethodProperty*
     FindMethodPropertyByFullName(const butil::StringPiece &fullname) {
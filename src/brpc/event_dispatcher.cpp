@@ -20,6 +20,7 @@
 #include "butil/compat.h"
 #include "butil/fd_utility.h"                         // make_close_on_exec
 #include "butil/logging.h"                            // LOG
+#include "butil/scoped_lock.h"                        // BAIDU_SCOPED_LOCK
 #include "butil/third_party/murmurhash3/murmurhash3.h"// fmix32
 #include "bthread/bthread.h"                          // bthread_start_background
 #include "brpc/event_dispatcher.h"
@@ -32,34 +33,77 @@ DEFINE_int32(event_dispatcher_num, 1, "Number of event dispatcher");
 DEFINE_bool(usercode_in_pthread, false, 
             "Call user's callback in pthreads, use bthreads otherwise");
 
+// Dispatchers of all worker groups, -event_dispatcher_num for each group.
+// Dispatchers of groups other than the default one are started on first use.
 static EventDispatcher* g_edisp = NULL;
+static int g_edisp_ntag = 0;
+static butil::atomic<bool>* g_edisp_started = NULL;
 static pthread_once_t g_edisp_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_edisp_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static void StopAndJoinGlobalDispatchers() {
-    for (int i = 0; i < FLAGS_event_dispatcher_num; ++i) {
-        g_edisp[i].Stop();
-        g_edisp[i].Join();
+    for (int tag = 0; tag < g_edisp_ntag; ++tag) {
+        if (!g_edisp_started[tag].load(butil::memory_order_acquire)) {
+            continue;
+        }
+        for (int i = 0; i < FLAGS_event_dispatcher_num; ++i) {
+            EventDispatcher& edisp = g_edisp[tag * FLAGS_event_dispatcher_num + i];
+            edisp.Stop();
+            edisp.Join();
+        }
     }
 }
-void InitializeGlobalDispatchers() {
-    g_edisp = new EventDispatcher[FLAGS_event_dispatcher_num];
+
+static void StartGlobalDispatchers(bthread_tag_t tag) {
     for (int i = 0; i < FLAGS_event_dispatcher_num; ++i) {
-        const bthread_attr_t attr = FLAGS_usercode_in_pthread ?
+        bthread_attr_t attr = FLAGS_usercode_in_pthread ?
             BTHREAD_ATTR_PTHREAD : BTHREAD_ATTR_NORMAL;
-        CHECK_EQ(0, g_edisp[i].Start(&attr));
+        attr.tag = tag;
+        CHECK_EQ(0, g_edisp[tag * FLAGS_event_dispatcher_num + i].Start(&attr));
+    }
+    g_edisp_started[tag].store(true, butil::memory_order_release);
+}
+
+void InitializeGlobalDispatchers() {
+    while (bthread_worker_group_concurrency(g_edisp_ntag) >= 0) {
+        ++g_edisp_ntag;
     }
+    g_edisp = new EventDispatcher[g_edisp_ntag * FLAGS_event_dispatcher_num];
+    g_edisp_started = new butil::atomic<bool>[g_edisp_ntag];
+    for (int tag = 0; tag < g_edisp_ntag; ++tag) {
+        g_edisp_started[tag].store(false, butil::memory_order_relaxed);
+    }
+    StartGlobalDispatchers(BTHREAD_TAG_DEFAULT);
     // This atexit is will be run before g_task_control.stop() because above
     // Start() initializes g_task_control by creating bthread (to run epoll/kqueue).
     CHECK_EQ(0, atexit(StopAndJoinGlobalDispatchers));
 }
 
 EventDispatcher& GetGlobalEventDispatcher(int fd) {
+    return GetGlobalEventDispatcher(fd, BTHREAD_TAG_DEFAULT, -1);
+}
+
+EventDispatcher& GetGlobalEventDispatcher(int fd, int index) {
+    return GetGlobalEventDispatcher(fd, BTHREAD_TAG_DEFAULT, index);
+}
+
+EventDispatcher& GetGlobalEventDispatcher(int fd, bthread_tag_t tag, int index) {
     pthread_once(&g_edisp_once, InitializeGlobalDispatchers);
-    if (FLAGS_event_dispatcher_num == 1) {
-        return g_edisp[0];
+    if (tag < 0 || tag >= g_edisp_ntag) {
+        tag = BTHREAD_TAG_DEFAULT;
+    }
+    if (!g_edisp_started[tag].load(butil::memory_order_acquire)) {
+        BAIDU_SCOPED_LOCK(g_edisp_mutex);
+        if (!g_edisp_started[tag].load(butil::memory_order_relaxed)) {
+            StartGlobalDispatchers(tag);
+        }
+    }
+    if (index < 0) {
+        index = (FLAGS_event_dispatcher_num == 1 ? 0 :
+                 butil::fmix32(fd) % FLAGS_event_dispatcher_num);
     }
-    int index = butil::fmix32(fd) % FLAGS_event_dispatcher_num;
-    return g_edisp[index];
+    return g_edisp[tag * FLAGS_event_dispatcher_num +
+                   index % FLAGS_event_dispatcher_num];
 }
 
 } // namespace brpc
@@ -31,6 +31,8 @@
 
 namespace brpc {
 
+class IoUringPoller;
+
 // Dispatch edge-triggered events of file descriptors to consumers
 // running in separate bthreads.
 class EventDispatcher {
@@ -64,6 +66,17 @@ public:
     // Returns 0 on success, -1 otherwise.
     int AddConsumer(SocketId socket_id, int fd);
 
+    // True if data of consumers can be received by this dispatcher with
+    // io_uring, see -event_dispatcher_io_uring_recv.
+    bool io_uring_recv_enabled() const;
+
+    // Same as AddConsumer, besides that data of `fd' is received by this
+    // dispatcher into IOBuf blocks provided to the kernel and handed to
+    // the Socket before calling `on_edge_triggered_events'. Socket::DoRead
+    // should not read `fd' anymore.
+    // Returns 0 on success, -1 otherwise and errno is set.
+    int AddRecvConsumer(SocketId socket_id, int fd);
+
     // Watch EPOLLOUT event on `fd' into epoll device. If `pollin' is
     // true, EPOLLIN event will also be included and EPOLL_CTL_MOD will
     // be used instead of EPOLL_CTL_ADD. When event arrives,
@@ -91,6 +104,10 @@ private:
     // The epoll to watch events.
     int _epfd;
 
+    // Watch events with io_uring instead of epoll when it's not NULL,
+    // see -event_dispatcher_use_io_uring.
+    IoUringPoller* _uring;
+
     // false unless Stop() is called.
 #if defined(THREAD_SANITIZER)
     std::atomic<bool> _stop;
@@ -110,6 +127,15 @@ private:
 
 EventDispatcher& GetGlobalEventDispatcher(int fd);
 
+// Get the global dispatcher at `index' (modulo -event_dispatcher_num) if
+// `index' is non-negative, otherwise the one chosen by `fd' as above.
+EventDispatcher& GetGlobalEventDispatcher(int fd, int index);
+
+// Same as above, but get the dispatcher of worker group `tag'(see
+// -bthread_worker_groups) which runs the consumers in bthreads of the group.
+// Dispatchers of a group other than the default one are started on first use.
+EventDispatcher& GetGlobalEventDispatcher(int fd, bthread_tag_t tag, int index);
+
 } // namespace brpc
 
 
@@ -19,15 +19,34 @@
 #ifdef BRPC_SOCKET_HAS_EOF
 #include "brpc/details/has_epollrdhup.h"
 #endif
+#include "brpc/details/io_uring.h"
 
 namespace brpc {
 
+DEFINE_bool(event_dispatcher_use_io_uring, false,
+            "Watch events of sockets with io_uring(multishot poll) instead "
+            "of epoll. Fall back to epoll if the kernel does not support it");
+
 EventDispatcher::EventDispatcher()
     : _epfd(-1)
+    , _uring(NULL)
     , _stop(false)
     , _tid(0)
     , _consumer_thread_attr(BTHREAD_ATTR_NORMAL)
 {
+    _wakeup_fds[0] = -1;
+    _wakeup_fds[1] = -1;
+#ifdef BRPC_HAS_IO_URING
+    if (FLAGS_event_dispatcher_use_io_uring) {
+        IoUringPoller* uring = new IoUringPoller;
+        if (uring->Init() == 0) {
+            _uring = uring;
+            return;
+        }
+        delete uring;
+        LOG(WARNING) << "Fail to create io_uring, fall back to epoll";
+    }
+#endif
     _epfd = epoll_create(1024 * 1024);
     if (_epfd < 0) {
         PLOG(FATAL) << "Fail to create epoll";
@@ -35,8 +54,6 @@ EventDispatcher::EventDispatcher()
     }
     CHECK_EQ(0, butil::make_close_on_exec(_epfd));
 
-    _wakeup_fds[0] = -1;
-    _wakeup_fds[1] = -1;
     if (pipe(_wakeup_fds) != 0) {
         PLOG(FATAL) << "Fail to create pipe";
         return;
@@ -54,10 +71,14 @@ EventDispatcher::~EventDispatcher() {
         close(_wakeup_fds[0]);
         close(_wakeup_fds[1]);
     }
+#ifdef BRPC_HAS_IO_URING
+    delete _uring;
+    _uring = NULL;
+#endif
 }
 
 int EventDispatcher::Start(const bthread_attr_t* consumer_thread_attr) {
-    if (_epfd < 0) {
+    if (_epfd < 0 && _uring == NULL) {
         LOG(FATAL) << "epoll was not created";
         return -1;
     }
@@ -92,12 +113,18 @@ int EventDispatcher::Start(const bthread_attr_t* consumer_thread_attr) {
 }
 
 bool EventDispatcher::Running() const {
-    return !_stop  && _epfd >= 0 && _tid != 0;
+    return !_stop  && (_epfd >= 0 || _uring != NULL) && _tid != 0;
 }
 
 void EventDispatcher::Stop() {
     _stop = true;
 
+#ifdef BRPC_HAS_IO_URING
+    if (_uring) {
+        _uring->Wakeup();
+        return;
+    }
+#endif
     if (_epfd >= 0) {
         epoll_event evt = { EPOLLOUT,  { NULL } };
         epoll_ctl(_epfd, EPOLL_CTL_ADD, _wakeup_fds[1], &evt);
@@ -112,6 +139,11 @@ void EventDispatcher::Join() {
 }
 
 int EventDispatcher::AddEpollOut(SocketId socket_id, int fd, bool pollin) {
+#ifdef BRPC_HAS_IO_URING
+    if (_uring) {
+        return _uring->AddEpollOut(socket_id, fd, pollin);
+    }
+#endif
     if (_epfd < 0) {
         errno = EINVAL;
         return -1;
@@ -140,6 +172,11 @@ int EventDispatcher::AddEpollOut(SocketId socket_id, int fd, bool pollin) {
 
 int EventDispatcher::RemoveEpollOut(SocketId socket_id, 
                                     int fd, bool pollin) {
+#ifdef BRPC_HAS_IO_URING
+    if (_uring) {
+        return _uring->RemoveEpollOut(socket_id, fd, pollin);
+    }
+#endif
     if (pollin) {
         epoll_event evt;
         evt.data.u64 = socket_id;
@@ -155,6 +192,11 @@ int EventDispatcher::RemoveEpollOut(SocketId socket_id,
 }
 
 int EventDispatcher::AddConsumer(SocketId socket_id, int fd) {
+#ifdef BRPC_HAS_IO_URING
+    if (_uring) {
+        return _uring->AddConsumer(socket_id, fd);
+    }
+#endif
     if (_epfd < 0) {
         errno = EINVAL;
         return -1;
@@ -169,6 +211,24 @@ int EventDispatcher::AddConsumer(SocketId socket_id, int fd) {
     return -1;
 }
 
+bool EventDispatcher::io_uring_recv_enabled() const {
+#ifdef BRPC_HAS_IO_URING
+    return _uring != NULL && _uring->recv_enabled();
+#else
+    return false;
+#endif
+}
+
+int EventDispatcher::AddRecvConsumer(SocketId socket_id, int fd) {
+#ifdef BRPC_HAS_IO_URING
+    if (_uring) {
+        return _uring->AddRecvConsumer(socket_id, fd);
+    }
+#endif
+    errno = ENOTSUP;
+    return -1;
+}
+
 int EventDispatcher::RemoveConsumer(int fd) {
     if (fd < 0) {
         return -1;
@@ -180,6 +240,15 @@ int EventDispatcher::RemoveConsumer(int fd) {
     // from epoll again! If the fd was level-triggered and there's data left,
     // epoll_wait will keep returning events of the fd continuously, making
     // program abnormal.
+#ifdef BRPC_HAS_IO_URING
+    if (_uring) {
+        if (_uring->RemoveConsumer(fd) < 0) {
+            PLOG(WARNING) << "Fail to remove fd=" << fd << " from io_uring";
+            return -1;
+        }
+        return 0;
+    }
+#endif
     if (epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, NULL) < 0) {
         PLOG(WARNING) << "Fail to remove fd=" << fd << " from epfd=" << _epfd;
         return -1;
@@ -195,15 +264,25 @@ void* EventDispatcher::RunThis(void* arg) {
 void EventDispatcher::Run() {
     while (!_stop) {
         epoll_event e[32];
+        int n = 0;
+#ifdef BRPC_HAS_IO_URING
+        if (_uring) {
+            // Registrations are batched into the ring, a single
+            // io_uring_enter reaps all events of this round.
+            n = _uring->Wait(e, ARRAY_SIZE(e));
+        } else
+#endif
+        {
 #ifdef BRPC_ADDITIONAL_EPOLL
-        // Performance downgrades in examples.
-        int n = epoll_wait(_epfd, e, ARRAY_SIZE(e), 0);
-        if (n == 0) {
-            n = epoll_wait(_epfd, e, ARRAY_SIZE(e), -1);
-        }
+            // Performance downgrades in examples.
+            n = epoll_wait(_epfd, e, ARRAY_SIZE(e), 0);
+            if (n == 0) {
+                n = epoll_wait(_epfd, e, ARRAY_SIZE(e), -1);
+            }
 #else
-        const int n = epoll_wait(_epfd, e, ARRAY_SIZE(e), -1);
+            n = epoll_wait(_epfd, e, ARRAY_SIZE(e), -1);
 #endif
+        }
         if (_stop) {
             // epoll_ctl/epoll_wait should have some sort of memory fencing
             // guaranteeing that we(after epoll_wait) see _stop set before
@@ -24,6 +24,7 @@ namespace brpc {
 
 EventDispatcher::EventDispatcher()
     : _epfd(-1)
+    , _uring(NULL)
     , _stop(false)
     , _tid(0)
     , _consumer_thread_attr(BTHREAD_ATTR_NORMAL)
@@ -162,6 +163,15 @@ int EventDispatcher::AddConsumer(SocketId socket_id, int fd) {
     return kevent(_epfd, &evt, 1, NULL, 0, NULL);
 }
 
+bool EventDispatcher::io_uring_recv_enabled() const {
+    return false;
+}
+
+int EventDispatcher::AddRecvConsumer(SocketId, int) {
+    errno = ENOTSUP;
+    return -1;
+}
+
 int EventDispatcher::RemoveConsumer(int fd) {
     if (fd < 0) {
         return -1;
@@ -51,6 +51,8 @@
 #include "brpc/policy/randomized_load_balancer.h"
 #include "brpc/policy/weighted_randomized_load_balancer.h"
 #include "brpc/policy/locality_aware_load_balancer.h"
+#include "brpc/policy/p2c_load_balancer.h"
+#include "brpc/policy/maglev_load_balancer.h"
 #include "brpc/policy/consistent_hashing_load_balancer.h"
 #include "brpc/policy/hasher.h"
 #include "brpc/policy/dynpart_load_balancer.h"
@@ -59,6 +61,8 @@
 #include "brpc/compress.h"
 #include "brpc/policy/gzip_compress.h"
 #include "brpc/policy/snappy_compress.h"
+#include "brpc/policy/lz4_compress.h"
+#include "brpc/policy/zstd_compress.h"
 
 // Protocols
 #include "brpc/protocol.h"
@@ -90,6 +94,7 @@
 #include "brpc/socket_map.h"          // SocketMapList
 #include "brpc/server.h"
 #include "brpc/trackme.h"             // TrackMe
+#include "brpc/metrics_pusher.h"      // PushMetricsIfNeeded
 #include "brpc/details/usercode_backup_pool.h"
 #if defined(OS_LINUX)
 #include <malloc.h>                   // malloc_trim
@@ -148,6 +153,8 @@ struct GlobalExtensions {
     RandomizedLoadBalancer randomized_lb;
     WeightedRandomizedLoadBalancer wr_lb;
     LocalityAwareLoadBalancer la_lb;
+    P2CLoadBalancer p2c_lb;
+    MaglevLoadBalancer maglev_lb;
     ConsistentHashingLoadBalancer ch_mh_lb;
     ConsistentHashingLoadBalancer ch_md5_lb;
     ConsistentHashingLoadBalancer ch_ketama_lb;
@@ -253,6 +260,8 @@ static void* GlobalUpdate(void*) {
 
         TrackMe();
 
+        PushMetricsIfNeeded();
+
         if (!IsDummyServerRunning()
             && g_running_server_count.load(butil::memory_order_relaxed) == 0
             && fw.check_and_consume() > 0) {
@@ -376,6 +385,8 @@ static void GlobalInitializeOrDieImpl() {
     LoadBalancerExtension()->RegisterOrDie("random", &g_ext->randomized_lb);
     LoadBalancerExtension()->RegisterOrDie("wr", &g_ext->wr_lb);
     LoadBalancerExtension()->RegisterOrDie("la", &g_ext->la_lb);
+    LoadBalancerExtension()->RegisterOrDie("p2c", &g_ext->p2c_lb);
+    LoadBalancerExtension()->RegisterOrDie("maglev", &g_ext->maglev_lb);
     LoadBalancerExtension()->RegisterOrDie("c_murmurhash", &g_ext->ch_mh_lb);
     LoadBalancerExtension()->RegisterOrDie("c_md5", &g_ext->ch_md5_lb);
     LoadBalancerExtension()->RegisterOrDie("c_ketama", &g_ext->ch_ketama_lb);
@@ -383,20 +394,38 @@ static void GlobalInitializeOrDieImpl() {
 
     // Compress Handlers
     const CompressHandler gzip_compress =
-        { GzipCompress, GzipDecompress, "gzip" };
+        { GzipCompress, GzipDecompress, "gzip",
+          NewGzipCompressor, NewGzipDecompressor };
     if (RegisterCompressHandler(COMPRESS_TYPE_GZIP, gzip_compress) != 0) {
         exit(1);
     }
     const CompressHandler zlib_compress =
-        { ZlibCompress, ZlibDecompress, "zlib" };
+        { ZlibCompress, ZlibDecompress, "zlib",
+          NewZlibCompressor, NewZlibDecompressor };
     if (RegisterCompressHandler(COMPRESS_TYPE_ZLIB, zlib_compress) != 0) {
         exit(1);
     }
     const CompressHandler snappy_compress =
-        { SnappyCompress, SnappyDecompress, "snappy" };
+        { SnappyCompress, SnappyDecompress, "snappy", NULL, NULL };
     if (RegisterCompressHandler(COMPRESS_TYPE_SNAPPY, snappy_compress) != 0) {
         exit(1);
     }
+#if BRPC_WITH_LZ4
+    const CompressHandler lz4_compress =
+        { Lz4Compress, Lz4Decompress, "lz4",
+          NewLz4Compressor, NewLz4Decompressor };
+    if (RegisterCompressHandler(COMPRESS_TYPE_LZ4, lz4_compress) != 0) {
+        exit(1);
+    }
+#endif
+#if BRPC_WITH_ZSTD
+    const CompressHandler zstd_compress =
+        { ZstdCompress, ZstdDecompress, "zstd",
+          NewZstdCompressor, NewZstdDecompressor };
+    if (RegisterCompressHandler(COMPRESS_TYPE_ZSTD, zstd_compress) != 0) {
+        exit(1);
+    }
+#endif
 
     // Protocols
     Protocol baidu_protocol = { ParseRpcMessage,
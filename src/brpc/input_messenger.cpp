@@ -26,8 +26,7 @@
 #include "butil/logging.h"                       // CHECK
 #include "butil/time.h"                          // cpuwide_time_us
 #include "butil/fd_utility.h"                    // make_non_blocking
-#include "bthread/bthread.h"                     // bthread_start_background
-#include "bthread/unstable.h"                   // bthread_flush
+#include "bthread/bthread.h"                     // bthread_start_batch
 #include "bvar/bvar.h"                          // bvar::Adder
 #include "brpc/options.pb.h"               // ProtocolType
 #include "brpc/reloadable_flags.h"         // BRPC_VALIDATE_GFLAG
@@ -172,31 +171,52 @@ struct RunLastMessage {
     }
 };
 
-static void QueueMessage(InputMessageBase* to_run_msg,
-                         int* num_bthread_created,
-                         bthread_keytable_pool_t* keytable_pool) {
-    if (!to_run_msg) {
-        return;
+// Messages to be processed in separate bthreads, which are created together
+// by bthread_start_batch() when the queue is full or flushed.
+class MessageQueue {
+public:
+    explicit MessageQueue(bthread_keytable_pool_t* keytable_pool)
+        : _keytable_pool(keytable_pool), _n(0) {}
+    ~MessageQueue() { Flush(); }
+
+    void Push(InputMessageBase* to_run_msg) {
+        if (!to_run_msg) {
+            return;
+        }
+        if (_n == ARRAY_SIZE(_msgs)) {
+            Flush();
+        }
+        _msgs[_n++] = to_run_msg;
     }
-    // Create bthread for last_msg. The bthread is not scheduled
-    // until bthread_flush() is called (in the worse case).
-                
-    // TODO(gejun): Join threads.
-    bthread_t th;
-    bthread_attr_t tmp = (FLAGS_usercode_in_pthread ?
-                          BTHREAD_ATTR_PTHREAD :
-                          BTHREAD_ATTR_NORMAL) | BTHREAD_NOSIGNAL;
-    tmp.keytable_pool = keytable_pool;
-    if (bthread_start_background(
-            &th, &tmp, ProcessInputMessage, to_run_msg) == 0) {
-        ++*num_bthread_created;
+
+    void Flush() {
+        if (_n == 0) {
+            return;
+        }
+        // TODO(gejun): Join threads.
+        bthread_t ths[ARRAY_SIZE(_msgs)];
+        bthread_attr_t tmp = (FLAGS_usercode_in_pthread ?
+                              BTHREAD_ATTR_PTHREAD : BTHREAD_ATTR_NORMAL);
+        tmp.keytable_pool = _keytable_pool;
+        bthread_start_batch(ths, &tmp, ProcessInputMessage, _msgs, _n);
+        for (size_t i = 0; i < _n; ++i) {
+            if (ths[i] == INVALID_BTHREAD) {
+                ProcessInputMessage(_msgs[i]);
+            }
 #ifdef BRPC_USE_PTHREAD_ONLY
-        pthread_detach(th);
+            else {
+                pthread_detach(ths[i]);
+            }
 #endif
-    } else {
-        ProcessInputMessage(to_run_msg);
+        }
+        _n = 0;
     }
-}
+
+private:
+    bthread_keytable_pool_t* _keytable_pool;
+    size_t _n;
+    void* _msgs[32];
+};
 
 InputMessenger::InputMessageClosure::~InputMessageClosure() {
     if (_msg) {
@@ -221,7 +241,8 @@ int InputMessenger::ProcessNewMessage(
     m->_last_readtime_us.store(received_us, butil::memory_order_relaxed);
     
     size_t last_size = m->_read_buf.length();
-    int num_bthread_created = 0;
+    // Flushed on all returns.
+    MessageQueue queued_msgs(m->_keytable_pool);
     while (1) {
         size_t index = 8888;
         ParseResult pr = CutInputMessage(m, &index, read_eof);
@@ -277,8 +298,7 @@ int InputMessenger::ProcessNewMessage(
         // This unique_ptr prevents msg to be lost before transfering
         // ownership to last_msg
         DestroyingPtr<InputMessageBase> msg(pr.message());
-        QueueMessage(last_msg.release(), &num_bthread_created,
-                            m->_keytable_pool);
+        queued_msgs.Push(last_msg.release());
         if (_handlers[index].process == NULL) {
             LOG(ERROR) << "process of index=" << index << " is NULL";
             continue;
@@ -311,15 +331,10 @@ int InputMessenger::ProcessNewMessage(
             // Transfer ownership to last_msg
             last_msg.reset(msg.release());
         } else {
-            QueueMessage(msg.release(), &num_bthread_created,
-                                m->_keytable_pool);
-            bthread_flush();
-            num_bthread_created = 0;
+            queued_msgs.Push(msg.release());
+            queued_msgs.Flush();
         }
     }
-    if (num_bthread_created) {
-        bthread_flush();
-    }
     return 0;
 }
 
@@ -330,8 +345,8 @@ void InputMessenger::OnNewMessages(Socket* m) {
     // - If the socket has several messages, all messages will be parsed (
     //   meaning cutting from butil::IOBuf. serializing from protobuf is part of
     //   "process") in this bthread. All messages except the last one will be
-    //   processed in separate bthreads. To minimize the overhead, scheduling
-    //   is batched(notice the BTHREAD_NOSIGNAL and bthread_flush).
+    //   processed in separate bthreads. To minimize the overhead, the bthreads
+    //   are created and scheduled in batch(notice the bthread_start_batch).
     // - Verify will always be called in this bthread at most once and before
     //   any process.
     InputMessenger* messenger = static_cast<InputMessenger*>(m->user());
@@ -74,6 +74,7 @@ struct InputMessageHandler {
 // `Message' corresponds to a client's request or a server's response.
 class InputMessenger : public SocketUser {
 friend class rdma::RdmaEndpoint;
+friend class Socket;
 public:
     explicit InputMessenger(size_t capacity = 128);
     ~InputMessenger();
@@ -0,0 +1,443 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <unistd.h>                         // getpid
+#include <algorithm>                        // std::sort
+#include <gflags/gflags.h>
+#include "butil/time.h"                     // gettimeofday_us
+#include "butil/fast_rand.h"                // fast_rand_less_than
+#include "butil/string_printf.h"            // string_printf
+#include "bvar/bvar.h"
+#include "brpc/log.h"
+#include "brpc/controller.h"
+#include "brpc/policy/hasher.h"             // MurmurHash32
+#include "brpc/metrics_pusher.h"
+
+namespace bvar {
+DECLARE_int32(bvar_max_dump_multi_dimension_metric_number);
+}
+
+namespace brpc {
+
+DEFINE_string(metrics_push_server, "", "Push bvars to the "
+              "MetricsCollectorService at this address or naming service "
+              "url, not reloadable");
+DEFINE_int32(metrics_push_interval, 10, "Push bvars to -metrics_push_server "
+             "every so many seconds");
+
+static const int32_t METRICS_PUSH_MAX_INTERVAL = 3600;
+
+MetricsPusherOptions::MetricsPusherOptions()
+    : source(butil::string_printf("%s:%d", butil::my_hostname(), (int)getpid()))
+    , interval_s(10)
+    , compress_type(COMPRESS_TYPE_SNAPPY) {
+}
+
+struct MetricsPusher::Series {
+    uint32_t id;
+    bool is_int;
+    int64_t last_int;
+    // Description in last push.
+    std::string last_desc;
+    uint64_t collect_id;
+};
+
+// Put new and changed series into the request.
+class MetricsPusher::Collector : public bvar::Dumper {
+public:
+    Collector(MetricsPusher* pusher, MetricsPushRequest* request)
+        : _pusher(pusher), _request(request) {}
+
+    bool dump(const std::string& name, const butil::StringPiece& desc) override;
+
+    void Finish();
+
+private:
+    MetricsPusher* _pusher;
+    MetricsPushRequest* _request;
+    std::vector<std::pair<uint32_t, int64_t> > _ints;
+    std::vector<std::pair<uint32_t, double> > _floats;
+};
+
+bool MetricsPusher::Collector::dump(const std::string& name,
+                                    const butil::StringPiece& desc) {
+    // Only numbers are pushed. Strings are quoted and vectors are
+    // surrounded by brackets.
+    char buf[64];
+    if (desc.empty() || desc.size() >= sizeof(buf) ||
+        desc[0] == '"' || desc[0] == '[') {
+        return true;
+    }
+    Series** ps = _pusher->_series.seek(name);
+    Series* s = NULL;
+    if (ps != NULL) {
+        s = *ps;
+        if (s->collect_id == _pusher->_collect_id) {
+            // Dumped more than once.
+            return true;
+        }
+        if (desc == s->last_desc) {
+            s->collect_id = _pusher->_collect_id;
+            return true;
+        }
+    }
+    memcpy(buf, desc.data(), desc.size());
+    buf[desc.size()] = '\0';
+    char* endptr = NULL;
+    const long long int_value = strtoll(buf, &endptr, 10);
+    const bool is_int = (endptr == buf + desc.size());
+    double float_value = 0;
+    if (!is_int) {
+        float_value = strtod(buf, &endptr);
+        if (endptr != buf + desc.size()) {
+            return true;
+        }
+    }
+    if (s == NULL) {
+        s = new Series;
+        s->id = _pusher->_next_id++;
+        s->is_int = false;
+        s->last_int = 0;
+        _pusher->_series[name] = s;
+        _request->add_new_names(name);
+    }
+    s->collect_id = _pusher->_collect_id;
+    s->last_desc.assign(desc.data(), desc.size());
+    s->is_int = is_int;
+    if (is_int) {
+        _ints.push_back(std::make_pair(s->id, int_value - s->last_int));
+        s->last_int = int_value;
+    } else {
+        _floats.push_back(std::make_pair(s->id, float_value));
+        s->last_int = 0;
+    }
+    return true;
+}
+
+void MetricsPusher::Collector::Finish() {
+    // Series are dumped in unspecified order, sort them to delta-encode ids.
+    std::sort(_ints.begin(), _ints.end());
+    uint32_t last_id = 0;
+    for (size_t i = 0; i < _ints.size(); ++i) {
+        _request->add_int_id_deltas(_ints[i].first - last_id);
+        _request->add_int_value_deltas(_ints[i].second);
+        last_id = _ints[i].first;
+    }
+    std::sort(_floats.begin(), _floats.end());
+    last_id = 0;
+    for (size_t i = 0; i < _floats.size(); ++i) {
+        _request->add_float_id_deltas(_floats[i].first - last_id);
+        _request->add_float_values(_floats[i].second);
+        last_id = _floats[i].first;
+    }
+}
+
+MetricsPusher::MetricsPusher()
+    : _tid(INVALID_BTHREAD)
+    , _started(false)
+    , _stop(false)
+    , _interval_s(0)
+    , _epoch(0)
+    , _sequence(0)
+    , _collect_id(0)
+    , _next_id(0)
+    , _full(true) {
+}
+
+MetricsPusher::~MetricsPusher() {
+    Stop();
+    ClearSeries();
+}
+
+void MetricsPusher::ClearSeries() {
+    for (SeriesMap::iterator it = _series.begin(); it != _series.end(); ++it) {
+        delete it->second;
+    }
+    _series.clear();
+    _next_id = 0;
+}
+
+int MetricsPusher::Init(const char* naming_service_url,
+                        const char* load_balancer_name,
+                        const MetricsPusherOptions* options) {
+    if (options) {
+        _options = *options;
+    }
+    if (_options.interval_s <= 0) {
+        LOG(ERROR) << "Invalid interval_s=" << _options.interval_s;
+        return -1;
+    }
+    _interval_s.store(_options.interval_s, butil::memory_order_relaxed);
+    if (_series.init(1024, 80) != 0) {
+        LOG(ERROR) << "Fail to init _series";
+        return -1;
+    }
+    if (_chan.Init(naming_service_url, load_balancer_name,
+                   &_options.channel_options) != 0) {
+        LOG(ERROR) << "Fail to init channel to " << naming_service_url;
+        return -1;
+    }
+    // Timestamps are different after restarting.
+    _epoch = butil::gettimeofday_us();
+    return 0;
+}
+
+void MetricsPusher::Collect(MetricsPushRequest* request) {
+    if (_full) {
+        ClearSeries();
+        request->set_full(true);
+    }
+    ++_collect_id;
+    request->set_source(_options.source);
+    request->set_epoch(_epoch);
+    request->set_sequence(++_sequence);
+    request->set_timestamp_us(butil::gettimeofday_us());
+    request->set_first_new_id(_next_id);
+    Collector collector(this, request);
+    bvar::Variable::dump_exposed_unsorted(&collector, bvar::DISPLAY_ON_PLAIN_TEXT);
+    if (bvar::FLAGS_bvar_max_dump_multi_dimension_metric_number > 0) {
+        bvar::MVariable::dump_exposed(&collector, NULL);
+    }
+    collector.Finish();
+
+    std::vector<uint32_t> removed;
+    for (SeriesMap::iterator it = _series.begin(); it != _series.end(); ++it) {
+        if (it->second->collect_id != _collect_id) {
+            removed.push_back(it->second->id);
+        }
+    }
+    if (!removed.empty()) {
+        std::vector<std::string> removed_names;
+        for (SeriesMap::iterator it = _series.begin(); it != _series.end(); ++it) {
+            if (it->second->collect_id != _collect_id) {
+                removed_names.push_back(it->first);
+                delete it->second;
+            }
+        }
+        for (size_t i = 0; i < removed_names.size(); ++i) {
+            _series.erase(removed_names[i]);
+        }
+        std::sort(removed.begin(), removed.end());
+        uint32_t last_id = 0;
+        for (size_t i = 0; i < removed.size(); ++i) {
+            request->add_removed_id_deltas(removed[i] - last_id);
+            last_id = removed[i];
+        }
+    }
+}
+
+int MetricsPusher::PushOnce() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    MetricsPushRequest request;
+    Collect(&request);
+    // Until the push succeeds, the collector may not have the states in
+    // the pusher.
+    _full = true;
+    MetricsPushResponse response;
+    Controller cntl;
+    cntl.set_request_compress_type(_options.compress_type);
+    // Pushes from a source go to the same collector if consistent hashing
+    // is used.
+    cntl.set_request_code(policy::MurmurHash32(_options.source.data(),
+                                               _options.source.size()));
+    MetricsCollectorService_Stub stub(&_chan);
+    stub.Push(&cntl, &request, &response, NULL);
+    if (cntl.Failed()) {
+        RPC_VLOG << "Fail to push metrics, " << cntl.ErrorText();
+        return -1;
+    }
+    _full = response.resync();
+    if (response.has_new_interval()) {
+        int32_t new_interval = response.new_interval();
+        new_interval = std::max(new_interval, 1);
+        new_interval = std::min(new_interval, METRICS_PUSH_MAX_INTERVAL);
+        _interval_s.store(new_interval, butil::memory_order_relaxed);
+    }
+    return 0;
+}
+
+void* MetricsPusher::RunThis(void* arg) {
+    static_cast<MetricsPusher*>(arg)->Run();
+    return NULL;
+}
+
+void MetricsPusher::Run() {
+    // Spread pushes of processes started at the same time.
+    int64_t next_push_us = butil::gettimeofday_us() +
+        butil::fast_rand_less_than(_interval_s.load(butil::memory_order_relaxed) *
+                                   1000000L);
+    while (!_stop.load(butil::memory_order_relaxed)) {
+        const int64_t now = butil::gettimeofday_us();
+        if (now < next_push_us) {
+            if (bthread_usleep(std::min<int64_t>(next_push_us - now, 100000)) != 0 &&
+                errno == ESTOP) {
+                break;
+            }
+            continue;
+        }
+        PushOnce();
+        next_push_us = butil::gettimeofday_us() +
+            _interval_s.load(butil::memory_order_relaxed) * 1000000L;
+    }
+}
+
+int MetricsPusher::Start() {
+    if (_started) {
+        LOG(ERROR) << "MetricsPusher is already started";
+        return -1;
+    }
+    _stop.store(false, butil::memory_order_relaxed);
+    if (bthread_start_background(&_tid, NULL, RunThis, this) != 0) {
+        LOG(ERROR) << "Fail to start bthread";
+        return -1;
+    }
+    _started = true;
+    return 0;
+}
+
+void MetricsPusher::Stop() {
+    if (!_started) {
+        return;
+    }
+    _stop.store(true, butil::memory_order_relaxed);
+    bthread_stop(_tid);
+    bthread_join(_tid, NULL);
+    _started = false;
+}
+
+MetricsPushState::MetricsPushState()
+    : _epoch(0), _sequence(0), _timestamp_us(0) {
+}
+
+// Returns true if all ids delta-encoded in `deltas' are known.
+static bool CheckIds(const google::protobuf::RepeatedField<uint32_t>& deltas,
+                     const std::map<uint32_t, MetricsPushState::Series>& series,
+                     uint32_t first_new_id, uint32_t end_new_id) {
+    uint32_t id = 0;
+    for (int i = 0; i < deltas.size(); ++i) {
+        id += deltas.Get(i);
+        if ((id < first_new_id || id >= end_new_id) &&
+            series.find(id) == series.end()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int MetricsPushState::Apply(const MetricsPushRequest& req) {
+    if (!req.full() &&
+        (req.epoch() != _epoch || req.sequence() != _sequence + 1)) {
+        return -1;
+    }
+    if (req.int_id_deltas_size() != req.int_value_deltas_size() ||
+        req.float_id_deltas_size() != req.float_values_size()) {
+        return -1;
+    }
+    // Check all ids before changing anything.
+    const std::map<uint32_t, Series> empty;
+    const std::map<uint32_t, Series>& known = (req.full() ? empty : _series);
+    const uint32_t first_new_id = req.first_new_id();
+    const uint32_t end_new_id = first_new_id + req.new_names_size();
+    if (req.new_names_size() != 0 && !known.empty() &&
+        known.rbegin()->first >= first_new_id) {
+        return -1;
+    }
+    if (!CheckIds(req.int_id_deltas(), known, first_new_id, end_new_id) ||
+        !CheckIds(req.float_id_deltas(), known, first_new_id, end_new_id) ||
+        !CheckIds(req.removed_id_deltas(), known, first_new_id, end_new_id)) {
+        return -1;
+    }
+
+    if (req.full()) {
+        _series.clear();
+    }
+    for (int i = 0; i < req.new_names_size(); ++i) {
+        Series& s = _series[first_new_id + i];
+        s.name = req.new_names(i);
+        s.is_int = false;
+        s.int_value = 0;
+        s.float_value = 0;
+    }
+    uint32_t id = 0;
+    for (int i = 0; i < req.int_id_deltas_size(); ++i) {
+        id += req.int_id_deltas(i);
+        Series& s = _series[id];
+        s.int_value = (s.is_int ? s.int_value : 0) + req.int_value_deltas(i);
+        s.is_int = true;
+    }
+    id = 0;
+    for (int i = 0; i < req.float_id_deltas_size(); ++i) {
+        id += req.float_id_deltas(i);
+        Series& s = _series[id];
+        s.float_value = req.float_values(i);
+        s.is_int = false;
+    }
+    id = 0;
+    for (int i = 0; i < req.removed_id_deltas_size(); ++i) {
+        id += req.removed_id_deltas(i);
+        _series.erase(id);
+    }
+    _epoch = req.epoch();
+    _sequence = req.sequence();
+    _timestamp_us = req.timestamp_us();
+    return 0;
+}
+
+void MetricsPushState::List(std::vector<const Series*>* series) const {
+    series->clear();
+    series->reserve(_series.size());
+    for (std::map<uint32_t, Series>::const_iterator it = _series.begin();
+         it != _series.end(); ++it) {
+        series->push_back(&it->second);
+    }
+}
+
+static pthread_mutex_t s_metrics_pusher_mutex = PTHREAD_MUTEX_INITIALIZER;
+static MetricsPusher* s_metrics_pusher = NULL;
+static bool s_metrics_pusher_failed = false;
+
+// Called in global.cpp
+void PushMetricsIfNeeded() {
+    if (FLAGS_metrics_push_server.empty()) {
+        return;
+    }
+    BAIDU_SCOPED_LOCK(s_metrics_pusher_mutex);
+    if (s_metrics_pusher != NULL || s_metrics_pusher_failed) {
+        return;
+    }
+    MetricsPusherOptions options;
+    options.interval_s = FLAGS_metrics_push_interval;
+    // Keep #connections on collectors low.
+    options.channel_options.connection_type = CONNECTION_TYPE_SHORT;
+    // Naming services need a load balancer. Pushes from a process go
+    // to the same collector so that only changes are pushed.
+    const char* lb_name =
+        (FLAGS_metrics_push_server.find("://") != std::string::npos ?
+         "c_murmurhash" : "");
+    MetricsPusher* pusher = new MetricsPusher;
+    if (pusher->Init(FLAGS_metrics_push_server.c_str(), lb_name, &options) != 0 ||
+        pusher->Start() != 0) {
+        LOG(ERROR) << "Fail to push metrics to " << FLAGS_metrics_push_server;
+        delete pusher;
+        s_metrics_pusher_failed = true;
+        return;
+    }
+    s_metrics_pusher = pusher;
+}
+
+} // namespace brpc
@@ -0,0 +1,149 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_METRICS_PUSHER_H
+#define BRPC_METRICS_PUSHER_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "butil/containers/flat_map.h"      // FlatMap
+#include "bthread/mutex.h"                  // bthread::Mutex
+#include "brpc/channel.h"                   // Channel
+#include "brpc/metrics_push.pb.h"           // MetricsPushRequest
+
+namespace brpc {
+
+struct MetricsPusherOptions {
+    // Constructed with default options.
+    MetricsPusherOptions();
+
+    // Who is pushing, filled in MetricsPushRequest.source.
+    // Default: hostname:pid
+    std::string source;
+
+    // Push every so many seconds. Overwritten by new_interval in responses
+    // of the collector.
+    // Default: 10
+    int32_t interval_s;
+
+    // Compression of pushed data.
+    // Default: COMPRESS_TYPE_SNAPPY
+    CompressType compress_type;
+
+    // Options of the channel to the collector.
+    ChannelOptions channel_options;
+};
+
+// Push numeric bvars and mbvars to a MetricsCollectorService periodically.
+// Names are sent once and only changed values are sent later, so that the
+// payload is much smaller than the result of pulling /vars or /brpc_metrics.
+// -metrics_push_server starts a pusher in every process using brpc, create a
+// pusher manually for collectors not described by a url, or for pushing
+// to multiple collectors.
+// Check tools/metrics_collector for a sample collector.
+class MetricsPusher {
+public:
+    MetricsPusher();
+    ~MetricsPusher();
+
+    // Push to collectors specified by `naming_service_url' and
+    // `load_balancer_name', see Channel::Init() for details.
+    // Returns 0 on success, -1 otherwise.
+    int Init(const char* naming_service_url,
+             const char* load_balancer_name,
+             const MetricsPusherOptions* options);
+
+    // Start a bthread pushing every options.interval_s seconds.
+    // Returns 0 on success, -1 otherwise.
+    int Start();
+
+    // Stop the bthread started by Start() and wait for it to quit.
+    void Stop();
+
+    // Collect variables and push them now, synchronously.
+    // Returns 0 on success, -1 otherwise.
+    int PushOnce();
+
+    int32_t interval_s() const { return _interval_s; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(MetricsPusher);
+    class Collector;
+    struct Series;
+    typedef butil::FlatMap<std::string, Series*> SeriesMap;
+
+    static void* RunThis(void* arg);
+    void Run();
+    void Collect(MetricsPushRequest* request);
+    void ClearSeries();
+
+    MetricsPusherOptions _options;
+    Channel _chan;
+    bthread_t _tid;
+    bool _started;
+    butil::atomic<bool> _stop;
+    butil::atomic<int32_t> _interval_s;
+    // Pushing states, protected by _mutex which is held during pushing.
+    bthread::Mutex _mutex;
+    uint64_t _epoch;
+    uint64_t _sequence;
+    uint64_t _collect_id;
+    uint32_t _next_id;
+    bool _full;
+    SeriesMap _series;
+};
+
+// Apply MetricsPushRequest in collectors.
+// Not thread-safe, a collector should keep one state for each source.
+class MetricsPushState {
+public:
+    struct Series {
+        std::string name;
+        bool is_int;
+        int64_t int_value;
+        double float_value;
+    };
+
+    MetricsPushState();
+
+    // Apply `request' to this state.
+    // Returns 0 on success, -1 if the request can't be applied in which case
+    // the state is not changed and the pusher should be asked for resync.
+    int Apply(const MetricsPushRequest& request);
+
+    // Get all series in ascending order of ids.
+    void List(std::vector<const Series*>* series) const;
+
+    size_t size() const { return _series.size(); }
+    int64_t last_timestamp_us() const { return _timestamp_us; }
+
+private:
+    uint64_t _epoch;
+    uint64_t _sequence;
+    int64_t _timestamp_us;
+    std::map<uint32_t, Series> _series;
+};
+
+// [Internal] Called in global.cpp every second, start pushing to
+// -metrics_push_server if it's set.
+void PushMetricsIfNeeded();
+
+} // namespace brpc
+
+#endif // BRPC_METRICS_PUSHER_H
@@ -145,8 +145,9 @@ void SendRpcResponse(int64_t correlation_id,
                      int64_t received_us) {
     ControllerPrivateAccessor accessor(cntl);
     Span* span = accessor.span();
+    const int64_t start_send_us = butil::cpuwide_time_us();
     if (span) {
-        span->set_start_send_us(butil::cpuwide_time_us());
+        span->set_start_send_us(start_send_us);
     }
     Socket* sock = accessor.get_sending_socket();
     std::unique_ptr<Controller, LogErrorTextAndDelete> recycle_cntl(cntl);
@@ -167,16 +168,22 @@ void SendRpcResponse(int64_t correlation_id,
     // If user calls `SetFailed' on Controller, we don't serialize
     // response either
     CompressType type = cntl->response_compress_type();
+    int64_t start_serialize_us = 0;
+    int64_t end_serialize_us = 0;
     if (res != NULL && !cntl->Failed()) {
         if (!res->IsInitialized()) {
             cntl->SetFailed(
                 ERESPONSE, "Missing required fields in response: %s", 
                 res->InitializationErrorString().c_str());
-        } else if (!SerializeAsCompressedData(*res, &res_body, type)) {
-            cntl->SetFailed(ERESPONSE, "Fail to serialize response, "
-                            "CompressType=%s", CompressTypeToCStr(type));
         } else {
-            append_body = true;
+            start_serialize_us = butil::cpuwide_time_us();
+            if (!SerializeAsCompressedData(*res, &res_body, type)) {
+                cntl->SetFailed(ERESPONSE, "Fail to serialize response, "
+                                "CompressType=%s", CompressTypeToCStr(type));
+            } else {
+                end_serialize_us = butil::cpuwide_time_us();
+                append_body = true;
+            }
         }
     }
 
@@ -231,6 +238,7 @@ void SendRpcResponse(int64_t correlation_id,
     if (span) {
         span->set_response_size(res_buf.size());
     }
+    const int64_t start_write_us = butil::cpuwide_time_us();
     // Send rpc response over stream even if server side failed to create
     // stream for some reasons.
     if(cntl->has_remote_stream()){
@@ -269,9 +277,17 @@ void SendRpcResponse(int64_t correlation_id,
         }
     }
 
+    const int64_t end_write_us = butil::cpuwide_time_us();
     if (span) {
         // TODO: this is not sent
-        span->set_sent_us(butil::cpuwide_time_us());
+        span->set_sent_us(end_write_us);
+    }
+    if (method_status && !cntl->Failed()) {
+        const ServerStageTimes times = {
+            received_us, accessor.start_parse_us(), accessor.end_parse_us(),
+            accessor.start_callback_us(), start_send_us, start_serialize_us,
+            end_serialize_us, start_write_us, end_write_us };
+        method_status->OnStagesDone(times);
     }
 }
 
@@ -309,6 +325,70 @@ void EndRunningCallMethodInPool(
     return EndRunningUserCodeInPool(CallMethodInBackupThread, args);
 };
 
+static void* CallMethodInNewBthreadThread(void* void_args) {
+    // The method is called from now on, waiting for this bthread to run is
+    // not counted as processing.
+    CallMethodInBackupThreadArgs* args = (CallMethodInBackupThreadArgs*)void_args;
+    ControllerPrivateAccessor accessor(
+        static_cast<Controller*>(args->controller));
+    const int64_t start_callback_us = butil::cpuwide_time_us();
+    accessor.set_start_callback_us(start_callback_us);
+    if (accessor.span()) {
+        accessor.span()->set_start_callback_us(start_callback_us);
+    }
+    if (!FLAGS_usercode_in_pthread) {
+        CallMethodInBackupThread(void_args);
+        return NULL;
+    }
+    if (BeginRunningUserCode()) {
+        CallMethodInBackupThread(void_args);
+        EndRunningUserCodeInPlace();
+    } else {
+        EndRunningUserCodeInPool(CallMethodInBackupThread, void_args);
+    }
+    return NULL;
+}
+
+// Whether the method should be called in a new bthread of its worker group
+// (see ServiceOptions.bthread_worker_group) or priority (see
+// ServiceOptions.bthread_priority) rather than the current one, which is
+// always of normal priority in the group of the server.
+// Used by other protocols as well.
+bool ShouldCallMethodInNewBthread(const Server::MethodProperty* mp) {
+    return (mp->bthread_tag != BTHREAD_TAG_INVALID &&
+            mp->bthread_tag != bthread_self_tag()) ||
+        mp->bthread_priority != BTHREAD_PRIORITY_NORMAL;
+}
+
+// Call the method in a new bthread of the worker group and priority of `mp'.
+// Used by other protocols as well.
+void CallMethodInNewBthread(
+    const Server::MethodProperty* mp,
+    ::google::protobuf::Service* service,
+    const ::google::protobuf::MethodDescriptor* method,
+    ::google::protobuf::RpcController* controller,
+    const ::google::protobuf::Message* request,
+    ::google::protobuf::Message* response,
+    ::google::protobuf::Closure* done) {
+    CallMethodInBackupThreadArgs* args = new CallMethodInBackupThreadArgs;
+    args->service = service;
+    args->method = method;
+    args->controller = controller;
+    args->request = request;
+    args->response = response;
+    args->done = done;
+    bthread_attr_t attr = BTHREAD_ATTR_NORMAL | BTHREAD_INHERIT_SPAN;
+    attr.tag = mp->bthread_tag;
+    attr.priority = mp->bthread_priority;
+    bthread_t th;
+    if (bthread_start_background(&th, &attr, CallMethodInNewBthreadThread,
+                                 args) != 0) {
+        LOG(ERROR) << "Fail to start bthread in worker group=" << attr.tag
+                   << " priority=" << attr.priority;
+        CallMethodInNewBthreadThread(args);
+    }
+}
+
 void ProcessRpcRequest(InputMessageBase* msg_base) {
     const int64_t start_parse_us = butil::cpuwide_time_us();
     DestroyingPtr<MostCommonMessage> msg(static_cast<MostCommonMessage*>(msg_base));
@@ -368,6 +448,7 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
         .set_auth_context(socket->auth_context())
         .set_request_protocol(PROTOCOL_BAIDU_STD)
         .set_begin_time_us(msg->received_us())
+        .set_start_parse_us(start_parse_us)
         .move_in_server_receiving_sock(socket_guard);
 
     if (meta.has_stream_settings()) {
@@ -448,6 +529,9 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             mp->service->CallMethod(mp->method, cntl.get(), &breq, &bres, NULL);
             break;
         }
+        if (!server_accessor.AdmitRequest(mp, cntl.get(), msg->received_us())) {
+            break;
+        }
         // Switch to service-specific error.
         non_service_error.release();
         method_status = mp->status;
@@ -504,10 +588,19 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
         msg.reset();
         req_buf.clear();
 
+        const int64_t end_parse_us = butil::cpuwide_time_us();
+        accessor.set_end_parse_us(end_parse_us);
         if (span) {
-            span->set_start_callback_us(butil::cpuwide_time_us());
+            span->set_start_callback_us(end_parse_us);
             span->AsParent();
         }
+        if (ShouldCallMethodInNewBthread(mp)) {
+            // start_callback_us is set in the new bthread.
+            return CallMethodInNewBthread(
+                mp, svc, method, cntl.release(),
+                req.release(), res.release(), done);
+        }
+        accessor.set_start_callback_us(end_parse_us);
         if (!FLAGS_usercode_in_pthread) {
             return svc->CallMethod(method, cntl.release(), 
                                    req.release(), res.release(), done);
@@ -17,6 +17,8 @@
 
 
 #include <google/protobuf/io/gzip_stream.h>    // GzipXXXStream
+#include <zlib.h>
+#include <algorithm>
 #include "butil/logging.h"
 #include "brpc/policy/gzip_compress.h"
 #include "brpc/protocol.h"
@@ -64,81 +66,225 @@ bool GzipDecompress(const butil::IOBuf& data, google::protobuf::Message* msg) {
     return true;
 }
 
-bool GzipCompress(const butil::IOBuf& msg, butil::IOBuf* buf,
-                  const GzipCompressOptions* options_in) {
-    butil::IOBufAsZeroCopyOutputStream wrapper(buf);
-    google::protobuf::io::GzipOutputStream::Options gzip_opt;
-    if (options_in) {
-        gzip_opt = *options_in;
+// Largest piece fed to zlib at a time since its lengths are 32-bit.
+static const size_t ZLIB_MAX_INPUT_PIECE = 1UL << 30;
+
+// Operates zlib directly rather than through GzipOutputStream, so that
+// input is deflated in place and output is written into IOBuf blocks.
+class ZlibCompressor : public StreamingCompressor {
+public:
+    ZlibCompressor() : _inited(false) {}
+    ~ZlibCompressor() {
+        if (_inited) {
+            deflateEnd(&_zs);
+        }
     }
-    google::protobuf::io::GzipOutputStream out(&wrapper, gzip_opt);
-    butil::IOBufAsZeroCopyInputStream in(msg);
-    const void* data_in = NULL;
-    int size_in = 0;
-    void* data_out = NULL;
-    int size_out = 0;
-    while (1) {
-        if (size_out == 0 && !out.Next(&data_out, &size_out)) {
-            break;
+
+    bool Init(const GzipCompressOptions& options) {
+        memset(&_zs, 0, sizeof(_zs));
+        // Same as GzipOutputStream: 16 more window bits for gzip headers.
+        const int window_bits =
+            15 + (options.format == google::protobuf::io::GzipOutputStream::GZIP ? 16 : 0);
+        const int rc = deflateInit2(&_zs, options.compression_level,
+                                    Z_DEFLATED, window_bits, 8,
+                                    options.compression_strategy);
+        if (rc != Z_OK) {
+            LOG(WARNING) << "Fail to deflateInit2: " << rc;
+            return false;
         }
-        if (size_in == 0 && !in.Next(&data_in, &size_in)) {
-            break;
+        _inited = true;
+        return true;
+    }
+
+    bool Update(const void* data, size_t n, butil::IOBufAppender* out) override {
+        while (n > 0) {
+            const size_t len = std::min(n, ZLIB_MAX_INPUT_PIECE);
+            if (!Deflate(data, len, Z_NO_FLUSH, out)) {
+                return false;
+            }
+            data = (const char*)data + len;
+            n -= len;
         }
-        const int size_cp = std::min(size_in, size_out);
-        memcpy(data_out, data_in, size_cp);
-        size_in -= size_cp;
-        data_in = (char*)data_in + size_cp;
-        size_out -= size_cp;
-        data_out = (char*)data_out + size_cp;
-    }
-    if (size_in != 0 || (size_t)in.ByteCount() != msg.size()) {
-        // If any stage is not fully consumed, something went wrong.
-        LogError(out);
-        return false;
+        return true;
+    }
+
+    bool Finish(butil::IOBufAppender* out) override {
+        return Deflate(NULL, 0, Z_FINISH, out);
+    }
+
+private:
+    bool Deflate(const void* data, size_t n, int flush,
+                 butil::IOBufAppender* out) {
+        _zs.next_in = (Bytef*)data;
+        _zs.avail_in = n;
+        while (true) {
+            void* space = NULL;
+            size_t size = 0;
+            if (out->reserve(&space, &size) != 0) {
+                return false;
+            }
+            _zs.next_out = (Bytef*)space;
+            _zs.avail_out = size;
+            const int rc = deflate(&_zs, flush);
+            out->commit(size - _zs.avail_out);
+            if (rc == Z_STREAM_ERROR) {
+                LOG(WARNING) << "Fail to deflate: "
+                             << (_zs.msg ? _zs.msg : "unknown error");
+                return false;
+            }
+            if (flush == Z_FINISH) {
+                if (rc == Z_STREAM_END) {
+                    return true;
+                }
+            } else if (_zs.avail_in == 0 && _zs.avail_out != 0) {
+                // All input is consumed and no pending output.
+                return true;
+            }
+        }
+    }
+
+    bool _inited;
+    z_stream _zs;
+};
+
+class ZlibDecompressor : public StreamingDecompressor {
+public:
+    ZlibDecompressor() : _inited(false), _ended(false) {}
+    ~ZlibDecompressor() {
+        if (_inited) {
+            inflateEnd(&_zs);
+        }
+    }
+
+    bool Init(google::protobuf::io::GzipInputStream::Format format) {
+        memset(&_zs, 0, sizeof(_zs));
+        const int window_bits =
+            15 + (format == google::protobuf::io::GzipInputStream::GZIP ? 16 :
+                  format == google::protobuf::io::GzipInputStream::AUTO ? 32 : 0);
+        const int rc = inflateInit2(&_zs, window_bits);
+        if (rc != Z_OK) {
+            LOG(WARNING) << "Fail to inflateInit2: " << rc;
+            return false;
+        }
+        _inited = true;
+        return true;
+    }
+
+    bool Update(const void* data, size_t n, butil::IOBufAppender* out) override {
+        while (n > 0) {
+            const size_t len = std::min(n, ZLIB_MAX_INPUT_PIECE);
+            if (!Inflate(data, len, out)) {
+                return false;
+            }
+            data = (const char*)data + len;
+            n -= len;
+        }
+        return true;
+    }
+
+    bool Finish(butil::IOBufAppender*) override {
+        // Empty input is accepted as GzipInputStream does.
+        if (!_ended && _zs.total_in != 0) {
+            LOG(WARNING) << "Fail to decompress truncated data";
+            return false;
+        }
+        return true;
     }
-    if (size_out != 0) {
-        out.BackUp(size_out);
+
+private:
+    bool Inflate(const void* data, size_t n, butil::IOBufAppender* out) {
+        _zs.next_in = (Bytef*)data;
+        _zs.avail_in = n;
+        while (true) {
+            if (_ended) {
+                if (_zs.avail_in == 0) {
+                    return true;
+                }
+                // Concatenated streams, as GzipInputStream does.
+                if (inflateReset(&_zs) != Z_OK) {
+                    return false;
+                }
+                _ended = false;
+            }
+            void* space = NULL;
+            size_t size = 0;
+            if (out->reserve(&space, &size) != 0) {
+                return false;
+            }
+            _zs.next_out = (Bytef*)space;
+            _zs.avail_out = size;
+            const int rc = inflate(&_zs, Z_NO_FLUSH);
+            out->commit(size - _zs.avail_out);
+            if (rc == Z_STREAM_END) {
+                _ended = true;
+            } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+                LOG(WARNING) << "Fail to inflate: "
+                             << (_zs.msg ? _zs.msg : "unknown error");
+                return false;
+            } else if (_zs.avail_in == 0 && _zs.avail_out != 0) {
+                return true;
+            }
+        }
+    }
+
+    bool _inited;
+    bool _ended;
+    z_stream _zs;
+};
+
+bool GzipCompress(const butil::IOBuf& msg, butil::IOBuf* buf,
+                  const GzipCompressOptions* options_in) {
+    GzipCompressOptions gzip_opt;
+    if (options_in) {
+        gzip_opt = *options_in;
     }
-    return out.Close();
+    ZlibCompressor c;
+    return c.Init(gzip_opt) && StreamingCompress(&c, msg, buf);
 }
 
 inline bool GzipDecompressBase(
     const butil::IOBuf& data, butil::IOBuf* msg,
     google::protobuf::io::GzipInputStream::Format format) {
-    butil::IOBufAsZeroCopyInputStream wrapper(data);
-    google::protobuf::io::GzipInputStream in(&wrapper, format);
-    butil::IOBufAsZeroCopyOutputStream out(msg);
-    const void* data_in = NULL;
-    int size_in = 0;
-    void* data_out = NULL;
-    int size_out = 0;
-    while (1) {
-        if (size_out == 0 && !out.Next(&data_out, &size_out)) {
-            break;
-        }
-        if (size_in == 0 && !in.Next(&data_in, &size_in)) {
-            break;
-        }
-        const int size_cp = std::min(size_in, size_out);
-        memcpy(data_out, data_in, size_cp);
-        size_in -= size_cp;
-        data_in = (char*)data_in + size_cp;
-        size_out -= size_cp;
-        data_out = (char*)data_out + size_cp;
-    }
-    if (size_in != 0 ||
-        (size_t)wrapper.ByteCount() != data.size() ||
-        in.Next(&data_in, &size_in)) {
-        // If any stage is not fully consumed, something went wrong.
-        // Here we call in.Next addtitionally to make sure that the gzip
-        // "blackbox" does not have buffer left.
-        LogError(in);
-        return false;
+    ZlibDecompressor d;
+    return d.Init(format) && StreamingDecompress(&d, data, msg);
+}
+
+template <google::protobuf::io::GzipOutputStream::Format format>
+static StreamingCompressor* NewCompressorOfFormat() {
+    GzipCompressOptions opt;
+    opt.format = format;
+    ZlibCompressor* c = new ZlibCompressor;
+    if (!c->Init(opt)) {
+        delete c;
+        return NULL;
     }
-    if (size_out != 0) {
-        out.BackUp(size_out);
+    return c;
+}
+
+template <google::protobuf::io::GzipInputStream::Format format>
+static StreamingDecompressor* NewDecompressorOfFormat() {
+    ZlibDecompressor* d = new ZlibDecompressor;
+    if (!d->Init(format)) {
+        delete d;
+        return NULL;
     }
-    return true;
+    return d;
+}
+
+StreamingCompressor* NewGzipCompressor(const google::protobuf::Descriptor*) {
+    return NewCompressorOfFormat<google::protobuf::io::GzipOutputStream::GZIP>();
+}
+
+StreamingDecompressor* NewGzipDecompressor() {
+    return NewDecompressorOfFormat<google::protobuf::io::GzipInputStream::GZIP>();
+}
+
+StreamingCompressor* NewZlibCompressor(const google::protobuf::Descriptor*) {
+    return NewCompressorOfFormat<google::protobuf::io::GzipOutputStream::ZLIB>();
+}
+
+StreamingDecompressor* NewZlibDecompressor() {
+    return NewDecompressorOfFormat<google::protobuf::io::GzipInputStream::ZLIB>();
 }
 
 bool ZlibCompress(const google::protobuf::Message& res, butil::IOBuf* buf) {
@@ -22,6 +22,7 @@
 #include <google/protobuf/message.h>              // Message
 #include <google/protobuf/io/gzip_stream.h>
 #include "butil/iobuf.h"                           // butil::IOBuf
+#include "brpc/compress.h"                         // StreamingCompressor
 
 
 namespace brpc {
@@ -45,6 +46,13 @@ bool GzipCompress(const butil::IOBuf& in, butil::IOBuf* out,
 bool GzipDecompress(const butil::IOBuf& in, butil::IOBuf* out);
 bool ZlibDecompress(const butil::IOBuf& in, butil::IOBuf* out);
 
+// Create streaming compressors and decompressors, see brpc/compress.h.
+// `type' is unused.
+StreamingCompressor* NewGzipCompressor(const google::protobuf::Descriptor* type);
+StreamingDecompressor* NewGzipDecompressor();
+StreamingCompressor* NewZlibCompressor(const google::protobuf::Descriptor* type);
+StreamingDecompressor* NewZlibDecompressor();
+
 }  // namespace policy
 } // namespace brpc
 
@@ -40,6 +40,8 @@
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/builtin/index_service.h"        // IndexService
 #include "brpc/policy/gzip_compress.h"
+#include "brpc/policy/lz4_compress.h"
+#include "brpc/policy/zstd_compress.h"
 #include "brpc/policy/http2_rpc_protocol.h"
 #include "brpc/details/usercode_backup_pool.h"
 #include "brpc/grpc.h"
@@ -127,6 +129,8 @@ CommonStrings::CommonStrings()
     , ACCEPT_ENCODING("accept-encoding")
     , CONTENT_ENCODING("content-encoding")
     , GZIP("gzip")
+    , ZSTD("zstd")
+    , LZ4("lz4")
     , CONNECTION("connection")
     , KEEP_ALIVE("keep-alive")
     , CLOSE("close")
@@ -147,7 +151,14 @@ CommonStrings::CommonStrings()
     , TRAILERS("trailers")
     , GRPC_ENCODING("grpc-encoding")
     , GRPC_ACCEPT_ENCODING("grpc-accept-encoding")
-    , GRPC_ACCEPT_ENCODING_VALUE("identity,gzip")
+    , GRPC_ACCEPT_ENCODING_VALUE("identity,gzip"
+#if BRPC_WITH_ZSTD
+                                 ",zstd"
+#endif
+#if BRPC_WITH_LZ4
+                                 ",lz4"
+#endif
+                                 )
     , GRPC_STATUS("grpc-status")
     , GRPC_MESSAGE("grpc-message")
     , GRPC_TIMEOUT("grpc-timeout")
@@ -158,6 +169,68 @@ static pthread_once_t g_common_strings_once = PTHREAD_ONCE_INIT;
 static void CreateCommonStrings() {
     common = new CommonStrings;
 }
+
+// Name of `type' in content-encoding or grpc-encoding, NULL if bodies
+// can't be compressed with `type'.
+static const std::string* CompressTypeToHttpEncoding(CompressType type) {
+    switch (type) {
+    case COMPRESS_TYPE_GZIP:
+        return &common->GZIP;
+    case COMPRESS_TYPE_ZSTD:
+        return &common->ZSTD;
+    case COMPRESS_TYPE_LZ4:
+        return &common->LZ4;
+    default:
+        return NULL;
+    }
+}
+
+// COMPRESS_TYPE_NONE for unknown encodings, bodies of which are kept as
+// they are.
+static CompressType HttpEncodingToCompressType(const std::string* encoding) {
+    if (encoding == NULL) {
+        return COMPRESS_TYPE_NONE;
+    } else if (*encoding == common->GZIP) {
+        return COMPRESS_TYPE_GZIP;
+    } else if (*encoding == common->ZSTD) {
+        return COMPRESS_TYPE_ZSTD;
+    } else if (*encoding == common->LZ4) {
+        return COMPRESS_TYPE_LZ4;
+    }
+    return COMPRESS_TYPE_NONE;
+}
+
+// Compress body `in' into `out'. `msg' is the message serialized in `in'
+// if it's not NULL, which selects the zstd dictionary.
+static bool CompressHttpBody(CompressType type, const butil::IOBuf& in,
+                             const google::protobuf::Message* msg,
+                             butil::IOBuf* out) {
+    switch (type) {
+    case COMPRESS_TYPE_GZIP:
+        return policy::GzipCompress(in, out, NULL);
+    case COMPRESS_TYPE_ZSTD:
+        return policy::ZstdCompress(
+            in, out, (msg != NULL ? msg->GetDescriptor() : NULL));
+    case COMPRESS_TYPE_LZ4:
+        return policy::Lz4Compress(in, out);
+    default:
+        return false;
+    }
+}
+
+static bool DecompressHttpBody(CompressType type, const butil::IOBuf& in,
+                               butil::IOBuf* out) {
+    switch (type) {
+    case COMPRESS_TYPE_GZIP:
+        return policy::GzipDecompress(in, out);
+    case COMPRESS_TYPE_ZSTD:
+        return policy::ZstdDecompress(in, out);
+    case COMPRESS_TYPE_LZ4:
+        return policy::Lz4Decompress(in, out);
+    default:
+        return false;
+    }
+}
 // Called in global.cpp
 int InitCommonStrings() {
     return pthread_once(&g_common_strings_once, CreateCommonStrings);
@@ -438,12 +511,15 @@ void ProcessHttpResponse(InputMessageBase* msg) {
         } else {
             encoding = res_header->GetHeader(common->CONTENT_ENCODING);
         }
-        if (encoding != NULL && *encoding == common->GZIP) {
+        const CompressType body_compress_type =
+            HttpEncodingToCompressType(encoding);
+        if (body_compress_type != COMPRESS_TYPE_NONE) {
             TRACEPRINTF("Decompressing response=%lu",
                         (unsigned long)res_body.size());
             butil::IOBuf uncompressed;
-            if (!policy::GzipDecompress(res_body, &uncompressed)) {
-                cntl->SetFailed(ERESPONSE, "Fail to un-gzip response body");
+            if (!DecompressHttpBody(body_compress_type, res_body, &uncompressed)) {
+                cntl->SetFailed(ERESPONSE, "Fail to un-%s response body",
+                                encoding->c_str());
                 break;
             }
             res_body.swap(uncompressed);
@@ -576,7 +652,9 @@ void SerializeHttpRequest(butil::IOBuf* /*not used*/,
     }
     bool grpc_compressed = false;
     if (cntl->request_compress_type() != COMPRESS_TYPE_NONE) {
-        if (cntl->request_compress_type() != COMPRESS_TYPE_GZIP) {
+        const std::string* encoding =
+            CompressTypeToHttpEncoding(cntl->request_compress_type());
+        if (encoding == NULL) {
             return cntl->SetFailed(EREQUEST, "http does not support %s",
                             CompressTypeToCStr(cntl->request_compress_type()));
         }
@@ -584,16 +662,19 @@ void SerializeHttpRequest(butil::IOBuf* /*not used*/,
         if (request_size >= (size_t)FLAGS_http_body_compress_threshold) {
             TRACEPRINTF("Compressing request=%lu", (unsigned long)request_size);
             butil::IOBuf compressed;
-            if (GzipCompress(cntl->request_attachment(), &compressed, NULL)) {
+            if (CompressHttpBody(cntl->request_compress_type(),
+                                 cntl->request_attachment(), pbreq,
+                                 &compressed)) {
                 cntl->request_attachment().swap(compressed);
                 if (is_grpc) {
                     grpc_compressed = true;
-                    hreq.SetHeader(common->GRPC_ENCODING, common->GZIP);
+                    hreq.SetHeader(common->GRPC_ENCODING, *encoding);
                 } else {
-                    hreq.SetHeader(common->CONTENT_ENCODING, common->GZIP);
+                    hreq.SetHeader(common->CONTENT_ENCODING, *encoding);
                 }
             } else {
-                cntl->SetFailed("Fail to gzip the request body, skip compressing");
+                cntl->SetFailed("Fail to " + *encoding +
+                                " the request body, skip compressing");
             }
         }
     }
@@ -689,10 +770,10 @@ void PackHttpRequest(butil::IOBuf* buf,
     }
 }
 
-inline bool SupportGzip(Controller* cntl) {
+inline bool SupportEncoding(Controller* cntl, const std::string& encoding) {
     const std::string* encodings =
         cntl->http_request().GetHeader(common->ACCEPT_ENCODING);
-    return (encodings && encodings->find(common->GZIP) != std::string::npos);
+    return (encodings && encodings->find(encoding) != std::string::npos);
 }
 
 class HttpResponseSender {
@@ -880,22 +961,26 @@ HttpResponseSender::~HttpResponseSender() {
                 " ignored when CreateProgressiveAttachment() was called";
         }
         // not set_content to enable chunked mode.
-    } else if (cntl->response_compress_type() == COMPRESS_TYPE_GZIP) {
+    } else if (CompressTypeToHttpEncoding(cntl->response_compress_type()) != NULL) {
+        const std::string* encoding =
+            CompressTypeToHttpEncoding(cntl->response_compress_type());
         const size_t response_size = cntl->response_attachment().size();
         if (response_size >= (size_t)FLAGS_http_body_compress_threshold
-            && (is_http2 || SupportGzip(cntl))) {
+            && (is_http2 || SupportEncoding(cntl, *encoding))) {
             TRACEPRINTF("Compressing response=%lu", (unsigned long)response_size);
             butil::IOBuf tmpbuf;
-            if (GzipCompress(cntl->response_attachment(), &tmpbuf, NULL)) {
+            if (CompressHttpBody(cntl->response_compress_type(),
+                                 cntl->response_attachment(), res, &tmpbuf)) {
                 cntl->response_attachment().swap(tmpbuf);
                 if (is_grpc) {
                     grpc_compressed = true;
-                    res_header->SetHeader(common->GRPC_ENCODING, common->GZIP);
+                    res_header->SetHeader(common->GRPC_ENCODING, *encoding);
                 } else {
-                    res_header->SetHeader(common->CONTENT_ENCODING, common->GZIP);
+                    res_header->SetHeader(common->CONTENT_ENCODING, *encoding);
                 }
             } else {
-                LOG(ERROR) << "Fail to gzip the http response, skip compression.";
+                LOG(ERROR) << "Fail to " << *encoding
+                           << " the http response, skip compression.";
             }
         }
     } else {
@@ -1251,6 +1336,19 @@ void EndRunningCallMethodInPool(
     ::google::protobuf::Message* response,
     ::google::protobuf::Closure* done);
 
+// Defined in baidu_rpc_protocol.cpp
+bool ShouldCallMethodInNewBthread(const Server::MethodProperty* mp);
+
+// Defined in baidu_rpc_protocol.cpp
+void CallMethodInNewBthread(
+    const Server::MethodProperty* mp,
+    ::google::protobuf::Service* service,
+    const ::google::protobuf::MethodDescriptor* method,
+    ::google::protobuf::RpcController* controller,
+    const ::google::protobuf::Message* request,
+    ::google::protobuf::Message* response,
+    ::google::protobuf::Closure* done);
+
 void ProcessHttpRequest(InputMessageBase *msg) {
     const int64_t start_parse_us = butil::cpuwide_time_us();
     DestroyingPtr<HttpContext> imsg_guard(static_cast<HttpContext*>(msg));
@@ -1495,12 +1593,15 @@ void ProcessHttpRequest(InputMessageBase *msg) {
             } else {
                 encoding = req_header.GetHeader(common->CONTENT_ENCODING);
             }
-            if (encoding != NULL && *encoding == common->GZIP) {
+            const CompressType body_compress_type =
+                HttpEncodingToCompressType(encoding);
+            if (body_compress_type != COMPRESS_TYPE_NONE) {
                 TRACEPRINTF("Decompressing request=%lu",
                             (unsigned long)req_body.size());
                 butil::IOBuf uncompressed;
-                if (!policy::GzipDecompress(req_body, &uncompressed)) {
-                    cntl->SetFailed(EREQUEST, "Fail to un-gzip request body");
+                if (!DecompressHttpBody(body_compress_type, req_body, &uncompressed)) {
+                    cntl->SetFailed(EREQUEST, "Fail to un-%s request body",
+                                    encoding->c_str());
                     return;
                 }
                 req_body.swap(uncompressed);
@@ -1554,6 +1655,9 @@ void ProcessHttpRequest(InputMessageBase *msg) {
         span->set_start_callback_us(butil::cpuwide_time_us());
         span->AsParent();
     }
+    if (ShouldCallMethodInNewBthread(sp)) {
+        return CallMethodInNewBthread(sp, svc, method, cntl, req, res, done);
+    }
     if (!FLAGS_usercode_in_pthread) {
         return svc->CallMethod(method, cntl, req, res, done);
     }
@@ -44,6 +44,8 @@ struct CommonStrings {
     std::string CONTENT_ENCODING;
     std::string CONTENT_LENGTH;
     std::string GZIP;
+    std::string ZSTD;
+    std::string LZ4;
     std::string CONNECTION;
     std::string KEEP_ALIVE;
     std::string CLOSE;
@@ -0,0 +1,318 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "brpc/policy/lz4_compress.h"
+
+#if BRPC_WITH_LZ4
+
+#include <string.h>
+#include <algorithm>
+#include <lz4frame.h>
+#include "butil/logging.h"
+#include "butil/thread_local.h"                // thread_atexit
+#include "brpc/protocol.h"
+
+
+namespace brpc {
+namespace policy {
+
+// Input is fed into the compressor in pieces of at most this size, so that
+// the output buffer is bounded no matter how large the input is.
+static const size_t LZ4_MAX_INPUT_PIECE = 64 * 1024;
+
+struct Lz4Context {
+    LZ4F_cctx* cctx;
+    LZ4F_dctx* dctx;
+    // Output of the compressor, large enough for any piece of input.
+    char* buf;
+    size_t buf_size;
+};
+
+static void DestroyLz4Context(Lz4Context* ctx) {
+    LZ4F_freeCompressionContext(ctx->cctx);
+    LZ4F_freeDecompressionContext(ctx->dctx);
+    free(ctx->buf);
+    delete ctx;
+}
+
+static Lz4Context* CreateLz4Context() {
+    Lz4Context* ctx = new Lz4Context;
+    memset(ctx, 0, sizeof(*ctx));
+    LZ4F_preferences_t prefs;
+    memset(&prefs, 0, sizeof(prefs));
+    ctx->buf_size = std::max(LZ4F_compressBound(LZ4_MAX_INPUT_PIECE, &prefs),
+                             (size_t)LZ4F_HEADER_SIZE_MAX);
+    ctx->buf = (char*)malloc(ctx->buf_size);
+    if (ctx->buf == NULL
+        || LZ4F_isError(LZ4F_createCompressionContext(&ctx->cctx, LZ4F_VERSION))
+        || LZ4F_isError(LZ4F_createDecompressionContext(&ctx->dctx, LZ4F_VERSION))) {
+        LOG(ERROR) << "Fail to create lz4 context";
+        DestroyLz4Context(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+// Contexts of one-shot functions are reused by each thread since creating
+// them allocates. They're never used across a yield of bthread.
+static BAIDU_THREAD_LOCAL Lz4Context* tls_lz4_ctx = NULL;
+
+static void DestroyTlsLz4Context(void* arg) {
+    DestroyLz4Context(static_cast<Lz4Context*>(arg));
+    tls_lz4_ctx = NULL;
+}
+
+static Lz4Context* GetLz4Context() {
+    if (tls_lz4_ctx == NULL) {
+        tls_lz4_ctx = CreateLz4Context();
+        if (tls_lz4_ctx != NULL) {
+            butil::thread_atexit(DestroyTlsLz4Context, tls_lz4_ctx);
+        }
+    }
+    return tls_lz4_ctx;
+}
+
+class Lz4Compressor : public StreamingCompressor {
+public:
+    // `content_size' is written into the frame header if it's not 0.
+    // `ctx' is deleted in destructor if `own_ctx' is true.
+    Lz4Compressor(Lz4Context* ctx, bool own_ctx, uint64_t content_size)
+        : _ctx(ctx), _own_ctx(own_ctx), _begun(false) {
+        memset(&_prefs, 0, sizeof(_prefs));
+        _prefs.frameInfo.contentSize = content_size;
+    }
+    ~Lz4Compressor() {
+        if (_own_ctx) {
+            DestroyLz4Context(_ctx);
+        }
+    }
+
+    bool Update(const void* data, size_t n, butil::IOBufAppender* out) override {
+        if (!Begin(out)) {
+            return false;
+        }
+        while (n > 0) {
+            const size_t len = std::min(n, LZ4_MAX_INPUT_PIECE);
+            const size_t rc = LZ4F_compressUpdate(
+                _ctx->cctx, _ctx->buf, _ctx->buf_size, data, len, NULL);
+            if (LZ4F_isError(rc)) {
+                LOG(WARNING) << "Fail to LZ4F_compressUpdate: "
+                             << LZ4F_getErrorName(rc);
+                return false;
+            }
+            if (out->append(_ctx->buf, rc) != 0) {
+                return false;
+            }
+            data = (const char*)data + len;
+            n -= len;
+        }
+        return true;
+    }
+
+    bool Finish(butil::IOBufAppender* out) override {
+        if (!Begin(out)) {
+            return false;
+        }
+        const size_t rc = LZ4F_compressEnd(
+            _ctx->cctx, _ctx->buf, _ctx->buf_size, NULL);
+        if (LZ4F_isError(rc)) {
+            LOG(WARNING) << "Fail to LZ4F_compressEnd: " << LZ4F_getErrorName(rc);
+            return false;
+        }
+        return out->append(_ctx->buf, rc) == 0;
+    }
+
+private:
+    bool Begin(butil::IOBufAppender* out) {
+        if (_begun) {
+            return true;
+        }
+        const size_t rc = LZ4F_compressBegin(
+            _ctx->cctx, _ctx->buf, _ctx->buf_size, &_prefs);
+        if (LZ4F_isError(rc)) {
+            LOG(WARNING) << "Fail to LZ4F_compressBegin: "
+                         << LZ4F_getErrorName(rc);
+            return false;
+        }
+        _begun = true;
+        return out->append(_ctx->buf, rc) == 0;
+    }
+
+    Lz4Context* _ctx;
+    bool _own_ctx;
+    bool _begun;
+    LZ4F_preferences_t _prefs;
+};
+
+class Lz4Decompressor : public StreamingDecompressor {
+public:
+    Lz4Decompressor(Lz4Context* ctx, bool own_ctx)
+        : _ctx(ctx), _own_ctx(own_ctx), _hint(1) {
+        // The context may be left in the middle of a frame by a failed call.
+        LZ4F_resetDecompressionContext(_ctx->dctx);
+    }
+    ~Lz4Decompressor() {
+        if (_own_ctx) {
+            DestroyLz4Context(_ctx);
+        }
+    }
+
+    bool Update(const void* data, size_t n, butil::IOBufAppender* out) override {
+        return Decompress(data, n, out);
+    }
+
+    bool Finish(butil::IOBufAppender* out) override {
+        // Flush data buffered in the context.
+        if (!Decompress(NULL, 0, out)) {
+            return false;
+        }
+        if (_hint != 0) {
+            LOG(WARNING) << "Fail to decompress truncated lz4 frame";
+            return false;
+        }
+        return true;
+    }
+
+private:
+    bool Decompress(const void* data, size_t n, butil::IOBufAppender* out) {
+        while (true) {
+            if (_hint == 0 && n == 0) {
+                // The frame ended, feeding more calls starts a new one.
+                return true;
+            }
+            void* space = NULL;
+            size_t size = 0;
+            if (out->reserve(&space, &size) != 0) {
+                return false;
+            }
+            size_t dst_size = size;
+            size_t src_size = n;
+            _hint = LZ4F_decompress(_ctx->dctx, space, &dst_size,
+                                    data, &src_size, NULL);
+            if (LZ4F_isError(_hint)) {
+                LOG(WARNING) << "Fail to LZ4F_decompress: "
+                             << LZ4F_getErrorName(_hint);
+                return false;
+            }
+            out->commit(dst_size);
+            data = (const char*)data + src_size;
+            n -= src_size;
+            if (n == 0 && dst_size != size) {
+                // Input is consumed and nothing is left in the context.
+                return true;
+            }
+        }
+    }
+
+    Lz4Context* _ctx;
+    bool _own_ctx;
+    // Non-zero until the frame ends.
+    size_t _hint;
+};
+
+bool Lz4Compress(const butil::IOBuf& in, butil::IOBuf* out) {
+    Lz4Context* ctx = GetLz4Context();
+    if (ctx == NULL) {
+        return false;
+    }
+    Lz4Compressor c(ctx, false, in.size());
+    return StreamingCompress(&c, in, out);
+}
+
+bool Lz4Decompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    Lz4Context* ctx = GetLz4Context();
+    if (ctx == NULL) {
+        return false;
+    }
+    Lz4Decompressor d(ctx, false);
+    return StreamingDecompress(&d, in, out);
+}
+
+bool Lz4Compress(const google::protobuf::Message& msg, butil::IOBuf* buf) {
+    Lz4Context* ctx = GetLz4Context();
+    if (ctx == NULL) {
+        return false;
+    }
+    // Size of the serialized message is unknown until it's serialized.
+    Lz4Compressor c(ctx, false, 0);
+    return StreamingCompress(&c, msg, buf);
+}
+
+bool Lz4Decompress(const butil::IOBuf& data, google::protobuf::Message* msg) {
+    butil::IOBuf binary_pb;
+    if (!Lz4Decompress(data, &binary_pb)) {
+        return false;
+    }
+    return ParsePbFromIOBuf(msg, binary_pb);
+}
+
+StreamingCompressor* NewLz4Compressor(const google::protobuf::Descriptor*) {
+    Lz4Context* ctx = CreateLz4Context();
+    return ctx != NULL ? new Lz4Compressor(ctx, true, 0) : NULL;
+}
+
+StreamingDecompressor* NewLz4Decompressor() {
+    Lz4Context* ctx = CreateLz4Context();
+    return ctx != NULL ? new Lz4Decompressor(ctx, true) : NULL;
+}
+
+}  // namespace policy
+} // namespace brpc
+
+#else
+
+#include "butil/logging.h"
+
+namespace brpc {
+namespace policy {
+
+static bool Lz4NotBuilt() {
+    LOG_EVERY_SECOND(ERROR) << "brpc is not compiled with lz4, "
+        "build it with -DWITH_LZ4=ON or --with-lz4";
+    return false;
+}
+
+bool Lz4Compress(const google::protobuf::Message&, butil::IOBuf*) {
+    return Lz4NotBuilt();
+}
+
+bool Lz4Decompress(const butil::IOBuf&, google::protobuf::Message*) {
+    return Lz4NotBuilt();
+}
+
+bool Lz4Compress(const butil::IOBuf&, butil::IOBuf*) {
+    return Lz4NotBuilt();
+}
+
+bool Lz4Decompress(const butil::IOBuf&, butil::IOBuf*) {
+    return Lz4NotBuilt();
+}
+
+StreamingCompressor* NewLz4Compressor(const google::protobuf::Descriptor*) {
+    Lz4NotBuilt();
+    return NULL;
+}
+
+StreamingDecompressor* NewLz4Decompressor() {
+    Lz4NotBuilt();
+    return NULL;
+}
+
+}  // namespace policy
+} // namespace brpc
+
+#endif  // BRPC_WITH_LZ4
@@ -0,0 +1,55 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_POLICY_LZ4_COMPRESS_H
+#define BRPC_POLICY_LZ4_COMPRESS_H
+
+#include <google/protobuf/message.h>          // Message
+#include "butil/iobuf.h"                       // IOBuf
+#include "brpc/compress.h"                      // StreamingCompressor
+
+
+namespace brpc {
+namespace policy {
+
+// Data is compressed in LZ4 frame format which is compatible with the
+// `lz4' command line tool. Following functions fail when brpc was not
+// built with lz4(-DWITH_LZ4=ON or --with-lz4).
+
+// Compress serialized `msg' into `buf'.
+bool Lz4Compress(const google::protobuf::Message& msg, butil::IOBuf* buf);
+
+// Parse `msg' from decompressed `buf'.
+bool Lz4Decompress(const butil::IOBuf& data, google::protobuf::Message* msg);
+
+// Put compressed `in' into `out'. Blocks of `in' are compressed one by
+// one without being flattened.
+bool Lz4Compress(const butil::IOBuf& in, butil::IOBuf* out);
+
+// Put decompressed `in' into `out'.
+bool Lz4Decompress(const butil::IOBuf& in, butil::IOBuf* out);
+
+// Create streaming compressors and decompressors, see brpc/compress.h.
+// `type' is unused.
+StreamingCompressor* NewLz4Compressor(const google::protobuf::Descriptor* type);
+StreamingDecompressor* NewLz4Decompressor();
+
+}  // namespace policy
+} // namespace brpc
+
+
+#endif // BRPC_POLICY_LZ4_COMPRESS_H
@@ -0,0 +1,474 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <math.h>                                      // ceil, sqrt
+#include <algorithm>                                   // std::sort
+#include <gflags/gflags.h>
+#include "butil/string_splitter.h"                     // KeyValuePairsSplitter
+#include "butil/strings/string_number_conversions.h"
+#include "butil/scoped_lock.h"                         // BAIDU_SCOPED_LOCK
+#include "brpc/log.h"
+#include "brpc/socket.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/policy/hasher.h"
+#include "brpc/policy/maglev_load_balancer.h"
+
+namespace brpc {
+namespace policy {
+
+static bool IsPrime(uint64_t n) {
+    if (n < 2) {
+        return false;
+    }
+    for (uint64_t i = 2; i * i <= n; ++i) {
+        if (n % i == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool ValidateTableSize(const char*, int32_t value) {
+    if (!IsPrime(value)) {
+        LOG(ERROR) << "maglev_table_size=" << value << " is not a prime";
+        return false;
+    }
+    return true;
+}
+
+DEFINE_int32(maglev_table_size, 65537, "Default number of slots in the lookup "
+             "table of maglev, must be a prime. Loads of servers are more even "
+             "with more slots, which should be much larger than the number of "
+             "servers, say 100 times. Changing this flag affects newly "
+             "created channels only");
+BRPC_VALIDATE_GFLAG(maglev_table_size, ValidateTableSize);
+
+MaglevLoadBalancer::MaglevLoadBalancer()
+    : _table_size(FLAGS_maglev_table_size)
+    , _load_factor(0)
+    , _total_inflight(0) {
+}
+
+MaglevLoadBalancer::~MaglevLoadBalancer() {
+    _db_servers.ModifyWithForeground(RemoveAll);
+    for (DetachedMap::iterator it = _detached.begin();
+         it != _detached.end(); ++it) {
+        delete it->second;
+    }
+    _detached.clear();
+}
+
+bool MaglevLoadBalancer::RemoveAll(Servers& bg, const Servers& fg) {
+    if (!fg.server_list.empty()) {
+        for (size_t i = 0; i < bg.server_list.size(); ++i) {
+            delete bg.server_list[i].inflight;
+        }
+    }
+    bg.server_list.clear();
+    bg.server_map.clear();
+    bg.table.clear();
+    return true;
+}
+
+void MaglevLoadBalancer::BuildTable(Servers* s, size_t table_size) {
+    const size_t n = s->server_list.size();
+    s->table.clear();
+    if (n == 0) {
+        return;
+    }
+    // Each server fills the table following its permutation
+    // (offset + j * skip) % table_size, which visits all slots since
+    // table_size is a prime. Servers take turns to fill their next
+    // unfilled slots, so that each server gets nearly table_size/n slots.
+    std::vector<uint32_t> offset(n);
+    std::vector<uint32_t> skip(n);
+    std::vector<uint64_t> next(n, 0);
+    for (size_t i = 0; i < n; ++i) {
+        const std::string key = endpoint2str(s->server_list[i].addr).c_str();
+        offset[i] = MurmurHash32(key.data(), key.size()) % table_size;
+        skip[i] = MD5Hash32(key.data(), key.size()) % (table_size - 1) + 1;
+    }
+    s->table.assign(table_size, UINT32_MAX);
+    size_t filled = 0;
+    while (true) {
+        for (size_t i = 0; i < n; ++i) {
+            size_t slot = (offset[i] + next[i] * skip[i]) % table_size;
+            while (s->table[slot] != UINT32_MAX) {
+                ++next[i];
+                slot = (offset[i] + next[i] * skip[i]) % table_size;
+            }
+            s->table[slot] = i;
+            ++next[i];
+            if (++filled == table_size) {
+                return;
+            }
+        }
+    }
+}
+
+size_t MaglevLoadBalancer::Apply(Servers& bg, const Servers& fg,
+                                 Modification* m) {
+    if (m->executed) {
+        // The other buffer is modified, copy it instead of rebuilding the
+        // table again.
+        bg = fg;
+        return m->count;
+    }
+    m->executed = true;
+    size_t count = 0;
+    for (size_t i = 0; i < m->removed.size(); ++i) {
+        const size_t* pindex = bg.server_map.seek(m->removed[i]);
+        if (pindex == NULL) {
+            continue;
+        }
+        m->garbage.push_back(bg.server_list[*pindex]);
+        // Mark as removed, erased from server_list below.
+        bg.server_list[*pindex].inflight = NULL;
+        bg.server_map.erase(m->removed[i]);
+        ++count;
+    }
+    if (count != 0) {
+        size_t j = 0;
+        for (size_t i = 0; i < bg.server_list.size(); ++i) {
+            if (bg.server_list[i].inflight != NULL) {
+                bg.server_list[j++] = bg.server_list[i];
+            }
+        }
+        bg.server_list.resize(j);
+    }
+    for (size_t i = 0; i < m->added.size(); ++i) {
+        const ServerInfo& info = m->added[i];
+        if (bg.server_map.seek(info.server_id) != NULL) {
+            continue;
+        }
+        if (bg.server_list.size() >= m->table_size) {
+            LOG(ERROR) << "Fail to add " << info.addr << ", number of servers"
+                " reaches table_size=" << m->table_size;
+            continue;
+        }
+        ServerInfo new_info = info;
+        // Requests to the server before it was removed are still counted.
+        DetachedMap::iterator it = m->detached->find(info.server_id);
+        if (it != m->detached->end()) {
+            new_info.inflight = it->second;
+            m->reattached.push_back(it->second);
+            m->detached->erase(it);
+        } else {
+            new_info.inflight = new butil::atomic<int64_t>(0);
+        }
+        bg.server_list.push_back(new_info);
+        // Indexes are set after sorting.
+        bg.server_map[info.server_id] = 0;
+        ++count;
+    }
+    if (count != 0) {
+        std::sort(bg.server_list.begin(), bg.server_list.end());
+        for (size_t i = 0; i < bg.server_list.size(); ++i) {
+            bg.server_map[bg.server_list[i].server_id] = i;
+        }
+        BuildTable(&bg, m->table_size);
+    }
+    m->count = count;
+    return count;
+}
+
+size_t MaglevLoadBalancer::Modify(Modification* m) {
+    BAIDU_SCOPED_LOCK(_modify_mutex);
+    const size_t count = _db_servers.ModifyWithForeground(Apply, m);
+    for (size_t i = 0; i < m->reattached.size(); ++i) {
+        _total_inflight.fetch_add(
+            m->reattached[i]->load(butil::memory_order_relaxed),
+            butil::memory_order_relaxed);
+    }
+    m->reattached.clear();
+    // No reader references the removed servers now. Counters with inflight
+    // requests are kept until Feedback() of the requests.
+    for (size_t i = 0; i < m->garbage.size(); ++i) {
+        butil::atomic<int64_t>* inflight = m->garbage[i].inflight;
+        const int64_t n = inflight->load(butil::memory_order_relaxed);
+        _total_inflight.fetch_sub(n, butil::memory_order_relaxed);
+        if (n > 0) {
+            _detached[m->garbage[i].server_id] = inflight;
+        } else {
+            delete inflight;
+        }
+    }
+    m->garbage.clear();
+    return count;
+}
+
+bool MaglevLoadBalancer::AddServer(const ServerId& server) {
+    if (!_id_mapper.AddServer(server)) {
+        return true;
+    }
+    SocketUniquePtr ptr;
+    if (Socket::AddressFailedAsWell(server.id, &ptr) == -1) {
+        return false;
+    }
+    Modification m(_table_size, &_detached);
+    const ServerInfo info = { server.id, ptr->remote_side(), NULL };
+    m.added.push_back(info);
+    RPC_VLOG << "Maglev: added " << server;
+    return Modify(&m) != 0;
+}
+
+bool MaglevLoadBalancer::RemoveServer(const ServerId& server) {
+    if (!_id_mapper.RemoveServer(server)) {
+        return true;
+    }
+    Modification m(_table_size, &_detached);
+    m.removed.push_back(server.id);
+    RPC_VLOG << "Maglev: removed " << server;
+    return Modify(&m) != 0;
+}
+
+size_t MaglevLoadBalancer::AddServersInBatch(
+    const std::vector<ServerId>& servers) {
+    std::vector<SocketId>& ids = _id_mapper.AddServers(servers);
+    Modification m(_table_size, &_detached);
+    m.added.reserve(ids.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        SocketUniquePtr ptr;
+        if (Socket::AddressFailedAsWell(ids[i], &ptr) == -1) {
+            continue;
+        }
+        const ServerInfo info = { ids[i], ptr->remote_side(), NULL };
+        m.added.push_back(info);
+    }
+    RPC_VLOG << "Maglev: added " << m.added.size();
+    Modify(&m);
+    return servers.size();
+}
+
+size_t MaglevLoadBalancer::RemoveServersInBatch(
+    const std::vector<ServerId>& servers) {
+    Modification m(_table_size, &_detached);
+    m.removed = _id_mapper.RemoveServers(servers);
+    RPC_VLOG << "Maglev: removed " << m.removed.size();
+    Modify(&m);
+    return servers.size();
+}
+
+LoadBalancer* MaglevLoadBalancer::New(const butil::StringPiece& params) const {
+    MaglevLoadBalancer* lb = new (std::nothrow) MaglevLoadBalancer;
+    if (lb && !lb->SetParameters(params)) {
+        delete lb;
+        lb = NULL;
+    }
+    return lb;
+}
+
+void MaglevLoadBalancer::Destroy() {
+    delete this;
+}
+
+int MaglevLoadBalancer::SelectServer(const SelectIn& in, SelectOut* out) {
+    if (!in.has_request_code) {
+        LOG(ERROR) << "Controller.set_request_code() is required";
+        return EINVAL;
+    }
+    butil::DoublyBufferedData<Servers>::ScopedPtr s;
+    if (_db_servers.Read(&s) != 0) {
+        return ENOMEM;
+    }
+    const size_t n = s->server_list.size();
+    if (n == 0) {
+        return ENODATA;
+    }
+    const bool bounded = (_load_factor > 0 && in.changable_weights);
+    int64_t capacity = 0;
+    if (bounded) {
+        // Every server is allowed to have at most ceil(c * average) inflight
+        // requests, including this one.
+        const int64_t total = std::max(
+            _total_inflight.load(butil::memory_order_relaxed), (int64_t)0);
+        capacity = (int64_t)ceil(_load_factor * (total + 1) / n);
+    }
+    const size_t table_size = s->table.size();
+    const size_t first = in.request_code % table_size;
+    const ServerInfo* chosen = NULL;
+    // The first available server exceeding the capacity, chosen when all
+    // available servers exceed the capacity, which is possible when the
+    // inflight counters are changed concurrently.
+    const ServerInfo* overloaded = NULL;
+    SocketUniquePtr overloaded_ptr;
+    for (size_t i = 0; i < table_size; ++i) {
+        const ServerInfo& info = s->server_list[s->table[(first + i) % table_size]];
+        SocketUniquePtr ptr;
+        if (ExcludedServers::IsExcluded(in.excluded, info.server_id)
+            || Socket::Address(info.server_id, &ptr) != 0
+            || !ptr->IsAvailable()) {
+            continue;
+        }
+        if (bounded &&
+            info.inflight->load(butil::memory_order_relaxed) >= capacity) {
+            if (overloaded == NULL) {
+                overloaded = &info;
+                overloaded_ptr.swap(ptr);
+            }
+            continue;
+        }
+        chosen = &info;
+        out->ptr->swap(ptr);
+        break;
+    }
+    if (chosen == NULL && overloaded != NULL) {
+        chosen = overloaded;
+        out->ptr->swap(overloaded_ptr);
+    }
+    if (chosen == NULL) {
+        // Instead of failing with EHOSTDOWN, we prefer choosing an excluded
+        // server at the last chance.
+        const size_t start = s->table[first];
+        for (size_t i = 0; i < n; ++i) {
+            const ServerInfo& info = s->server_list[(start + i) % n];
+            if (Socket::Address(info.server_id, out->ptr) == 0
+                && (*out->ptr)->IsAvailable()) {
+                chosen = &info;
+                break;
+            }
+        }
+        if (chosen == NULL) {
+            return EHOSTDOWN;
+        }
+    }
+    if (bounded) {
+        chosen->inflight->fetch_add(1, butil::memory_order_relaxed);
+        _total_inflight.fetch_add(1, butil::memory_order_relaxed);
+        out->need_feedback = true;
+    }
+    return 0;
+}
+
+bool MaglevLoadBalancer::DecreaseInflight(SocketId server_id) {
+    butil::DoublyBufferedData<Servers>::ScopedPtr s;
+    if (_db_servers.Read(&s) != 0) {
+        return true;
+    }
+    const size_t* pindex = s->server_map.seek(server_id);
+    if (NULL == pindex) {
+        return false;
+    }
+    s->server_list[*pindex].inflight->fetch_sub(1, butil::memory_order_relaxed);
+    _total_inflight.fetch_sub(1, butil::memory_order_relaxed);
+    return true;
+}
+
+void MaglevLoadBalancer::Feedback(const CallInfo& info) {
+    if (DecreaseInflight(info.server_id)) {
+        return;
+    }
+    // The server was removed and its inflight requests were subtracted from
+    // _total_inflight. Notice that the lock can't be acquired while reading
+    // _db_servers since Modify() waits for readers with the lock held.
+    BAIDU_SCOPED_LOCK(_modify_mutex);
+    DetachedMap::iterator it = _detached.find(info.server_id);
+    if (it == _detached.end()) {
+        // Added again after the lookup above.
+        DecreaseInflight(info.server_id);
+        return;
+    }
+    if (it->second->fetch_sub(1, butil::memory_order_relaxed) == 1) {
+        delete it->second;
+        _detached.erase(it);
+    }
+}
+
+void MaglevLoadBalancer::GetLoads(std::map<butil::EndPoint, double>* load_map) {
+    load_map->clear();
+    butil::DoublyBufferedData<Servers>::ScopedPtr s;
+    if (_db_servers.Read(&s) != 0 || s->table.empty()) {
+        return;
+    }
+    std::vector<uint32_t> count(s->server_list.size(), 0);
+    for (size_t i = 0; i < s->table.size(); ++i) {
+        ++count[s->table[i]];
+    }
+    for (size_t i = 0; i < count.size(); ++i) {
+        (*load_map)[s->server_list[i].addr] += (double)count[i] / s->table.size();
+    }
+}
+
+void MaglevLoadBalancer::Describe(std::ostream& os,
+                                  const DescribeOptions& options) {
+    if (!options.verbose) {
+        os << "maglev";
+        return;
+    }
+    os << "MaglevLoadBalancer {\n"
+       << "  table size: " << _table_size << '\n'
+       << "  load factor: " << _load_factor << '\n'
+       << "  inflight: " << _total_inflight.load(butil::memory_order_relaxed)
+       << '\n';
+    std::map<butil::EndPoint, double> load_map;
+    GetLoads(&load_map);
+    os << "  number of hosts: " << load_map.size() << '\n';
+    os << "  load of hosts: {\n";
+    double expected_load_per_server = 1.0 / load_map.size();
+    double load_sum = 0;
+    double load_sqr_sum = 0;
+    for (std::map<butil::EndPoint, double>::iterator
+            it = load_map.begin(); it!= load_map.end(); ++it) {
+        os << "    " << it->first << ": " << it->second << '\n';
+        double normalized_load = it->second / expected_load_per_server;
+        load_sum += normalized_load;
+        load_sqr_sum += normalized_load * normalized_load;
+    }
+    os << "  }\n";
+    os << "deviation: "
+       << sqrt(load_sqr_sum * load_map.size() - load_sum * load_sum)
+          / load_map.size();
+    os << "}\n";
+}
+
+bool MaglevLoadBalancer::SetParameters(const butil::StringPiece& params) {
+    for (butil::KeyValuePairsSplitter sp(params.begin(), params.end(), ' ', '=');
+            sp; ++sp) {
+        if (sp.value().empty()) {
+            LOG(ERROR) << "Empty value for " << sp.key() << " in lb parameter";
+            return false;
+        }
+        if (sp.key() == "table_size") {
+            if (!butil::StringToSizeT(sp.value(), &_table_size)) {
+                return false;
+            }
+            if (!IsPrime(_table_size) || _table_size > UINT32_MAX) {
+                LOG(ERROR) << "table_size=" << _table_size
+                           << " is not a 32-bit prime";
+                return false;
+            }
+            continue;
+        }
+        if (sp.key() == "load_factor") {
+            if (!butil::StringToDouble(sp.value().as_string(), &_load_factor)) {
+                return false;
+            }
+            if (_load_factor != 0 && _load_factor <= 1) {
+                LOG(ERROR) << "load_factor=" << _load_factor
+                           << " must be greater than 1";
+                return false;
+            }
+            continue;
+        }
+        LOG(ERROR) << "Failed to set this unknown parameters " << sp.key_and_value();
+    }
+    return true;
+}
+
+}  // namespace policy
+} // namespace brpc
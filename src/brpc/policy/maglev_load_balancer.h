@@ -0,0 +1,143 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_POLICY_MAGLEV_LOAD_BALANCER_H
+#define BRPC_POLICY_MAGLEV_LOAD_BALANCER_H
+
+#include <stdint.h>                                    // uint32_t
+#include <map>
+#include <vector>                                      // std::vector
+#include <gflags/gflags_declare.h>
+#include "butil/atomicops.h"
+#include "butil/synchronization/lock.h"               // butil::Mutex
+#include "butil/endpoint.h"                             // butil::EndPoint
+#include "butil/containers/flat_map.h"                  // FlatMap
+#include "butil/containers/doubly_buffered_data.h"      // DoublyBufferedData
+#include "brpc/load_balancer.h"
+
+
+namespace brpc {
+namespace policy {
+
+DECLARE_int32(maglev_table_size);
+
+// Consistent hashing with the lookup table of Maglev(Eisenbud et al, NSDI'16).
+// Each server fills slots of a table of a prime size following its own
+// permutation of the slots, and a request goes to the server filling slot
+// `request_code % table_size'. Selection is one memory access into a table
+// of 4 bytes per slot, and a few slots change owners when a server is added
+// or removed.
+//
+// With parameter "load_factor=c"(c > 1), the load is bounded as well
+// (Mirrokni et al, "Consistent Hashing with Bounded Loads"): a server having
+// more than c times the average number of inflight requests is skipped, and
+// the request goes to owners of following slots, which are still same for
+// the same request_code.
+class MaglevLoadBalancer : public LoadBalancer {
+public:
+    MaglevLoadBalancer();
+    ~MaglevLoadBalancer();
+    bool AddServer(const ServerId& server);
+    bool RemoveServer(const ServerId& server);
+    size_t AddServersInBatch(const std::vector<ServerId>& servers);
+    size_t RemoveServersInBatch(const std::vector<ServerId>& servers);
+    LoadBalancer* New(const butil::StringPiece& params) const;
+    void Destroy();
+    int SelectServer(const SelectIn& in, SelectOut* out);
+    void Feedback(const CallInfo& info);
+    void Describe(std::ostream& os, const DescribeOptions& options);
+
+private:
+    struct ServerInfo {
+        SocketId server_id;
+        butil::EndPoint addr;
+        // Inflight requests to the server, shared by both buffers of
+        // _db_servers. Only counted when the load is bounded. Detached when
+        // the server is removed and re-attached when it's added again, so
+        // that feedback of a call always decreases the counter increased by
+        // the call.
+        butil::atomic<int64_t>* inflight;
+
+        bool operator<(const ServerInfo& rhs) const {
+            return addr < rhs.addr ||
+                (addr == rhs.addr && server_id < rhs.server_id);
+        }
+    };
+    struct Servers {
+        // Sorted by addresses so that clients build same tables.
+        std::vector<ServerInfo> server_list;
+        // SocketId -> index in server_list.
+        butil::FlatMap<SocketId, size_t> server_map;
+        // Slot -> index in server_list.
+        std::vector<uint32_t> table;
+
+        Servers() {
+            CHECK_EQ(0, server_map.init(1024, 70));
+        }
+    };
+    typedef std::map<SocketId, butil::atomic<int64_t>*> DetachedMap;
+    struct Modification {
+        Modification(size_t table_size, DetachedMap* detached)
+            : table_size(table_size), executed(false), count(0)
+            , detached(detached) {}
+        std::vector<ServerInfo> added;
+        std::vector<SocketId> removed;
+        size_t table_size;
+        // The foreground buffer is modified already, just copy it.
+        bool executed;
+        // Number of servers actually added or removed.
+        size_t count;
+        // Counters of removed servers with inflight requests.
+        DetachedMap* detached;
+        // Inflight counters of removed servers, detached after both buffers
+        // are modified.
+        std::vector<ServerInfo> garbage;
+        // Counters taken back from `detached' by added servers.
+        std::vector<butil::atomic<int64_t>*> reattached;
+    };
+
+    bool SetParameters(const butil::StringPiece& params);
+    void GetLoads(std::map<butil::EndPoint, double>* load_map);
+    // Decrease inflight requests of `server_id' if it's in _db_servers.
+    // Returns false if it's not.
+    bool DecreaseInflight(SocketId server_id);
+    // Add or remove servers in `m', and rebuild the table.
+    size_t Modify(Modification* m);
+    static size_t Apply(Servers& bg, const Servers& fg, Modification* m);
+    static bool RemoveAll(Servers& bg, const Servers& fg);
+    // Fill s->table with indexes of s->server_list.
+    static void BuildTable(Servers* s, size_t table_size);
+
+    size_t _table_size;
+    // Zero means the load is not bounded.
+    double _load_factor;
+    // Inflight requests to servers in _db_servers.
+    butil::atomic<int64_t> _total_inflight;
+    butil::DoublyBufferedData<Servers> _db_servers;
+    // Serializes modifications and accesses to _detached.
+    butil::Mutex _modify_mutex;
+    // Inflight counters of removed servers, deleted when the requests end.
+    DetachedMap _detached;
+    ServerId2SocketIdMapper _id_mapper;
+};
+
+}  // namespace policy
+} // namespace brpc
+
+
+#endif  // BRPC_POLICY_MAGLEV_LOAD_BALANCER_H
@@ -0,0 +1,313 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <math.h>                                     // exp
+#include <algorithm>                                  // std::max
+#include <gflags/gflags.h>
+#include "butil/time.h"                               // gettimeofday_us
+#include "butil/fast_rand.h"
+#include "brpc/log.h"
+#include "brpc/socket.h"
+#include "brpc/controller.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/policy/p2c_load_balancer.h"
+
+namespace brpc {
+namespace policy {
+
+DEFINE_int32(p2c_decay_ms, 1000, "Latency of a server in p2c decays "
+             "exponentially with this time constant after a peak");
+BRPC_VALIDATE_GFLAG(p2c_decay_ms, PositiveInteger);
+
+// Load of a server that has inflight requests but no latency measured yet,
+// so that a new server receives just a few requests before any response.
+static const int64_t UNKNOWN_LATENCY_PENALTY_US = 1000000L;
+
+P2CLoadBalancer::Stat::Stat()
+    : _inflight(0)
+    , _latency_us(0)
+    , _last_update_us(0) {
+}
+
+int64_t P2CLoadBalancer::Stat::decayed_latency(int64_t now_us) const {
+    const int64_t latency_us = _latency_us.load(butil::memory_order_relaxed);
+    const int64_t elapse_us =
+        now_us - _last_update_us.load(butil::memory_order_relaxed);
+    if (elapse_us <= 0 || latency_us == 0) {
+        return latency_us;
+    }
+    // A server not chosen for long (because of its high latency) looks
+    // better and better, until it's chosen and measured again.
+    return (int64_t)(latency_us *
+                     exp(-elapse_us / (FLAGS_p2c_decay_ms * 1000.0)));
+}
+
+int64_t P2CLoadBalancer::Stat::load(int64_t now_us) const {
+    const int64_t inflight =
+        std::max(_inflight.load(butil::memory_order_relaxed), (int64_t)0);
+    const int64_t latency_us = decayed_latency(now_us);
+    if (latency_us == 0) {
+        return inflight * UNKNOWN_LATENCY_PENALTY_US;
+    }
+    return (inflight + 1) * latency_us;
+}
+
+void P2CLoadBalancer::Stat::Update(int64_t latency_us, int64_t now_us) {
+    _inflight.fetch_sub(1, butil::memory_order_relaxed);
+    BAIDU_SCOPED_LOCK(_mutex);
+    const int64_t old_latency = _latency_us.load(butil::memory_order_relaxed);
+    int64_t new_latency = latency_us;
+    if (latency_us < old_latency) {
+        // Peak-EWMA: a higher latency is taken immediately, a lower one
+        // is moved towards smoothly.
+        const int64_t elapse_us = std::max(
+            now_us - _last_update_us.load(butil::memory_order_relaxed),
+            (int64_t)0);
+        const double w = exp(-elapse_us / (FLAGS_p2c_decay_ms * 1000.0));
+        new_latency = (int64_t)(old_latency * w + latency_us * (1 - w));
+    }
+    // Zero means unknown.
+    _latency_us.store(std::max(new_latency, (int64_t)1),
+                      butil::memory_order_relaxed);
+    _last_update_us.store(now_us, butil::memory_order_relaxed);
+}
+
+void P2CLoadBalancer::Stat::Describe(std::ostream& os, int64_t now_us) const {
+    os << "inflight=" << _inflight.load(butil::memory_order_relaxed)
+       << " latency=" << decayed_latency(now_us);
+}
+
+P2CLoadBalancer::P2CLoadBalancer() {
+}
+
+P2CLoadBalancer::~P2CLoadBalancer() {
+    _db_servers.ModifyWithForeground(RemoveAll);
+}
+
+bool P2CLoadBalancer::Add(Servers& bg, const Servers& fg, SocketId id) {
+    if (bg.server_map.seek(id) != NULL) {
+        // The id duplicates.
+        return false;
+    }
+    const size_t* pindex = fg.server_map.seek(id);
+    // Create the Stat when modifying the first buffer, and share it with
+    // the other buffer.
+    ServerInfo info = { id, (pindex ? fg.server_list[*pindex].stat : new Stat) };
+    bg.server_map[id] = bg.server_list.size();
+    bg.server_list.push_back(info);
+    return true;
+}
+
+bool P2CLoadBalancer::Remove(Servers& bg, const Servers& fg, SocketId id) {
+    size_t* pindex = bg.server_map.seek(id);
+    if (NULL == pindex) {
+        // The id does not exist.
+        return false;
+    }
+    const size_t index = *pindex;
+    Stat* stat = bg.server_list[index].stat;
+    bg.server_list[index] = bg.server_list.back();
+    bg.server_map[bg.server_list[index].server_id] = index;
+    bg.server_list.pop_back();
+    bg.server_map.erase(id);
+    if (fg.server_map.seek(id) == NULL) {
+        // The second buffer. Both buffers do not have the server now and
+        // there's no reader of this buffer, the Stat can't be referenced.
+        delete stat;
+    }
+    return true;
+}
+
+bool P2CLoadBalancer::RemoveAll(Servers& bg, const Servers& fg) {
+    if (!fg.server_list.empty()) {
+        for (size_t i = 0; i < bg.server_list.size(); ++i) {
+            delete bg.server_list[i].stat;
+        }
+    }
+    bg.server_list.clear();
+    bg.server_map.clear();
+    return true;
+}
+
+size_t P2CLoadBalancer::BatchAdd(Servers& bg, const Servers& fg,
+                                 const std::vector<SocketId>& servers) {
+    size_t count = 0;
+    for (size_t i = 0; i < servers.size(); ++i) {
+        count += !!Add(bg, fg, servers[i]);
+    }
+    return count;
+}
+
+size_t P2CLoadBalancer::BatchRemove(Servers& bg, const Servers& fg,
+                                    const std::vector<SocketId>& servers) {
+    size_t count = 0;
+    for (size_t i = 0; i < servers.size(); ++i) {
+        count += !!Remove(bg, fg, servers[i]);
+    }
+    return count;
+}
+
+bool P2CLoadBalancer::AddServer(const ServerId& id) {
+    if (_id_mapper.AddServer(id)) {
+        RPC_VLOG << "P2C: added " << id;
+        return _db_servers.ModifyWithForeground(Add, id.id);
+    } else {
+        return true;
+    }
+}
+
+bool P2CLoadBalancer::RemoveServer(const ServerId& id) {
+    if (_id_mapper.RemoveServer(id)) {
+        RPC_VLOG << "P2C: removed " << id;
+        return _db_servers.ModifyWithForeground(Remove, id.id);
+    } else {
+        return true;
+    }
+}
+
+size_t P2CLoadBalancer::AddServersInBatch(
+    const std::vector<ServerId>& servers) {
+    std::vector<SocketId>& ids = _id_mapper.AddServers(servers);
+    RPC_VLOG << "P2C: added " << ids.size();
+    _db_servers.ModifyWithForeground(BatchAdd, ids);
+    return servers.size();
+}
+
+size_t P2CLoadBalancer::RemoveServersInBatch(
+    const std::vector<ServerId>& servers) {
+    std::vector<SocketId>& ids = _id_mapper.RemoveServers(servers);
+    RPC_VLOG << "P2C: removed " << ids.size();
+    _db_servers.ModifyWithForeground(BatchRemove, ids);
+    return servers.size();
+}
+
+bool P2CLoadBalancer::IsSelectable(const ServerInfo& info, const SelectIn& in,
+                                   bool ignore_excluded, SocketUniquePtr* ptr) {
+    return (ignore_excluded ||
+            !ExcludedServers::IsExcluded(in.excluded, info.server_id))
+        && Socket::Address(info.server_id, ptr) == 0
+        && (*ptr)->IsAvailable();
+}
+
+int P2CLoadBalancer::SelectServer(const SelectIn& in, SelectOut* out) {
+    butil::DoublyBufferedData<Servers>::ScopedPtr s;
+    if (_db_servers.Read(&s) != 0) {
+        return ENOMEM;
+    }
+    const size_t n = s->server_list.size();
+    if (n == 0) {
+        return ENODATA;
+    }
+    const size_t first = butil::fast_rand_less_than(n);
+    const ServerInfo* chosen = NULL;
+    if (IsSelectable(s->server_list[first], in, n == 1, out->ptr)) {
+        chosen = &s->server_list[first];
+    }
+    if (n > 1) {
+        size_t second = butil::fast_rand_less_than(n - 1);
+        if (second >= first) {
+            ++second;
+        }
+        SocketUniquePtr ptr;
+        const ServerInfo& info = s->server_list[second];
+        if (IsSelectable(info, in, false, &ptr) &&
+            (chosen == NULL ||
+             info.stat->load(in.begin_time_us) <
+             chosen->stat->load(in.begin_time_us))) {
+            chosen = &info;
+            out->ptr->swap(ptr);
+        }
+    }
+    if (chosen == NULL) {
+        // Both choices are unavailable, which should be rare in normal
+        // clusters. Look for any available server.
+        for (size_t i = 1; i < n; ++i) {
+            const ServerInfo& info = s->server_list[(first + i) % n];
+            // Instead of fail with EHOSTDOWN, we prefer choosing an excluded
+            // server at the last chance.
+            if (IsSelectable(info, in, i + 1 == n, out->ptr)) {
+                chosen = &info;
+                break;
+            }
+        }
+        if (chosen == NULL) {
+            return EHOSTDOWN;
+        }
+    }
+    if (in.changable_weights) {
+        chosen->stat->AddInflight();
+        out->need_feedback = true;
+    }
+    return 0;
+}
+
+void P2CLoadBalancer::Feedback(const CallInfo& info) {
+    butil::DoublyBufferedData<Servers>::ScopedPtr s;
+    if (_db_servers.Read(&s) != 0) {
+        return;
+    }
+    const size_t* pindex = s->server_map.seek(info.server_id);
+    if (NULL == pindex) {
+        return;
+    }
+    const int64_t now_us = butil::gettimeofday_us();
+    int64_t latency_us = now_us - info.begin_time_us;
+    if (info.error_code != 0) {
+        // Errors are often returned quickly, count them as timedout so that
+        // a failing server does not attract more traffic.
+        const int64_t timeout_ms = info.controller->timeout_ms();
+        if (timeout_ms > 0) {
+            latency_us = std::max(latency_us, timeout_ms * 1000L);
+        }
+    }
+    s->server_list[*pindex].stat->Update(std::max(latency_us, (int64_t)0),
+                                         now_us);
+}
+
+P2CLoadBalancer* P2CLoadBalancer::New(const butil::StringPiece&) const {
+    return new (std::nothrow) P2CLoadBalancer;
+}
+
+void P2CLoadBalancer::Destroy() {
+    delete this;
+}
+
+void P2CLoadBalancer::Describe(std::ostream& os,
+                               const DescribeOptions& options) {
+    if (!options.verbose) {
+        os << "p2c";
+        return;
+    }
+    os << "P2C{";
+    butil::DoublyBufferedData<Servers>::ScopedPtr s;
+    if (_db_servers.Read(&s) != 0) {
+        os << "fail to read _db_servers";
+    } else {
+        const int64_t now_us = butil::gettimeofday_us();
+        os << "n=" << s->server_list.size() << ':';
+        for (size_t i = 0; i < s->server_list.size(); ++i) {
+            const ServerInfo& info = s->server_list[i];
+            os << "\n  " << info.server_id << ": ";
+            info.stat->Describe(os, now_us);
+        }
+    }
+    os << '}';
+}
+
+}  // namespace policy
+} // namespace brpc
@@ -0,0 +1,118 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_POLICY_P2C_LOAD_BALANCER_H
+#define BRPC_POLICY_P2C_LOAD_BALANCER_H
+
+#include <vector>                                      // std::vector
+#include <gflags/gflags_declare.h>
+#include "butil/atomicops.h"
+#include "butil/synchronization/lock.h"                 // butil::Mutex
+#include "butil/containers/flat_map.h"                  // FlatMap
+#include "butil/containers/doubly_buffered_data.h"      // DoublyBufferedData
+#include "brpc/load_balancer.h"
+
+
+namespace brpc {
+namespace policy {
+
+DECLARE_int32(p2c_decay_ms);
+
+// "Power of two choices": pick two servers randomly and send the request to
+// the one with less load, which is the number of inflight requests times
+// the peak-EWMA latency of the server. Selection is O(1) and adding/removing
+// servers does not touch other servers, which suits large clusters better
+// than LocalityAwareLoadBalancer.
+class P2CLoadBalancer : public LoadBalancer {
+public:
+    P2CLoadBalancer();
+    ~P2CLoadBalancer();
+    bool AddServer(const ServerId& id);
+    bool RemoveServer(const ServerId& id);
+    size_t AddServersInBatch(const std::vector<ServerId>& servers);
+    size_t RemoveServersInBatch(const std::vector<ServerId>& servers);
+    P2CLoadBalancer* New(const butil::StringPiece&) const;
+    void Destroy();
+    int SelectServer(const SelectIn& in, SelectOut* out);
+    void Feedback(const CallInfo& info);
+    void Describe(std::ostream& os, const DescribeOptions& options);
+
+private:
+    // Load statistics of a server, shared by both buffers of _db_servers.
+    class Stat {
+    public:
+        Stat();
+
+        // Load of the server at `now_us'. Smaller is better.
+        int64_t load(int64_t now_us) const;
+
+        void AddInflight() { _inflight.fetch_add(1, butil::memory_order_relaxed); }
+
+        // Called in Feedback() with latency of the call.
+        void Update(int64_t latency_us, int64_t now_us);
+
+        void Describe(std::ostream& os, int64_t now_us) const;
+
+    private:
+        // Latency decayed to `now_us', the peak is kept for a while and then
+        // decays exponentially with time constant -p2c_decay_ms.
+        int64_t decayed_latency(int64_t now_us) const;
+
+        butil::atomic<int64_t> _inflight;
+        // Written with _mutex locked, read without lock.
+        butil::atomic<int64_t> _latency_us;
+        butil::atomic<int64_t> _last_update_us;
+        butil::Mutex _mutex;
+    };
+
+    struct ServerInfo {
+        SocketId server_id;
+        Stat* stat;
+    };
+
+    struct Servers {
+        std::vector<ServerInfo> server_list;
+        // SocketId -> index in server_list.
+        butil::FlatMap<SocketId, size_t> server_map;
+
+        Servers() {
+            CHECK_EQ(0, server_map.init(1024, 70));
+        }
+    };
+    static bool Add(Servers& bg, const Servers& fg, SocketId id);
+    static bool Remove(Servers& bg, const Servers& fg, SocketId id);
+    static size_t BatchAdd(Servers& bg, const Servers& fg,
+                           const std::vector<SocketId>& servers);
+    static size_t BatchRemove(Servers& bg, const Servers& fg,
+                              const std::vector<SocketId>& servers);
+    static bool RemoveAll(Servers& bg, const Servers& fg);
+
+    // Returns true if the server is available and not excluded (unless
+    // `ignore_excluded' is true), and addresses it into `ptr'.
+    static bool IsSelectable(const ServerInfo& info, const SelectIn& in,
+                             bool ignore_excluded, SocketUniquePtr* ptr);
+
+    butil::DoublyBufferedData<Servers> _db_servers;
+    ServerId2SocketIdMapper _id_mapper;
+};
+
+}  // namespace policy
+} // namespace brpc
+
+
+#endif  // BRPC_POLICY_P2C_LOAD_BALANCER_H
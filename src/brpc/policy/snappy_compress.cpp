@@ -25,6 +25,12 @@
 namespace brpc {
 namespace policy {
 
+// A 3-byte copy tag of snappy expands to at most 64 bytes, output of valid
+// data is never larger than this.
+static size_t MaxUncompressedSize(size_t compressed_size) {
+    return compressed_size * 22;
+}
+
 bool SnappyCompress(const google::protobuf::Message& res, butil::IOBuf* buf) {
     butil::IOBuf serialized_pb;
     butil::IOBufAsZeroCopyOutputStream wrapper(&serialized_pb);
@@ -40,7 +46,7 @@ bool SnappyCompress(const google::protobuf::Message& res, butil::IOBuf* buf) {
 bool SnappyDecompress(const butil::IOBuf& data, google::protobuf::Message* req) {
     butil::IOBufAsSnappySource source(data);
     butil::IOBuf binary_pb;
-    butil::IOBufAsSnappySink sink(binary_pb);
+    butil::IOBufAsSnappySink sink(binary_pb, MaxUncompressedSize(data.size()));
     if (butil::snappy::Uncompress(&source, &sink)) {
         return ParsePbFromIOBuf(req, binary_pb);
     }
@@ -56,8 +62,17 @@ bool SnappyCompress(const butil::IOBuf& in, butil::IOBuf* out) {
 
 bool SnappyDecompress(const butil::IOBuf& in, butil::IOBuf* out) {
     butil::IOBufAsSnappySource source(in);
-    butil::IOBufAsSnappySink sink(*out);
-    return butil::snappy::Uncompress(&source, &sink);
+    // Snappy appends what was decompressed even if it fails, don't leave
+    // partial output in `out'.
+    butil::IOBuf buf;
+    {
+        butil::IOBufAsSnappySink sink(buf, MaxUncompressedSize(in.size()));
+        if (!butil::snappy::Uncompress(&source, &sink)) {
+            return false;
+        }
+    }
+    out->append(butil::IOBuf::Movable(buf));
+    return true;
 }
 
 }  // namespace policy
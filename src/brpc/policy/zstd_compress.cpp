@@ -0,0 +1,441 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "brpc/compress.h"
+#include "brpc/policy/zstd_compress.h"
+
+#if BRPC_WITH_ZSTD
+
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <gflags/gflags.h>
+#include <zstd.h>
+#include "butil/logging.h"
+#include "butil/thread_local.h"                // thread_atexit
+#include "brpc/protocol.h"
+
+
+namespace brpc {
+
+DEFINE_int32(zstd_compress_level, 3, "Compression level of zstd, "
+             "applied to dictionaries when they're registered");
+
+namespace policy {
+
+struct ZstdDictionary {
+    unsigned id;
+    ZSTD_CDict* cdict;
+    ZSTD_DDict* ddict;
+};
+
+// Written by RegisterZstdDictionary() before RPCs start, read-only later.
+typedef std::map<const google::protobuf::Descriptor*, ZstdDictionary*> DictByType;
+typedef std::map<unsigned, ZstdDictionary*> DictById;
+static DictByType* s_dict_by_type = NULL;
+static DictById* s_dict_by_id = NULL;
+
+static const ZstdDictionary* FindDictionary(
+    const google::protobuf::Descriptor* type) {
+    if (s_dict_by_type == NULL || type == NULL) {
+        return NULL;
+    }
+    DictByType::const_iterator it = s_dict_by_type->find(type);
+    return it != s_dict_by_type->end() ? it->second : NULL;
+}
+
+static const ZstdDictionary* FindDictionary(unsigned id) {
+    if (s_dict_by_id == NULL || id == 0) {
+        return NULL;
+    }
+    DictById::const_iterator it = s_dict_by_id->find(id);
+    return it != s_dict_by_id->end() ? it->second : NULL;
+}
+
+// Contexts of one-shot functions are reused by each thread since creating
+// them allocates a lot. They're never used across a yield of bthread.
+struct ZstdContext {
+    ZSTD_CCtx* cctx;
+    ZSTD_DCtx* dctx;
+};
+
+static BAIDU_THREAD_LOCAL ZstdContext* tls_zstd_ctx = NULL;
+
+static void DestroyZstdContext(void* arg) {
+    ZstdContext* ctx = static_cast<ZstdContext*>(arg);
+    ZSTD_freeCCtx(ctx->cctx);
+    ZSTD_freeDCtx(ctx->dctx);
+    delete ctx;
+    tls_zstd_ctx = NULL;
+}
+
+static ZstdContext* GetZstdContext() {
+    if (tls_zstd_ctx != NULL) {
+        return tls_zstd_ctx;
+    }
+    ZstdContext* ctx = new ZstdContext;
+    ctx->cctx = ZSTD_createCCtx();
+    ctx->dctx = ZSTD_createDCtx();
+    if (ctx->cctx == NULL || ctx->dctx == NULL) {
+        LOG(ERROR) << "Fail to create zstd context";
+        DestroyZstdContext(ctx);
+        return NULL;
+    }
+    butil::thread_atexit(DestroyZstdContext, ctx);
+    tls_zstd_ctx = ctx;
+    return ctx;
+}
+
+class ZstdCompressor : public StreamingCompressor {
+public:
+    // `cctx' is freed in destructor if `own_ctx' is true.
+    ZstdCompressor(ZSTD_CCtx* cctx, bool own_ctx)
+        : _cctx(cctx), _own_ctx(own_ctx) {}
+    ~ZstdCompressor() {
+        if (_own_ctx) {
+            ZSTD_freeCCtx(_cctx);
+        }
+    }
+
+    // Compress with the dictionary registered for `type', if any. The
+    // frame header records `content_size' if it's not
+    // ZSTD_CONTENTSIZE_UNKNOWN.
+    bool Init(const google::protobuf::Descriptor* type,
+              unsigned long long content_size) {
+        ZSTD_CCtx_reset(_cctx, ZSTD_reset_session_and_parameters);
+        const ZstdDictionary* dict = FindDictionary(type);
+        size_t rc = (dict != NULL ? ZSTD_CCtx_refCDict(_cctx, dict->cdict) :
+                     ZSTD_CCtx_setParameter(_cctx, ZSTD_c_compressionLevel,
+                                            FLAGS_zstd_compress_level));
+        if (!ZSTD_isError(rc)) {
+            rc = ZSTD_CCtx_setPledgedSrcSize(_cctx, content_size);
+        }
+        if (ZSTD_isError(rc)) {
+            LOG(WARNING) << "Fail to set zstd parameters: " << ZSTD_getErrorName(rc);
+            return false;
+        }
+        return true;
+    }
+
+    bool Update(const void* data, size_t n, butil::IOBufAppender* out) override {
+        ZSTD_inBuffer input = { data, n, 0 };
+        return Compress(&input, ZSTD_e_continue, out);
+    }
+
+    bool Finish(butil::IOBufAppender* out) override {
+        ZSTD_inBuffer input = { NULL, 0, 0 };
+        return Compress(&input, ZSTD_e_end, out);
+    }
+
+private:
+    bool Compress(ZSTD_inBuffer* input, ZSTD_EndDirective mode,
+                  butil::IOBufAppender* out) {
+        while (true) {
+            void* space = NULL;
+            size_t size = 0;
+            if (out->reserve(&space, &size) != 0) {
+                return false;
+            }
+            ZSTD_outBuffer output = { space, size, 0 };
+            // Returns bytes remaining to flush for ZSTD_e_end.
+            const size_t rc = ZSTD_compressStream2(_cctx, &output, input, mode);
+            if (ZSTD_isError(rc)) {
+                LOG(WARNING) << "Fail to ZSTD_compressStream2: "
+                             << ZSTD_getErrorName(rc);
+                return false;
+            }
+            out->commit(output.pos);
+            if (mode == ZSTD_e_continue ? input->pos == input->size : rc == 0) {
+                return true;
+            }
+        }
+    }
+
+    ZSTD_CCtx* _cctx;
+    bool _own_ctx;
+};
+
+// Same as ZSTD_FRAMEHEADERSIZE_MAX which is not visible without
+// ZSTD_STATIC_LINKING_ONLY.
+static const size_t ZSTD_FRAME_HEADER_SIZE_MAX = 18;
+
+class ZstdDecompressor : public StreamingDecompressor {
+public:
+    // `dctx' is freed in destructor if `own_ctx' is true.
+    ZstdDecompressor(ZSTD_DCtx* dctx, bool own_ctx)
+        : _dctx(dctx), _own_ctx(own_ctx), _header_size(0), _hint(1) {
+        // The context may be left in the middle of a frame by a failed call.
+        ZSTD_DCtx_reset(_dctx, ZSTD_reset_session_and_parameters);
+    }
+    ~ZstdDecompressor() {
+        if (_own_ctx) {
+            ZSTD_freeDCtx(_dctx);
+        }
+    }
+
+    bool Update(const void* data, size_t n, butil::IOBufAppender* out) override {
+        if (_header_size < sizeof(_header)) {
+            // Collect the frame header to find the dictionary before
+            // decompressing anything.
+            const size_t len = std::min(n, sizeof(_header) - _header_size);
+            memcpy(_header + _header_size, data, len);
+            _header_size += len;
+            if (_header_size < sizeof(_header)) {
+                return true;
+            }
+            return FeedHeader(out) &&
+                Decompress((const char*)data + len, n - len, out);
+        }
+        return Decompress(data, n, out);
+    }
+
+    bool Finish(butil::IOBufAppender* out) override {
+        if (_header_size < sizeof(_header) && !FeedHeader(out)) {
+            return false;
+        }
+        if (_hint != 0) {
+            LOG(WARNING) << "Fail to decompress truncated zstd frame";
+            return false;
+        }
+        return true;
+    }
+
+private:
+    bool FeedHeader(butil::IOBufAppender* out) {
+        const unsigned dict_id = ZSTD_getDictID_fromFrame(_header, _header_size);
+        if (dict_id != 0) {
+            const ZstdDictionary* dict = FindDictionary(dict_id);
+            if (dict == NULL) {
+                LOG(WARNING) << "Fail to find zstd dictionary=" << dict_id;
+                return false;
+            }
+            ZSTD_DCtx_refDDict(_dctx, dict->ddict);
+        }
+        const size_t header_size = _header_size;
+        // Following data is fed to the context directly.
+        _header_size = sizeof(_header);
+        return Decompress(_header, header_size, out);
+    }
+
+    bool Decompress(const void* data, size_t n, butil::IOBufAppender* out) {
+        if (n == 0) {
+            // Nothing is buffered in the context, see below.
+            return true;
+        }
+        ZSTD_inBuffer input = { data, n, 0 };
+        // Decompress until the input is consumed and the output is not
+        // full, which means that nothing is buffered in the context.
+        while (true) {
+            void* space = NULL;
+            size_t size = 0;
+            if (out->reserve(&space, &size) != 0) {
+                return false;
+            }
+            ZSTD_outBuffer output = { space, size, 0 };
+            _hint = ZSTD_decompressStream(_dctx, &output, &input);
+            if (ZSTD_isError(_hint)) {
+                LOG(WARNING) << "Fail to ZSTD_decompressStream: "
+                             << ZSTD_getErrorName(_hint);
+                return false;
+            }
+            out->commit(output.pos);
+            // Calling ZSTD_decompressStream() again after the frame ended
+            // returns the hint of a next frame.
+            if (input.pos == input.size &&
+                (output.pos != output.size || _hint == 0)) {
+                return true;
+            }
+        }
+    }
+
+    ZSTD_DCtx* _dctx;
+    bool _own_ctx;
+    // Beginning of the frame, buffered until it's long enough to contain
+    // the dictionary id.
+    char _header[ZSTD_FRAME_HEADER_SIZE_MAX];
+    size_t _header_size;
+    // Non-zero until the frame ends.
+    size_t _hint;
+};
+
+bool ZstdCompress(const butil::IOBuf& in, butil::IOBuf* out,
+                  const google::protobuf::Descriptor* type) {
+    ZstdContext* ctx = GetZstdContext();
+    if (ctx == NULL) {
+        return false;
+    }
+    ZstdCompressor c(ctx->cctx, false);
+    return c.Init(type, in.size()) && StreamingCompress(&c, in, out);
+}
+
+bool ZstdDecompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    ZstdContext* ctx = GetZstdContext();
+    if (ctx == NULL) {
+        return false;
+    }
+    ZstdDecompressor d(ctx->dctx, false);
+    return StreamingDecompress(&d, in, out);
+}
+
+bool ZstdCompress(const google::protobuf::Message& msg, butil::IOBuf* buf) {
+    ZstdContext* ctx = GetZstdContext();
+    if (ctx == NULL) {
+        return false;
+    }
+    ZstdCompressor c(ctx->cctx, false);
+    return c.Init(msg.GetDescriptor(), ZSTD_CONTENTSIZE_UNKNOWN) &&
+        StreamingCompress(&c, msg, buf);
+}
+
+bool ZstdDecompress(const butil::IOBuf& data, google::protobuf::Message* msg) {
+    butil::IOBuf binary_pb;
+    if (!ZstdDecompress(data, &binary_pb)) {
+        return false;
+    }
+    return ParsePbFromIOBuf(msg, binary_pb);
+}
+
+StreamingCompressor* NewZstdCompressor(const google::protobuf::Descriptor* type) {
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    if (cctx == NULL) {
+        LOG(ERROR) << "Fail to create zstd context";
+        return NULL;
+    }
+    ZstdCompressor* c = new ZstdCompressor(cctx, true);
+    if (!c->Init(type, ZSTD_CONTENTSIZE_UNKNOWN)) {
+        delete c;
+        return NULL;
+    }
+    return c;
+}
+
+StreamingDecompressor* NewZstdDecompressor() {
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    if (dctx == NULL) {
+        LOG(ERROR) << "Fail to create zstd context";
+        return NULL;
+    }
+    return new ZstdDecompressor(dctx, true);
+}
+
+}  // namespace policy
+
+int RegisterZstdDictionary(const google::protobuf::ServiceDescriptor* service,
+                           const butil::StringPiece& dict) {
+    using policy::ZstdDictionary;
+    if (service == NULL || dict.empty()) {
+        LOG(ERROR) << "Invalid parameter";
+        return -1;
+    }
+    const unsigned id = ZSTD_getDictID_fromDict(dict.data(), dict.size());
+    if (id == 0) {
+        // The id is the only way for receivers to find the dictionary.
+        LOG(ERROR) << "Dictionary of " << service->full_name()
+                   << " has no id, train it with `zstd --train'";
+        return -1;
+    }
+    if (policy::s_dict_by_type == NULL) {
+        policy::s_dict_by_type = new policy::DictByType;
+        policy::s_dict_by_id = new policy::DictById;
+    }
+    for (int i = 0; i < service->method_count(); ++i) {
+        const google::protobuf::MethodDescriptor* m = service->method(i);
+        if (policy::FindDictionary(m->input_type()) != NULL ||
+            policy::FindDictionary(m->output_type()) != NULL) {
+            LOG(ERROR) << "Messages of " << m->full_name()
+                       << " already have a zstd dictionary";
+            return -1;
+        }
+    }
+    ZstdDictionary* d = (*policy::s_dict_by_id)[id];
+    if (d == NULL) {
+        d = new ZstdDictionary;
+        d->id = id;
+        d->cdict = ZSTD_createCDict(dict.data(), dict.size(),
+                                    FLAGS_zstd_compress_level);
+        d->ddict = ZSTD_createDDict(dict.data(), dict.size());
+        if (d->cdict == NULL || d->ddict == NULL) {
+            LOG(ERROR) << "Fail to load zstd dictionary=" << id;
+            ZSTD_freeCDict(d->cdict);
+            ZSTD_freeDDict(d->ddict);
+            delete d;
+            policy::s_dict_by_id->erase(id);
+            return -1;
+        }
+        (*policy::s_dict_by_id)[id] = d;
+    }
+    for (int i = 0; i < service->method_count(); ++i) {
+        const google::protobuf::MethodDescriptor* m = service->method(i);
+        (*policy::s_dict_by_type)[m->input_type()] = d;
+        (*policy::s_dict_by_type)[m->output_type()] = d;
+    }
+    return 0;
+}
+
+} // namespace brpc
+
+#else
+
+#include "butil/logging.h"
+
+namespace brpc {
+namespace policy {
+
+static bool ZstdNotBuilt() {
+    LOG_EVERY_SECOND(ERROR) << "brpc is not compiled with zstd, "
+        "build it with -DWITH_ZSTD=ON or --with-zstd";
+    return false;
+}
+
+bool ZstdCompress(const google::protobuf::Message&, butil::IOBuf*) {
+    return ZstdNotBuilt();
+}
+
+bool ZstdDecompress(const butil::IOBuf&, google::protobuf::Message*) {
+    return ZstdNotBuilt();
+}
+
+bool ZstdCompress(const butil::IOBuf&, butil::IOBuf*,
+                  const google::protobuf::Descriptor*) {
+    return ZstdNotBuilt();
+}
+
+bool ZstdDecompress(const butil::IOBuf&, butil::IOBuf*) {
+    return ZstdNotBuilt();
+}
+
+StreamingCompressor* NewZstdCompressor(const google::protobuf::Descriptor*) {
+    ZstdNotBuilt();
+    return NULL;
+}
+
+StreamingDecompressor* NewZstdDecompressor() {
+    ZstdNotBuilt();
+    return NULL;
+}
+
+}  // namespace policy
+
+int RegisterZstdDictionary(const google::protobuf::ServiceDescriptor*,
+                           const butil::StringPiece&) {
+    policy::ZstdNotBuilt();
+    return -1;
+}
+
+} // namespace brpc
+
+#endif  // BRPC_WITH_ZSTD
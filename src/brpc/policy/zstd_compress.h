@@ -0,0 +1,60 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_POLICY_ZSTD_COMPRESS_H
+#define BRPC_POLICY_ZSTD_COMPRESS_H
+
+#include <google/protobuf/message.h>          // Message
+#include "butil/iobuf.h"                       // IOBuf
+#include "brpc/compress.h"                      // StreamingCompressor
+
+
+namespace brpc {
+namespace policy {
+
+// Data is compressed in zstd frame format which is compatible with the
+// `zstd' command line tool. Following functions fail when brpc was not
+// built with zstd(-DWITH_ZSTD=ON or --with-zstd).
+
+// Compress serialized `msg' into `buf' with the dictionary registered for
+// the service of `msg' by RegisterZstdDictionary(), if any.
+bool ZstdCompress(const google::protobuf::Message& msg, butil::IOBuf* buf);
+
+// Parse `msg' from decompressed `buf'.
+bool ZstdDecompress(const butil::IOBuf& data, google::protobuf::Message* msg);
+
+// Put compressed `in' into `out'. Blocks of `in' are compressed one by
+// one without being flattened. If `type' is not NULL, the dictionary
+// registered for the service of messages in `type' is used.
+bool ZstdCompress(const butil::IOBuf& in, butil::IOBuf* out,
+                  const google::protobuf::Descriptor* type);
+
+// Put decompressed `in' into `out'. The dictionary is found by the id
+// stored in the frame.
+bool ZstdDecompress(const butil::IOBuf& in, butil::IOBuf* out);
+
+// Create streaming compressors and decompressors, see brpc/compress.h.
+// The compressor uses the dictionary registered for the service of
+// messages in `type' if it's not NULL.
+StreamingCompressor* NewZstdCompressor(const google::protobuf::Descriptor* type);
+StreamingDecompressor* NewZstdDecompressor();
+
+}  // namespace policy
+} // namespace brpc
+
+
+#endif // BRPC_POLICY_ZSTD_COMPRESS_H
@@ -36,6 +36,9 @@
 #include "butil/time.h"
 #include "butil/class_name.h"
 #include "butil/string_printf.h"
+#if defined(OS_LINUX)
+#include <linux/filter.h>                            // sock_filter
+#endif
 #include "brpc/log.h"
 #include "brpc/compress.h"
 #include "brpc/policy/nova_pbrpc_protocol.h"
@@ -71,6 +74,7 @@
 #include "brpc/builtin/hotspots_service.h"     // HotspotsService
 #include "brpc/builtin/prometheus_metrics_service.h"
 #include "brpc/details/method_status.h"
+#include "brpc/details/codel_shedder.h"
 #include "brpc/load_balancer.h"
 #include "brpc/naming_service.h"
 #include "brpc/simple_data_pool.h"
@@ -117,6 +121,7 @@ DEFINE_bool(enable_dir_service, false, "Enable /dir");
 DEFINE_bool(enable_threads_service, false, "Enable /threads");
 
 DECLARE_int32(usercode_backup_threads);
+DECLARE_int32(event_dispatcher_num);
 DECLARE_bool(usercode_in_pthread);
 
 const int INITIAL_SERVICE_CAP = 64;
@@ -133,7 +138,10 @@ ServerOptions::ServerOptions()
     , auth(NULL)
     , server_owns_auth(false)
     , num_threads(8)
+    , num_reuse_port_listeners(0)
     , max_concurrency(0)
+    , deadline_aware_admission(false)
+    , codel_shedding(false)
     , session_local_data_factory(NULL)
     , reserved_session_local_data(0)
     , thread_local_data_factory(NULL)
@@ -174,7 +182,9 @@ Server::MethodProperty::MethodProperty()
     , http_url(NULL)
     , service(NULL)
     , method(NULL)
-    , status(NULL) {
+    , status(NULL)
+    , bthread_tag(BTHREAD_TAG_INVALID)
+    , bthread_priority(BTHREAD_PRIORITY_NORMAL) {
 }
 
 static timeval GetUptime(void* arg/*start_time*/) {
@@ -232,7 +242,7 @@ static void PrintEnabledProfilers(std::ostream& os, void*) {
             os << "heap(no TCMALLOC_SAMPLE_PARAMETER in env) ";
         }
     }
-    os << "contention";
+    os << "contention offcpu";
 }
 
 static bvar::PassiveStatus<std::string> s_lb_st(
@@ -406,7 +416,8 @@ Server::Server(ProfilerLinker)
     , _derivative_thread(INVALID_BTHREAD)
     , _keytable_pool(NULL)
     , _eps_bvar(&_nerror_bvar)
-    , _concurrency(0) {
+    , _concurrency(0)
+    , _codel(NULL) {
     BAIDU_CASSERT(offsetof(Server, _concurrency) % 64 == 0,
                   Server_concurrency_must_be_aligned_by_cacheline);
 }
@@ -442,6 +453,9 @@ Server::~Server() {
     delete _global_restful_map;
     _global_restful_map = NULL;
 
+    delete _codel;
+    _codel = NULL;
+
     if (!_options.pid_file.empty()) {
         unlink(_options.pid_file.c_str());
     }
@@ -494,6 +508,9 @@ int Server::AddBuiltinServices() {
         LOG(ERROR) << "Fail to add HealthService";
         return -1;
     }
+    // Health checks should not be queued behind normal requests.
+    SetMethodPriority(HealthService::descriptor()->method(0)->full_name(),
+                      BTHREAD_PRIORITY_HIGH);
     if (AddBuiltinService(new (std::nothrow) ProtobufsService(this))) {
         LOG(ERROR) << "Fail to add ProtobufsService";
         return -1;
@@ -691,6 +708,63 @@ static int get_port_from_fd(int fd) {
     return ntohs(addr.sin_port);
 }
 
+// Make the kernel choose the listener `cpu % nlistener' for new connections
+// in the SO_REUSEPORT group of `listened_fd', where `cpu' is the core
+// processing the handshake. The program is shared by the whole group and
+// the kernel falls back to hashing when the index is out of range.
+static int SteerReusePortByCpu(int listened_fd, int nlistener) {
+#if defined(OS_LINUX) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    struct sock_filter code[] = {
+        // A = current cpu
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU) },
+        // A = A % nlistener
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)nlistener },
+        // return A
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog;
+    prog.len = ARRAY_SIZE(code);
+    prog.filter = code;
+    return setsockopt(listened_fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                      &prog, sizeof(prog));
+#else
+    (void)listened_fd;
+    (void)nlistener;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+static void CloseFds(const std::vector<int>& fds, size_t begin) {
+    for (size_t i = begin; i < fds.size(); ++i) {
+        close(fds[i]);
+    }
+}
+
+// Returns true if no socket listens to `point', in which case sockets
+// listening to it with SO_REUSEPORT afterwards form a new group.
+static bool IsNotListened(const butil::EndPoint& point) {
+    if (point.port == 0) {
+        // The kernel chooses an unused port.
+        return true;
+    }
+    struct sockaddr_storage addr;
+    socklen_t addr_size = 0;
+    if (butil::endpoint2sockaddr(point, &addr, &addr_size) != 0) {
+        return false;
+    }
+    butil::fd_guard fd(socket(addr.ss_family, SOCK_STREAM, 0));
+    if (fd < 0) {
+        return false;
+    }
+    // Same as tcp_listen(), sockets in TIME_WAIT don't matter.
+    const int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0) {
+        return false;
+    }
+    return bind(fd, (struct sockaddr*)&addr, addr_size) == 0;
+}
+
 static bool CreateConcurrencyLimiter(const AdaptiveMaxConcurrency& amc,
                                      ConcurrencyLimiter** out) {
     if (amc.type() == AdaptiveMaxConcurrency::UNLIMITED()) {
@@ -774,6 +848,14 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
         return -1;
     }
 
+    if (_options.codel_shedding && _codel == NULL) {
+        _codel = new (std::nothrow) CoDelShedder;
+        if (_codel == NULL) {
+            LOG(ERROR) << "Fail to new CoDelShedder";
+            return -1;
+        }
+    }
+
     if (_options.use_rdma) {
 #if BRPC_WITH_RDMA
         if (!OptionsAvailableOverRdma(&_options)) {
@@ -955,6 +1037,18 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
         _global_restful_map->PrepareForFinding();
     }
 
+    bthread_tag_t bthread_tag = BTHREAD_TAG_DEFAULT;
+    if (!_options.bthread_worker_group.empty()) {
+        bthread_tag = bthread_worker_group_tag(
+            _options.bthread_worker_group.c_str());
+        if (bthread_tag == BTHREAD_TAG_INVALID) {
+            LOG(ERROR) << "Unknown worker group=`"
+                       << _options.bthread_worker_group
+                       << "', check -bthread_worker_groups";
+            return -1;
+        }
+    }
+
     if (_options.num_threads > 0) {
         if (FLAGS_usercode_in_pthread) {
             _options.num_threads += FLAGS_usercode_backup_threads;
@@ -994,10 +1088,25 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
         LOG(ERROR) << "Only IPv4 address supports port range feature";
         return -1;
     }
+    const bool reuse_port = (_options.num_reuse_port_listeners > 1);
+    if (reuse_port && butil::is_endpoint_extended(endpoint)) {
+        LOG(ERROR) << "num_reuse_port_listeners is available in IPv4 address only";
+        return -1;
+    }
+    if (reuse_port && _options.num_reuse_port_listeners >
+        FLAGS_event_dispatcher_num) {
+        LOG(WARNING) << "ServerOptions.num_reuse_port_listeners="
+                     << _options.num_reuse_port_listeners
+                     << " is greater than -event_dispatcher_num="
+                     << FLAGS_event_dispatcher_num
+                     << ", some listeners share dispatchers";
+    }
     _listen_addr = endpoint;
     for (int port = port_range.min_port; port <= port_range.max_port; ++port) {
         _listen_addr.port = port;
-        butil::fd_guard sockfd(tcp_listen(_listen_addr));
+        const bool new_reuse_port_group =
+            reuse_port && IsNotListened(_listen_addr);
+        butil::fd_guard sockfd(tcp_listen(_listen_addr, reuse_port));
         if (sockfd < 0) {
             if (port != port_range.max_port) { // not the last port, try next
                 continue;
@@ -1028,6 +1137,35 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
             }
             _am->_use_rdma = _options.use_rdma;
         }
+        _am->_bthread_tag = bthread_tag;
+
+        // Other listeners join the SO_REUSEPORT group of `sockfd' in order,
+        // the i-th one receives connections steered to index i. Listen to
+        // all of them before the server is running.
+        std::vector<int> extra_fds;
+        for (int i = 1; reuse_port && i < _options.num_reuse_port_listeners;
+             ++i) {
+            const int extra_fd = tcp_listen(_listen_addr, true);
+            if (extra_fd < 0) {
+                PLOG(ERROR) << "Fail to listen " << _listen_addr
+                            << " with SO_REUSEPORT";
+                CloseFds(extra_fds, 0);
+                return -1;
+            }
+            extra_fds.push_back(extra_fd);
+        }
+        if (reuse_port) {
+            if (!new_reuse_port_group) {
+                LOG(WARNING) << _listen_addr << " was listened by other "
+                    "sockets with SO_REUSEPORT, don't steer connections to "
+                    "listeners by cpu";
+            } else if (SteerReusePortByCpu(
+                           sockfd, _options.num_reuse_port_listeners) != 0) {
+                PLOG(WARNING) << "Fail to steer connections to listeners by "
+                    "cpu, the kernel chooses listeners by hashing instead";
+            }
+        }
+
         // Set `_status' to RUNNING before accepting connections
         // to prevent requests being rejected as ELOGOFF
         _status = RUNNING;
@@ -1037,11 +1175,26 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
 
         // Pass ownership of `sockfd' to `_am'
         if (_am->StartAccept(sockfd, _options.idle_timeout_sec,
-                             _default_ssl_ctx) != 0) {
+                             _default_ssl_ctx, (reuse_port ? 0 : -1)) != 0) {
             LOG(ERROR) << "Fail to start acceptor";
+            CloseFds(extra_fds, 0);
+            g_running_server_count.fetch_sub(1, butil::memory_order_relaxed);
+            _status = READY;
             return -1;
         }
         sockfd.release();
+        for (size_t i = 0; i < extra_fds.size(); ++i) {
+            if (_am->AddListener(extra_fds[i], i + 1) != 0) {
+                LOG(ERROR) << "Fail to add listener to acceptor";
+                CloseFds(extra_fds, i);
+                // Don't leave the server accepting from part of listeners.
+                _am->StopAccept(0);
+                _am->Join();
+                g_running_server_count.fetch_sub(1, butil::memory_order_relaxed);
+                _status = READY;
+                return -1;
+            }
+        }
         break; // stop trying
     }
     if (_options.internal_port >= 0 && _options.has_builtin_services) {
@@ -1270,6 +1423,23 @@ int Server::AddServiceInternal(google::protobuf::Service* service,
         return -1;
     }
 
+    bthread_tag_t bthread_tag = BTHREAD_TAG_INVALID;
+    if (!svc_opt.bthread_worker_group.empty()) {
+        bthread_tag = bthread_worker_group_tag(svc_opt.bthread_worker_group.c_str());
+        if (bthread_tag == BTHREAD_TAG_INVALID) {
+            LOG(ERROR) << "Unknown worker group=`" << svc_opt.bthread_worker_group
+                       << "' of service=" << sd->full_name()
+                       << ", check -bthread_worker_groups";
+            return -1;
+        }
+    }
+    if (svc_opt.bthread_priority < BTHREAD_PRIORITY_LOW ||
+        svc_opt.bthread_priority > BTHREAD_PRIORITY_HIGH) {
+        LOG(ERROR) << "Invalid bthread_priority=" << svc_opt.bthread_priority
+                   << " of service=" << sd->full_name();
+        return -1;
+    }
+
     // defined `option (idl_support) = true' or not.
     const bool is_idl_support = sd->file()->options().GetExtension(idl_support);
 
@@ -1287,6 +1457,8 @@ int Server::AddServiceInternal(google::protobuf::Service* service,
         mp.service = service;
         mp.method = md;
         mp.status = new MethodStatus;
+        mp.bthread_tag = bthread_tag;
+        mp.bthread_priority = svc_opt.bthread_priority;
         _method_map[md->full_name()] = mp;
         if (is_idl_support && sd->name() != sd->full_name()/*has ns*/) {
             MethodProperty mp2 = mp;
@@ -1471,6 +1643,7 @@ ServiceOptions::ServiceOptions()
     , pb_bytes_to_base64(true)
 #endif
     , pb_single_repeated_to_array(false)
+    , bthread_priority(BTHREAD_PRIORITY_NORMAL)
     {}
 
 int Server::AddService(google::protobuf::Service* service,
@@ -2199,6 +2372,53 @@ int Server::MaxConcurrencyOf(google::protobuf::Service* service,
     return MaxConcurrencyOf(service->GetDescriptor()->full_name(), method_name);
 }
 
+int Server::SetMethodPriority(const butil::StringPiece& full_method_name,
+                              bthread_priority_t priority) {
+    if (IsRunning()) {
+        LOG(ERROR) << "SetMethodPriority is only allowed before Server started";
+        return -1;
+    }
+    if (priority < BTHREAD_PRIORITY_LOW || priority > BTHREAD_PRIORITY_HIGH) {
+        LOG(ERROR) << "Invalid priority=" << priority;
+        return -1;
+    }
+    MethodProperty* mp = _method_map.seek(full_method_name);
+    if (mp == NULL) {
+        LOG(ERROR) << "Fail to find method=" << full_method_name;
+        return -1;
+    }
+    mp->bthread_priority = priority;
+    return 0;
+}
+
+bool Server::AdmitRequest(const MethodProperty* mp, Controller* cntl,
+                          int64_t received_us) const {
+    if (mp->is_builtin_service ||
+        (!_options.codel_shedding && !_options.deadline_aware_admission)) {
+        return true;
+    }
+    const int64_t now_us = butil::cpuwide_time_us();
+    const int64_t elapsed_us = now_us - received_us;
+    if (_options.codel_shedding && _codel != NULL &&
+        _codel->OnDequeued(elapsed_us, now_us)) {
+        cntl->SetFailed(ELIMIT, "Shed by CoDel, queueing delay=%" PRId64 "us",
+                        elapsed_us);
+        return false;
+    }
+    if (_options.deadline_aware_admission && cntl->timeout_ms() > 0) {
+        const int64_t left_us = cntl->timeout_ms() * 1000L - elapsed_us;
+        const int64_t expected_us =
+            mp->status ? mp->status->ExpectedLatency(now_us) : 0;
+        if (left_us <= 0 || left_us < expected_us) {
+            cntl->SetFailed(ERPCTIMEDOUT, "Time left before deadline=%" PRId64
+                            "us is less than expected latency=%" PRId64 "us",
+                            left_us, expected_us);
+            return false;
+        }
+    }
+    return true;
+}
+
 #ifdef SSL_CTRL_SET_TLSEXT_HOSTNAME
 int Server::SSLSwitchCTXByHostname(struct ssl_st* ssl,
                                    int* al, Server* server) {
@@ -58,6 +58,7 @@ class MongoServiceAdaptor;
 class RestfulMap;
 class RtmpService;
 class RedisService;
+class CoDelShedder;
 struct SocketSSLContext;
 
 struct ServerOptions {
@@ -106,6 +107,35 @@ struct ServerOptions {
     // Default: #cpu-cores
     int num_threads;
 
+    // If this option is greater than 1, the server opens so many sockets
+    // listening to the same port with SO_REUSEPORT instead of one, the i-th
+    // listener and all connections accepted from it are watched by the i-th
+    // EventDispatcher (modulo -event_dispatcher_num, which should be set to
+    // at least this value), so that accepting, reading and processing of a
+    // connection stay in one dispatcher rather than being spread over all
+    // of them. On linux, new connections are steered to the listener
+    // `cpu % num_reuse_port_listeners' where `cpu' is the core receiving the
+    // connection, otherwise the kernel chooses the listener by hashing.
+    // Dispatchers are bthreads not pinned to cores, so the steering is just
+    // a best-effort spreading of connections rather than keeping them on
+    // the receiving cores.
+    // Suitable for servers accepting a lot of short connections.
+    // Connections are not steered if the port was already listened by
+    // other sockets with SO_REUSEPORT (e.g. of other processes with
+    // -reuse_port) when the server started, since the steering applies to
+    // the whole group.
+    // Default: 0 (one listener)
+    int num_reuse_port_listeners;
+
+    // Name of the worker group (see -bthread_worker_groups) to run the
+    // server in. EventDispatchers watching connections of the server and
+    // bthreads reading, parsing and processing requests all run in the
+    // group, so that the server neither uses nor is delayed by workers of
+    // other groups. `num_threads' does not apply to named groups whose
+    // sizes are fixed by the flag.
+    // Default: "" (the default group)
+    std::string bthread_worker_group;
+
     // Server-level max concurrency.
     // "concurrency" = "number of requests processed in parallel"
     //
@@ -127,6 +157,29 @@ struct ServerOptions {
     // Overridable by Server.MaxConcurrencyOf().
     AdaptiveMaxConcurrency method_max_concurrency;
 
+    // Reject a request without calling the method when the time left before
+    // the deadline of the client is less than the time the method took to
+    // process requests and write responses recently. The response would
+    // arrive after the client timed out, so processing it only wastes CPU
+    // which is often scarce when requests queue up. The time left is the
+    // timeout sent by the client minus the time the request has spent in
+    // the server, including queueing in bthread run queues. Rejected
+    // requests fail with ERPCTIMEDOUT, which is not retried by clients.
+    // NOTE: Only baidu_std clients with -baidu_std_protocol_deliver_timeout_ms
+    // on send their timeouts.
+    // Default: false
+    bool deadline_aware_admission;
+
+    // Shed requests waiting too long before being processed with CoDel
+    // (Controlled Delay): if queueing delays of requests stay above
+    // -server_codel_target_ms for -server_codel_interval_ms, requests with
+    // long delays are rejected with ELIMIT at increasing rates until the
+    // delays drop below the target. Short bursts are not affected.
+    // NOTE: builtin services are neither shed nor rejected by
+    // `deadline_aware_admission'. Only baidu_std is supported now.
+    // Default: false
+    bool codel_shedding;
+
     // -------------------------------------------------------
     // Differences between session-local and thread-local data
     // -------------------------------------------------------
@@ -314,6 +367,30 @@ struct ServiceOptions {
     // decode json array to protobuf message which contains a single repeated field.
     // Default: false.
     bool pb_single_repeated_to_array;
+
+    // Name of the worker group (see -bthread_worker_groups) to run methods
+    // of the service in. Requests are still read and parsed in the group of
+    // the server (ServerOptions.bthread_worker_group) and handed over to a
+    // bthread of this group before calling the method. Only baidu_std and
+    // http/h2 (including grpc) support this option, methods called by other
+    // protocols run in the group of the server.
+    // Default: "" (same as the server)
+    std::string bthread_worker_group;
+
+    // Priority of bthreads calling methods of the service, see
+    // bthread_attr_t.priority. Methods of non-normal priorities are called
+    // in new bthreads of the priority after parsing requests, so that e.g.
+    // health checks are not queued behind bulk scans of low priority under
+    // overload. Overridable by Server.SetMethodPriority(). Only baidu_std and
+    // http/h2 (including grpc) support this option.
+    // NOTE: The priority is unknown before the request is parsed, so
+    // queueing before that is NOT prioritized: bthreads parsing requests
+    // (one per message cut from a connection) are of normal priority and a
+    // request of high priority still waits behind queued messages of other
+    // requests before being parsed. Only the processing after parsing is
+    // prioritized.
+    // Default: BTHREAD_PRIORITY_NORMAL
+    bthread_priority_t bthread_priority;
 };
 
 // Represent ports inside [min_port, max_port]
@@ -374,6 +451,11 @@ public:
         const google::protobuf::MethodDescriptor* method;
         MethodStatus* status;
         AdaptiveMaxConcurrency max_concurrency;
+        // Worker group to call the method in, BTHREAD_TAG_INVALID to call
+        // in the group parsing the request.
+        bthread_tag_t bthread_tag;
+        // Priority of the bthread calling the method.
+        bthread_priority_t bthread_priority;
 
         MethodProperty();
     };
@@ -552,6 +634,16 @@ public:
     int MaxConcurrencyOf(google::protobuf::Service* service,
                          const butil::StringPiece& method_name) const;
 
+    // Set priority of bthreads calling the method, overriding
+    // ServiceOptions.bthread_priority of its service. Methods of builtin
+    // health service are BTHREAD_PRIORITY_HIGH by default.
+    // Example:
+    //    server.SetMethodPriority("example.EchoService.Scan", BTHREAD_PRIORITY_LOW);
+    // Note: This interface can ONLY be called before the server is started.
+    // Returns 0 on success, -1 otherwise.
+    int SetMethodPriority(const butil::StringPiece& full_method_name,
+                          bthread_priority_t priority);
+
 private:
 friend class StatusService;
 friend class ProtobufsService;
@@ -644,6 +736,12 @@ friend class Controller;
     AdaptiveMaxConcurrency& MaxConcurrencyOf(MethodProperty*);
     int MaxConcurrencyOf(const MethodProperty*) const;
 
+    // Returns true if the request to `mp' received at `received_us' should
+    // be processed, otherwise `cntl' is failed with the reason. See
+    // ServerOptions.deadline_aware_admission and ServerOptions.codel_shedding.
+    bool AdmitRequest(const MethodProperty* mp, Controller* cntl,
+                      int64_t received_us) const;
+
     DISALLOW_COPY_AND_ASSIGN(Server);
 
     // Put frequently-accessed data pool at first.
@@ -705,6 +803,9 @@ friend class Controller;
     mutable bvar::Adder<int64_t> _nerror_bvar;
     mutable bvar::PerSecond<bvar::Adder<int64_t> > _eps_bvar;
     BAIDU_CACHELINE_ALIGNMENT mutable int32_t _concurrency;
+
+    // Created at first start with ServerOptions.codel_shedding on.
+    CoDelShedder* _codel;
 };
 
 // Get the data attached to current searching thread. The data is created by
@@ -30,6 +30,9 @@
 #include <mesalink/openssl/x509.h>
 #endif
 #include <netinet/tcp.h>                         // getsockopt
+#if defined(OS_LINUX)
+#include <linux/errqueue.h>                      // sock_extended_err
+#endif
 #include <gflags/gflags.h>
 #include "bthread/unstable.h"                    // bthread_timer_del
 #include "butil/fd_utility.h"                     // make_non_blocking
@@ -59,6 +62,19 @@
 #include <sys/event.h>
 #endif
 
+#if defined(OS_LINUX)
+// Missing in headers of old glibc and kernels.
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+#endif
+
 namespace bthread {
 size_t __attribute__((weak))
 get_sizes(const bthread_id_list_t* list, size_t* cnt, size_t n);
@@ -94,6 +110,11 @@ DEFINE_int64(socket_max_streams_unconsumed_bytes, 0,
              "Max stream receivers' unconsumed bytes in one socket,"
              " it used in stream for receiver buffer control.");
 
+DEFINE_int64(socket_zerocopy_min_bytes, 0,
+             "Write into TCP sockets with MSG_ZEROCOPY(Linux 4.14+) when a "
+             "batch of data to write has at least so many bytes, 0 disables");
+BRPC_VALIDATE_GFLAG(socket_zerocopy_min_bytes, NonNegativeInteger);
+
 DEFINE_int32(max_connection_pool_size, 100,
              "Max number of pooled connections to a single endpoint");
 BRPC_VALIDATE_GFLAG(max_connection_pool_size, PassValidate);
@@ -430,6 +451,8 @@ Socket::Socket(Forbidden)
     , _shared_part(NULL)
     , _nevent(0)
     , _keytable_pool(NULL)
+    , _event_dispatcher_index(-1)
+    , _bthread_tag(BTHREAD_TAG_DEFAULT)
     , _fd(-1)
     , _tos(0)
     , _reset_fd_real_us(-1)
@@ -441,6 +464,8 @@ Socket::Socket(Forbidden)
     , _hc_count(0)
     , _last_msg_size(0)
     , _avg_msg_size(0)
+    , _io_uring_recv(false)
+    , _io_uring_recv_error(0)
     , _last_readtime_us(0)
     , _parsing_context(NULL)
     , _correlation_id(0)
@@ -470,6 +495,8 @@ Socket::Socket(Forbidden)
     , _stream_set(NULL)
     , _total_streams_unconsumed_size(0)
     , _ninflight_app_health_check(0)
+    , _zerocopy_state(ZEROCOPY_UNKNOWN)
+    , _zerocopy_front_id(0)
 {
     CreateVarsOnce();
     pthread_mutex_init(&_id_wait_list_mutex, NULL);
@@ -540,6 +567,18 @@ int Socket::ResetFileDescriptor(int fd) {
     // Reset message sizes when fd is changed.
     _last_msg_size = 0;
     _avg_msg_size = 0;
+    _io_uring_recv = false;
+    {
+        BAIDU_SCOPED_LOCK(_io_uring_recv_mutex);
+        _io_uring_recv_buf.clear();
+        _io_uring_recv_error = 0;
+    }
+    _zerocopy_state.store(ZEROCOPY_UNKNOWN, butil::memory_order_relaxed);
+    {
+        BAIDU_SCOPED_LOCK(_zerocopy_mutex);
+        _zerocopy_q.clear();
+        _zerocopy_front_id = 0;
+    }
     // MUST store `_fd' before adding itself into epoll device to avoid
     // race conditions with the callback function inside epoll
     _fd.store(fd, butil::memory_order_release);
@@ -589,9 +628,20 @@ int Socket::ResetFileDescriptor(int fd) {
     }
 
     if (_on_edge_triggered_events) {
-        if (GetGlobalEventDispatcher(fd).AddConsumer(id(), fd) != 0) {
+        EventDispatcher& edisp =
+            GetGlobalEventDispatcher(fd, _bthread_tag,
+                                     _event_dispatcher_index);
+        // Only plain connections read by InputMessenger can be received by
+        // the dispatcher, SSL and RDMA need to read the fd by themselves.
+        _io_uring_recv = (edisp.io_uring_recv_enabled() &&
+                          _on_edge_triggered_events == InputMessenger::OnNewMessages &&
+                          _ssl_state == SSL_OFF && _rdma_state == RDMA_OFF);
+        const int rc = (_io_uring_recv ? edisp.AddRecvConsumer(id(), fd) :
+                        edisp.AddConsumer(id(), fd));
+        if (rc != 0) {
             PLOG(ERROR) << "Fail to add SocketId=" << id() 
                         << " into EventDispatcher";
+            _io_uring_recv = false;
             _fd.store(-1, butil::memory_order_release);
             return -1;
         }
@@ -613,6 +663,8 @@ int Socket::Create(const SocketOptions& options, SocketId* id) {
     CHECK(NULL == m->_shared_part.load(butil::memory_order_relaxed));
     m->_nevent.store(0, butil::memory_order_relaxed);
     m->_keytable_pool = options.keytable_pool;
+    m->_event_dispatcher_index = options.event_dispatcher_index;
+    m->_bthread_tag = options.bthread_tag;
     m->_tos = 0;
     m->_remote_side = options.remote_side;
     m->_on_edge_triggered_events = options.on_edge_triggered_events;
@@ -737,7 +789,9 @@ int Socket::WaitAndReset(int32_t expected_nref) {
     const int prev_fd = _fd.exchange(-1, butil::memory_order_relaxed);
     if (ValidFileDescriptor(prev_fd)) {
         if (_on_edge_triggered_events != NULL) {
-            GetGlobalEventDispatcher(prev_fd).RemoveConsumer(prev_fd);
+            GetGlobalEventDispatcher(prev_fd, _bthread_tag,
+                                     _event_dispatcher_index)
+                .RemoveConsumer(prev_fd);
         }
         close(prev_fd);
         if (CreatedByConnect()) {
@@ -1045,7 +1099,9 @@ void Socket::OnRecycle() {
     const int prev_fd = _fd.exchange(-1, butil::memory_order_relaxed);
     if (ValidFileDescriptor(prev_fd)) {
         if (_on_edge_triggered_events != NULL) {
-            GetGlobalEventDispatcher(prev_fd).RemoveConsumer(prev_fd);
+            GetGlobalEventDispatcher(prev_fd, _bthread_tag,
+                                     _event_dispatcher_index)
+                .RemoveConsumer(prev_fd);
         }
         close(prev_fd);
         if (create_by_connect) {
@@ -1063,6 +1119,16 @@ void Socket::OnRecycle() {
 
     reset_parsing_context(NULL);
     _read_buf.clear();
+    {
+        BAIDU_SCOPED_LOCK(_io_uring_recv_mutex);
+        _io_uring_recv_buf.clear();
+    }
+    {
+        // The fd was closed, pages still being sent by the kernel are kept
+        // alive by the kernel itself.
+        BAIDU_SCOPED_LOCK(_zerocopy_mutex);
+        _zerocopy_q.clear();
+    }
 
     _auth_flag_error.store(0, butil::memory_order_relaxed);
     bthread_id_error(_auth_id, 0);
@@ -1173,7 +1239,8 @@ int Socket::WaitEpollOut(int fd, bool pollin, const timespec* abstime) {
     // Do not need to check addressable since it will be called by
     // health checker which called `SetFailed' before
     const int expected_val = _epollout_butex->load(butil::memory_order_relaxed);
-    EventDispatcher& edisp = GetGlobalEventDispatcher(fd);
+    EventDispatcher& edisp =
+        GetGlobalEventDispatcher(fd, _bthread_tag, _event_dispatcher_index);
     if (edisp.AddEpollOut(id(), fd, pollin) != 0) {
         return -1;
     }
@@ -1807,13 +1874,97 @@ void* Socket::KeepWrite(void* void_arg) {
     return NULL;
 }
 
+ssize_t Socket::DoZerocopyWrite(butil::IOBuf* const* data_list, size_t ndata) {
+#if defined(OS_LINUX)
+    int state = _zerocopy_state.load(butil::memory_order_relaxed);
+    if (state == ZEROCOPY_UNKNOWN) {
+        // Fails on non-TCP sockets or kernels before 4.14.
+        const int on = 1;
+        state = (setsockopt(fd(), SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0
+                 ? ZEROCOPY_ON : ZEROCOPY_OFF);
+        _zerocopy_state.store(state, butil::memory_order_relaxed);
+    }
+    if (state == ZEROCOPY_ON) {
+        // Release finished writes before holding more blocks.
+        ReapZerocopyCompletions();
+        butil::IOBuf sent;
+        // Hold the lock during sending, otherwise the notification may be
+        // reaped before the write is queued.
+        BAIDU_SCOPED_LOCK(_zerocopy_mutex);
+        const ssize_t nw = butil::IOBuf::cut_multiple_into_socket_zerocopy(
+            fd(), data_list, ndata, &sent);
+        if (nw > 0) {
+            _zerocopy_q.push_back(ZerocopyWrite());
+            _zerocopy_q.back().data.swap(sent);
+            g_vars->nzerocopy << 1;
+            return nw;
+        }
+        // ENOBUFS means that pages pinned by the socket exceeded the limit
+        // of optmem_max, send with copying instead.
+        if (nw == 0 || errno != ENOBUFS) {
+            return nw;
+        }
+    }
+#endif
+    g_vars->nzerocopy_fallback << 1;
+    return butil::IOBuf::cut_multiple_into_file_descriptor(
+        fd(), data_list, ndata);
+}
+
+void Socket::ReapZerocopyCompletions() {
+#if defined(OS_LINUX)
+    BAIDU_SCOPED_LOCK(_zerocopy_mutex);
+    while (!_zerocopy_q.empty()) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd(), &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            // EAGAIN when there's no notification. Other errors are
+            // reported by reading or writing the fd as well.
+            break;
+        }
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+             cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            const sock_extended_err* serr = (const sock_extended_err*)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // Writes numbered in [ee_info, ee_data] are done.
+            const uint32_t n = serr->ee_data - serr->ee_info + 1;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                g_vars->nzerocopy_copied << n;
+            }
+            for (uint32_t i = 0; i < n; ++i) {
+                const uint32_t index = serr->ee_info + i - _zerocopy_front_id;
+                if (index < _zerocopy_q.size()) {
+                    _zerocopy_q[index].done = true;
+                }
+            }
+        }
+        // Notifications may be out of order, only release the front ones.
+        while (!_zerocopy_q.empty() && _zerocopy_q.front().done) {
+            _zerocopy_q.pop_front();
+            ++_zerocopy_front_id;
+        }
+    }
+#endif
+}
+
 ssize_t Socket::DoWrite(WriteRequest* req) {
     // Group butil::IOBuf in the list into a batch array.
     butil::IOBuf* data_list[DATA_LIST_MAX];
     size_t ndata = 0;
+    size_t nbytes = 0;
     for (WriteRequest* p = req; p != NULL && ndata < DATA_LIST_MAX;
          p = p->next) {
         data_list[ndata++] = &p->data;
+        nbytes += p->data.size();
     }
 
     if (ssl_state() == SSL_OFF) {
@@ -1826,6 +1977,10 @@ ssize_t Socket::DoWrite(WriteRequest* req) {
                 return _rdma_ep->CutFromIOBufList(data_list, ndata);
             }
 #endif
+            const int64_t zerocopy_min_bytes = FLAGS_socket_zerocopy_min_bytes;
+            if (zerocopy_min_bytes > 0 && (int64_t)nbytes >= zerocopy_min_bytes) {
+                return DoZerocopyWrite(data_list, ndata);
+            }
             return butil::IOBuf::cut_multiple_into_file_descriptor(
                 fd(), data_list, ndata);
         }
@@ -1951,7 +2106,44 @@ int Socket::SSLHandshake(int fd, bool server_mode) {
     #endif
 }
 
+ssize_t Socket::DoReadFromIoUring() {
+    BAIDU_SCOPED_LOCK(_io_uring_recv_mutex);
+    if (!_io_uring_recv_buf.empty()) {
+        const ssize_t nr = _io_uring_recv_buf.size();
+        _read_buf.append(butil::IOBuf::Movable(_io_uring_recv_buf));
+        return nr;
+    }
+    if (_io_uring_recv_error == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (_io_uring_recv_error < 0) {
+        return 0;  // EOF
+    }
+    errno = _io_uring_recv_error;
+    return -1;
+}
+
+void Socket::AppendIoUringRecv(butil::IOBuf* data, int error) {
+    BAIDU_SCOPED_LOCK(_io_uring_recv_mutex);
+    if (!data->empty()) {
+        _io_uring_recv_buf.append(butil::IOBuf::Movable(*data));
+    }
+    if (error != 0 && _io_uring_recv_error == 0) {
+        _io_uring_recv_error = error;
+    }
+}
+
 ssize_t Socket::DoRead(size_t size_hint) {
+    if (_zerocopy_state.load(butil::memory_order_relaxed) == ZEROCOPY_ON) {
+        // Notifications of MSG_ZEROCOPY arrive as EPOLLERR which is handled
+        // as an input event.
+        ReapZerocopyCompletions();
+    }
+    if (_io_uring_recv) {
+        // Received by the EventDispatcher already, `size_hint' is useless.
+        return DoReadFromIoUring();
+    }
     if (ssl_state() == SSL_UNKNOWN) {
         int error_code = 0;
         _ssl_state = DetectSSLState(fd(), &error_code);
@@ -140,6 +140,9 @@ struct SocketVarsCollector {
         , nkeepwrite_second("rpc_keepwrite_second", &nkeepwrite)
         , nwaitepollout("rpc_waitepollout_count")
         , nwaitepollout_second("rpc_waitepollout_second", &nwaitepollout)
+        , nzerocopy("rpc_socket_zerocopy_count")
+        , nzerocopy_copied("rpc_socket_zerocopy_copied_count")
+        , nzerocopy_fallback("rpc_socket_zerocopy_fallback_count")
     {}
 
     bvar::Adder<int64_t> nsocket;
@@ -151,6 +154,12 @@ struct SocketVarsCollector {
     bvar::PerSecond<bvar::Adder<int64_t> > nkeepwrite_second;
     bvar::Adder<int64_t> nwaitepollout;
     bvar::PerSecond<bvar::Adder<int64_t> > nwaitepollout_second;
+    // Writes sent with MSG_ZEROCOPY.
+    bvar::Adder<int64_t> nzerocopy;
+    // Writes sent with MSG_ZEROCOPY but copied by the kernel anyway.
+    bvar::Adder<int64_t> nzerocopy_copied;
+    // Writes qualified for MSG_ZEROCOPY but sent with plain writev.
+    bvar::Adder<int64_t> nzerocopy_fallback;
 };
 
 struct PipelinedInfo {
@@ -198,12 +207,24 @@ struct SocketOptions {
     std::shared_ptr<AppConnect> app_connect;
     // The created socket will set parsing_context with this value.
     Destroyable* initial_parsing_context;
+    // Events of the fd are watched by the global EventDispatcher at this
+    // index (modulo -event_dispatcher_num). Acceptors set it so that
+    // connections accepted from a listener are dispatched by the same
+    // dispatcher as the listener.
+    // Default: -1 (choose the dispatcher by hashing the fd)
+    int event_dispatcher_index;
+    // Events of the fd are watched by dispatchers of this worker group and
+    // the messages are processed in bthreads of the group, see
+    // -bthread_worker_groups.
+    // Default: BTHREAD_TAG_DEFAULT
+    bthread_tag_t bthread_tag;
 };
 
 // Abstractions on reading from and writing into file descriptors.
 // NOTE: accessed by multiple threads(frequently), align it by cacheline.
 class BAIDU_CACHELINE_ALIGNMENT/*note*/ Socket {
 friend class EventDispatcher;
+friend class IoUringPoller;
 friend class InputMessenger;
 friend class Acceptor;
 friend class ConnectionsService;
@@ -578,11 +599,28 @@ friend void DereferenceSocket(Socket*);
     // bytes on success, 0 on EOF, -1 otherwise and errno is set
     ssize_t DoRead(size_t size_hint);
 
+    // Move data received by the EventDispatcher into `_read_buf'. Returns
+    // same as DoRead.
+    ssize_t DoReadFromIoUring();
+
+    // Called by the EventDispatcher with data received on behalf of this
+    // socket. `error' is 0, errno or -1 on EOF.
+    void AppendIoUringRecv(butil::IOBuf* data, int error);
+
     // Based upon whether the underlying channel is using SSL, write
     // `req' using the corresponding method. Returns written bytes on
     // success, -1 otherwise and errno is set
     ssize_t DoWrite(WriteRequest* req);
 
+    // Write with sendmsg(MSG_ZEROCOPY) and keep written blocks referenced
+    // until the kernel is done with them. Fall back to writev if zerocopy
+    // is not available. Returns same as DoWrite.
+    ssize_t DoZerocopyWrite(butil::IOBuf* const* data_list, size_t ndata);
+
+    // Release blocks written by DoZerocopyWrite according to notifications
+    // in the error queue of `_fd'.
+    void ReapZerocopyCompletions();
+
     // Called before returning to pool.
     void OnRecycle();
 
@@ -716,6 +754,12 @@ private:
     // on sockets created by the Acceptor.
     bthread_keytable_pool_t* _keytable_pool;
 
+    // Initialized by SocketOptions.event_dispatcher_index.
+    int _event_dispatcher_index;
+
+    // Initialized by SocketOptions.bthread_tag.
+    bthread_tag_t _bthread_tag;
+
     // [ Set in ResetFileDescriptor ]
     butil::atomic<int> _fd;  // -1 when not connected.
     int _tos;                // Type of service which is actually only 8bits.
@@ -762,6 +806,15 @@ private:
     // Storing data read from `_fd' but cut-off yet.
     butil::IOPortal _read_buf;
 
+    // True if data of `_fd' is received by the EventDispatcher with
+    // io_uring(-event_dispatcher_io_uring_recv) rather than by DoRead.
+    bool _io_uring_recv;
+    // Received by the EventDispatcher but not moved into `_read_buf' yet.
+    butil::Mutex _io_uring_recv_mutex;
+    butil::IOBuf _io_uring_recv_buf;
+    // 0, errno of the last failed receiving or -1 on EOF.
+    int _io_uring_recv_error;
+
     // Set with cpuwide_time_us() at last read operation
     butil::atomic<int64_t> _last_readtime_us;
 
@@ -873,6 +926,26 @@ private:
     butil::atomic<int64_t> _total_streams_unconsumed_size;
 
     butil::atomic<int64_t> _ninflight_app_health_check;
+
+    enum ZerocopyState {
+        ZEROCOPY_UNKNOWN,
+        ZEROCOPY_ON,
+        ZEROCOPY_OFF,
+    };
+    struct ZerocopyWrite {
+        ZerocopyWrite() : done(false) {}
+        butil::IOBuf data;
+        bool done;
+    };
+    // Whether SO_ZEROCOPY was enabled on `_fd', set by the first write over
+    // -socket_zerocopy_min_bytes.
+    butil::atomic<int> _zerocopy_state;
+    butil::Mutex _zerocopy_mutex;
+    // Writes sent with MSG_ZEROCOPY whose pages may still be used by the
+    // kernel. The kernel numbers them consecutively, the front one is
+    // numbered `_zerocopy_front_id'.
+    std::deque<ZerocopyWrite> _zerocopy_q;
+    uint32_t _zerocopy_front_id;
 };
 
 } // namespace brpc
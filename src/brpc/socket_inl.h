@@ -62,6 +62,8 @@ inline SocketOptions::SocketOptions()
     , conn(NULL)
     , app_connect(NULL)
     , initial_parsing_context(NULL)
+    , event_dispatcher_index(-1)
+    , bthread_tag(BTHREAD_TAG_DEFAULT)
 {}
 
 inline int Socket::Dereference() {
@@ -137,22 +137,96 @@ start_from_non_worker(bthread_t* __restrict tid,
     if (NULL == c) {
         return ENOMEM;
     }
+    bthread_tag_t tag = BTHREAD_TAG_DEFAULT;
+    if (attr != NULL && attr->tag != BTHREAD_TAG_INVALID) {
+        if (attr->tag < 0 || attr->tag >= c->worker_group_count()) {
+            return EINVAL;
+        }
+        tag = attr->tag;
+    }
     if (attr != NULL && (attr->flags & BTHREAD_NOSIGNAL)) {
         // Remember the TaskGroup to insert NOSIGNAL tasks for 2 reasons:
         // 1. NOSIGNAL is often for creating many bthreads in batch,
         //    inserting into the same TaskGroup maximizes the batch.
         // 2. bthread_flush() needs to know which TaskGroup to flush.
         TaskGroup* g = tls_task_group_nosignal;
-        if (NULL == g) {
-            g = c->choose_one_group();
+        if (NULL == g || g->tag() != tag) {
+            if (g) {
+                g->flush_nosignal_tasks_remote();
+            }
+            g = c->choose_one_group(tag);
             tls_task_group_nosignal = g;
         }
         return g->start_background<true>(tid, attr, fn, arg);
     }
-    return c->choose_one_group()->start_background<true>(
+    return c->choose_one_group(tag)->start_background<true>(
         tid, attr, fn, arg);
 }
 
+BUTIL_FORCE_INLINE int
+start_batch_from_non_worker(bthread_t* __restrict tids,
+                            const bthread_attr_t* __restrict attr,
+                            void * (*fn)(void*),
+                            void* const* args,
+                            size_t n) {
+    TaskControl* c = get_or_new_task_control();
+    if (NULL == c) {
+        return ENOMEM;
+    }
+    bthread_tag_t tag = BTHREAD_TAG_DEFAULT;
+    if (attr != NULL && attr->tag != BTHREAD_TAG_INVALID) {
+        if (attr->tag < 0 || attr->tag >= c->worker_group_count()) {
+            return EINVAL;
+        }
+        tag = attr->tag;
+    }
+    if (attr != NULL && (attr->flags & BTHREAD_NOSIGNAL)) {
+        // Same as start_from_non_worker().
+        TaskGroup* g = tls_task_group_nosignal;
+        if (NULL == g || g->tag() != tag) {
+            if (g) {
+                g->flush_nosignal_tasks_remote();
+            }
+            g = c->choose_one_group(tag);
+            tls_task_group_nosignal = g;
+        }
+        return g->start_background_batch<true>(tids, attr, fn, args, n);
+    }
+    return c->choose_one_group(tag)->start_background_batch<true>(
+        tids, attr, fn, args, n);
+}
+
+inline bool invalid_priority(const bthread_attr_t* attr) {
+    return attr != NULL && (attr->priority < BTHREAD_PRIORITY_LOW ||
+                            attr->priority > BTHREAD_PRIORITY_HIGH);
+}
+
+// Whether a bthread with `attr' started by worker `g' should run in another
+// worker group.
+inline bool in_other_worker_group(const TaskGroup* g,
+                                  const bthread_attr_t* attr) {
+    return attr != NULL && attr->tag != BTHREAD_TAG_INVALID &&
+        attr->tag != g->tag();
+}
+
+// Start a bthread from worker `g' into another worker group. NOSIGNAL is
+// ignored because bthread_flush() in a worker only flushes its own group.
+BUTIL_FORCE_INLINE int
+start_in_other_worker_group(TaskGroup* g,
+                            bthread_t* __restrict tid,
+                            const bthread_attr_t* __restrict attr,
+                            void * (*fn)(void*),
+                            void* __restrict arg) {
+    TaskControl* c = g->control();
+    if (attr->tag < 0 || attr->tag >= c->worker_group_count()) {
+        return EINVAL;
+    }
+    bthread_attr_t using_attr = *attr;
+    using_attr.flags &= ~BTHREAD_NOSIGNAL;
+    return c->choose_one_group(attr->tag)->start_background<true>(
+        tid, &using_attr, fn, arg);
+}
+
 struct TidTraits {
     static const size_t BLOCK_SIZE = 63;
     static const size_t MAX_ENTRIES = 65536;
@@ -181,8 +255,14 @@ int bthread_start_urgent(bthread_t* __restrict tid,
                          const bthread_attr_t* __restrict attr,
                          void * (*fn)(void*),
                          void* __restrict arg) {
+    if (bthread::invalid_priority(attr)) {
+        return EINVAL;
+    }
     bthread::TaskGroup* g = bthread::tls_task_group;
     if (g) {
+        if (bthread::in_other_worker_group(g, attr)) {
+            return bthread::start_in_other_worker_group(g, tid, attr, fn, arg);
+        }
         // start from worker
         return bthread::TaskGroup::start_foreground(&g, tid, attr, fn, arg);
     }
@@ -197,8 +277,14 @@ int bthread_start_background(bthread_t* __restrict tid,
                              const bthread_attr_t* __restrict attr,
                              void * (*fn)(void*),
                              void* __restrict arg) {
+    if (bthread::invalid_priority(attr)) {
+        return EINVAL;
+    }
     bthread::TaskGroup* g = bthread::tls_task_group;
     if (g) {
+        if (bthread::in_other_worker_group(g, attr)) {
+            return bthread::start_in_other_worker_group(g, tid, attr, fn, arg);
+        }
         // start from worker
         return g->start_background<false>(tid, attr, fn, arg);
     }
@@ -209,6 +295,48 @@ int bthread_start_background(bthread_t* __restrict tid,
 #endif  /* !BRPC_USE_PTHREAD_ONLY */
 }
 
+int bthread_start_batch(bthread_t* __restrict tids,
+                        const bthread_attr_t* __restrict attr,
+                        void * (*fn)(void*),
+                        void* const* args,
+                        size_t n) {
+    if (bthread::invalid_priority(attr)) {
+        return EINVAL;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    bthread::TaskGroup* g = bthread::tls_task_group;
+    if (g) {
+        if (bthread::in_other_worker_group(g, attr)) {
+            bthread::TaskControl* c = g->control();
+            if (attr->tag < 0 || attr->tag >= c->worker_group_count()) {
+                return EINVAL;
+            }
+            // NOSIGNAL is ignored, see start_in_other_worker_group().
+            bthread_attr_t using_attr = *attr;
+            using_attr.flags &= ~BTHREAD_NOSIGNAL;
+            return c->choose_one_group(attr->tag)->start_background_batch<true>(
+                tids, &using_attr, fn, args, n);
+        }
+        // start from worker
+        return g->start_background_batch<false>(tids, attr, fn, args, n);
+    }
+#ifdef BRPC_USE_PTHREAD_ONLY
+    int rc = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const int rc2 = pthread_create(&tids[i], NULL, fn, args[i]);
+        if (rc2 != 0) {
+            tids[i] = INVALID_BTHREAD;
+            rc = rc2;
+        }
+    }
+    return rc;
+#else
+    return bthread::start_batch_from_non_worker(tids, attr, fn, args, n);
+#endif  /* !BRPC_USE_PTHREAD_ONLY */
+}
+
 void bthread_flush() {
     bthread::TaskGroup* g = bthread::tls_task_group;
     if (g) {
@@ -349,6 +477,38 @@ int bthread_setconcurrency(int num) {
 #endif  /* !BRPC_USE_PTHREAD_ONLY */
 }
 
+bthread_tag_t bthread_worker_group_tag(const char* name) {
+#ifdef BRPC_USE_PTHREAD_ONLY
+    return BTHREAD_TAG_DEFAULT;
+#else
+    bthread::TaskControl* c = bthread::get_or_new_task_control();
+    if (c == NULL || name == NULL) {
+        return BTHREAD_TAG_INVALID;
+    }
+    return c->find_worker_group(name);
+#endif  /* !BRPC_USE_PTHREAD_ONLY */
+}
+
+int bthread_worker_group_concurrency(bthread_tag_t tag) {
+#ifdef BRPC_USE_PTHREAD_ONLY
+    return tag == BTHREAD_TAG_DEFAULT ? bthread::FLAGS_bthread_concurrency : -1;
+#else
+    bthread::TaskControl* c = bthread::get_or_new_task_control();
+    if (c == NULL) {
+        return -1;
+    }
+    if (tag == BTHREAD_TAG_DEFAULT) {
+        return bthread::FLAGS_bthread_concurrency;
+    }
+    return c->concurrency(tag);
+#endif  /* !BRPC_USE_PTHREAD_ONLY */
+}
+
+bthread_tag_t bthread_self_tag(void) {
+    bthread::TaskGroup* g = bthread::tls_task_group;
+    return g ? g->tag() : BTHREAD_TAG_INVALID;
+}
+
 int bthread_about_to_quit() {
 #ifdef BRPC_USE_PTHREAD_ONLY
     return 0;
@@ -60,6 +60,19 @@ extern int bthread_start_background(bthread_t* __restrict tid,
                                     void * (*fn)(void*),
                                     void* __restrict args);
 
+// Create `n' bthreads `fn(args[i])' with attributes `attr' and put the
+// identifiers into `tids[i]'. Behaves like calling bthread_start_background()
+// `n' times, but the bthreads are pushed into the runqueue together and
+// workers are signalled once, which is cheaper for fan-out.
+// Returns 0 on success, errno otherwise. When some of the bthreads failed
+// to be created, their tids are set to INVALID_BTHREAD while others still
+// run.
+extern int bthread_start_batch(bthread_t* __restrict tids,
+                               const bthread_attr_t* __restrict attr,
+                               void * (*fn)(void*),
+                               void* const* args,
+                               size_t n);
+
 // Wake up operations blocking the thread. Different functions may behave
 // differently:
 //   bthread_usleep(): returns -1 and sets errno to ESTOP if bthread_stop()
@@ -151,6 +164,19 @@ extern int bthread_getconcurrency(void);
 // NOTE: currently concurrency cannot be reduced after any bthread created.
 extern int bthread_setconcurrency(int num);
 
+// Get tag of the worker group named `name' in -bthread_worker_groups, or
+// BTHREAD_TAG_DEFAULT for "default". Returns BTHREAD_TAG_INVALID if there's
+// no such group. Set the tag in bthread_attr_t to run bthreads in the group.
+extern bthread_tag_t bthread_worker_group_tag(const char* name);
+
+// Get number of worker pthreads in the worker group `tag', -1 if the tag
+// is invalid.
+extern int bthread_worker_group_concurrency(bthread_tag_t tag);
+
+// Get tag of the worker group running the calling bthread.
+// Returns BTHREAD_TAG_INVALID if the caller is not a bthread worker.
+extern bthread_tag_t bthread_self_tag(void);
+
 // Yield processor to another bthread. 
 // Notice that current implementation is not fair, which means that 
 // even if bthread_yield() is called, suspended threads may still starve.
@@ -63,6 +63,12 @@
 
 namespace bthread {
 
+// Defined in mutex.cpp
+extern bool g_butex_wait_profiler_on;
+size_t is_butex_wait_collectable();
+void submit_butex_wait(int64_t duration_ns, size_t sampling_range,
+                       int64_t now_ns);
+
 #ifdef SHOW_BTHREAD_BUTEX_WAITER_COUNT_IN_VARS
 struct ButexWaiterCount : public bvar::Adder<int64_t> {
     ButexWaiterCount() : bvar::Adder<int64_t>("bthread_butex_waiter_count") {}
@@ -105,6 +111,8 @@ struct ButexBthreadWaiter : public ButexWaiter {
     int expected_value;
     Butex* initial_butex;
     TaskControl* control;
+    // Tag of the worker group that the waiter should be woken up in.
+    bthread_tag_t tag;
     const timespec* abstime;
 };
 
@@ -284,20 +292,36 @@ void butex_destroy(void* butex) {
     butil::return_object(b);
 }
 
-inline TaskGroup* get_task_group(TaskControl* c, bool nosignal = false) {
+// Get a TaskGroup of worker group `tag' to run the woken-up bthread.
+inline TaskGroup* get_task_group(TaskControl* c, bthread_tag_t tag,
+                                 bool nosignal = false) {
     TaskGroup* g;
     if (nosignal) {
         g = tls_task_group_nosignal;
-        if (NULL == g) {
-            g = c->choose_one_group();
+        if (NULL == g || g->tag() != tag) {
+            if (g) {
+                g->flush_nosignal_tasks_general();
+            }
+            g = c->choose_one_group(tag);
             tls_task_group_nosignal = g;
         }
     } else {
-        g = tls_task_group ? tls_task_group : c->choose_one_group();
+        g = (tls_task_group && tls_task_group->tag() == tag) ?
+            tls_task_group : c->choose_one_group(tag);
     }
     return g;
 }
 
+// Wake up `w' in TaskGroup `g', or in a TaskGroup of w's worker group
+// (which are rarely mixed in one butex) when `g' is in another group.
+inline void ready_to_run_in_group(TaskGroup* g, ButexBthreadWaiter* w) {
+    if (w->tag == g->tag()) {
+        g->ready_to_run_general(w->tid, true);
+    } else {
+        w->control->choose_one_group(w->tag)->ready_to_run_remote(w->tid);
+    }
+}
+
 inline void run_in_local_task_group(TaskGroup* g, bthread_t tid, bool nosignal) {
     if (!nosignal) {
         TaskGroup::exchange(&g, tid);
@@ -324,7 +348,7 @@ int butex_wake(void* arg, bool nosignal) {
     }
     ButexBthreadWaiter* bbw = static_cast<ButexBthreadWaiter*>(front);
     unsleep_if_necessary(bbw, get_global_timer_thread());
-    TaskGroup* g = get_task_group(bbw->control, nosignal);
+    TaskGroup* g = get_task_group(bbw->control, bbw->tag, nosignal);
     if (g == tls_task_group) {
         run_in_local_task_group(g, bbw->tid, nosignal);
     } else {
@@ -369,7 +393,7 @@ int butex_wake_all(void* arg, bool nosignal) {
     next->RemoveFromList();
     unsleep_if_necessary(next, get_global_timer_thread());
     ++nwakeup;
-    TaskGroup* g = get_task_group(next->control, nosignal);
+    TaskGroup* g = get_task_group(next->control, next->tag, nosignal);
     const int saved_nwakeup = nwakeup;
     while (!bthread_waiters.empty()) {
         // pop reversely
@@ -377,7 +401,7 @@ int butex_wake_all(void* arg, bool nosignal) {
             bthread_waiters.tail()->value());
         w->RemoveFromList();
         unsleep_if_necessary(w, get_global_timer_thread());
-        g->ready_to_run_general(w->tid, true);
+        ready_to_run_in_group(g, w);
         ++nwakeup;
     }
     if (!nosignal && saved_nwakeup != nwakeup) {
@@ -436,7 +460,7 @@ int butex_wake_except(void* arg, bthread_t excluded_bthread) {
     ButexBthreadWaiter* front = static_cast<ButexBthreadWaiter*>(
                 bthread_waiters.head()->value());
 
-    TaskGroup* g = get_task_group(front->control);
+    TaskGroup* g = get_task_group(front->control, front->tag);
     const int saved_nwakeup = nwakeup;
     do {
         // pop reversely
@@ -444,7 +468,7 @@ int butex_wake_except(void* arg, bthread_t excluded_bthread) {
             bthread_waiters.tail()->value());
         w->RemoveFromList();
         unsleep_if_necessary(w, get_global_timer_thread());
-        g->ready_to_run_general(w->tid, true);
+        ready_to_run_in_group(g, w);
         ++nwakeup;
     } while (!bthread_waiters.empty());
     if (saved_nwakeup != nwakeup) {
@@ -485,10 +509,10 @@ int butex_requeue(void* arg, void* arg2) {
     ButexBthreadWaiter* bbw = static_cast<ButexBthreadWaiter*>(front);
     unsleep_if_necessary(bbw, get_global_timer_thread());
     TaskGroup* g = tls_task_group;
-    if (g) {
+    if (g && g->tag() == bbw->tag) {
         TaskGroup::exchange(&g, front->tid);
     } else {
-        bbw->control->choose_one_group()->ready_to_run_remote(front->tid);
+        bbw->control->choose_one_group(bbw->tag)->ready_to_run_remote(front->tid);
     }
     return 1;
 }
@@ -526,7 +550,7 @@ inline bool erase_from_butex(ButexWaiter* bw, bool wakeup, WaiterState state) {
     if (erased && wakeup) {
         if (bw->tid) {
             ButexBthreadWaiter* bbw = static_cast<ButexBthreadWaiter*>(bw);
-            get_task_group(bbw->control)->ready_to_run_general(bw->tid);
+            get_task_group(bbw->control, bbw->tag)->ready_to_run_general(bw->tid);
         } else {
             ButexPthreadWaiter* pw = static_cast<ButexPthreadWaiter*>(bw);
             wakeup_pthread(pw);
@@ -645,19 +669,8 @@ static int butex_wait_from_pthread(TaskGroup* g, Butex* b, int expected_value,
     return rc;
 }
 
-int butex_wait(void* arg, int expected_value, const timespec* abstime) {
-    Butex* b = container_of(static_cast<butil::atomic<int>*>(arg), Butex, value);
-    if (b->value.load(butil::memory_order_relaxed) != expected_value) {
-        errno = EWOULDBLOCK;
-        // Sometimes we may take actions immediately after unmatched butex,
-        // this fence makes sure that we see changes before changing butex.
-        butil::atomic_thread_fence(butil::memory_order_acquire);
-        return -1;
-    }
-    TaskGroup* g = tls_task_group;
-    if (NULL == g || g->is_current_pthread_task()) {
-        return butex_wait_from_pthread(g, b, expected_value, abstime);
-    }
+static int butex_wait_from_bthread(TaskGroup* g, Butex* b, int expected_value,
+                                   const timespec* abstime) {
     ButexBthreadWaiter bbw;
     // tid is 0 iff the thread is non-bthread
     bbw.tid = g->current_tid();
@@ -668,6 +681,7 @@ int butex_wait(void* arg, int expected_value, const timespec* abstime) {
     bbw.expected_value = expected_value;
     bbw.initial_butex = b;
     bbw.control = g->control();
+    bbw.tag = g->tag();
     bbw.abstime = abstime;
 
     if (abstime != NULL) {
@@ -725,6 +739,41 @@ int butex_wait(void* arg, int expected_value, const timespec* abstime) {
     return 0;
 }
 
+inline int butex_wait_blocking(Butex* b, int expected_value,
+                               const timespec* abstime) {
+    TaskGroup* g = tls_task_group;
+    if (NULL == g || g->is_current_pthread_task()) {
+        return butex_wait_from_pthread(g, b, expected_value, abstime);
+    }
+    return butex_wait_from_bthread(g, b, expected_value, abstime);
+}
+
+int butex_wait(void* arg, int expected_value, const timespec* abstime) {
+    Butex* b = container_of(static_cast<butil::atomic<int>*>(arg), Butex, value);
+    if (b->value.load(butil::memory_order_relaxed) != expected_value) {
+        errno = EWOULDBLOCK;
+        // Sometimes we may take actions immediately after unmatched butex,
+        // this fence makes sure that we see changes before changing butex.
+        butil::atomic_thread_fence(butil::memory_order_acquire);
+        return -1;
+    }
+    if (__builtin_expect(g_butex_wait_profiler_on, false)) {
+        const size_t sampling_range = is_butex_wait_collectable();
+        if (sampling_range) {
+            const int64_t start_ns = butil::cpuwide_time_ns();
+            const int rc = butex_wait_blocking(b, expected_value, abstime);
+            const int saved_errno = errno;
+            const int64_t end_ns = butil::cpuwide_time_ns();
+            // Stack of the waiter is captured here, which is not available
+            // in the waker.
+            submit_butex_wait(end_ns - start_ns, sampling_range, end_ns);
+            errno = saved_errno;
+            return rc;
+        }
+    }
+    return butex_wait_blocking(b, expected_value, abstime);
+}
+
 }  // namespace bthread
 
 namespace butil {
@@ -540,6 +540,112 @@ void submit_contention(const bthread_contention_site_t& csite, int64_t now_ns) {
     tls_inside_lock = false;
 }
 
+// ============ Profiling waits on butex ==============
+// Waits are sampled at wakeup of the waiter, so that stacks of bthreads
+// (which are not running when they're blocked) are captured as well.
+
+// For controlling waits collected per second.
+static bvar::CollectorSpeedLimit g_bwp_sl = BVAR_COLLECTOR_SPEED_LIMIT_INITIALIZER;
+
+// If butex wait profiler is on, this variable will be set with a valid
+// instance. NULL otherwise.
+BAIDU_CACHELINE_ALIGNMENT static ContentionProfiler* g_bwp = NULL;
+// Protecting accesss to g_bwp.
+static pthread_mutex_t g_bwp_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Checked by butex_wait() before sampling, true iff g_bwp is not NULL.
+bool g_butex_wait_profiler_on = false;
+
+// Same layout as SampledContention, but dumped into g_bwp.
+struct SampledButexWait : public SampledContention {
+    // Implement bvar::Collected
+    void dump_and_destroy(size_t round) override;
+    void destroy() override;
+    bvar::CollectorSpeedLimit* speed_limit() override { return &g_bwp_sl; }
+};
+
+BAIDU_CASSERT(sizeof(SampledButexWait) == 256, be_friendly_to_allocator);
+
+void SampledButexWait::dump_and_destroy(size_t /*round*/) {
+    if (g_bwp) {
+        BAIDU_SCOPED_LOCK(g_bwp_mutex);
+        if (g_bwp) {
+            g_bwp->dump_and_destroy(this);
+            return;
+        }
+    }
+    destroy();
+}
+
+void SampledButexWait::destroy() {
+    butil::return_object(this);
+}
+
+// Start profiling waits on butex.
+bool ButexWaitProfilerStart(const char* filename) {
+    if (filename == NULL) {
+        LOG(ERROR) << "Parameter [filename] is NULL";
+        return false;
+    }
+    if (g_bwp) {
+        return false;
+    }
+
+    // Create related global bvar lazily.
+    static bvar::DisplaySamplingRatio g_sampling_ratio_var(
+        "butex_wait_profiler_sampling_ratio", &g_bwp_sl);
+
+    // Optimistic locking. A not-used ContentionProfiler does not write file.
+    std::unique_ptr<ContentionProfiler> ctx(new ContentionProfiler(filename));
+    {
+        BAIDU_SCOPED_LOCK(g_bwp_mutex);
+        if (g_bwp) {
+            return false;
+        }
+        g_bwp = ctx.release();
+        g_butex_wait_profiler_on = true;
+    }
+    return true;
+}
+
+// Stop butex wait profiler.
+void ButexWaitProfilerStop() {
+    ContentionProfiler* ctx = NULL;
+    if (g_bwp) {
+        std::unique_lock<pthread_mutex_t> mu(g_bwp_mutex);
+        if (g_bwp) {
+            ctx = g_bwp;
+            g_bwp = NULL;
+            g_butex_wait_profiler_on = false;
+            mu.unlock();
+
+            ctx->init_if_needed();
+            // Deletion is safe because usages of g_bwp are inside g_bwp_mutex.
+            delete ctx;
+            return;
+        }
+    }
+    LOG(ERROR) << "Butex wait profiler is not started!";
+}
+
+// Returns non-zero sampling_range if the wait to begin should be sampled.
+size_t is_butex_wait_collectable() {
+    return bvar::is_collectable(&g_bwp_sl);
+}
+
+// Submit a wait that took `duration_ns' along with the stacktrace of the
+// waiter. Frames of butex_wait() and this function are skipped.
+void submit_butex_wait(int64_t duration_ns, size_t sampling_range,
+                       int64_t now_ns) {
+    tls_inside_lock = true;
+    SampledButexWait* sc = butil::get_object<SampledButexWait>();
+    sc->duration_ns = duration_ns * bvar::COLLECTOR_SAMPLING_BASE
+        / sampling_range;
+    sc->count = bvar::COLLECTOR_SAMPLING_BASE / (double)sampling_range;
+    sc->nframes = backtrace(sc->stack, arraysize(sc->stack)); // may lock
+    sc->submit(now_ns / 1000);  // may lock
+    tls_inside_lock = false;
+}
+
 BUTIL_FORCE_INLINE int pthread_mutex_lock_impl(pthread_mutex_t* mutex) {
     // Don't change behavior of lock when profiler is off.
     if (!g_cp ||
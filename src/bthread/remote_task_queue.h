@@ -29,58 +29,80 @@
 
 #include "butil/containers/bounded_queue.h"
 #include "butil/macros.h"
+#include "bthread/types.h"                   // BTHREAD_PRIORITY_NUM
 
 namespace bthread {
 
 class TaskGroup;
 
+// Index of run queues for bthreads of `priority'. Higher priorities have
+// smaller indexes so that run queues are drained in the order of indexes.
+inline int priority_queue_index(bthread_priority_t priority) {
+    return BTHREAD_PRIORITY_HIGH - priority;
+}
+static const int NORMAL_PRIORITY_QUEUE_INDEX =
+    BTHREAD_PRIORITY_HIGH - BTHREAD_PRIORITY_NORMAL;
+
 // A queue for storing bthreads created by non-workers. Since non-workers
 // randomly choose a TaskGroup to push which distributes the contentions,
 // this queue is simply implemented as a queue protected with a lock.
 // The function names should be self-explanatory.
+// Tasks of different priorities are put in different queues indexed by
+// priority_queue_index(), all protected by the same lock.
 class RemoteTaskQueue {
 public:
     RemoteTaskQueue() {}
 
     int init(size_t cap) {
         const size_t memsize = sizeof(bthread_t) * cap;
-        void* q_mem = malloc(memsize);
-        if (q_mem == NULL) {
-            return -1;
+        for (int i = 0; i < BTHREAD_PRIORITY_NUM; ++i) {
+            void* q_mem = malloc(memsize);
+            if (q_mem == NULL) {
+                return -1;
+            }
+            butil::BoundedQueue<bthread_t> q(q_mem, memsize, butil::OWNS_STORAGE);
+            _tasks[i].swap(q);
         }
-        butil::BoundedQueue<bthread_t> q(q_mem, memsize, butil::OWNS_STORAGE);
-        _tasks.swap(q);
         return 0;
     }
 
 __attribute__((no_sanitize("thread")))
-    bool pop(bthread_t* task) {
-        if (_tasks.empty()) {
+    bool pop(bthread_t* task, int index) {
+        if (_tasks[index].empty()) {
             return false;
         }
         _mutex.lock();
-        const bool result = _tasks.pop(task);
+        const bool result = _tasks[index].pop(task);
         _mutex.unlock();
         return result;
     }
 
-    bool push(bthread_t task) {
+    bool push(bthread_t task, int index) {
         _mutex.lock();
-        const bool res = push_locked(task);
+        const bool res = push_locked(task, index);
         _mutex.unlock();
         return res;
     }
 
-    bool push_locked(bthread_t task) {
-        return _tasks.push(task);
+    bool push_locked(bthread_t task, int index) {
+        return _tasks[index].push(task);
     }
 
-    size_t capacity() const { return _tasks.capacity(); }
+    size_t capacity() const { return _tasks[0].capacity(); }
+
+    // Not synchronized, for statistics only.
+    size_t volatile_size() const {
+        size_t n = 0;
+        for (int i = 0; i < BTHREAD_PRIORITY_NUM; ++i) {
+            n += _tasks[i].size();
+        }
+        return n;
+    }
     
 private:
 friend class TaskGroup;
     DISALLOW_COPY_AND_ASSIGN(RemoteTaskQueue);
-    butil::BoundedQueue<bthread_t> _tasks;
+    butil::BoundedQueue<bthread_t> _tasks[BTHREAD_PRIORITY_NUM];
     butil::Mutex _mutex;
 };
 
@@ -20,7 +20,7 @@
 // Date: Sun Sep  7 22:37:39 CST 2014
 
 #include <unistd.h>                               // getpagesize
-#include <sys/mman.h>                             // mmap, munmap, mprotect
+#include <sys/mman.h>                             // mmap, munmap, mprotect, madvise
 #include <algorithm>                              // std::max
 #include <stdlib.h>                               // posix_memalign
 #include "butil/macros.h"                          // BAIDU_CASSERT
@@ -146,6 +146,20 @@ void deallocate_stack_storage(StackStorage* s) {
     }
 }
 
+int reset_stack_storage(StackStorage* s) {
+    // Pages of malloc-ed stacks may be shared with other allocations.
+    if (s->guardsize <= 0) {
+        return -1;
+    }
+    if (madvise((char*)s->bottom - s->stacksize, s->stacksize,
+                MADV_DONTNEED) != 0) {
+        PLOG_EVERY_SECOND(ERROR) << "Fail to madvise stack="
+                                 << (void*)s->bottom;
+        return -1;
+    }
+    return 0;
+}
+
 int* SmallStackClass::stack_size_flag = &FLAGS_stack_size_small;
 int* NormalStackClass::stack_size_flag = &FLAGS_stack_size_normal;
 int* LargeStackClass::stack_size_flag = &FLAGS_stack_size_large;
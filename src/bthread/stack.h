@@ -27,6 +27,7 @@
 #include "bthread/types.h"
 #include "bthread/context.h"        // bthread_fcontext_t
 #include "butil/object_pool.h"
+#include "butil/numa.h"                    // numa_thread_node
 
 namespace bthread {
 
@@ -52,6 +53,11 @@ int allocate_stack_storage(StackStorage* s, int stacksize, int guardsize);
 // Deallocate a piece of stack. Parameters MUST be returned or set by the
 // corresponding allocate_stack_storage() otherwise behavior is undefined.
 void deallocate_stack_storage(StackStorage* s);
+// Drop physical pages of a piece of unused stack so that they're allocated
+// again on the NUMA node of the thread touching them next. Content of the
+// stack is lost.
+// Returns 0 on success, -1 otherwise(e.g. the stack is allocated by malloc).
+int reset_stack_storage(StackStorage* s);
 
 enum StackType {
     STACK_TYPE_MAIN = 0,
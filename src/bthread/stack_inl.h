@@ -48,7 +48,8 @@ struct LargeStackClass {
 
 template <typename StackClass> struct StackFactory {
     struct Wrapper : public ContextualStack {
-        explicit Wrapper(void (*entry)(intptr_t)) {
+        explicit Wrapper(void (*entry)(intptr_t))
+            : numa_node(butil::numa_thread_node()) {
             if (allocate_stack_storage(&storage, *StackClass::stack_size_flag,
                                        FLAGS_guard_page_size) != 0) {
                 storage.zeroize();
@@ -65,10 +66,26 @@ template <typename StackClass> struct StackFactory {
                 storage.zeroize();
             }
         }
+        // The stack may be cached and reused by workers on other NUMA nodes
+        // (through the global free list of ObjectPool), move its pages to
+        // the node of current worker which touches the stack first.
+        void move_to_current_numa_node(void (*entry)(intptr_t)) {
+            numa_node = butil::numa_thread_node();
+            if (numa_node >= 0 && reset_stack_storage(&storage) == 0) {
+                context = bthread_make_fcontext(
+                    storage.bottom, storage.stacksize, entry);
+            }
+        }
+
+        int numa_node;
     };
     
     static ContextualStack* get_stack(void (*entry)(intptr_t)) {
-        return butil::get_object<Wrapper>(entry);
+        Wrapper* w = butil::get_object<Wrapper>(entry);
+        if (w != NULL && w->numa_node != butil::numa_thread_node()) {
+            w->move_to_current_numa_node(entry);
+        }
+        return w;
     }
     
     static void return_stack(ContextualStack* sc) {
@@ -27,7 +27,11 @@
 #include "butil/scoped_lock.h"             // BAIDU_SCOPED_LOCK
 #include "butil/errno.h"                   // berror
 #include "butil/logging.h"
+#include "butil/numa.h"                    // bind_thread_to_numa_node
 #include "butil/third_party/murmurhash3/murmurhash3.h"
+#include "butil/string_splitter.h"         // StringSplitter
+#include "butil/strings/string_number_conversions.h"  // StringToInt
+#include "butil/strings/string_util.h"     // TrimWhitespaceASCII
 #include "bthread/sys_futex.h"            // futex_wake_private
 #include "bthread/interrupt_pthread.h"
 #include "bthread/processor.h"            // cpu_relax
@@ -49,6 +53,23 @@ namespace bthread {
 DECLARE_int32(bthread_concurrency);
 DECLARE_int32(bthread_min_concurrency);
 
+DEFINE_string(bthread_worker_groups, "",
+              "Named worker groups in form of `name1:nworkers1,name2:nworkers2'."
+              " Each group gets its own workers in addition to the default"
+              " group sized by -bthread_concurrency, bthreads of a group are"
+              " never run or stolen by workers of other groups. Tags of the"
+              " groups are 1,2... in the order of appearance");
+DEFINE_bool(bthread_numa_aware, false,
+            "Spread workers of each worker group over NUMA nodes and pin them"
+            " to CPUs of their nodes. Idle workers steal tasks from the same"
+            " node first, stacks and IOBuf blocks cached by workers are kept"
+            " local to their nodes. Must be set before the first bthread is"
+            " created");
+DEFINE_int32(bthread_numa_steal_attempts, 2,
+             "With -bthread_numa_aware, an idle worker steals from workers on"
+             " the same NUMA node for so many rounds before stealing from"
+             " other nodes");
+
 extern pthread_mutex_t g_task_control_mutex;
 extern BAIDU_THREAD_LOCAL TaskGroup* tls_task_group;
 void (*g_worker_startfn)() = NULL;
@@ -66,8 +87,22 @@ void* TaskControl::worker_thread(void* arg) {
     logging::ComlogInitializer comlog_initializer;
 #endif
     
-    TaskControl* c = static_cast<TaskControl*>(arg);
-    TaskGroup* g = c->create_group();
+    WorkerArgs* args = static_cast<WorkerArgs*>(arg);
+    TaskControl* c = args->control;
+    const bthread_tag_t tag = args->tag;
+    const int numa_node = args->numa_node;
+    delete args;
+    WorkerGroup* wg = c->_worker_groups[tag];
+    if (numa_node >= 0) {
+        // Before create_group() so that the TaskGroup and its main stack
+        // are allocated on the node.
+        const int rc = butil::bind_thread_to_numa_node(numa_node);
+        if (rc != 0) {
+            LOG(WARNING) << "Fail to bind worker=" << pthread_self()
+                         << " to numa node=" << numa_node << ": " << berror(rc);
+        }
+    }
+    TaskGroup* g = c->create_group(tag);
     TaskStatistics stat;
     if (NULL == g) {
         LOG(ERROR) << "Fail to create TaskGroup in pthread=" << pthread_self();
@@ -78,6 +113,7 @@ void* TaskControl::worker_thread(void* arg) {
 
     tls_task_group = g;
     c->_nworkers << 1;
+    wg->nworkers << 1;
     g->run_main_task();
 
     stat = g->main_stat();
@@ -87,11 +123,12 @@ void* TaskControl::worker_thread(void* arg) {
     tls_task_group = NULL;
     g->destroy_self();
     c->_nworkers << -1;
+    wg->nworkers << -1;
     return NULL;
 }
 
-TaskGroup* TaskControl::create_group() {
-    TaskGroup* g = new (std::nothrow) TaskGroup(this);
+TaskGroup* TaskControl::create_group(bthread_tag_t tag) {
+    TaskGroup* g = new (std::nothrow) TaskGroup(this, tag);
     if (NULL == g) {
         LOG(FATAL) << "Fail to new TaskGroup";
         return NULL;
@@ -125,10 +162,92 @@ static int64_t get_cumulated_signal_count_from_this(void *arg) {
     return static_cast<TaskControl*>(arg)->get_cumulated_signal_count();
 }
 
+TaskControl::WorkerGroup::WorkerGroup(
+    TaskControl* c, bthread_tag_t tag2, const std::string& name2)
+    : control(c)
+    , tag(tag2)
+    , name(name2)
+    , nworkers_expected(0)
+    , ngroup(0)
+    , groups((TaskGroup**)calloc(BTHREAD_MAX_CONCURRENCY, sizeof(TaskGroup*)))
+    , numa_groups(NULL)
+    , next_numa_node(0)
+    , cumulated_worker_time(get_cumulated_worker_time, this)
+    , worker_usage_second(&cumulated_worker_time, 1)
+    , queue_depth(get_queue_depth, this) {
+    CHECK(groups) << "Fail to create array of groups";
+    for (int i = 0; i < BTHREAD_PRIORITY_NUM; ++i) {
+        nqueued[i].store(0, butil::memory_order_relaxed);
+    }
+}
+
+TaskControl::WorkerGroup::~WorkerGroup() {
+    hide();
+    free(groups);
+    groups = NULL;
+    delete [] numa_groups;
+    numa_groups = NULL;
+}
+
+TaskControl::NumaGroups::NumaGroups()
+    : ngroup(0)
+    , groups((TaskGroup**)calloc(BTHREAD_MAX_CONCURRENCY, sizeof(TaskGroup*))) {
+    CHECK(groups) << "Fail to create array of groups";
+}
+
+TaskControl::NumaGroups::~NumaGroups() {
+    free(groups);
+    groups = NULL;
+}
+
+void TaskControl::WorkerGroup::expose() {
+    const std::string prefix = "bthread_worker_group_" + name;
+    nworkers.expose(prefix + "_count");
+    worker_usage_second.expose(prefix + "_usage");
+    queue_depth.expose(prefix + "_queue_depth");
+}
+
+void TaskControl::WorkerGroup::hide() {
+    nworkers.hide();
+    worker_usage_second.hide();
+    queue_depth.hide();
+}
+
+double TaskControl::WorkerGroup::get_cumulated_worker_time(void* arg) {
+    WorkerGroup* wg = static_cast<WorkerGroup*>(arg);
+    int64_t cputime_ns = 0;
+    BAIDU_SCOPED_LOCK(wg->control->_modify_group_mutex);
+    const size_t ngroup = wg->ngroup.load(butil::memory_order_relaxed);
+    for (size_t i = 0; i < ngroup; ++i) {
+        if (wg->groups[i]) {
+            cputime_ns += wg->groups[i]->_cumulated_cputime_ns;
+        }
+    }
+    return cputime_ns / 1000000000.0;
+}
+
+int64_t TaskControl::WorkerGroup::get_queue_depth(void* arg) {
+    WorkerGroup* wg = static_cast<WorkerGroup*>(arg);
+    int64_t depth = 0;
+    BAIDU_SCOPED_LOCK(wg->control->_modify_group_mutex);
+    const size_t ngroup = wg->ngroup.load(butil::memory_order_relaxed);
+    for (size_t i = 0; i < ngroup; ++i) {
+        TaskGroup* g = wg->groups[i];
+        if (g) {
+            for (int i = 0; i < BTHREAD_PRIORITY_NUM; ++i) {
+                depth += g->_rq[i].volatile_size();
+            }
+            depth += g->_remote_rq.volatile_size();
+        }
+    }
+    return depth;
+}
+
 TaskControl::TaskControl()
     // NOTE: all fileds must be initialized before the vars.
     : _ngroup(0)
     , _groups((TaskGroup**)calloc(BTHREAD_MAX_CONCURRENCY, sizeof(TaskGroup*)))
+    , _numa_node_count(0)
     , _stop(false)
     , _concurrency(0)
     , _nworkers("bthread_worker_count")
@@ -158,6 +277,9 @@ int TaskControl::init(int concurrency) {
         return -1;
     }
     _concurrency = concurrency;
+    if (init_worker_groups() != 0) {
+        return -1;
+    }
 
     // Make sure TimerThread is ready.
     if (get_or_create_global_timer_thread() == NULL) {
@@ -165,34 +287,140 @@ int TaskControl::init(int concurrency) {
         return -1;
     }
     
-    _workers.resize(_concurrency);   
-    for (int i = 0; i < _concurrency; ++i) {
-        const int rc = pthread_create(&_workers[i], NULL, worker_thread, this);
-        if (rc) {
-            LOG(ERROR) << "Fail to create _workers[" << i << "], " << berror(rc);
-            return -1;
+    for (size_t tag = 0; tag < _worker_groups.size(); ++tag) {
+        const int n = (tag == BTHREAD_TAG_DEFAULT ? _concurrency.load()
+                       : _worker_groups[tag]->nworkers_expected);
+        for (int i = 0; i < n; ++i) {
+            if (create_worker(tag) != 0) {
+                return -1;
+            }
         }
     }
     _worker_usage_second.expose("bthread_worker_usage");
     _switch_per_second.expose("bthread_switch_second");
     _signal_per_second.expose("bthread_signal_second");
     _status.expose("bthread_group_status");
+    if (_numa_node_count > 0) {
+        _numa_remote_steal_count.expose("bthread_numa_remote_steal_count");
+    }
+
+    if (_worker_groups.size() > 1) {
+        for (size_t tag = 0; tag < _worker_groups.size(); ++tag) {
+            _worker_groups[tag]->expose();
+        }
+    }
 
-    // Wait for at least one group is added so that choose_one_group()
-    // never returns NULL.
+    // Wait for at least one group of each tag is added so that
+    // choose_one_group() never returns NULL.
     // TODO: Handle the case that worker quits before add_group
-    while (_ngroup == 0) {
-        usleep(100);  // TODO: Elaborate
+    for (size_t tag = 0; tag < _worker_groups.size(); ++tag) {
+        while (_worker_groups[tag]->ngroup == 0) {
+            usleep(100);  // TODO: Elaborate
+        }
+    }
+    return 0;
+}
+
+int TaskControl::init_worker_groups() {
+    if (FLAGS_bthread_numa_aware) {
+        _numa_node_count = butil::numa_node_count();
+        LOG(INFO) << "Spread bthread workers over " << _numa_node_count
+                  << " numa nodes";
+    }
+    _worker_groups.push_back(new WorkerGroup(this, BTHREAD_TAG_DEFAULT, "default"));
+    int total = _concurrency;
+    for (butil::StringSplitter sp(FLAGS_bthread_worker_groups.c_str(), ',');
+         sp; ++sp) {
+        butil::StringPiece item(sp.field(), sp.length());
+        butil::TrimWhitespaceASCII(item, butil::TRIM_ALL, &item);
+        if (item.empty()) {
+            continue;
+        }
+        const size_t colon = item.find(':');
+        std::string name;
+        int nworkers = 0;
+        if (colon != butil::StringPiece::npos) {
+            item.substr(0, colon).CopyToString(&name);
+            if (!butil::StringToInt(item.substr(colon + 1), &nworkers)) {
+                nworkers = 0;
+            }
+        }
+        if (name.empty() || nworkers <= 0) {
+            LOG(ERROR) << "Invalid worker group `" << item
+                       << "' in -bthread_worker_groups";
+            return -1;
+        }
+        if (find_worker_group(name) != BTHREAD_TAG_INVALID) {
+            LOG(ERROR) << "Duplicated worker group `" << name
+                       << "' in -bthread_worker_groups";
+            return -1;
+        }
+        total += nworkers;
+        if (total > BTHREAD_MAX_CONCURRENCY) {
+            LOG(ERROR) << "Too many workers in -bthread_worker_groups, max="
+                       << BTHREAD_MAX_CONCURRENCY;
+            return -1;
+        }
+        WorkerGroup* wg = new WorkerGroup(this, _worker_groups.size(), name);
+        wg->nworkers_expected = nworkers;
+        _worker_groups.push_back(wg);
+    }
+    if (_numa_node_count > 0) {
+        for (size_t tag = 0; tag < _worker_groups.size(); ++tag) {
+            _worker_groups[tag]->numa_groups = new NumaGroups[_numa_node_count];
+        }
     }
     return 0;
 }
 
+int TaskControl::create_worker(bthread_tag_t tag) {
+    WorkerArgs* args = new WorkerArgs;
+    args->control = this;
+    args->tag = tag;
+    args->numa_node = -1;
+    if (_numa_node_count > 0) {
+        // Spread workers of each group over the nodes evenly.
+        WorkerGroup* wg = _worker_groups[tag];
+        args->numa_node = wg->next_numa_node;
+        wg->next_numa_node = (wg->next_numa_node + 1) % _numa_node_count;
+    }
+    pthread_t tid;
+    const int rc = pthread_create(&tid, NULL, worker_thread, args);
+    if (rc) {
+        LOG(ERROR) << "Fail to create worker of group=" << tag << ", "
+                   << berror(rc);
+        delete args;
+        return -1;
+    }
+    _workers.push_back(tid);
+    return 0;
+}
+
+bthread_tag_t TaskControl::find_worker_group(const std::string& name) const {
+    for (size_t i = 0; i < _worker_groups.size(); ++i) {
+        if (_worker_groups[i]->name == name) {
+            return (bthread_tag_t)i;
+        }
+    }
+    return BTHREAD_TAG_INVALID;
+}
+
+int TaskControl::concurrency(bthread_tag_t tag) const {
+    if (tag < 0 || (size_t)tag >= _worker_groups.size()) {
+        return -1;
+    }
+    if (tag == BTHREAD_TAG_DEFAULT) {
+        return concurrency();
+    }
+    return _worker_groups[tag]->nworkers_expected;
+}
+
 int TaskControl::add_workers(int num) {
     if (num <= 0) {
         return 0;
     }
     try {
-        _workers.resize(_concurrency + num);
+        _workers.reserve(_workers.size() + num);
     } catch (...) {
         return 0;
     }
@@ -201,24 +429,20 @@ int TaskControl::add_workers(int num) {
         // Worker will add itself to _idle_workers, so we have to add
         // _concurrency before create a worker.
         _concurrency.fetch_add(1);
-        const int rc = pthread_create(
-                &_workers[i + old_concurency], NULL, worker_thread, this);
-        if (rc) {
-            LOG(WARNING) << "Fail to create _workers[" << i + old_concurency
-                         << "], " << berror(rc);
+        if (create_worker(BTHREAD_TAG_DEFAULT) != 0) {
             _concurrency.fetch_sub(1, butil::memory_order_release);
             break;
         }
     }
-    // Cannot fail
-    _workers.resize(_concurrency.load(butil::memory_order_relaxed));
     return _concurrency.load(butil::memory_order_relaxed) - old_concurency;
 }
 
-TaskGroup* TaskControl::choose_one_group() {
-    const size_t ngroup = _ngroup.load(butil::memory_order_acquire);
+TaskGroup* TaskControl::choose_one_group(bthread_tag_t tag) {
+    CHECK(tag >= 0 && (size_t)tag < _worker_groups.size()) << "tag=" << tag;
+    WorkerGroup* wg = _worker_groups[tag];
+    const size_t ngroup = wg->ngroup.load(butil::memory_order_acquire);
     if (ngroup != 0) {
-        return _groups[butil::fast_rand_less_than(ngroup)];
+        return wg->groups[butil::fast_rand_less_than(ngroup)];
     }
     CHECK(false) << "Impossible: ngroup is 0";
     return NULL;
@@ -236,9 +460,14 @@ void TaskControl::stop_and_join() {
         BAIDU_SCOPED_LOCK(_modify_group_mutex);
         _stop = true;
         _ngroup.exchange(0, butil::memory_order_relaxed); 
+        for (size_t tag = 0; tag < _worker_groups.size(); ++tag) {
+            _worker_groups[tag]->ngroup.exchange(0, butil::memory_order_relaxed);
+        }
     }
-    for (int i = 0; i < PARKING_LOT_NUM; ++i) {
-        _pl[i].stop();
+    for (size_t tag = 0; tag < _worker_groups.size(); ++tag) {
+        for (int i = 0; i < PARKING_LOT_NUM; ++i) {
+            _worker_groups[tag]->pl[i].stop();
+        }
     }
     // Interrupt blocking operations.
     for (size_t i = 0; i < _workers.size(); ++i) {
@@ -258,11 +487,16 @@ TaskControl::~TaskControl() {
     _switch_per_second.hide();
     _signal_per_second.hide();
     _status.hide();
+    for (size_t tag = 0; tag < _worker_groups.size(); ++tag) {
+        _worker_groups[tag]->hide();
+    }
     
     stop_and_join();
 
     free(_groups);
     _groups = NULL;
+    // WorkerGroups are not deleted for the same reason as TaskGroups: tasks
+    // being destroyed may still signal them.
 }
 
 int TaskControl::_add_group(TaskGroup* g) {
@@ -273,18 +507,54 @@ int TaskControl::_add_group(TaskGroup* g) {
     if (_stop) {
         return -1;
     }
-    size_t ngroup = _ngroup.load(butil::memory_order_relaxed);
-    if (ngroup < (size_t)BTHREAD_MAX_CONCURRENCY) {
-        _groups[ngroup] = g;
-        _ngroup.store(ngroup + 1, butil::memory_order_release);
+    add_to_groups(_groups, &_ngroup, g);
+    WorkerGroup* wg = _worker_groups[g->tag()];
+    add_to_groups(wg->groups, &wg->ngroup, g);
+    if (wg->numa_groups && g->numa_node() >= 0) {
+        NumaGroups& ng = wg->numa_groups[g->numa_node()];
+        add_to_groups(ng.groups, &ng.ngroup, g);
     }
     mu.unlock();
-    // See the comments in _destroy_group
+    // See the comments in remove_from_groups
     // TODO: Not needed anymore since non-worker pthread cannot have TaskGroup
-    signal_task(65536);
+    signal_task(65536, g->tag());
     return 0;
 }
 
+void TaskControl::add_to_groups(TaskGroup** groups,
+                                butil::atomic<size_t>* ngroup, TaskGroup* g) {
+    const size_t n = ngroup->load(butil::memory_order_relaxed);
+    if (n < (size_t)BTHREAD_MAX_CONCURRENCY) {
+        groups[n] = g;
+        ngroup->store(n + 1, butil::memory_order_release);
+    }
+}
+
+bool TaskControl::remove_from_groups(TaskGroup** groups,
+                                     butil::atomic<size_t>* ngroup,
+                                     TaskGroup* g) {
+    const size_t n = ngroup->load(butil::memory_order_relaxed);
+    for (size_t i = 0; i < n; ++i) {
+        if (groups[i] == g) {
+            // No need for atomic_thread_fence because lock did it.
+            groups[i] = groups[n - 1];
+            // Change ngroup and keep groups unchanged at last so that:
+            //  - If steal_task sees the newest ngroup, it would not touch
+            //    groups[n -1]
+            //  - If steal_task sees old ngroup and is still iterating on
+            //    groups, it would not miss groups[n - 1] which was
+            //    swapped to groups[i]. Although adding new group would
+            //    overwrite it, since we do signal_task in _add_group(),
+            //    we think the pending tasks of groups[n - 1] would
+            //    not miss.
+            ngroup->store(n - 1, butil::memory_order_release);
+            //groups[n - 1] = NULL;
+            return true;
+        }
+    }
+    return false;
+}
+
 void TaskControl::delete_task_group(void* arg) {
     delete(TaskGroup*)arg;
 }
@@ -302,25 +572,12 @@ int TaskControl::_destroy_group(TaskGroup* g) {
     bool erased = false;
     {
         BAIDU_SCOPED_LOCK(_modify_group_mutex);
-        const size_t ngroup = _ngroup.load(butil::memory_order_relaxed);
-        for (size_t i = 0; i < ngroup; ++i) {
-            if (_groups[i] == g) {
-                // No need for atomic_thread_fence because lock did it.
-                _groups[i] = _groups[ngroup - 1];
-                // Change _ngroup and keep _groups unchanged at last so that:
-                //  - If steal_task sees the newest _ngroup, it would not touch
-                //    _groups[ngroup -1]
-                //  - If steal_task sees old _ngroup and is still iterating on
-                //    _groups, it would not miss _groups[ngroup - 1] which was 
-                //    swapped to _groups[i]. Although adding new group would
-                //    overwrite it, since we do signal_task in _add_group(),
-                //    we think the pending tasks of _groups[ngroup - 1] would
-                //    not miss.
-                _ngroup.store(ngroup - 1, butil::memory_order_release);
-                //_groups[ngroup - 1] = NULL;
-                erased = true;
-                break;
-            }
+        erased = remove_from_groups(_groups, &_ngroup, g);
+        WorkerGroup* wg = _worker_groups[g->tag()];
+        remove_from_groups(wg->groups, &wg->ngroup, g);
+        if (wg->numa_groups && g->numa_node() >= 0) {
+            NumaGroups& ng = wg->numa_groups[g->numa_node()];
+            remove_from_groups(ng.groups, &ng.ngroup, g);
         }
     }
 
@@ -337,27 +594,57 @@ int TaskControl::_destroy_group(TaskGroup* g) {
     return 0;
 }
 
-bool TaskControl::steal_task(bthread_t* tid, size_t* seed, size_t offset) {
+bool TaskControl::steal_task(bthread_t* tid, size_t* seed, size_t offset,
+                             bthread_tag_t tag, int numa_node, int index) {
+    WorkerGroup* wg = _worker_groups[tag];
+    if (numa_node >= 0 && wg->numa_groups) {
+        const NumaGroups& ng = wg->numa_groups[numa_node];
+        for (int i = 0; i < FLAGS_bthread_numa_steal_attempts; ++i) {
+            if (steal_from_groups(ng.groups, ng.ngroup, index,
+                                  tid, seed, offset)) {
+                return true;
+            }
+        }
+        // Tasks of other nodes are still stolen finally, otherwise they
+        // may be pending forever when the signaled workers are all on
+        // this node.
+        TaskGroup* victim = steal_from_groups(
+            wg->groups, wg->ngroup, index, tid, seed, offset);
+        if (victim == NULL) {
+            return false;
+        }
+        if (victim->numa_node() != numa_node) {
+            _numa_remote_steal_count << 1;
+        }
+        return true;
+    }
+    return steal_from_groups(wg->groups, wg->ngroup, index, tid, seed, offset);
+}
+
+TaskGroup* TaskControl::steal_from_groups(TaskGroup** groups,
+                                          const butil::atomic<size_t>& ngroup_in,
+                                          int index, bthread_t* tid,
+                                          size_t* seed, size_t offset) {
     // 1: Acquiring fence is paired with releasing fence in _add_group to
-    // avoid accessing uninitialized slot of _groups.
-    const size_t ngroup = _ngroup.load(butil::memory_order_acquire/*1*/);
+    // avoid accessing uninitialized slot of groups.
+    const size_t ngroup = ngroup_in.load(butil::memory_order_acquire/*1*/);
     if (0 == ngroup) {
-        return false;
+        return NULL;
     }
 
     // NOTE: Don't return inside `for' iteration since we need to update |seed|
-    bool stolen = false;
+    TaskGroup* stolen = NULL;
     size_t s = *seed;
     for (size_t i = 0; i < ngroup; ++i, s += offset) {
-        TaskGroup* g = _groups[s % ngroup];
+        TaskGroup* g = groups[s % ngroup];
         // g is possibly NULL because of concurrent _destroy_group
         if (g) {
-            if (g->_rq.steal(tid)) {
-                stolen = true;
+            if (g->_rq[index].steal(tid)) {
+                stolen = g;
                 break;
             }
-            if (g->_remote_rq.pop(tid)) {
-                stolen = true;
+            if (g->_remote_rq.pop(tid, index)) {
+                stolen = g;
                 break;
             }
         }
@@ -366,7 +653,7 @@ bool TaskControl::steal_task(bthread_t* tid, size_t* seed, size_t offset) {
     return stolen;
 }
 
-void TaskControl::signal_task(int num_task) {
+void TaskControl::signal_task(int num_task, bthread_tag_t tag) {
     if (num_task <= 0) {
         return;
     }
@@ -377,17 +664,19 @@ void TaskControl::signal_task(int num_task) {
     if (num_task > 2) {
         num_task = 2;
     }
+    ParkingLot* pl = _worker_groups[tag]->pl;
     int start_index = butil::fmix64(pthread_numeric_id()) % PARKING_LOT_NUM;
-    num_task -= _pl[start_index].signal(1);
+    num_task -= pl[start_index].signal(1);
     if (num_task > 0) {
         for (int i = 1; i < PARKING_LOT_NUM && num_task > 0; ++i) {
             if (++start_index >= PARKING_LOT_NUM) {
                 start_index = 0;
             }
-            num_task -= _pl[start_index].signal(1);
+            num_task -= pl[start_index].signal(1);
         }
     }
-    if (num_task > 0 &&
+    // Only the default group grows lazily.
+    if (num_task > 0 && tag == BTHREAD_TAG_DEFAULT &&
         FLAGS_bthread_min_concurrency > 0 &&    // test min_concurrency for performance
         _concurrency.load(butil::memory_order_relaxed) < FLAGS_bthread_concurrency) {
         // TODO: Reduce this lock
@@ -406,7 +695,12 @@ void TaskControl::print_rq_sizes(std::ostream& os) {
         // ngroup > _ngroup: nums[_ngroup ... ngroup-1] = 0
         // ngroup < _ngroup: just ignore _groups[_ngroup ... ngroup-1]
         for (size_t i = 0; i < ngroup; ++i) {
-            nums[i] = (_groups[i] ? _groups[i]->_rq.volatile_size() : 0);
+            nums[i] = 0;
+            if (_groups[i]) {
+                for (int j = 0; j < BTHREAD_PRIORITY_NUM; ++j) {
+                    nums[i] += _groups[i]->_rq[j].volatile_size();
+                }
+            }
         }
     }
     for (size_t i = 0; i < ngroup; ++i) {
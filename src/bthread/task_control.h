@@ -31,6 +31,8 @@
 #include <iostream>                             // std::ostream
 #endif
 #include <stddef.h>                             // size_t
+#include <string>
+#include <vector>
 #include "butil/atomicops.h"                     // butil::atomic
 #include "bvar/bvar.h"                          // bvar::PassiveStatus
 #include "bthread/task_meta.h"                  // TaskMeta
@@ -50,55 +52,147 @@ public:
     TaskControl();
     ~TaskControl();
 
-    // Must be called before using. `nconcurrency' is # of worker pthreads.
+    // Must be called before using. `nconcurrency' is # of worker pthreads
+    // of the default group, workers of named groups are created according
+    // to -bthread_worker_groups additionally.
     int init(int nconcurrency);
     
-    // Create a TaskGroup in this control.
-    TaskGroup* create_group();
+    // Create a TaskGroup of worker group `tag' in this control.
+    TaskGroup* create_group(bthread_tag_t tag);
 
-    // Steal a task from a "random" group.
-    bool steal_task(bthread_t* tid, size_t* seed, size_t offset);
+    // Steal a task from run queues of `index' (see priority_queue_index())
+    // of a "random" group of worker group `tag'. If `numa_node' is
+    // non-negative, groups on the node are tried for
+    // -bthread_numa_steal_attempts rounds before groups on other nodes.
+    bool steal_task(bthread_t* tid, size_t* seed, size_t offset,
+                    bthread_tag_t tag, int numa_node, int index);
 
-    // Tell other groups that `n' tasks was just added to caller's runqueue
-    void signal_task(int num_task);
+    // Tell other groups of worker group `tag' that `n' tasks was just added
+    // to caller's runqueue
+    void signal_task(int num_task, bthread_tag_t tag);
 
     // Stop and join worker threads in TaskControl.
     void stop_and_join();
     
-    // Get # of worker threads.
+    // Get # of worker threads of the default group.
     int concurrency() const 
     { return _concurrency.load(butil::memory_order_acquire); }
 
+    // Get # of worker threads of worker group `tag', -1 if `tag' is invalid.
+    int concurrency(bthread_tag_t tag) const;
+
+    // # of worker groups including the default one. Valid tags are
+    // [0, worker_group_count()).
+    int worker_group_count() const { return (int)_worker_groups.size(); }
+
+    // Tag of the worker group named `name', BTHREAD_TAG_INVALID if not found.
+    bthread_tag_t find_worker_group(const std::string& name) const;
+
+    // # of NUMA nodes that workers are spread over, 0 if -bthread_numa_aware
+    // is off.
+    int numa_node_count() const { return _numa_node_count; }
+
     void print_rq_sizes(std::ostream& os);
 
     double get_cumulated_worker_time();
     int64_t get_cumulated_switch_count();
     int64_t get_cumulated_signal_count();
 
-    // [Not thread safe] Add more worker threads.
+    // [Not thread safe] Add more worker threads to the default group.
     // Return the number of workers actually added, which may be less than |num|
     int add_workers(int num);
 
-    // Choose one TaskGroup (randomly right now).
+    // Choose one TaskGroup of worker group `tag' (randomly right now).
     // If this method is called after init(), it never returns NULL.
-    TaskGroup* choose_one_group();
+    TaskGroup* choose_one_group(bthread_tag_t tag = BTHREAD_TAG_DEFAULT);
 
 private:
+    static const int PARKING_LOT_NUM = 4;
+
+    // TaskGroups of a worker group on one NUMA node.
+    struct NumaGroups {
+        NumaGroups();
+        ~NumaGroups();
+
+        butil::atomic<size_t> ngroup;
+        TaskGroup** groups;
+    };
+
+    // Workers sharing a tag. Tasks of the tag are only run and stolen by
+    // TaskGroups in `groups'.
+    struct WorkerGroup {
+        WorkerGroup(TaskControl* c, bthread_tag_t tag, const std::string& name);
+        ~WorkerGroup();
+        void expose();
+        void hide();
+        static double get_cumulated_worker_time(void* arg);
+        static int64_t get_queue_depth(void* arg);
+
+        TaskControl* control;
+        bthread_tag_t tag;
+        std::string name;
+        int nworkers_expected;
+        butil::atomic<size_t> ngroup;
+        TaskGroup** groups;
+        // `groups' split by NUMA nodes, NULL if -bthread_numa_aware is off.
+        NumaGroups* numa_groups;
+        // Node of the next created worker.
+        int next_numa_node;
+        // Tasks queued in run queues of each priority, only counted for
+        // high and low priorities to skip their empty queues quickly.
+        butil::atomic<int64_t> nqueued[BTHREAD_PRIORITY_NUM];
+        ParkingLot pl[PARKING_LOT_NUM];
+        // Following vars are only exposed for named groups.
+        bvar::Adder<int64_t> nworkers;
+        bvar::PassiveStatus<double> cumulated_worker_time;
+        bvar::PerSecond<bvar::PassiveStatus<double> > worker_usage_second;
+        bvar::PassiveStatus<int64_t> queue_depth;
+    };
+
+    struct WorkerArgs {
+        TaskControl* control;
+        bthread_tag_t tag;
+        int numa_node;
+    };
+
+    // Parse -bthread_worker_groups into _worker_groups.
+    int init_worker_groups();
+
+    // Create a worker pthread of group `tag' and append it to _workers.
+    int create_worker(bthread_tag_t tag);
+
     // Add/Remove a TaskGroup.
     // Returns 0 on success, -1 otherwise.
     int _add_group(TaskGroup*);
     int _destroy_group(TaskGroup*);
 
+    // Append `g' to groups[0..ngroup) / Remove `g' from groups[0..ngroup),
+    // called with _modify_group_mutex held.
+    static void add_to_groups(TaskGroup** groups, butil::atomic<size_t>* ngroup,
+                              TaskGroup* g);
+    static bool remove_from_groups(TaskGroup** groups,
+                                   butil::atomic<size_t>* ngroup, TaskGroup* g);
+    // Steal a task from one of groups[0..ngroup).
+    // Returns the group that the task is stolen from, NULL otherwise.
+    static TaskGroup* steal_from_groups(TaskGroup** groups,
+                                        const butil::atomic<size_t>& ngroup,
+                                        int index, bthread_t* tid,
+                                        size_t* seed, size_t offset);
+
     static void delete_task_group(void* arg);
 
-    static void* worker_thread(void* task_control);
+    static void* worker_thread(void* args);
 
     bvar::LatencyHistogramRecorder& exposed_pending_time();
     bvar::LatencyHistogramRecorder* create_exposed_pending_time();
 
+    // All groups, for statistics.
     butil::atomic<size_t> _ngroup;
     TaskGroup** _groups;
     butil::Mutex _modify_group_mutex;
+    // Indexed by tag. Not modified after init().
+    std::vector<WorkerGroup*> _worker_groups;
+    int _numa_node_count;
 
     bool _stop;
     butil::atomic<int> _concurrency;
@@ -115,9 +209,8 @@ private:
     bvar::PerSecond<bvar::PassiveStatus<int64_t> > _signal_per_second;
     bvar::PassiveStatus<std::string> _status;
     bvar::Adder<int64_t> _nbthreads;
-
-    static const int PARKING_LOT_NUM = 4;
-    ParkingLot _pl[PARKING_LOT_NUM];
+    // Tasks stolen from workers on other NUMA nodes.
+    bvar::Adder<int64_t> _numa_remote_steal_count;
 };
 
 inline bvar::LatencyHistogramRecorder& TaskControl::exposed_pending_time() {
@@ -26,6 +26,7 @@
 #include "butil/macros.h"                   // ARRAY_SIZE
 #include "butil/scoped_lock.h"              // BAIDU_SCOPED_LOCK
 #include "butil/fast_rand.h"
+#include "butil/numa.h"                     // numa_thread_node
 #include "butil/unique_ptr.h"
 #include "butil/third_party/murmurhash3/murmurhash3.h" // fmix64
 #include "bthread/errno.h"                  // ESTOP
@@ -40,7 +41,8 @@
 namespace bthread {
 
 static const bthread_attr_t BTHREAD_ATTR_TASKGROUP = {
-    BTHREAD_STACKTYPE_UNKNOWN, 0, NULL };
+    BTHREAD_STACKTYPE_UNKNOWN, 0, NULL, BTHREAD_TAG_INVALID,
+    BTHREAD_PRIORITY_NORMAL };
 
 static bool pass_bool(const char*, bool) { return true; }
 
@@ -173,7 +175,7 @@ void TaskGroup::run_main_task() {
     current_task()->stat.cputime_ns += butil::cpuwide_time_ns() - _last_run_ns;
 }
 
-TaskGroup::TaskGroup(TaskControl* c)
+TaskGroup::TaskGroup(TaskControl* c, bthread_tag_t tag)
     :
 #ifndef NDEBUG
     _sched_recursive_guard(0),
@@ -192,10 +194,14 @@ TaskGroup::TaskGroup(TaskControl* c)
     , _main_tid(0)
     , _remote_num_nosignal(0)
     , _remote_nsignaled(0)
+    , _nqueued(c->_worker_groups[tag]->nqueued)
+    , _tag(tag)
+    , _numa_node(butil::numa_thread_node())
 {
     _steal_seed = butil::fast_rand();
     _steal_offset = OFFSET_TABLE[_steal_seed % ARRAY_SIZE(OFFSET_TABLE)];
-    _pl = &c->_pl[butil::fmix64(pthread_numeric_id()) % TaskControl::PARKING_LOT_NUM];
+    _pl = &c->_worker_groups[tag]->pl[
+        butil::fmix64(pthread_numeric_id()) % TaskControl::PARKING_LOT_NUM];
     CHECK(c);
 }
 
@@ -210,9 +216,11 @@ TaskGroup::~TaskGroup() {
 }
 
 int TaskGroup::init(size_t runqueue_capacity) {
-    if (_rq.init(runqueue_capacity) != 0) {
-        LOG(FATAL) << "Fail to init _rq";
-        return -1;
+    for (int i = 0; i < BTHREAD_PRIORITY_NUM; ++i) {
+        if (_rq[i].init(runqueue_capacity) != 0) {
+            LOG(FATAL) << "Fail to init _rq";
+            return -1;
+        }
     }
     if (_remote_rq.init(runqueue_capacity / 2) != 0) {
         LOG(FATAL) << "Fail to init _remote_rq";
@@ -238,6 +246,7 @@ int TaskGroup::init(size_t runqueue_capacity) {
     m->cpuwide_start_ns = butil::cpuwide_time_ns();
     m->stat = EMPTY_STAT;
     m->attr = BTHREAD_ATTR_TASKGROUP;
+    m->attr.tag = _tag;
     m->tid = make_tid(*m->version_butex, slot);
     m->set_stack(stk);
 
@@ -381,6 +390,8 @@ int TaskGroup::start_foreground(TaskGroup** pg,
     m->arg = arg;
     CHECK(m->stack == NULL);
     m->attr = using_attr;
+    // Resolve the tag so that wakeups know where to put the task back.
+    m->attr.tag = (*pg)->tag();
     m->local_storage = LOCAL_STORAGE_INIT;
     if (using_attr.flags & BTHREAD_INHERIT_SPAN) {
         m->local_storage.rpcz_parent_span = tls_bls.rpcz_parent_span;
@@ -416,20 +427,16 @@ int TaskGroup::start_foreground(TaskGroup** pg,
     return 0;
 }
 
-template <bool REMOTE>
-int TaskGroup::start_background(bthread_t* __restrict th,
-                                const bthread_attr_t* __restrict attr,
-                                void * (*fn)(void*),
-                                void* __restrict arg) {
-    if (__builtin_expect(!fn, 0)) {
-        return EINVAL;
-    }
-    const int64_t start_ns = butil::cpuwide_time_ns();
-    const bthread_attr_t using_attr = (attr ? *attr : BTHREAD_ATTR_NORMAL);
+// Get a TaskMeta to run `fn(arg)' in this group.
+// Returns NULL on out of memory.
+TaskMeta* TaskGroup::new_task_meta(const bthread_attr_t& attr,
+                                   void * (*fn)(void*),
+                                   void* arg,
+                                   int64_t start_ns) {
     butil::ResourceId<TaskMeta> slot;
     TaskMeta* m = butil::get_resource(&slot);
     if (__builtin_expect(!m, 0)) {
-        return ENOMEM;
+        return NULL;
     }
     CHECK(m->current_waiter.load(butil::memory_order_relaxed) == NULL);
     m->stop = false;
@@ -438,18 +445,36 @@ int TaskGroup::start_background(bthread_t* __restrict th,
     m->fn = fn;
     m->arg = arg;
     CHECK(m->stack == NULL);
-    m->attr = using_attr;
+    m->attr = attr;
+    m->attr.tag = _tag;
     m->local_storage = LOCAL_STORAGE_INIT;
-    if (using_attr.flags & BTHREAD_INHERIT_SPAN) {
+    if (attr.flags & BTHREAD_INHERIT_SPAN) {
         m->local_storage.rpcz_parent_span = tls_bls.rpcz_parent_span;
     }
     m->cpuwide_start_ns = start_ns;
     m->stat = EMPTY_STAT;
     m->tid = make_tid(*m->version_butex, slot);
-    *th = m->tid;
-    if (using_attr.flags & BTHREAD_LOG_START_AND_FINISH) {
+    if (attr.flags & BTHREAD_LOG_START_AND_FINISH) {
         LOG(INFO) << "Started bthread " << m->tid;
     }
+    return m;
+}
+
+template <bool REMOTE>
+int TaskGroup::start_background(bthread_t* __restrict th,
+                                const bthread_attr_t* __restrict attr,
+                                void * (*fn)(void*),
+                                void* __restrict arg) {
+    if (__builtin_expect(!fn, 0)) {
+        return EINVAL;
+    }
+    const int64_t start_ns = butil::cpuwide_time_ns();
+    const bthread_attr_t using_attr = (attr ? *attr : BTHREAD_ATTR_NORMAL);
+    TaskMeta* m = new_task_meta(using_attr, fn, arg, start_ns);
+    if (__builtin_expect(!m, 0)) {
+        return ENOMEM;
+    }
+    *th = m->tid;
     _control->_nbthreads << 1;
     if (REMOTE) {
         ready_to_run_remote(m->tid, (using_attr.flags & BTHREAD_NOSIGNAL));
@@ -459,6 +484,44 @@ int TaskGroup::start_background(bthread_t* __restrict th,
     return 0;
 }
 
+template <bool REMOTE>
+int TaskGroup::start_background_batch(bthread_t* __restrict tids,
+                                      const bthread_attr_t* __restrict attr,
+                                      void * (*fn)(void*),
+                                      void* const* args,
+                                      size_t n) {
+    if (__builtin_expect(!fn, 0)) {
+        return EINVAL;
+    }
+    const int64_t start_ns = butil::cpuwide_time_ns();
+    const bthread_attr_t using_attr = (attr ? *attr : BTHREAD_ATTR_NORMAL);
+    int rc = 0;
+    size_t ncreated = 0;
+    for (; ncreated < n; ++ncreated) {
+        TaskMeta* m = new_task_meta(using_attr, fn, args[ncreated], start_ns);
+        if (__builtin_expect(!m, 0)) {
+            rc = ENOMEM;
+            break;
+        }
+        tids[ncreated] = m->tid;
+    }
+    for (size_t i = ncreated; i < n; ++i) {
+        tids[i] = INVALID_BTHREAD;
+    }
+    if (ncreated == 0) {
+        return rc;
+    }
+    _control->_nbthreads << ncreated;
+    if (REMOTE) {
+        ready_to_run_remote_batch(tids, ncreated,
+                                  (using_attr.flags & BTHREAD_NOSIGNAL));
+    } else {
+        ready_to_run_batch(tids, ncreated,
+                           (using_attr.flags & BTHREAD_NOSIGNAL));
+    }
+    return rc;
+}
+
 // Explicit instantiations.
 template int
 TaskGroup::start_background<true>(bthread_t* __restrict th,
@@ -470,6 +533,18 @@ TaskGroup::start_background<false>(bthread_t* __restrict th,
                                    const bthread_attr_t* __restrict attr,
                                    void * (*fn)(void*),
                                    void* __restrict arg);
+template int
+TaskGroup::start_background_batch<true>(bthread_t* __restrict tids,
+                                        const bthread_attr_t* __restrict attr,
+                                        void * (*fn)(void*),
+                                        void* const* args,
+                                        size_t n);
+template int
+TaskGroup::start_background_batch<false>(bthread_t* __restrict tids,
+                                         const bthread_attr_t* __restrict attr,
+                                         void * (*fn)(void*),
+                                         void* const* args,
+                                         size_t n);
 
 int TaskGroup::join(bthread_t tid, void** return_value) {
     if (__builtin_expect(!tid, 0)) {  // tid of bthread is never 0.
@@ -517,15 +592,7 @@ void TaskGroup::ending_sched(TaskGroup** pg) {
     TaskGroup* g = *pg;
     bthread_t next_tid = 0;
     // Find next task to run, if none, switch to idle thread of the group.
-#ifndef BTHREAD_FAIR_WSQ
-    // When BTHREAD_FAIR_WSQ is defined, profiling shows that cpu cost of
-    // WSQ::steal() in example/multi_threaded_echo_c++ changes from 1.9%
-    // to 2.9%
-    const bool popped = g->_rq.pop(&next_tid);
-#else
-    const bool popped = g->_rq.steal(&next_tid);
-#endif
-    if (!popped && !g->steal_task(&next_tid)) {
+    if (!g->pop_rq(&next_tid) && !g->steal_task(&next_tid)) {
         // Jump to main task if there's no task to run.
         next_tid = g->_main_tid;
     }
@@ -558,12 +625,7 @@ void TaskGroup::sched(TaskGroup** pg) {
     TaskGroup* g = *pg;
     bthread_t next_tid = 0;
     // Find next task to run, if none, switch to idle thread of the group.
-#ifndef BTHREAD_FAIR_WSQ
-    const bool popped = g->_rq.pop(&next_tid);
-#else
-    const bool popped = g->_rq.steal(&next_tid);
-#endif
-    if (!popped && !g->steal_task(&next_tid)) {
+    if (!g->pop_rq(&next_tid) && !g->steal_task(&next_tid)) {
         // Jump to main task if there's no task to run.
         next_tid = g->_main_tid;
     }
@@ -663,7 +725,20 @@ void TaskGroup::ready_to_run(bthread_t tid, bool nosignal) {
         const int additional_signal = _num_nosignal;
         _num_nosignal = 0;
         _nsignaled += 1 + additional_signal;
-        _control->signal_task(1 + additional_signal);
+        _control->signal_task(1 + additional_signal, _tag);
+    }
+}
+
+void TaskGroup::ready_to_run_batch(const bthread_t* tids, size_t n,
+                                   bool nosignal) {
+    push_rq_batch(tids, n);
+    if (nosignal) {
+        _num_nosignal += n;
+    } else {
+        const int additional_signal = _num_nosignal;
+        _num_nosignal = 0;
+        _nsignaled += n + additional_signal;
+        _control->signal_task(n + additional_signal, _tag);
     }
 }
 
@@ -672,13 +747,15 @@ void TaskGroup::flush_nosignal_tasks() {
     if (val) {
         _num_nosignal = 0;
         _nsignaled += val;
-        _control->signal_task(val);
+        _control->signal_task(val, _tag);
     }
 }
 
 void TaskGroup::ready_to_run_remote(bthread_t tid, bool nosignal) {
+    const int index = priority_queue_index(address_meta(tid)->attr.priority);
+    add_queued(index, 1);
     _remote_rq._mutex.lock();
-    while (!_remote_rq.push_locked(tid)) {
+    while (!_remote_rq.push_locked(tid, index)) {
         flush_nosignal_tasks_remote_locked(_remote_rq._mutex);
         LOG_EVERY_SECOND(ERROR) << "_remote_rq is full, capacity="
                                 << _remote_rq.capacity();
@@ -693,7 +770,34 @@ void TaskGroup::ready_to_run_remote(bthread_t tid, bool nosignal) {
         _remote_num_nosignal = 0;
         _remote_nsignaled += 1 + additional_signal;
         _remote_rq._mutex.unlock();
-        _control->signal_task(1 + additional_signal);
+        _control->signal_task(1 + additional_signal, _tag);
+    }
+}
+
+void TaskGroup::ready_to_run_remote_batch(const bthread_t* tids, size_t n,
+                                          bool nosignal) {
+    // bthreads of a batch share the same attributes.
+    const int index = priority_queue_index(address_meta(tids[0])->attr.priority);
+    add_queued(index, n);
+    _remote_rq._mutex.lock();
+    for (size_t i = 0; i < n; ++i) {
+        while (!_remote_rq.push_locked(tids[i], index)) {
+            flush_nosignal_tasks_remote_locked(_remote_rq._mutex);
+            LOG_EVERY_SECOND(ERROR) << "_remote_rq is full, capacity="
+                                    << _remote_rq.capacity();
+            ::usleep(1000);
+            _remote_rq._mutex.lock();
+        }
+    }
+    if (nosignal) {
+        _remote_num_nosignal += n;
+        _remote_rq._mutex.unlock();
+    } else {
+        const int additional_signal = _remote_num_nosignal;
+        _remote_num_nosignal = 0;
+        _remote_nsignaled += n + additional_signal;
+        _remote_rq._mutex.unlock();
+        _control->signal_task(n + additional_signal, _tag);
     }
 }
 
@@ -706,7 +810,7 @@ void TaskGroup::flush_nosignal_tasks_remote_locked(butil::Mutex& locked_mutex) {
     _remote_num_nosignal = 0;
     _remote_nsignaled += val;
     locked_mutex.unlock();
-    _control->signal_task(val);
+    _control->signal_task(val, _tag);
 }
 
 void TaskGroup::ready_to_run_general(bthread_t tid, bool nosignal) {
@@ -743,7 +847,8 @@ struct SleepArgs {
 static void ready_to_run_from_timer_thread(void* arg) {
     CHECK(tls_task_group == NULL);
     const SleepArgs* e = static_cast<const SleepArgs*>(arg);
-    e->group->control()->choose_one_group()->ready_to_run_remote(e->tid);
+    e->group->control()->choose_one_group(e->meta->attr.tag)
+        ->ready_to_run_remote(e->tid);
 }
 
 void TaskGroup::_add_sleep_event(void* void_args) {
@@ -880,13 +985,14 @@ int TaskGroup::interrupt(bthread_t tid, TaskControl* c) {
     } else if (sleep_id != 0) {
         if (get_global_timer_thread()->unschedule(sleep_id) == 0) {
             bthread::TaskGroup* g = bthread::tls_task_group;
-            if (g) {
+            const bthread_tag_t tag = address_meta(tid)->attr.tag;
+            if (g && g->tag() == tag) {
                 g->ready_to_run(tid);
             } else {
                 if (!c) {
                     return EINVAL;
                 }
-                c->choose_one_group()->ready_to_run_remote(tid);
+                c->choose_one_group(tag)->ready_to_run_remote(tid);
             }
         }
     }
@@ -74,6 +74,20 @@ public:
                          void * (*fn)(void*),
                          void* __restrict arg);
 
+    // Create `n' tasks `fn(args[i])' with attributes `attr' in this TaskGroup
+    // and put the identifiers into `tids'. All tasks are pushed into the
+    // runqueue together and signalled at most once.
+    //   Called from worker: start_background_batch<false>
+    //   Called from non-worker: start_background_batch<true>
+    // Return 0 on success, errno otherwise, tids of tasks failed to be
+    // created are set to INVALID_BTHREAD.
+    template <bool REMOTE>
+    int start_background_batch(bthread_t* __restrict tids,
+                               const bthread_attr_t* __restrict attr,
+                               void * (*fn)(void*),
+                               void* const* args,
+                               size_t n);
+
     // Suspend caller and run next bthread in TaskGroup *pg.
     static void sched(TaskGroup** pg);
     static void ending_sched(TaskGroup** pg);
@@ -152,11 +166,16 @@ public:
 
     // Push a bthread into the runqueue
     void ready_to_run(bthread_t tid, bool nosignal = false);
+    // Push bthreads with the same attributes into the runqueue.
+    void ready_to_run_batch(const bthread_t* tids, size_t n,
+                            bool nosignal = false);
     // Flush tasks pushed to rq but signalled.
     void flush_nosignal_tasks();
 
     // Push a bthread into the runqueue from another non-worker thread.
     void ready_to_run_remote(bthread_t tid, bool nosignal = false);
+    void ready_to_run_remote_batch(const bthread_t* tids, size_t n,
+                                   bool nosignal = false);
     void flush_nosignal_tasks_remote_locked(butil::Mutex& locked_mutex);
     void flush_nosignal_tasks_remote();
 
@@ -168,6 +187,12 @@ public:
     // The TaskControl that this TaskGroup belongs to.
     TaskControl* control() const { return _control; }
 
+    // Tag of the worker group that this TaskGroup belongs to.
+    bthread_tag_t tag() const { return _tag; }
+
+    // NUMA node that the worker is bound to, -1 if -bthread_numa_aware is off.
+    int numa_node() const { return _numa_node; }
+
     // Call this instead of delete.
     void destroy_self();
 
@@ -178,18 +203,23 @@ public:
     // Get the meta associate with the task.
     static TaskMeta* address_meta(bthread_t tid);
 
-    // Push a task into _rq, if _rq is full, retry after some time. This
-    // process make go on indefinitely.
+    // Push a task into _rq of its priority, if _rq is full, retry after some
+    // time. This process make go on indefinitely.
     void push_rq(bthread_t tid);
+    // Push tasks with the same priority into _rq in a batch.
+    void push_rq_batch(const bthread_t* tids, size_t n);
 
 private:
 friend class TaskControl;
 
     // You shall use TaskControl::create_group to create new instance.
-    explicit TaskGroup(TaskControl*);
+    TaskGroup(TaskControl*, bthread_tag_t tag);
 
     int init(size_t runqueue_capacity);
 
+    TaskMeta* new_task_meta(const bthread_attr_t& attr, void * (*fn)(void*),
+                            void* arg, int64_t start_ns);
+
     // You shall call destroy_self() instead of destructor because deletion
     // of groups are postponed to avoid race.
     ~TaskGroup();
@@ -211,14 +241,37 @@ friend class TaskControl;
     // loop calling this function should end.
     bool wait_task(bthread_t* tid);
 
+    // Pop a task from _rq of the highest priority.
+    bool pop_rq(bthread_t* tid);
+
+    // Steal a task of the highest priority from _remote_rq or other groups.
     bool steal_task(bthread_t* tid) {
-        if (_remote_rq.pop(tid)) {
-            return true;
-        }
 #ifndef BTHREAD_DONT_SAVE_PARKING_STATE
         _last_pl_state = _pl->get_state();
 #endif
-        return _control->steal_task(tid, &_steal_seed, _steal_offset);
+        for (int i = 0; i < BTHREAD_PRIORITY_NUM; ++i) {
+            // Skip the high and low priorities quickly when no such tasks
+            // are queued in the worker group.
+            if (i != NORMAL_PRIORITY_QUEUE_INDEX &&
+                _nqueued[i].load(butil::memory_order_relaxed) <= 0) {
+                continue;
+            }
+            if (_remote_rq.pop(tid, i) ||
+                _control->steal_task(tid, &_steal_seed, _steal_offset, _tag,
+                                     _numa_node, i)) {
+                add_queued(i, -1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Count tasks in queues of `index' of the worker group, only counted
+    // for high and low priorities.
+    void add_queued(int index, int64_t n) {
+        if (index != NORMAL_PRIORITY_QUEUE_INDEX) {
+            _nqueued[index].fetch_add(n, butil::memory_order_relaxed);
+        }
     }
 
 #ifndef NDEBUG
@@ -247,10 +300,15 @@ friend class TaskControl;
     size_t _steal_offset;
     ContextualStack* _main_stack;
     bthread_t _main_tid;
-    WorkStealingQueue<bthread_t> _rq;
+    // Indexed by priority_queue_index().
+    WorkStealingQueue<bthread_t> _rq[BTHREAD_PRIORITY_NUM];
     RemoteTaskQueue _remote_rq;
     int _remote_num_nosignal;
     int _remote_nsignaled;
+    // Queued tasks of each priority in the worker group.
+    butil::atomic<int64_t>* _nqueued;
+    bthread_tag_t _tag;
+    int _numa_node;
 };
 
 }  // namespace bthread
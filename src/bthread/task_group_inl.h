@@ -79,7 +79,11 @@ inline void TaskGroup::sched_to(TaskGroup** pg, bthread_t next_tid) {
 }
 
 inline void TaskGroup::push_rq(bthread_t tid) {
-    while (!_rq.push(tid)) {
+    const int index = priority_queue_index(address_meta(tid)->attr.priority);
+    // Count before pushing so that stealers never miss the task.
+    add_queued(index, 1);
+    WorkStealingQueue<bthread_t>& rq = _rq[index];
+    while (!rq.push(tid)) {
         // Created too many bthreads: a promising approach is to insert the
         // task into another TaskGroup, but we don't use it because:
         // * There're already many bthreads to run, inserting the bthread
@@ -88,7 +92,7 @@ inline void TaskGroup::push_rq(bthread_t tid) {
         //   are busy at creating bthreads (proved by test_input_messenger in
         //   brpc)
         flush_nosignal_tasks();
-        LOG_EVERY_SECOND(ERROR) << "_rq is full, capacity=" << _rq.capacity();
+        LOG_EVERY_SECOND(ERROR) << "_rq is full, capacity=" << rq.capacity();
         // TODO(gejun): May cause deadlock when all workers are spinning here.
         // A better solution is to pop and run existing bthreads, however which
         // make set_remained()-callbacks do context switches and need extensive
@@ -97,6 +101,46 @@ inline void TaskGroup::push_rq(bthread_t tid) {
     }
 }
 
+inline void TaskGroup::push_rq_batch(const bthread_t* tids, size_t n) {
+    const int index = priority_queue_index(address_meta(tids[0])->attr.priority);
+    add_queued(index, n);
+    WorkStealingQueue<bthread_t>& rq = _rq[index];
+    while (true) {
+        const size_t npushed = rq.push_batch(tids, n);
+        tids += npushed;
+        n -= npushed;
+        if (n == 0) {
+            break;
+        }
+        // Same as push_rq() when _rq is full.
+        flush_nosignal_tasks();
+        LOG_EVERY_SECOND(ERROR) << "_rq is full, capacity=" << rq.capacity();
+        ::usleep(1000);
+    }
+}
+
+inline bool TaskGroup::pop_rq(bthread_t* tid) {
+    for (int i = 0; i < BTHREAD_PRIORITY_NUM; ++i) {
+        WorkStealingQueue<bthread_t>& rq = _rq[i];
+        // Size seen by the owner is never less than the actual one.
+        if (i != NORMAL_PRIORITY_QUEUE_INDEX && rq.volatile_size() == 0) {
+            continue;
+        }
+#ifndef BTHREAD_FAIR_WSQ
+        // When BTHREAD_FAIR_WSQ is defined, profiling shows that cpu cost of
+        // WSQ::steal() in example/multi_threaded_echo_c++ changes from 1.9%
+        // to 2.9%
+        if (rq.pop(tid)) {
+#else
+        if (rq.steal(tid)) {
+#endif
+            add_queued(i, -1);
+            return true;
+        }
+    }
+    return false;
+}
+
 inline void TaskGroup::flush_nosignal_tasks_remote() {
     if (_remote_num_nosignal) {
         _remote_rq._mutex.lock();
@@ -64,6 +64,25 @@ static const bthread_attrflags_t BTHREAD_NOSIGNAL = 32;
 static const bthread_attrflags_t BTHREAD_NEVER_QUIT = 64;
 static const bthread_attrflags_t BTHREAD_INHERIT_SPAN = 128;
 
+// Tag of a worker group. Workers are partitioned into groups by
+// -bthread_worker_groups, a bthread only runs (and is only stolen) by workers
+// of its group. Tag 0 is the default group sized by -bthread_concurrency.
+typedef int bthread_tag_t;
+// Run in the worker group of the creator, or the default group when the
+// creator is not a bthread worker.
+static const bthread_tag_t BTHREAD_TAG_INVALID = -1;
+static const bthread_tag_t BTHREAD_TAG_DEFAULT = 0;
+
+// Priority of a bthread. Workers always run (and steal) runnable bthreads of
+// higher priorities first, a bthread keeps its priority after being woken up.
+// Lower priorities may starve when there're always runnable bthreads of
+// higher priorities.
+typedef int bthread_priority_t;
+static const bthread_priority_t BTHREAD_PRIORITY_LOW = -1;
+static const bthread_priority_t BTHREAD_PRIORITY_NORMAL = 0;
+static const bthread_priority_t BTHREAD_PRIORITY_HIGH = 1;
+static const int BTHREAD_PRIORITY_NUM = 3;
+
 // Key of thread-local data, created by bthread_key_create.
 typedef struct {
     uint32_t index;    // index in KeyTable
@@ -115,16 +134,26 @@ typedef struct {
 } bthread_keytable_pool_stat_t;
 
 // Attributes for thread creation.
+// NOTE: Initialize attributes by copying BTHREAD_ATTR_* (optionally with
+// flags or'ed, e.g. `BTHREAD_ATTR_NORMAL | BTHREAD_INHERIT_SPAN') and then
+// assigning fields, rather than listing fields in braces. Fields omitted in
+// a brace initializer are zero, which means `tag' is BTHREAD_TAG_DEFAULT
+// instead of BTHREAD_TAG_INVALID, and such bthreads created by a worker of
+// another group run in the default group instead of the creator's group.
 typedef struct bthread_attr_t {
     bthread_stacktype_t stack_type;
     bthread_attrflags_t flags;
     bthread_keytable_pool_t* keytable_pool;
+    bthread_tag_t tag;
+    bthread_priority_t priority;
 
 #if defined(__cplusplus)
     void operator=(unsigned stacktype_and_flags) {
         stack_type = (stacktype_and_flags & 7);
         flags = (stacktype_and_flags & ~(unsigned)7u);
         keytable_pool = NULL;
+        tag = BTHREAD_TAG_INVALID;
+        priority = BTHREAD_PRIORITY_NORMAL;
     }
     bthread_attr_t operator|(unsigned other_flags) const {
         CHECK(!(other_flags & 7)) << "flags=" << other_flags;
@@ -142,23 +171,29 @@ typedef struct bthread_attr_t {
 // obvious drawback is that you need more worker pthreads when you have a lot
 // of such bthreads.
 static const bthread_attr_t BTHREAD_ATTR_PTHREAD =
-{ BTHREAD_STACKTYPE_PTHREAD, 0, NULL };
+{ BTHREAD_STACKTYPE_PTHREAD, 0, NULL, BTHREAD_TAG_INVALID,
+  BTHREAD_PRIORITY_NORMAL };
 
 // bthreads created with following attributes will have different size of
 // stacks. Default is BTHREAD_ATTR_NORMAL.
 static const bthread_attr_t BTHREAD_ATTR_SMALL =
-{ BTHREAD_STACKTYPE_SMALL, 0, NULL };
+{ BTHREAD_STACKTYPE_SMALL, 0, NULL, BTHREAD_TAG_INVALID,
+  BTHREAD_PRIORITY_NORMAL };
 static const bthread_attr_t BTHREAD_ATTR_NORMAL =
-{ BTHREAD_STACKTYPE_NORMAL, 0, NULL };
+{ BTHREAD_STACKTYPE_NORMAL, 0, NULL, BTHREAD_TAG_INVALID,
+  BTHREAD_PRIORITY_NORMAL };
 static const bthread_attr_t BTHREAD_ATTR_LARGE =
-{ BTHREAD_STACKTYPE_LARGE, 0, NULL };
+{ BTHREAD_STACKTYPE_LARGE, 0, NULL, BTHREAD_TAG_INVALID,
+  BTHREAD_PRIORITY_NORMAL };
 
 // bthreads created with this attribute will print log when it's started,
 // context-switched, finished.
 static const bthread_attr_t BTHREAD_ATTR_DEBUG = {
     BTHREAD_STACKTYPE_NORMAL,
     BTHREAD_LOG_START_AND_FINISH | BTHREAD_LOG_CONTEXT_SWITCH,
-    NULL
+    NULL,
+    BTHREAD_TAG_INVALID,
+    BTHREAD_PRIORITY_NORMAL
 };
 
 static const size_t BTHREAD_EPOLL_THREAD_NUM = 1;
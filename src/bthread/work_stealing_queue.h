@@ -80,6 +80,24 @@ public:
         return true;
     }
 
+    // Push at most `n' items into the queue with one release of _bottom.
+    // Returns number of pushed items, which is less than `n' when the queue
+    // is full.
+    // Same concurrency constraints as push().
+    size_t push_batch(const T* xs, size_t n) {
+        const size_t b = _bottom.load(butil::memory_order_relaxed);
+        const size_t t = _top.load(butil::memory_order_acquire);
+        const size_t room = t + _capacity - b;
+        if (n > room) {
+            n = room;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            _buffer[(b + i) & (_capacity - 1)] = xs[i];
+        }
+        _bottom.store(b + n, butil::memory_order_release);
+        return n;
+    }
+
     // Pop an item from the queue.
     // Returns true on popped and the item is written to `val'.
     // May run in parallel with steal().
@@ -137,6 +137,11 @@ int tcp_connect(EndPoint server, int* self_port);
 // Returns the socket descriptor, -1 otherwise and errno is set.
 int tcp_listen(EndPoint ip_and_port);
 
+// Same as above, but SO_REUSEPORT is enabled iff `reuse_port' is true
+// (or gflag -reuse_port is on), so that multiple sockets can listen to
+// the same port.
+int tcp_listen(EndPoint ip_and_port, bool reuse_port);
+
 // Get the local end of a socket connection
 int get_local_side(int fd, EndPoint *out);
 
@@ -32,6 +32,7 @@
 #endif
 #include <sys/syscall.h>                   // syscall
 #include <fcntl.h>                         // O_RDONLY
+#include <sys/socket.h>                    // sendmsg
 #include <errno.h>                         // errno
 #include <limits.h>                        // CHAR_BIT
 #include <stdexcept>                       // std::invalid_argument
@@ -41,6 +42,7 @@
 #include "butil/macros.h"                   // BAIDU_CASSERT
 #include "butil/logging.h"                  // CHECK, LOG
 #include "butil/fd_guard.h"                 // butil::fd_guard
+#include "butil/numa.h"                     // numa_thread_node
 #include "butil/iobuf.h"
 
 namespace butil {
@@ -192,7 +194,7 @@ size_t IOBuf::new_bigview_count() {
     return iobuf::g_newbigview.load(butil::memory_order_relaxed);
 }
 
-const uint16_t IOBUF_BLOCK_FLAGS_USER_DATA = 0x1;
+const uint8_t IOBUF_BLOCK_FLAGS_USER_DATA = 0x1;
 typedef void (*UserDataDeleter)(void*);
 
 struct UserDataExtension {
@@ -201,7 +203,9 @@ struct UserDataExtension {
 
 struct IOBuf::Block {
     butil::atomic<int> nshared;
-    uint16_t flags;
+    uint8_t flags;
+    // NUMA node of the thread creating the block, see numa_thread_node().
+    int8_t numa_node;
     uint16_t abi_check;  // original cap, never be zero.
     uint32_t size;
     uint32_t cap;
@@ -214,6 +218,7 @@ struct IOBuf::Block {
     Block(char* data_in, uint32_t data_size)
         : nshared(1)
         , flags(0)
+        , numa_node(butil::numa_thread_node())
         , abi_check(0)
         , size(0)
         , cap(data_size)
@@ -227,6 +232,7 @@ struct IOBuf::Block {
     Block(char* data_in, uint32_t data_size, UserDataDeleter deleter)
         : nshared(1)
         , flags(IOBUF_BLOCK_FLAGS_USER_DATA)
+        , numa_node(-1)
         , abi_check(0)
         , size(data_size)
         , cap(data_size)
@@ -393,13 +399,19 @@ IOBuf::Block* share_tls_block() {
     return new_block;
 }
 
+// Blocks created on other NUMA nodes are not cached, so that the TLS cache
+// of a thread bound to a node only contains memory local to the node.
+inline bool is_numa_local(const IOBuf::Block* b, int numa_node) {
+    return b->numa_node == numa_node;
+}
+
 // Return one block to TLS.
 inline void release_tls_block(IOBuf::Block *b) {
     if (!b) {
         return;
     }
     TLSData& tls_data = g_tls_data;
-    if (b->full()) {
+    if (b->full() || !is_numa_local(b, butil::numa_thread_node())) {
         b->dec_ref();
     } else if (tls_data.num_blocks >= MAX_BLOCKS_PER_THREAD) {
         b->dec_ref();
@@ -430,17 +442,28 @@ void release_tls_block_chain(IOBuf::Block* b) {
         g_num_hit_tls_threshold.fetch_add(n, butil::memory_order_relaxed);
         return;
     }
-    IOBuf::Block* first_b = b;
+    const int numa_node = butil::numa_thread_node();
+    IOBuf::Block* first_b = NULL;
     IOBuf::Block* last_b = NULL;
     do {
-        ++n;
         CHECK(!b->full());
-        if (b->portal_next == NULL) {
+        IOBuf::Block* const saved_next = b->portal_next;
+        if (!is_numa_local(b, numa_node)) {
+            b->dec_ref();
+        } else {
+            if (last_b) {
+                last_b->portal_next = b;
+            } else {
+                first_b = b;
+            }
             last_b = b;
-            break;
+            ++n;
         }
-        b = b->portal_next;
-    } while (true);
+        b = saved_next;
+    } while (b);
+    if (last_b == NULL) {
+        return;
+    }
     last_b->portal_next = tls_data.block_head;
     tls_data.block_head = first_b;
     tls_data.num_blocks += n;
@@ -920,6 +943,15 @@ int IOBuf::_cut_by_delim(IOBuf* out, char const* dbegin, size_t ndelim) {
 // is too large(in the worst case) for bthreads with small stacks.
 static const size_t IOBUF_IOV_MAX = 256;
 
+#if defined(OS_LINUX)
+// Defined since Linux 4.14, missing in headers of old glibc.
+#ifdef MSG_ZEROCOPY
+static const int IOBUF_MSG_ZEROCOPY = MSG_ZEROCOPY;
+#else
+static const int IOBUF_MSG_ZEROCOPY = 0x4000000;
+#endif
+#endif
+
 ssize_t IOBuf::pcut_into_file_descriptor(int fd, off_t offset, size_t size_hint) {
     if (empty()) {
         return 0;
@@ -1093,6 +1125,45 @@ ssize_t IOBuf::pcut_multiple_into_file_descriptor(
     return nw;
 }
 
+ssize_t IOBuf::cut_multiple_into_socket_zerocopy(
+    int fd, IOBuf* const* pieces, size_t count, IOBuf* sent) {
+#if defined(OS_LINUX)
+    if (BAIDU_UNLIKELY(count == 0)) {
+        return 0;
+    }
+    struct iovec vec[IOBUF_IOV_MAX];
+    size_t nvec = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const IOBuf* p = pieces[i];
+        const size_t nref = p->_ref_num();
+        for (size_t j = 0; j < nref && nvec < IOBUF_IOV_MAX; ++j, ++nvec) {
+            IOBuf::BlockRef const& r = p->_ref_at(j);
+            vec[nvec].iov_base = r.block->data + r.offset;
+            vec[nvec].iov_len = r.length;
+        }
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = vec;
+    msg.msg_iovlen = nvec;
+    const ssize_t nw = ::sendmsg(fd, &msg, IOBUF_MSG_ZEROCOPY);
+    if (nw <= 0) {
+        return nw;
+    }
+    size_t ncut_all = nw;
+    for (size_t i = 0; i < count; ++i) {
+        ncut_all -= pieces[i]->cutn(sent, ncut_all);
+        if (ncut_all == 0) {
+            break;
+        }
+    }
+    return nw;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
 ssize_t IOBuf::cut_multiple_into_writer(
         IWriter* writer, IOBuf* const* pieces, size_t count) {
     if (BAIDU_UNLIKELY(count == 0)) {
@@ -2070,12 +2141,24 @@ void IOBufAsZeroCopyOutputStream::_release_block() {
     _cur_block = NULL;
 }
 
-IOBufAsSnappySink::IOBufAsSnappySink(butil::IOBuf& buf)
-    : _cur_buf(NULL), _cur_len(0), _buf(&buf), _buf_stream(&buf) {
+const size_t IOBufAsSnappySink::DEFAULT_MAX_FLAT_SIZE;
+
+IOBufAsSnappySink::IOBufAsSnappySink(butil::IOBuf& buf, size_t max_flat_size)
+    : _cur_buf(NULL), _cur_len(0), _user_buf(NULL)
+    , _max_flat_size(max_flat_size), _buf(&buf), _buf_stream(&buf) {
+}
+
+IOBufAsSnappySink::~IOBufAsSnappySink() {
+    free(_user_buf);
 }
 
 void IOBufAsSnappySink::Append(const char* bytes, size_t n) {
-    if (_cur_len > 0) {
+    if (_user_buf != NULL && bytes == _user_buf) {
+        if (n == 0 || _buf->append_user_data(_user_buf, n, free) != 0) {
+            free(_user_buf);
+        }
+        _user_buf = NULL;
+    } else if (_cur_len > 0) {
         CHECK(bytes == _cur_buf && static_cast<int>(n) <= _cur_len)
             << "bytes must be _cur_buf";
         _buf_stream.BackUp(_cur_len - n);
@@ -2103,6 +2186,32 @@ char* IOBufAsSnappySink::GetAppendBuffer(size_t length, char* scratch) {
     return scratch;
 }
 
+char* IOBufAsSnappySink::GetAppendBufferVariable(
+    size_t min_size, size_t desired_size_hint, char* scratch,
+    size_t scratch_size, size_t* allocated_size) {
+    // Small output fits in the current block.
+    if (desired_size_hint <= 8000/*just a hint*/ &&
+        GetAppendBuffer(desired_size_hint, scratch) == _cur_buf &&
+        _cur_buf != NULL) {
+        *allocated_size = _cur_len;
+        return _cur_buf;
+    }
+    // Otherwise snappy decompresses into chunks and copies them into this
+    // sink at the end. Allocating the whole output once avoids the copy,
+    // unless the hint is too large to be trusted.
+    if (desired_size_hint >= min_size && desired_size_hint > scratch_size &&
+        desired_size_hint <= _max_flat_size) {
+        free(_user_buf);
+        _user_buf = (char*)malloc(desired_size_hint);
+        if (_user_buf != NULL) {
+            *allocated_size = desired_size_hint;
+            return _user_buf;
+        }
+    }
+    *allocated_size = scratch_size;
+    return scratch;
+}
+
 size_t IOBufAsSnappySource::Available() const {
     return _buf->length() - _stream.ByteCount();
 }
@@ -190,6 +190,16 @@ public:
     static ssize_t cut_multiple_into_file_descriptor(
         int fd, IOBuf* const* pieces, size_t count);
 
+    // Cut `count' number of `pieces' into socket `fd' with
+    // sendmsg(MSG_ZEROCOPY). Instead of being dropped, written bytes are cut
+    // into `sent' which references the same blocks, the caller must keep
+    // `sent' until the kernel notifies(via the error queue of `fd') that the
+    // pages are not used anymore. SO_ZEROCOPY must be enabled on `fd'.
+    // Returns bytes cut on success, -1 otherwise and errno is set(ENOTSUP
+    // on platforms without MSG_ZEROCOPY).
+    static ssize_t cut_multiple_into_socket_zerocopy(
+        int fd, IOBuf* const* pieces, size_t count, IOBuf* sent);
+
     // Cut `count' number of `pieces' into file descriptor `fd' at a given
     // offset. The file offset is not changed.
     // If `offset' is negative, does exactly what cut_multiple_into_file_descriptor
@@ -615,18 +625,36 @@ private:
 // Wrap IOBuf into output of snappy compression.
 class IOBufAsSnappySink : public butil::snappy::Sink {
 public:
-    explicit IOBufAsSnappySink(butil::IOBuf& buf);
-    virtual ~IOBufAsSnappySink() {}
+    // Flat output buffers are at most this large by default.
+    static const size_t DEFAULT_MAX_FLAT_SIZE = 8 * IOBuf::BRPC_DEFAULT_BLOCK_SIZE;
+
+    // The size of the whole output is read from the header of the compressed
+    // data which may be corrupted or malicious. Output larger than
+    // `max_flat_size' is decompressed block by block and copied into `buf'
+    // instead of being allocated as a whole. Pass an upper bound of valid
+    // output (e.g. derived from the compressed size) to avoid the copy.
+    explicit IOBufAsSnappySink(butil::IOBuf& buf,
+                               size_t max_flat_size = DEFAULT_MAX_FLAT_SIZE);
+    virtual ~IOBufAsSnappySink();
 
     // Append "bytes[0,n-1]" to this.
     void Append(const char* bytes, size_t n) override;
     
     // Returns a writable buffer of the specified length for appending.
     char* GetAppendBuffer(size_t length, char* scratch) override;
+
+    // Returns a flat buffer for the whole output of decompression which
+    // becomes a user-data block of the IOBuf in Append() without copying.
+    char* GetAppendBufferVariable(
+        size_t min_size, size_t desired_size_hint, char* scratch,
+        size_t scratch_size, size_t* allocated_size) override;
     
 private:
     char* _cur_buf;
     int _cur_len;
+    // Allocated by GetAppendBufferVariable(), owned by _buf after Append().
+    char* _user_buf;
+    size_t _max_flat_size;
     butil::IOBuf* _buf;
     butil::IOBufAsZeroCopyOutputStream _buf_stream;
 };
@@ -686,7 +714,18 @@ public:
     // E5-2620 @ 2.00GHz
     // Returns 0 on success, -1 otherwise.
     int push_back(char c);
-    
+
+    // Get the unused space at back side of the internal buffer, a new block
+    // is allocated when the space is exhausted. This is for producers(e.g.
+    // compressors) writing into the buffer directly rather than copying
+    // from their own buffers. Bytes written must be committed by commit()
+    // before calling other methods.
+    // Returns 0 on success, -1 otherwise.
+    int reserve(void** data, size_t* size);
+
+    // Commit first `n' bytes of the space returned by last reserve().
+    void commit(size_t n);
+
     IOBuf& buf() {
         shrink();
         return _buf;
@@ -313,6 +313,21 @@ inline int IOBufAppender::push_back(char c) {
     return 0;
 }
 
+inline int IOBufAppender::reserve(void** data, size_t* size) {
+    if (_data == _data_end) {
+        if (add_block() != 0) {
+            return -1;
+        }
+    }
+    *data = _data;
+    *size = (char*)_data_end - (char*)_data;
+    return 0;
+}
+
+inline void IOBufAppender::commit(size_t n) {
+    _data = (char*)_data + n;
+}
+
 inline int IOBufAppender::add_block() {
     int size = 0;
     if (_zc_stream.Next(&_data, &size)) {
@@ -0,0 +1,181 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>                                // sysconf
+#include "butil/build_config.h"
+#if defined(OS_LINUX)
+#include <sched.h>                                 // cpu_set_t
+#endif
+#include "butil/file_util.h"                       // ReadFileToString
+#include "butil/logging.h"
+#include "butil/memory/singleton_on_pthread_once.h"
+#include "butil/string_splitter.h"
+#include "butil/string_printf.h"
+#include "butil/strings/string_number_conversions.h"
+#include "butil/strings/string_util.h"
+#include "butil/thread_local.h"
+#include "butil/numa.h"
+
+namespace butil {
+
+namespace {
+
+struct NumaTopology {
+    NumaTopology();
+
+    // cpus of each node, never empty.
+    std::vector<std::vector<int> > node_cpus;
+    // node of each cpu.
+    std::vector<int> cpu_nodes;
+};
+
+NumaTopology::NumaTopology() {
+#if defined(OS_LINUX)
+    // IDs of online nodes are not necessarily continuous.
+    std::string online;
+    std::vector<int> node_ids;
+    if (ReadFileToString(FilePath("/sys/devices/system/node/online"), &online)
+        && parse_cpu_list(online, &node_ids) != 0) {
+        LOG(WARNING) << "Fail to parse online nodes: " << online;
+        node_ids.clear();
+    }
+    for (size_t i = 0; i < node_ids.size(); ++i) {
+        std::string content;
+        const std::string path = string_printf(
+            "/sys/devices/system/node/node%d/cpulist", node_ids[i]);
+        if (!ReadFileToString(FilePath(path), &content)) {
+            continue;
+        }
+        std::vector<int> cpus;
+        if (parse_cpu_list(content, &cpus) != 0) {
+            LOG(WARNING) << "Fail to parse " << path << ": " << content;
+            node_cpus.clear();
+            break;
+        }
+        // Skip memory-only nodes which no thread can be bound to.
+        if (!cpus.empty()) {
+            node_cpus.push_back(cpus);
+        }
+    }
+#endif
+    if (node_cpus.empty()) {
+        const long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        node_cpus.resize(1);
+        for (long i = 0; i < ncpu; ++i) {
+            node_cpus[0].push_back((int)i);
+        }
+    }
+    for (size_t node = 0; node < node_cpus.size(); ++node) {
+        const std::vector<int>& cpus = node_cpus[node];
+        for (size_t i = 0; i < cpus.size(); ++i) {
+            if ((size_t)cpus[i] >= cpu_nodes.size()) {
+                cpu_nodes.resize(cpus[i] + 1, 0);
+            }
+            cpu_nodes[cpus[i]] = (int)node;
+        }
+    }
+}
+
+const NumaTopology& topology() {
+    return *get_leaky_singleton<NumaTopology>();
+}
+
+BAIDU_THREAD_LOCAL int tls_numa_node = -1;
+
+}  // namespace
+
+int parse_cpu_list(const StringPiece& cpulist, std::vector<int>* cpus) {
+    cpus->clear();
+    for (StringMultiSplitter sp(cpulist.data(), cpulist.data() + cpulist.size(),
+                                ",\n"); sp; ++sp) {
+        StringPiece item(sp.field(), sp.length());
+        TrimWhitespaceASCII(item, TRIM_ALL, &item);
+        if (item.empty()) {
+            continue;
+        }
+        const size_t dash = item.find('-');
+        int first = 0;
+        int last = 0;
+        if (dash == StringPiece::npos) {
+            if (!StringToInt(item, &first)) {
+                return -1;
+            }
+            last = first;
+        } else if (!StringToInt(item.substr(0, dash), &first) ||
+                   !StringToInt(item.substr(dash + 1), &last)) {
+            return -1;
+        }
+        if (first < 0 || last < first) {
+            return -1;
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus->push_back(cpu);
+        }
+    }
+    return 0;
+}
+
+int numa_node_count() {
+    return (int)topology().node_cpus.size();
+}
+
+const std::vector<int>& numa_node_cpus(int node) {
+    static const std::vector<int> empty;
+    const NumaTopology& t = topology();
+    if (node < 0 || (size_t)node >= t.node_cpus.size()) {
+        return empty;
+    }
+    return t.node_cpus[node];
+}
+
+int numa_node_of_cpu(int cpu) {
+    const NumaTopology& t = topology();
+    if (cpu < 0 || (size_t)cpu >= t.cpu_nodes.size()) {
+        return 0;
+    }
+    return t.cpu_nodes[cpu];
+}
+
+int bind_thread_to_numa_node(int node) {
+    const std::vector<int>& cpus = numa_node_cpus(node);
+    if (cpus.empty()) {
+        return EINVAL;
+    }
+#if defined(OS_LINUX)
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        if (cpus[i] < CPU_SETSIZE) {
+            CPU_SET(cpus[i], &cs);
+        }
+    }
+    const int rc = pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+    if (rc != 0) {
+        return rc;
+    }
+#endif
+    tls_numa_node = node;
+    return 0;
+}
+
+int numa_thread_node() {
+    return tls_numa_node;
+}
+
+}  // namespace butil
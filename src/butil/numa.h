@@ -0,0 +1,57 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Minimal NUMA topology support read from sysfs, no libnuma is needed.
+
+#ifndef BUTIL_NUMA_H
+#define BUTIL_NUMA_H
+
+#include <vector>
+#include "butil/strings/string_piece.h"
+
+namespace butil {
+
+// Number of NUMA nodes with CPUs of this machine. Machines without NUMA (or
+// where the topology is not readable) are treated as a single node.
+// NOTE: nodes in this file are numbered from 0 to numa_node_count()-1 in
+// the order of IDs of the nodes, which differ from the IDs used by the
+// kernel when the IDs are not continuous or some nodes have no CPUs.
+int numa_node_count();
+
+// CPUs belonging to `node'. Node 0 of a non-NUMA machine contains all
+// online CPUs. Empty if `node' is out of range.
+const std::vector<int>& numa_node_cpus(int node);
+
+// Node of `cpu', 0 if unknown.
+int numa_node_of_cpu(int cpu);
+
+// Pin the calling thread to CPUs of `node' and remember the node so that
+// numa_thread_node() returns it afterwards.
+// Returns 0 on success, errno otherwise.
+int bind_thread_to_numa_node(int node);
+
+// Node that the calling thread was bound to by bind_thread_to_numa_node(),
+// -1 if the thread is not bound.
+int numa_thread_node();
+
+// Parse a cpulist in form of "0-3,8,10-11" into `cpus'.
+// Returns 0 on success, -1 otherwise.
+int parse_cpu_list(const StringPiece& cpulist, std::vector<int>* cpus);
+
+}  // namespace butil
+
+#endif  // BUTIL_NUMA_H
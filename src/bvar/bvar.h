@@ -26,10 +26,12 @@
 #define  BVAR_BVAR_H
 
 #include "bvar/reducer.h"
+#include "bvar/packed_reducer.h"
 #include "bvar/recorder.h"
 #include "bvar/status.h"
 #include "bvar/passive_status.h"
 #include "bvar/latency_histogram_recorder.h"
+#include "bvar/histogram.h"
 #include "bvar/gflag.h"
 #include "bvar/scoped_timer.h"
 #include "bvar/mvariable.h"
@@ -0,0 +1,205 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_DETAIL_PACKED_COMBINER_H
+#define  BVAR_DETAIL_PACKED_COMBINER_H
+
+#include <new>                           // placement new
+#include <vector>                        // std::vector
+#include <algorithm>                     // std::max
+#include "butil/atomicops.h"             // butil::atomic
+#include "butil/compiler_specific.h"     // BAIDU_CACHELINE_SIZE
+#include "butil/macros.h"                // DISALLOW_COPY_AND_ASSIGN
+#include "butil/synchronization/lock.h"  // butil::Lock
+#include "butil/containers/linked_list.h"// LinkNode
+#include "butil/memory/aligned_memory.h" // butil::AlignedAlloc
+#include "bvar/detail/agent_group.h"     // detail::AgentGroup
+#include "bvar/detail/call_op_returning_void.h"
+
+namespace bvar {
+namespace detail {
+
+// Like AgentCombiner, but each thread owns one cacheline-aligned array of
+// `n' values instead of one value per agent. Values updated together by a
+// thread share cachelines and the values of all threads are combined in a
+// single walk over the agents.
+// Only the owning thread modifies its array, so modifications are plain
+// load+store of relaxed atomics, no RMW instructions or locks are needed.
+// NOTE: values can't be reset, which would race with the owning thread.
+template <typename T, typename Op>
+class PackedCombiner {
+public:
+    typedef PackedCombiner<T, Op> self_type;
+
+    struct Agent : public butil::LinkNode<Agent> {
+        Agent() : combiner(NULL), values(NULL) {}
+
+        ~Agent() {
+            if (combiner) {
+                combiner->commit_and_erase(this);
+                combiner = NULL;
+            }
+            free_values();
+        }
+
+        void free_values() {
+            if (values) {
+                butil::AlignedFree(values);
+                values = NULL;
+            }
+        }
+
+        // Always called from the owning thread.
+        void modify(const Op& op, size_t index, const T& value) {
+            T v = values[index].load(butil::memory_order_relaxed);
+            call_op_returning_void(op, v, value);
+            values[index].store(v, butil::memory_order_relaxed);
+        }
+
+        self_type* combiner;
+        butil::atomic<T>* values;
+    };
+
+    typedef detail::AgentGroup<Agent> AgentGroup;
+
+    PackedCombiner(size_t n, const T& identity, const Op& op)
+        : _id(AgentGroup::create_new_agent())
+        , _n(n)
+        , _op(op)
+        , _identity(identity)
+        , _global_result(n, identity) {
+    }
+
+    ~PackedCombiner() {
+        if (_id >= 0) {
+            clear_all_agents();
+            AgentGroup::destroy_agent(_id);
+            _id = -1;
+        }
+    }
+
+    // [Threadsafe] Combine the index-th values of all threads.
+    T combine_agents(size_t index) const {
+        butil::AutoLock guard(_lock);
+        T ret = _global_result[index];
+        for (const butil::LinkNode<Agent>* node = _agents.head();
+             node != _agents.end(); node = node->next()) {
+            const T tmp = node->value()->values[index].load(
+                butil::memory_order_relaxed);
+            call_op_returning_void(_op, ret, tmp);
+        }
+        return ret;
+    }
+
+    // [Threadsafe] Combine all values of all threads, touching each array
+    // of threads once and sequentially.
+    void combine_agents(std::vector<T>* result) const {
+        butil::AutoLock guard(_lock);
+        *result = _global_result;
+        T* const out = result->empty() ? NULL : &(*result)[0];
+        for (const butil::LinkNode<Agent>* node = _agents.head();
+             node != _agents.end(); node = node->next()) {
+            const butil::atomic<T>* values = node->value()->values;
+            for (size_t i = 0; i < _n; ++i) {
+                const T tmp = values[i].load(butil::memory_order_relaxed);
+                call_op_returning_void(_op, out[i], tmp);
+            }
+        }
+    }
+
+    // Always called from the thread owning the agent.
+    void commit_and_erase(Agent* agent) {
+        butil::AutoLock guard(_lock);
+        for (size_t i = 0; i < _n; ++i) {
+            const T tmp = agent->values[i].load(butil::memory_order_relaxed);
+            call_op_returning_void(_op, _global_result[i], tmp);
+        }
+        agent->RemoveFromList();
+    }
+
+    // We need this function to be as fast as possible.
+    inline Agent* get_or_create_tls_agent() {
+        Agent* agent = AgentGroup::get_tls_agent(_id);
+        if (!agent) {
+            agent = AgentGroup::get_or_create_tls_agent(_id);
+            if (NULL == agent) {
+                LOG(FATAL) << "Fail to create agent";
+                return NULL;
+            }
+        }
+        if (agent->combiner) {
+            return agent;
+        }
+        // The agent may be reused from a destroyed combiner with the same id
+        // whose values have been freed in clear_all_agents().
+        const size_t size = std::max(_n, (size_t)1) * sizeof(butil::atomic<T>);
+        void* mem = butil::AlignedAlloc(
+            (size + BAIDU_CACHELINE_SIZE - 1) & ~(BAIDU_CACHELINE_SIZE - 1),
+            BAIDU_CACHELINE_SIZE);
+        if (NULL == mem) {
+            LOG(FATAL) << "Fail to allocate " << _n << " values";
+            return NULL;
+        }
+        agent->values = static_cast<butil::atomic<T>*>(mem);
+        for (size_t i = 0; i < _n; ++i) {
+            new (agent->values + i) butil::atomic<T>(_identity);
+        }
+        agent->combiner = this;
+        {
+            butil::AutoLock guard(_lock);
+            _agents.Append(agent);
+        }
+        return agent;
+    }
+
+    void clear_all_agents() {
+        butil::AutoLock guard(_lock);
+        // Release values of agents because the agent object may be reused
+        // by another combiner with a different size.
+        for (butil::LinkNode<Agent>*
+                 node = _agents.head(); node != _agents.end();) {
+            node->value()->combiner = NULL;
+            node->value()->free_values();
+            butil::LinkNode<Agent>* const saved_next = node->next();
+            node->RemoveFromList();
+            node = saved_next;
+        }
+    }
+
+    size_t size() const { return _n; }
+
+    const Op& op() const { return _op; }
+
+    bool valid() const { return _id >= 0; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(PackedCombiner);
+
+    AgentId                                     _id;
+    const size_t                                _n;
+    Op                                          _op;
+    const T                                     _identity;
+    mutable butil::Lock                         _lock;
+    // Values of exited threads.
+    std::vector<T>                              _global_result;
+    butil::LinkedList<Agent>                    _agents;
+};
+
+}  // namespace detail
+}  // namespace bvar
+
+#endif  // BVAR_DETAIL_PACKED_COMBINER_H
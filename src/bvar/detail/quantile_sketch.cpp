@@ -0,0 +1,240 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <inttypes.h>                   // PRIu64
+#include <math.h>                       // log pow ceil
+#include <algorithm>                    // std::min std::max
+#include <limits>                       // std::numeric_limits
+#include "butil/logging.h"
+#include "butil/string_printf.h"        // string_appendf
+#include "butil/string_splitter.h"      // StringSplitter
+#include "butil/strings/string_number_conversions.h"
+#include "bvar/detail/quantile_sketch.h"
+
+namespace bvar {
+namespace detail {
+
+const double QuantileSketch::RELATIVE_ACCURACY = 0.01;
+const size_t QuantileSketch::NUM_BINS;
+
+static const double GAMMA = (1 + QuantileSketch::RELATIVE_ACCURACY) /
+                            (1 - QuantileSketch::RELATIVE_ACCURACY);
+static const double INV_LOG_GAMMA = 1.0 / log(GAMMA);
+// Allocate some more bins when the range grows, to avoid growing again for
+// values slightly beyond the range.
+static const size_t EXTRA_BINS = 8;
+
+QuantileSketch::QuantileSketch()
+    : _count(0)
+    , _offset(0) {
+}
+
+// Bin 0 holds 0, bin i (i > 0) holds values in (gamma^(i-2), gamma^(i-1)].
+inline size_t QuantileSketch::index_of(int64_t x) {
+    if (x <= 0) {
+        return 0;
+    }
+    if (x > std::numeric_limits<uint32_t>::max()) {
+        x = std::numeric_limits<uint32_t>::max();
+    }
+    const size_t index = (size_t)ceil(log((double)x) * INV_LOG_GAMMA) + 1;
+    return index < NUM_BINS ? index : NUM_BINS - 1;
+}
+
+// The value whose relative distance to both bounds of the bin is
+// RELATIVE_ACCURACY.
+inline int64_t QuantileSketch::value_of(size_t index) {
+    if (index == 0) {
+        return 0;
+    }
+    return (int64_t)round(2 * pow(GAMMA, (double)(index - 1)) / (GAMMA + 1));
+}
+
+void QuantileSketch::extend(size_t lo, size_t hi) {
+    lo = (lo > EXTRA_BINS ? lo - EXTRA_BINS : 0);
+    hi = std::min(hi + EXTRA_BINS, NUM_BINS - 1);
+    if (_bins.empty()) {
+        _offset = lo;
+        _bins.resize(hi - lo + 1, 0);
+        return;
+    }
+    if (lo < _offset) {
+        _bins.insert(_bins.begin(), _offset - lo, 0);
+        _offset = lo;
+    }
+    if (hi >= _offset + _bins.size()) {
+        _bins.resize(hi - _offset + 1, 0);
+    }
+}
+
+void QuantileSketch::add(int64_t x) {
+    const size_t index = index_of(x);
+    // Also true when index < _offset since the subtraction wraps.
+    if (index - _offset >= _bins.size()) {
+        extend(index, index);
+    }
+    ++_bins[index - _offset];
+    ++_count;
+}
+
+void QuantileSketch::merge(const QuantileSketch& rhs) {
+    if (rhs._count == 0) {
+        return;
+    }
+    if (rhs._offset < _offset || _bins.empty() ||
+        rhs._offset + rhs._bins.size() > _offset + _bins.size()) {
+        extend(rhs._offset, rhs._offset + rhs._bins.size() - 1);
+    }
+    uint64_t* const bins = &_bins[rhs._offset - _offset];
+    for (size_t i = 0; i < rhs._bins.size(); ++i) {
+        bins[i] += rhs._bins[i];
+    }
+    _count += rhs._count;
+}
+
+int64_t QuantileSketch::get_number(double ratio) const {
+    uint64_t n = (uint64_t)ceil(ratio * _count);
+    if (n > _count) {
+        n = _count;
+    } else if (n == 0) {
+        return 0;
+    }
+    uint64_t sum = 0;
+    for (size_t i = 0; i < _bins.size(); ++i) {
+        sum += _bins[i];
+        if (sum >= n) {
+            return value_of(_offset + i);
+        }
+    }
+    CHECK(false) << "Can't reach here";
+    return value_of(_offset + _bins.size() - 1);
+}
+
+void QuantileSketch::clear() {
+    _count = 0;
+    _offset = 0;
+    _bins.clear();
+}
+
+void QuantileSketch::serialize(std::string* out) const {
+    out->clear();
+    for (size_t i = 0; i < _bins.size(); ++i) {
+        if (_bins[i] != 0) {
+            butil::string_appendf(out, "%s%zu:%" PRIu64,
+                                  (out->empty() ? "" : ","),
+                                  _offset + i, _bins[i]);
+        }
+    }
+}
+
+int QuantileSketch::parse(const butil::StringPiece& data) {
+    clear();
+    for (butil::StringSplitter sp(data.data(), data.data() + data.size(), ',');
+         sp; ++sp) {
+        const butil::StringPiece bin(sp.field(), sp.length());
+        const size_t colon = bin.find(':');
+        unsigned index = 0;
+        uint64_t count = 0;
+        if (colon == butil::StringPiece::npos ||
+            !butil::StringToUint(bin.substr(0, colon), &index) ||
+            !butil::StringToUint64(bin.substr(colon + 1), &count) ||
+            index >= NUM_BINS ||
+            count > std::numeric_limits<uint64_t>::max() - _count) {
+            clear();
+            return -1;
+        }
+        if (index - _offset >= _bins.size()) {
+            extend(index, index);
+        }
+        _bins[index - _offset] += count;
+        _count += count;
+    }
+    return 0;
+}
+
+void QuantileSketch::describe(std::ostream& os) const {
+    os << "{count=" << _count << " bins=[";
+    for (size_t i = 0; i < _bins.size(); ++i) {
+        if (_bins[i] != 0) {
+            os << ' ' << value_of(_offset + i) << ':' << _bins[i];
+        }
+    }
+    os << " ]}";
+}
+
+bool QuantileSketch::operator==(const QuantileSketch& rhs) const {
+    if (_count != rhs._count) {
+        return false;
+    }
+    // Allocated ranges of equal sketches may differ.
+    const size_t lo = std::min(_offset, rhs._offset);
+    const size_t hi = std::max(_offset + _bins.size(),
+                               rhs._offset + rhs._bins.size());
+    for (size_t i = lo; i < hi; ++i) {
+        if (bin(i) != rhs.bin(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+PercentileSketch::PercentileSketch() : _combiner(NULL), _sampler(NULL) {
+    _combiner = new combiner_type;
+}
+
+PercentileSketch::~PercentileSketch() {
+    // Have to destroy sampler first to avoid the race between destruction and
+    // sampler
+    if (_sampler != NULL) {
+        _sampler->destroy();
+        _sampler = NULL;
+    }
+    delete _combiner;
+}
+
+PercentileSketch::value_type PercentileSketch::reset() {
+    return _combiner->reset_all_agents();
+}
+
+PercentileSketch::value_type PercentileSketch::get_value() const {
+    return _combiner->combine_agents();
+}
+
+PercentileSketch& PercentileSketch::operator<<(int64_t latency) {
+    agent_type* agent = _combiner->get_or_create_tls_agent();
+    if (BAIDU_UNLIKELY(!agent)) {
+        LOG(FATAL) << "Fail to create agent";
+        return *this;
+    }
+    if (latency < 0) {
+        if (!_debug_name.empty()) {
+            LOG(WARNING) << "Input=" << latency << " to `" << _debug_name
+                       << "' is negative, drop";
+        } else {
+            LOG(WARNING) << "Input=" << latency << " to PercentileSketch("
+                       << (void*)this << ") is negative, drop";
+        }
+        return *this;
+    }
+    // Only the owning thread and resetting/combining of the combiner touch
+    // the element, recording is never blocked by other recording threads.
+    agent->element.modify(AddValue(), latency);
+    return *this;
+}
+
+}  // namespace detail
+}  // namespace bvar
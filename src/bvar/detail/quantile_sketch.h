@@ -0,0 +1,174 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_DETAIL_QUANTILE_SKETCH_H
+#define  BVAR_DETAIL_QUANTILE_SKETCH_H
+
+#include <stdint.h>                     // uint64_t
+#include <ostream>                      // std::ostream
+#include <string>                       // std::string
+#include <vector>                       // std::vector
+#include "butil/macros.h"               // DISALLOW_COPY_AND_ASSIGN
+#include "butil/strings/string_piece.h" // butil::StringPiece
+#include "bvar/reducer.h"               // VoidOp
+#include "bvar/window.h"                // Window
+#include "bvar/detail/combiner.h"       // AgentCombiner
+#include "bvar/detail/sampler.h"        // ReducerSampler
+
+namespace bvar {
+namespace detail {
+
+// Counting values in logarithmic bins (as DDSketch does), any quantile got
+// from the sketch is within RELATIVE_ACCURACY of the exact value. Unlike
+// PercentileSamples, no value is dropped, so merging sketches (of different
+// threads, seconds or even processes) is exact and tails like 99.99%-ile
+// are as accurate as the median.
+// Memory is bounded: values are clamped into [0, UINT32_MAX] like Percentile
+// and fall into NUM_BINS bins, of which only bins between the smallest and
+// the largest values are allocated, so sketches of threads or seconds
+// recording latencies in a narrow range are small.
+class QuantileSketch {
+public:
+    // Relative error of quantiles.
+    static const double RELATIVE_ACCURACY;
+    // One bin for 0 and ceil(log(UINT32_MAX) / log(gamma)) + 1 bins for
+    // positive values, where gamma = (1 + 0.01) / (1 - 0.01).
+    static const size_t NUM_BINS = 1111;
+
+    QuantileSketch();
+
+    // Add a value. Negative values are treated as 0.
+    void add(int64_t x);
+
+    // Add all values of another sketch.
+    void merge(const QuantileSketch& rhs);
+
+    // Get the `ratio'-ile value. E.g. 0.99 means 99%-ile value.
+    // Returns 0 when the sketch is empty.
+    int64_t get_number(double ratio) const;
+
+    // Number of values added.
+    uint64_t count() const { return _count; }
+
+    bool empty() const { return _count == 0; }
+
+    // Remove all values.
+    void clear();
+
+    // Serialize non-empty bins into `out' in form of "index:count,...",
+    // which can be parsed by parse() in other processes and merged.
+    void serialize(std::string* out) const;
+
+    // Replace content of this sketch with the output of serialize().
+    // Returns 0 on success, -1 otherwise.
+    int parse(const butil::StringPiece& data);
+
+    // For debugging.
+    void describe(std::ostream& os) const;
+
+    bool operator==(const QuantileSketch& rhs) const;
+
+private:
+    static size_t index_of(int64_t x);
+    static int64_t value_of(size_t index);
+
+    // Make bins in [lo, hi] allocated.
+    void extend(size_t lo, size_t hi);
+
+    // Count of the index-th bin, 0 if it's not allocated.
+    uint64_t bin(size_t index) const {
+        return index - _offset < _bins.size() ? _bins[index - _offset] : 0;
+    }
+
+    uint64_t _count;
+    // Counts of bins in [_offset, _offset + _bins.size()). 64-bit counters
+    // don't overflow when sketches of many seconds or processes are merged.
+    size_t _offset;
+    std::vector<uint64_t> _bins;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const QuantileSketch& s) {
+    s.describe(os);
+    return os;
+}
+
+// A specialized reducer recording latencies into QuantileSketch.
+// NOTE: DON'T use it directly, use LatencyRecorder with
+// -bvar_latency_use_sketch instead.
+class PercentileSketch {
+public:
+    struct AddSketch {
+        void operator()(QuantileSketch& s1, const QuantileSketch& s2) const {
+            s1.merge(s2);
+        }
+    };
+    struct AddValue {
+        void operator()(QuantileSketch& s, int64_t x) const {
+            s.add(x);
+        }
+    };
+
+    typedef QuantileSketch                                  value_type;
+    typedef ReducerSampler<PercentileSketch,
+                           QuantileSketch,
+                           AddSketch, VoidOp>               sampler_type;
+    typedef AgentCombiner <QuantileSketch,
+                           QuantileSketch,
+                           AddSketch>                       combiner_type;
+    typedef combiner_type::Agent                            agent_type;
+    PercentileSketch();
+    ~PercentileSketch();
+
+    AddSketch op() const { return AddSketch(); }
+    VoidOp inv_op() const { return VoidOp(); }
+
+    // The sampler for windows over the sketch.
+    sampler_type* get_sampler() {
+        if (NULL == _sampler) {
+            _sampler = new sampler_type(this);
+            _sampler->schedule();
+        }
+        return _sampler;
+    }
+
+    value_type reset();
+
+    value_type get_value() const;
+
+    PercentileSketch& operator<<(int64_t latency);
+
+    bool valid() const { return _combiner != NULL && _combiner->valid(); }
+
+    // This name is useful for warning negative latencies in operator<<
+    void set_debug_name(const butil::StringPiece& name) {
+        _debug_name.assign(name.data(), name.size());
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(PercentileSketch);
+
+    combiner_type*          _combiner;
+    sampler_type*           _sampler;
+    std::string _debug_name;
+};
+
+typedef Window<PercentileSketch, SERIES_IN_SECOND> PercentileSketchWindow;
+
+}  // namespace detail
+}  // namespace bvar
+
+#endif  //BVAR_DETAIL_QUANTILE_SKETCH_H
@@ -23,7 +23,12 @@
 // Date: Tue Jul 28 18:14:40 CST 2015
 
 #include <gflags/gflags.h>
+#include <mutex>                        // std::unique_lock
+#include <typeinfo>                     // std::type_info
+#include <vector>
 #include "butil/time.h"
+#include "butil/atomicops.h"
+#include "butil/class_name.h"           // demangle
 #include "butil/memory/singleton_on_pthread_once.h"
 #include "bvar/reducer.h"
 #include "bvar/detail/sampler.h"
@@ -53,6 +58,46 @@ struct CombineSampler {
 // of child as well, no need to register in the child again.
 static bool registered_atfork = false;
 
+DEFINE_int32(bvar_sampler_thread_num, 1, "Number of threads sampling "
+             "windowed bvars, increase it when sampling takes a large "
+             "fraction of a second. Can only be increased at runtime");
+
+static const int MAX_SAMPLER_THREAD_NUM = 32;
+
+static bool validate_bvar_sampler_thread_num(const char*, int32_t v) {
+    return v >= 1 && v <= MAX_SAMPLER_THREAD_NUM;
+}
+const bool ALLOW_UNUSED dummy_bvar_sampler_thread_num =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_bvar_sampler_thread_num,
+                                       validate_bvar_sampler_thread_num);
+
+// Samplers sampled by one thread. They're stored in an array rather than the
+// linked list so that walking through them is cache-friendly.
+struct SamplerShard {
+    SamplerShard() : nsampler(0), cost_ns(0), lag_us(0), cumulated_time_us(0)
+                   , slowest_ns(0), slowest_type(NULL)
+                   , created(false), tid(0) {}
+
+    std::vector<Sampler*> samplers;
+    // Samplers assigned to this shard and not sampled yet, protected by the
+    // mutex of SamplerCollector.
+    std::vector<Sampler*> incoming;
+    // Size of `samplers' after last round, which is modified by the thread
+    // sampling this shard and can't be read by other threads.
+    butil::atomic<int64_t> nsampler;
+    // Time spent on take_sample() of all samplers in last round.
+    butil::atomic<int64_t> cost_ns;
+    // Microseconds between the scheduled time of last round and the end of
+    // sampling in this shard.
+    butil::atomic<int64_t> lag_us;
+    butil::atomic<int64_t> cumulated_time_us;
+    // The most expensive sampler in last round, for warning.
+    int64_t slowest_ns;
+    const std::type_info* slowest_type;
+    bool created;
+    pthread_t tid;
+};
+
 // Call take_sample() of all scheduled samplers.
 // This can be done with regular timer thread, but it's way too slow(global
 // contention + log(N) heap manipulations). We need it to be super fast so that
@@ -61,23 +106,40 @@ static bool registered_atfork = false;
 // doubly linked, thus we can reduce multiple Samplers into one cicurlarly
 // doubly linked list, and multiple lists into larger lists. We create a
 // dedicated thread to periodically get_value() which is just the combined
-// list of Samplers. Waking through the list and call take_sample().
+// list of Samplers, and distribute them to shards sampled by a small pool of
+// threads (-bvar_sampler_thread_num) every second. New samplers go to the
+// shard which costs least.
 // If a Sampler needs to be deleted, we just mark it as unused and the
-// deletion is taken place in the thread as well.
+// deletion is taken place in the sampling threads as well.
 class SamplerCollector : public bvar::Reducer<Sampler*, CombineSampler> {
 public:
     SamplerCollector()
         : _created(false)
         , _stop(false)
-        , _cumulated_time_us(0) {
+        , _nshard(1)
+        , _round(0)
+        , _round_start_us(0) {
+        pthread_mutex_init(&_mutex, NULL);
+        pthread_cond_init(&_cond, NULL);
         create_sampling_thread();
     }
     ~SamplerCollector() {
         if (_created) {
-            _stop = true;
+            {
+                BAIDU_SCOPED_LOCK(_mutex);
+                _stop = true;
+                pthread_cond_broadcast(&_cond);
+            }
             pthread_join(_tid, NULL);
+            for (int i = 1; i < _nshard; ++i) {
+                if (_shards[i].created) {
+                    pthread_join(_shards[i].tid, NULL);
+                }
+            }
             _created = false;
         }
+        pthread_cond_destroy(&_cond);
+        pthread_mutex_destroy(&_mutex);
     }
 
 private:
@@ -85,7 +147,7 @@ private:
     // * The singleton can be null before forking, the child callback will not
     //   be registered.
     // * If the singleton is not null before forking, the child callback will
-    //   be registered and the sampling thread will be re-created.
+    //   be registered and the sampling threads will be re-created.
     // * A forked program can be forked again.
 
     static void child_callback_atfork() {
@@ -106,35 +168,206 @@ private:
     }
 
     void after_forked_as_child() {
+        // Threads other than the forking one do not exist in the child.
+        pthread_mutex_init(&_mutex, NULL);
+        pthread_cond_init(&_cond, NULL);
+        // Sample all samplers in the forking thread until new threads are
+        // created.
+        for (int i = 1; i < _nshard; ++i) {
+            SamplerShard& shard = _shards[i];
+            std::vector<Sampler*>& incoming = _shards[0].incoming;
+            incoming.insert(incoming.end(), shard.samplers.begin(),
+                            shard.samplers.end());
+            incoming.insert(incoming.end(), shard.incoming.begin(),
+                            shard.incoming.end());
+            shard.samplers.clear();
+            shard.incoming.clear();
+            shard.created = false;
+        }
+        _nshard = 1;
         _created = false;
         create_sampling_thread();
     }
 
     void run();
+    void run_shard(int index);
+    void add_shards(int nshard);
+    void distribute(Sampler* list);
+    void sample_shard(SamplerShard* shard, int64_t round_start_us);
 
     static void* sampling_thread(void* arg) {
         static_cast<SamplerCollector*>(arg)->run();
         return NULL;
     }
 
+    struct ShardArg {
+        SamplerCollector* collector;
+        int index;
+    };
+
+    static void* shard_thread(void* arg) {
+        ShardArg* a = static_cast<ShardArg*>(arg);
+        a->collector->run_shard(a->index);
+        delete a;
+        return NULL;
+    }
+
     static double get_cumulated_time(void* arg) {
-        return static_cast<SamplerCollector*>(arg)->_cumulated_time_us / 1000.0 / 1000.0;
+        SamplerCollector* c = static_cast<SamplerCollector*>(arg);
+        int64_t sum = 0;
+        for (int i = 0; i < c->_nshard; ++i) {
+            sum += c->_shards[i].cumulated_time_us.load(butil::memory_order_relaxed);
+        }
+        return sum / 1000.0 / 1000.0;
+    }
+
+    static int64_t get_lag_us(void* arg) {
+        SamplerCollector* c = static_cast<SamplerCollector*>(arg);
+        int64_t max_lag = 0;
+        for (int i = 0; i < c->_nshard; ++i) {
+            max_lag = std::max(
+                max_lag, c->_shards[i].lag_us.load(butil::memory_order_relaxed));
+        }
+        return max_lag;
     }
 
 private:
     bool _created;
     bool _stop;
-    int64_t _cumulated_time_us;
     pthread_t _tid;
+    // Only increases, shards are never destroyed.
+    int _nshard;
+    SamplerShard _shards[MAX_SAMPLER_THREAD_NUM];
+    // Protecting `incoming' of shards, _round and _round_start_us.
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+    int64_t _round;
+    int64_t _round_start_us;
 };
 
 #ifndef UNIT_TEST
 static PassiveStatus<double>* s_cumulated_time_bvar = NULL;
 static bvar::PerSecond<bvar::PassiveStatus<double> >* s_sampling_thread_usage_bvar = NULL;
+static PassiveStatus<int64_t>* s_sampler_lag_bvar = NULL;
 #endif
 
 DEFINE_int32(bvar_sampler_thread_start_delay_us, 10000, "bvar sampler thread start delay us");
 
+void SamplerCollector::add_shards(int nshard) {
+    for (int i = _nshard; i < nshard; ++i) {
+        ShardArg* arg = new ShardArg;
+        arg->collector = this;
+        arg->index = i;
+        const int rc = pthread_create(&_shards[i].tid, NULL, shard_thread, arg);
+        if (rc != 0) {
+            LOG(ERROR) << "Fail to create sampling thread, " << berror(rc);
+            delete arg;
+            return;
+        }
+        _shards[i].created = true;
+        // Visible to the collector after the thread is created.
+        BAIDU_SCOPED_LOCK(_mutex);
+        _nshard = i + 1;
+    }
+}
+
+void SamplerCollector::distribute(Sampler* list) {
+    butil::LinkNode<Sampler> root;
+    list->InsertBeforeAsList(&root);
+    // Estimate costs of shards with costs of last round.
+    int64_t costs[MAX_SAMPLER_THREAD_NUM];
+    int64_t total_cost = 0;
+    int64_t total_num = 0;
+    for (int i = 0; i < _nshard; ++i) {
+        costs[i] = _shards[i].cost_ns.load(butil::memory_order_relaxed);
+        total_cost += costs[i];
+        total_num += _shards[i].nsampler.load(butil::memory_order_relaxed);
+    }
+    const int64_t avg_cost =
+        std::max<int64_t>(total_num ? total_cost / total_num : 0, 1);
+    BAIDU_SCOPED_LOCK(_mutex);
+    while (root.next() != &root) {
+        butil::LinkNode<Sampler>* p = root.next();
+        p->RemoveFromList();
+        int best = 0;
+        for (int i = 1; i < _nshard; ++i) {
+            if (costs[i] < costs[best]) {
+                best = i;
+            }
+        }
+        costs[best] += avg_cost;
+        _shards[best].incoming.push_back(p->value());
+    }
+}
+
+void SamplerCollector::sample_shard(SamplerShard* shard, int64_t round_start_us) {
+    const int64_t begin_us = butil::gettimeofday_us();
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        shard->samplers.insert(shard->samplers.end(),
+                               shard->incoming.begin(), shard->incoming.end());
+        shard->incoming.clear();
+    }
+    std::vector<Sampler*>& samplers = shard->samplers;
+    int64_t cost_ns = 0;
+    int64_t slowest_ns = 0;
+    const std::type_info* slowest_type = NULL;
+    for (size_t i = 0; i < samplers.size();) {
+        if (i + 1 < samplers.size()) {
+            __builtin_prefetch(samplers[i + 1]);
+        }
+        Sampler* s = samplers[i];
+        s->_mutex.lock();
+        if (!s->_used) {
+            s->_mutex.unlock();
+            delete s;
+            // Order of samplers does not matter.
+            samplers[i] = samplers.back();
+            samplers.pop_back();
+            continue;
+        }
+        const int64_t t0 = butil::cpuwide_time_ns();
+        s->take_sample();
+        const int64_t t = butil::cpuwide_time_ns() - t0;
+        s->_mutex.unlock();
+        cost_ns += t;
+        if (t > slowest_ns) {
+            slowest_ns = t;
+            slowest_type = &typeid(*s);
+        }
+        ++i;
+    }
+    const int64_t end_us = butil::gettimeofday_us();
+    shard->nsampler.store(samplers.size(), butil::memory_order_relaxed);
+    shard->cost_ns.store(cost_ns, butil::memory_order_relaxed);
+    shard->slowest_ns = slowest_ns;
+    shard->slowest_type = slowest_type;
+    shard->lag_us.store(end_us - round_start_us, butil::memory_order_relaxed);
+    shard->cumulated_time_us.fetch_add(end_us - begin_us,
+                                       butil::memory_order_relaxed);
+}
+
+void SamplerCollector::run_shard(int index) {
+    int64_t last_round = 0;
+    while (true) {
+        int64_t round_start_us = 0;
+        {
+            std::unique_lock<pthread_mutex_t> mu(_mutex);
+            while (_round == last_round && !_stop) {
+                pthread_cond_wait(&_cond, &_mutex);
+            }
+            if (_stop) {
+                return;
+            }
+            // Rounds missed when sampling is slower than the interval are
+            // skipped.
+            last_round = _round;
+            round_start_us = _round_start_us;
+        }
+        sample_shard(&_shards[index], round_start_us);
+    }
+}
+
 void SamplerCollector::run() {
     ::usleep(FLAGS_bvar_sampler_thread_start_delay_us);
     
@@ -153,38 +386,31 @@ void SamplerCollector::run() {
             new bvar::PerSecond<bvar::PassiveStatus<double> >(
                     "bvar_sampler_collector_usage", s_cumulated_time_bvar, 10);
     }
+    if (s_sampler_lag_bvar == NULL) {
+        s_sampler_lag_bvar = new PassiveStatus<int64_t>(
+            "bvar_sampler_lag_us", get_lag_us, this);
+    }
 #endif
 
-    butil::LinkNode<Sampler> root;
     int consecutive_nosleep = 0;
     while (!_stop) {
         int64_t abstime = butil::gettimeofday_us();
+        if (FLAGS_bvar_sampler_thread_num > _nshard) {
+            add_shards(FLAGS_bvar_sampler_thread_num);
+        }
         Sampler* s = this->reset();
         if (s) {
-            s->InsertBeforeAsList(&root);
-        }
-        int nremoved = 0;
-        int nsampled = 0;
-        for (butil::LinkNode<Sampler>* p = root.next(); p != &root;) {
-            // We may remove p from the list, save next first.
-            butil::LinkNode<Sampler>* saved_next = p->next();
-            Sampler* s = p->value();
-            s->_mutex.lock();
-            if (!s->_used) {
-                s->_mutex.unlock();
-                p->RemoveFromList();
-                delete s;
-                ++nremoved;
-            } else {
-                s->take_sample();
-                s->_mutex.unlock();
-                ++nsampled;
-            }
-            p = saved_next;
+            distribute(s);
+        }
+        if (_nshard > 1) {
+            BAIDU_SCOPED_LOCK(_mutex);
+            ++_round;
+            _round_start_us = abstime;
+            pthread_cond_broadcast(&_cond);
         }
+        sample_shard(&_shards[0], abstime);
         bool slept = false;
         int64_t now = butil::gettimeofday_us();
-        _cumulated_time_us += now - abstime;
         abstime += 1000000L;
         while (abstime > now) {
             ::usleep(abstime - now);
@@ -196,8 +422,17 @@ void SamplerCollector::run() {
         } else {            
             if (++consecutive_nosleep >= WARN_NOSLEEP_THRESHOLD) {
                 consecutive_nosleep = 0;
+                const SamplerShard& shard = _shards[0];
                 LOG(WARNING) << "bvar is busy at sampling for "
-                             << WARN_NOSLEEP_THRESHOLD << " seconds!";
+                             << WARN_NOSLEEP_THRESHOLD << " seconds! "
+                             << shard.nsampler.load(butil::memory_order_relaxed)
+                             << " samplers cost "
+                             << shard.cost_ns.load(butil::memory_order_relaxed) / 1000
+                             << "us, the slowest one is "
+                             << (shard.slowest_type ?
+                                 butil::demangle(shard.slowest_type->name()) : "")
+                             << " which costs " << shard.slowest_ns / 1000
+                             << "us, consider increasing -bvar_sampler_thread_num";
             }
         }
     }
@@ -46,8 +46,9 @@ class Sampler : public butil::LinkNode<Sampler> {
 public:
     Sampler();
         
-    // This function will be called every second(approximately) in a
-    // dedicated thread if schedule() is called.
+    // This function will be called every second(approximately) in one of
+    // the sampling threads (-bvar_sampler_thread_num) if schedule() is
+    // called.
     virtual void take_sample() = 0;
 
     // Register this sampler globally so that take_sample() will be called
@@ -0,0 +1,278 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <math.h>                       // ceil
+#include <string.h>                     // strlen
+#include <algorithm>                    // std::min
+#include <limits>                       // std::numeric_limits
+#include "butil/logging.h"
+#include "butil/string_splitter.h"      // StringSplitter
+#include "butil/strings/string_number_conversions.h"
+#include "bvar/histogram.h"
+
+namespace bvar {
+
+// Upper bounds larger than this may overflow.
+static const int64_t MAX_HISTOGRAM_VALUE = (int64_t)1 << 60;
+static const int MAX_PRECISION_BITS = 10;
+
+HistogramBuckets::HistogramBuckets() {
+    init(1, (int64_t)1 << 30, 3);
+}
+
+HistogramBuckets::HistogramBuckets(int64_t resolution, int64_t max_value,
+                                   int precision_bits) {
+    init(resolution, max_value, precision_bits);
+}
+
+void HistogramBuckets::init(int64_t resolution, int64_t max_value,
+                            int precision_bits) {
+    _unit_bits = 0;
+    while (_unit_bits < 60 && ((int64_t)2 << _unit_bits) <= resolution) {
+        ++_unit_bits;
+    }
+    _precision_bits = std::max(0, std::min(precision_bits, MAX_PRECISION_BITS));
+    _max_value = std::max(std::min(max_value, MAX_HISTOGRAM_VALUE),
+                          (int64_t)1 << _unit_bits);
+    // The bucket containing max_value and the bucket of +Inf.
+    _size = std::numeric_limits<size_t>::max();
+    _size = index_of(_max_value) + 2;
+}
+
+int64_t HistogramBuckets::upper_bound(size_t index) const {
+    if (index + 1 >= _size) {
+        return std::numeric_limits<int64_t>::max();
+    }
+    if ((index >> _precision_bits) == 0) {
+        return (int64_t)(index + 1) << _unit_bits;
+    }
+    // Inverse of index_of(): index = e * 2^precision_bits + m where m is in
+    // [2^precision_bits, 2^(precision_bits+1)).
+    const int e = (int)(index >> _precision_bits) - 1;
+    const size_t m = index - ((size_t)e << _precision_bits);
+    return (int64_t)(m + 1) << (e + _unit_bits);
+}
+
+int64_t HistogramSnapshot::count() const {
+    int64_t n = 0;
+    for (size_t i = 0; i < _counts.size(); ++i) {
+        n += _counts[i];
+    }
+    return n;
+}
+
+int64_t HistogramSnapshot::get_number(double ratio) const {
+    const int64_t total = count();
+    int64_t n = (int64_t)ceil(ratio * total);
+    if (n > total) {
+        n = total;
+    } else if (n <= 0) {
+        return 0;
+    }
+    int64_t sum = 0;
+    for (size_t i = 0; i < _counts.size(); ++i) {
+        sum += _counts[i];
+        if (sum >= n) {
+            // The last bucket has no upper bound, use max_value instead.
+            return std::min(_buckets.upper_bound(i), _buckets.max_value());
+        }
+    }
+    return 0;
+}
+
+HistogramSnapshot& HistogramSnapshot::operator+=(const HistogramSnapshot& rhs) {
+    if (rhs._counts.empty()) {
+        return *this;
+    }
+    if (_counts.empty()) {
+        *this = rhs;
+        return *this;
+    }
+    if (_buckets != rhs._buckets) {
+        LOG(ERROR) << "Fail to merge histograms with different buckets";
+        return *this;
+    }
+    for (size_t i = 0; i < _counts.size(); ++i) {
+        _counts[i] += rhs._counts[i];
+    }
+    _sum += rhs._sum;
+    return *this;
+}
+
+HistogramSnapshot& HistogramSnapshot::operator-=(const HistogramSnapshot& rhs) {
+    if (rhs._counts.empty()) {
+        return *this;
+    }
+    if (_counts.empty()) {
+        _buckets = rhs._buckets;
+        _counts.assign(rhs._counts.size(), 0);
+    } else if (_buckets != rhs._buckets) {
+        LOG(ERROR) << "Fail to merge histograms with different buckets";
+        return *this;
+    }
+    for (size_t i = 0; i < _counts.size(); ++i) {
+        _counts[i] -= rhs._counts[i];
+    }
+    _sum -= rhs._sum;
+    return *this;
+}
+
+void HistogramSnapshot::describe(std::ostream& os) const {
+    os << "{count=" << count() << " sum=" << _sum
+       << " resolution=" << _buckets.resolution()
+       << " max=" << _buckets.max_value()
+       << " precision=" << _buckets.precision_bits() << " buckets=[";
+    bool first = true;
+    for (size_t i = 0; i < _counts.size(); ++i) {
+        if (_counts[i] == 0) {
+            continue;
+        }
+        if (!first) {
+            os << ' ';
+        }
+        first = false;
+        if (i + 1 == _counts.size()) {
+            os << "+Inf";
+        } else {
+            os << _buckets.upper_bound(i);
+        }
+        os << ':' << _counts[i];
+    }
+    os << "]}";
+}
+
+// Get the integer after `key=' in `str'.
+static bool get_field(const butil::StringPiece& str, const char* key,
+                      int64_t* value) {
+    const size_t pos = str.find(key);
+    if (pos == butil::StringPiece::npos) {
+        return false;
+    }
+    const size_t begin = pos + strlen(key);
+    const size_t end = str.find_first_of(" ]}", begin);
+    if (end == butil::StringPiece::npos) {
+        return false;
+    }
+    return butil::StringToInt64(str.substr(begin, end - begin), value);
+}
+
+int HistogramSnapshot::parse(const butil::StringPiece& str) {
+    *this = HistogramSnapshot();
+    int64_t count = 0;
+    int64_t sum = 0;
+    int64_t resolution = 0;
+    int64_t max_value = 0;
+    int64_t precision = 0;
+    if (!str.starts_with("{count=") || !str.ends_with("]}") ||
+        !get_field(str, "{count=", &count) ||
+        !get_field(str, " sum=", &sum) ||
+        !get_field(str, " resolution=", &resolution) ||
+        !get_field(str, " max=", &max_value) ||
+        !get_field(str, " precision=", &precision)) {
+        return -1;
+    }
+    const size_t bracket = str.find(" buckets=[");
+    if (bracket == butil::StringPiece::npos) {
+        return -1;
+    }
+    HistogramSnapshot tmp(HistogramBuckets(resolution, max_value, precision));
+    tmp._sum = sum;
+    const butil::StringPiece list =
+        str.substr(bracket + 10, str.size() - bracket - 12);
+    for (butil::StringSplitter sp(list.data(), list.data() + list.size(), ' ');
+         sp; ++sp) {
+        const butil::StringPiece bucket(sp.field(), sp.length());
+        const size_t colon = bucket.find(':');
+        int64_t upper_bound = 0;
+        int64_t n = 0;
+        if (colon == butil::StringPiece::npos ||
+            !butil::StringToInt64(bucket.substr(colon + 1), &n)) {
+            return -1;
+        }
+        size_t index = tmp._counts.size() - 1;
+        if (bucket.substr(0, colon) != "+Inf") {
+            if (!butil::StringToInt64(bucket.substr(0, colon), &upper_bound)) {
+                return -1;
+            }
+            index = tmp._buckets.index_of(upper_bound);
+            if (tmp._buckets.upper_bound(index) != upper_bound) {
+                return -1;
+            }
+        }
+        tmp._counts[index] += n;
+    }
+    if (tmp.count() != count) {
+        return -1;
+    }
+    *this = tmp;
+    return 0;
+}
+
+Histogram::Histogram(const HistogramBuckets& buckets)
+    : _buckets(buckets)
+    , _combiner(buckets.size() + 1, 0, detail::AddTo<int64_t>())
+    , _sampler(NULL) {
+}
+
+Histogram::Histogram(const butil::StringPiece& name,
+                     const HistogramBuckets& buckets)
+    : _buckets(buckets)
+    , _combiner(buckets.size() + 1, 0, detail::AddTo<int64_t>())
+    , _sampler(NULL) {
+    expose(name);
+}
+
+Histogram::Histogram(const butil::StringPiece& prefix,
+                     const butil::StringPiece& name,
+                     const HistogramBuckets& buckets)
+    : _buckets(buckets)
+    , _combiner(buckets.size() + 1, 0, detail::AddTo<int64_t>())
+    , _sampler(NULL) {
+    expose_as(prefix, name);
+}
+
+Histogram::~Histogram() {
+    // Calling hide() manually is a MUST required by Variable.
+    hide();
+    if (_sampler) {
+        _sampler->destroy();
+        _sampler = NULL;
+    }
+}
+
+HistogramSnapshot Histogram::get_value() const {
+    HistogramSnapshot s;
+    s._buckets = _buckets;
+    _combiner.combine_agents(&s._counts);
+    s._sum = s._counts.back();
+    s._counts.pop_back();
+    return s;
+}
+
+void Histogram::describe(std::ostream& os, bool /*quote_string*/) const {
+    get_value().describe(os);
+}
+
+Histogram::sampler_type* Histogram::get_sampler() {
+    if (NULL == _sampler) {
+        _sampler = new sampler_type(this);
+        _sampler->schedule();
+    }
+    return _sampler;
+}
+
+}  // namespace bvar
@@ -0,0 +1,233 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_HISTOGRAM_H
+#define  BVAR_HISTOGRAM_H
+
+#include <stdint.h>                        // int64_t
+#include <ostream>                         // std::ostream
+#include <vector>                          // std::vector
+#include "butil/macros.h"                  // DISALLOW_COPY_AND_ASSIGN
+#include "butil/strings/string_piece.h"    // butil::StringPiece
+#include "bvar/variable.h"                 // Variable
+#include "bvar/reducer.h"                  // detail::AddTo
+#include "bvar/window.h"                   // Window
+#include "bvar/detail/sampler.h"           // detail::ReducerSampler
+#include "bvar/detail/packed_combiner.h"   // detail::PackedCombiner
+
+namespace bvar {
+
+// Log-linear (HDR-style) layout of buckets: every range of [2^k, 2^(k+1))
+// is split into 2^precision_bits buckets of equal width, so that the
+// relative width of a bucket is at most 2^-precision_bits, while values
+// less than resolution * 2^precision_bits are in buckets of `resolution'.
+// A bucket contains values in (previous upper bound, upper bound], values
+// not greater than `resolution' are in the first bucket and values greater
+// than `max_value' are in the last bucket whose upper bound is +Inf.
+//
+// Example: buckets for latencies in [200us, 2s] with 12.5% relative width:
+//   bvar::HistogramBuckets(16/*resolution*/, 2000000/*max_value*/, 3);
+// makes 121 buckets: 16, 32, ..., 128, 144, 160, ..., 1966080, 2097152, +Inf
+class HistogramBuckets {
+public:
+    // 1, 2^30, 3
+    HistogramBuckets();
+    // `resolution' is rounded down to a power of 2, `precision_bits' is
+    // limited in [0, 10].
+    HistogramBuckets(int64_t resolution, int64_t max_value, int precision_bits);
+
+    // Number of buckets including the last one.
+    size_t size() const { return _size; }
+
+    // Index of the bucket containing `value'.
+    size_t index_of(int64_t value) const {
+        if (value <= 0) {
+            return 0;
+        }
+        const uint64_t x = (uint64_t)(value - 1) >> _unit_bits;
+        size_t index = x;
+        if (x >> _precision_bits) {
+            const int e = 63 - __builtin_clzll(x) - _precision_bits;
+            index = ((size_t)e << _precision_bits) + (x >> e);
+        }
+        return index < _size ? index : _size - 1;
+    }
+
+    // Inclusive upper bound of the bucket at `index', INT64_MAX for the last.
+    int64_t upper_bound(size_t index) const;
+
+    int64_t resolution() const { return (int64_t)1 << _unit_bits; }
+    int64_t max_value() const { return _max_value; }
+    int precision_bits() const { return _precision_bits; }
+
+    bool operator==(const HistogramBuckets& rhs) const {
+        return _unit_bits == rhs._unit_bits &&
+            _precision_bits == rhs._precision_bits &&
+            _max_value == rhs._max_value;
+    }
+    bool operator!=(const HistogramBuckets& rhs) const {
+        return !operator==(rhs);
+    }
+
+private:
+    void init(int64_t resolution, int64_t max_value, int precision_bits);
+
+    int _unit_bits;
+    int _precision_bits;
+    int64_t _max_value;
+    size_t _size;
+};
+
+// Counts of buckets, the value of Histogram and Window<Histogram>.
+class HistogramSnapshot {
+public:
+    HistogramSnapshot() : _sum(0) {}
+    explicit HistogramSnapshot(const HistogramBuckets& buckets)
+        : _buckets(buckets), _counts(buckets.size(), 0), _sum(0) {}
+
+    const HistogramBuckets& buckets() const { return _buckets; }
+
+    // Number of values in the bucket at `index'.
+    int64_t count(size_t index) const {
+        return index < _counts.size() ? _counts[index] : 0;
+    }
+    // Number of all values.
+    int64_t count() const;
+    // Sum of all values.
+    int64_t sum() const { return _sum; }
+
+    // Get the `ratio'-ile value (e.g. 0.99 means 99%-ile) as the upper bound
+    // of the bucket. Returns 0 when the snapshot is empty.
+    int64_t get_number(double ratio) const;
+
+    // Add a value.
+    void add(int64_t value) {
+        ++_counts[_buckets.index_of(value)];
+        _sum += value;
+    }
+
+    // Counts of snapshots with different buckets can't be merged, the
+    // right-hand side is ignored and an error is logged.
+    HistogramSnapshot& operator+=(const HistogramSnapshot& rhs);
+    HistogramSnapshot& operator-=(const HistogramSnapshot& rhs);
+
+    // Print as
+    //   {count=12 sum=3456 resolution=16 max=2000000 precision=3
+    //    buckets=[160:3 176:9]}
+    // where only non-empty buckets are listed with their upper bounds.
+    void describe(std::ostream& os) const;
+
+    // Replace content of this snapshot with the output of describe().
+    // Returns 0 on success, -1 otherwise.
+    int parse(const butil::StringPiece& str);
+
+private:
+friend class Histogram;
+    HistogramBuckets _buckets;
+    std::vector<int64_t> _counts;
+    int64_t _sum;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const HistogramSnapshot& s) {
+    s.describe(os);
+    return os;
+}
+
+namespace detail {
+// Snapshots are not plotted.
+template <> struct NoSeries<HistogramSnapshot> : public butil::true_type {};
+}  // namespace detail
+
+// Count values in log-linear buckets. Values are recorded into thread-local
+// buckets without locking, and all buckets are combined in one pass.
+// Exposed histograms are dumped as histograms by /brpc_metrics.
+//
+// bvar::Histogram rpc_latency("rpc_latency_us",
+//                             bvar::HistogramBuckets(16, 2000000, 3));
+// rpc_latency << 230 << 1500;
+// // Histogram of the last minute.
+// bvar::Window<bvar::Histogram> rpc_latency_minute(
+//     "rpc_latency_us_minute", &rpc_latency, 60);
+// rpc_latency_minute.get_value().get_number(0.99);
+class Histogram : public Variable {
+public:
+    typedef HistogramSnapshot value_type;
+    typedef detail::ReducerSampler<Histogram, HistogramSnapshot,
+                                   detail::AddTo<HistogramSnapshot>,
+                                   detail::MinusFrom<HistogramSnapshot> >
+        sampler_type;
+
+    explicit Histogram(const HistogramBuckets& buckets = HistogramBuckets());
+    Histogram(const butil::StringPiece& name,
+              const HistogramBuckets& buckets);
+    Histogram(const butil::StringPiece& prefix,
+              const butil::StringPiece& name,
+              const HistogramBuckets& buckets);
+    ~Histogram();
+
+    // Add a value.
+    Histogram& operator<<(int64_t value) {
+        agent_type* agent = _combiner.get_or_create_tls_agent();
+        if (__builtin_expect(agent != NULL, 1)) {
+            agent->modify(_combiner.op(), _buckets.index_of(value), 1);
+            agent->modify(_combiner.op(), _buckets.size(), value);
+        }
+        return *this;
+    }
+
+    // Get values added since creation.
+    HistogramSnapshot get_value() const;
+
+    const HistogramBuckets& buckets() const { return _buckets; }
+
+    void describe(std::ostream& os, bool quote_string) const override;
+
+    sampler_type* get_sampler();
+
+    detail::AddTo<HistogramSnapshot> op() const {
+        return detail::AddTo<HistogramSnapshot>();
+    }
+    detail::MinusFrom<HistogramSnapshot> inv_op() const {
+        return detail::MinusFrom<HistogramSnapshot>();
+    }
+
+    bool valid() const { return _combiner.valid(); }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(Histogram);
+friend sampler_type;
+
+    // Required by sampler_type but never called because values can be
+    // subtracted.
+    HistogramSnapshot reset() {
+        CHECK(false) << "Histogram can't be reset";
+        return get_value();
+    }
+
+    // Counts of buckets followed by the sum.
+    typedef detail::PackedCombiner<int64_t, detail::AddTo<int64_t> >
+        combiner_type;
+    typedef combiner_type::Agent agent_type;
+
+    const HistogramBuckets _buckets;
+    combiner_type _combiner;
+    sampler_type* _sampler;
+};
+
+}  // namespace bvar
+
+#endif  //BVAR_HISTOGRAM_H
@@ -28,6 +28,10 @@ namespace bvar {
 DEFINE_int32(bvar_latency_p1, 80, "First latency percentile");
 DEFINE_int32(bvar_latency_p2, 90, "Second latency percentile");
 DEFINE_int32(bvar_latency_p3, 99, "Third latency percentile");
+// Reloading the gflag does not affect existing LatencyRecorders.
+DEFINE_bool(bvar_latency_use_sketch, false, "Get latency percentiles from a "
+            "mergeable sketch with 1% relative error instead of samples, "
+            "so that tail percentiles (99.9%, 99.99%) are accurate");
 
 static bool valid_percentile(const char*, int32_t v) {
     return v > 0 && v < 100;
@@ -43,7 +47,7 @@ namespace detail {
 
 typedef PercentileSamples<1022> CombinedPercentileSamples;
 
-CDF::CDF(PercentileWindow* w) : _w(w) {}
+CDF::CDF(PercentileWindow* w, PercentileSketchWindow* sw) : _w(w), _sw(sw) {}
 
 CDF::~CDF() {
     hide();
@@ -55,28 +59,40 @@ void CDF::describe(std::ostream& os, bool) const {
 
 int CDF::describe_series(
     std::ostream& os, const SeriesOptions& options) const {
-    if (_w == NULL) {
+    if (_w == NULL && _sw == NULL) {
         return 1;
     }
     if (options.test_only) {
         return 0;
     }
-    std::unique_ptr<CombinedPercentileSamples> cb(new CombinedPercentileSamples);
-    std::vector<GlobalPercentileSamples> buckets;
-    _w->get_samples(&buckets);
-    for (size_t i = 0; i < buckets.size(); ++i) {
-        cb->combine_of(buckets.begin(), buckets.end());
-    }
     std::pair<int, int> values[20];
     size_t n = 0;
-    for (int i = 1; i < 10; ++i) {
-        values[n++] = std::make_pair(i*10, cb->get_number(i * 0.1));
-    }
-    for (int i = 91; i < 100; ++i) {
-        values[n++] = std::make_pair(i, cb->get_number(i * 0.01));
+    if (_sw != NULL) {
+        const QuantileSketch sketch = _sw->get_value();
+        for (int i = 1; i < 10; ++i) {
+            values[n++] = std::make_pair(i*10, sketch.get_number(i * 0.1));
+        }
+        for (int i = 91; i < 100; ++i) {
+            values[n++] = std::make_pair(i, sketch.get_number(i * 0.01));
+        }
+        values[n++] = std::make_pair(100, sketch.get_number(0.999));
+        values[n++] = std::make_pair(101, sketch.get_number(0.9999));
+    } else {
+        std::unique_ptr<CombinedPercentileSamples> cb(new CombinedPercentileSamples);
+        std::vector<GlobalPercentileSamples> buckets;
+        _w->get_samples(&buckets);
+        for (size_t i = 0; i < buckets.size(); ++i) {
+            cb->combine_of(buckets.begin(), buckets.end());
+        }
+        for (int i = 1; i < 10; ++i) {
+            values[n++] = std::make_pair(i*10, cb->get_number(i * 0.1));
+        }
+        for (int i = 91; i < 100; ++i) {
+            values[n++] = std::make_pair(i, cb->get_number(i * 0.01));
+        }
+        values[n++] = std::make_pair(100, cb->get_number(0.999));
+        values[n++] = std::make_pair(101, cb->get_number(0.9999));
     }
-    values[n++] = std::make_pair(100, cb->get_number(0.999));
-    values[n++] = std::make_pair(101, cb->get_number(0.9999));
     CHECK_EQ(n, arraysize(values));
     os << "{\"label\":\"cdf\",\"data\":[";
     for (size_t i = 0; i < n; ++i) {
@@ -140,6 +156,16 @@ static int64_t get_p3(void* arg) {
     return lr->latency_percentile(FLAGS_bvar_latency_p3 / 100.0);
 }
 
+static Vector<int64_t, 4> get_latency_percentiles(void* arg) {
+    return static_cast<LatencyRecorder*>(arg)->latency_percentiles();
+}
+
+static void print_latency_sketch(std::ostream& os, void* arg) {
+    std::string str;
+    static_cast<LatencyRecorder*>(arg)->latency_sketch().serialize(&str);
+    os << str;
+}
+
 static Vector<int64_t, 4> get_latencies(void *arg) {
     std::unique_ptr<CombinedPercentileSamples> cb(
         combine((PercentileWindow*)arg));
@@ -156,23 +182,36 @@ static Vector<int64_t, 4> get_latencies(void *arg) {
 
 LatencyRecorderBase::LatencyRecorderBase(time_t window_size)
     : _max_latency(0)
+    , _latency_sketch(FLAGS_bvar_latency_use_sketch ? new PercentileSketch : NULL)
     , _latency_window(&_latency, window_size)
     , _max_latency_window(&_max_latency, window_size)
     , _count(get_recorder_count, &_latency)
     , _qps(get_window_recorder_qps, &_latency_window)
     , _latency_percentile_window(&_latency_percentile, window_size)
+    , _latency_sketch_window(_latency_sketch ?
+        new PercentileSketchWindow(_latency_sketch.get(), window_size) : NULL)
+    , _latency_sketch_str(print_latency_sketch, this)
     , _latency_p1(get_p1, this)
     , _latency_p2(get_p2, this)
     , _latency_p3(get_p3, this)
     , _latency_999(get_percetile<999, 1000>, this)
     , _latency_9999(get_percetile<9999, 10000>, this)
-    , _latency_cdf(&_latency_percentile_window)
-    , _latency_percentiles(get_latencies, &_latency_percentile_window)
+    , _latency_cdf(&_latency_percentile_window, _latency_sketch_window.get())
+    , _latency_percentiles(get_latency_percentiles, this)
 {}
 
 }  // namespace detail
 
 Vector<int64_t, 4> LatencyRecorder::latency_percentiles() const {
+    if (_latency_sketch_window) {
+        const detail::QuantileSketch sketch = _latency_sketch_window->get_value();
+        Vector<int64_t, 4> result;
+        result[0] = sketch.get_number(FLAGS_bvar_latency_p1 / 100.0);
+        result[1] = sketch.get_number(FLAGS_bvar_latency_p2 / 100.0);
+        result[2] = sketch.get_number(FLAGS_bvar_latency_p3 / 100.0);
+        result[3] = sketch.get_number(0.999);
+        return result;
+    }
     // const_cast here is just to adapt parameter type and safe.
     return detail::get_latencies(
         const_cast<detail::PercentileWindow*>(&_latency_percentile_window));
@@ -215,6 +254,9 @@ int LatencyRecorder::expose(const butil::StringPiece& prefix1,
     // set debug names for printing helpful error log.
     _latency.set_debug_name(prefix);
     _latency_percentile.set_debug_name(prefix);
+    if (_latency_sketch) {
+        _latency_sketch->set_debug_name(prefix);
+    }
 
     if (_latency_window.expose_as(prefix, "latency") != 0) {
         return -1;
@@ -253,6 +295,11 @@ int LatencyRecorder::expose(const butil::StringPiece& prefix1,
     if (_latency_percentiles.expose_as(prefix, "latency_percentiles", DISPLAY_ON_HTML) != 0) {
         return -1;
     }
+    if (_latency_sketch_window &&
+        _latency_sketch_str.expose_as(prefix, "latency_sketch",
+                                      DISPLAY_ON_PLAIN_TEXT) != 0) {
+        return -1;
+    }
     snprintf(namebuf, sizeof(namebuf), "%d%%,%d%%,%d%%,99.9%%",
              (int)FLAGS_bvar_latency_p1, (int)FLAGS_bvar_latency_p2,
              (int)FLAGS_bvar_latency_p3);
@@ -261,11 +308,21 @@ int LatencyRecorder::expose(const butil::StringPiece& prefix1,
 }
 
 int64_t LatencyRecorder::latency_percentile(double ratio) const {
+    if (_latency_sketch_window) {
+        return _latency_sketch_window->get_value().get_number(ratio);
+    }
     std::unique_ptr<detail::CombinedPercentileSamples> cb(
         combine((detail::PercentileWindow*)&_latency_percentile_window));
     return cb->get_number(ratio);
 }
 
+detail::QuantileSketch LatencyRecorder::latency_sketch() const {
+    if (_latency_sketch_window) {
+        return _latency_sketch_window->get_value();
+    }
+    return detail::QuantileSketch();
+}
+
 void LatencyRecorder::hide() {
     _latency_window.hide();
     _max_latency_window.hide();
@@ -276,6 +333,7 @@ void LatencyRecorder::hide() {
     _latency_p3.hide();
     _latency_999.hide();
     _latency_9999.hide();
+    _latency_sketch_str.hide();
     _latency_cdf.hide();
     _latency_percentiles.hide();
 }
@@ -283,7 +341,11 @@ void LatencyRecorder::hide() {
 LatencyRecorder& LatencyRecorder::operator<<(int64_t latency) {
     _latency << latency;
     _max_latency << latency;
-    _latency_percentile << latency;
+    if (_latency_sketch) {
+        *_latency_sketch << latency;
+    } else {
+        _latency_percentile << latency;
+    }
     return *this;
 }
 
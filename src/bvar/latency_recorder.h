@@ -20,10 +20,12 @@
 #ifndef  BVAR_LATENCY_RECORDER_H
 #define  BVAR_LATENCY_RECORDER_H
 
+#include "butil/unique_ptr.h"
 #include "bvar/recorder.h"
 #include "bvar/reducer.h"
 #include "bvar/passive_status.h"
 #include "bvar/detail/percentile.h"
+#include "bvar/detail/quantile_sketch.h"
 
 namespace bvar {
 namespace detail {
@@ -37,12 +39,14 @@ typedef Window<Percentile, SERIES_IN_SECOND> PercentileWindow;
 
 class CDF : public Variable {
 public:
-    explicit CDF(PercentileWindow* w);
+    // CDF is plotted from `sw' instead of `w' when `sw' is not NULL.
+    explicit CDF(PercentileWindow* w, PercentileSketchWindow* sw = NULL);
     ~CDF();
     void describe(std::ostream& os, bool quote_string) const override;
     int describe_series(std::ostream& os, const SeriesOptions& options) const override;
 private:
     PercentileWindow* _w; 
+    PercentileSketchWindow* _sw;
 };
 
 // For mimic constructor inheritance.
@@ -54,12 +58,17 @@ protected:
     IntRecorder _latency;
     Maxer<int64_t> _max_latency;
     Percentile _latency_percentile;
+    // Percentiles are got from the sketch instead of _latency_percentile
+    // when -bvar_latency_use_sketch is on at construction.
+    std::unique_ptr<PercentileSketch> _latency_sketch;
 
     RecorderWindow _latency_window;
     MaxWindow _max_latency_window;
     PassiveStatus<int64_t> _count;
     PassiveStatus<int64_t> _qps;
     PercentileWindow _latency_percentile_window;
+    std::unique_ptr<PercentileSketchWindow> _latency_sketch_window;
+    PassiveStatus<std::string> _latency_sketch_str;
     PassiveStatus<int64_t> _latency_p1;
     PassiveStatus<int64_t> _latency_p2;
     PassiveStatus<int64_t> _latency_p3;
@@ -146,6 +155,13 @@ public:
     // E.g. 0.99 means 99%-ile
     int64_t latency_percentile(double ratio) const;
 
+    // Get the sketch of latencies in recent window_size-to-ctor seconds,
+    // which can be merged with sketches of other recorders (even in other
+    // processes, see QuantileSketch::serialize()) to get accurate
+    // percentiles of all of them. Empty if -bvar_latency_use_sketch was off
+    // when this recorder was created.
+    detail::QuantileSketch latency_sketch() const;
+
     // Get name of a sub-bvar.
     const std::string& latency_name() const { return _latency_window.name(); }
     const std::string& latency_percentiles_name() const
@@ -20,12 +20,19 @@
 #ifndef BVAR_MULTI_DIMENSION_H
 #define BVAR_MULTI_DIMENSION_H
 
+#include <algorithm>                                   // std::equal
+#include "butil/atomicops.h"                          // butil::atomic
+#include "butil/hash.h"                              // butil::Hash
 #include "butil/logging.h"                           // LOG
 #include "butil/macros.h"                            // BAIDU_CASSERT
 #include "butil/scoped_lock.h"                       // BAIDU_SCOPE_LOCK
+#include "butil/thread_local.h"                      // get_thread_local
+#include "butil/strings/string_piece.h"              // butil::StringPiece
 #include "butil/containers/doubly_buffered_data.h"   // DBD
 #include "butil/containers/flat_map.h"               // butil::FlatMap
+#include "butil/containers/hash_tables.h"            // butil::HashInts64
 #include "bvar/mvariable.h"
+#include "bvar/latency_recorder.h"                 // LatencyRecorder
 
 namespace bvar {
 
@@ -45,18 +52,56 @@ public:
     typedef T value_type;
     typedef T* value_ptr_type;
 
+    // Label values referenced without copying, used for looking up stats
+    // without allocating memory.
+    struct KeyRef {
+        const butil::StringPiece* labels_value;
+        size_t n;
+        size_t size() const { return n; }
+    };
+
+    // Combine hashes of label values in order, so that permuted label
+    // values hash differently.
     struct KeyHash {
         size_t operator() (const key_type& key) const {
             size_t hash_value = 0;
             for (auto &k : key) {
-                hash_value += std::hash<std::string>()(k);
+                hash_value = butil::HashInts64(hash_value, butil::Hash(k));
+            }
+            return hash_value;
+        }
+        size_t operator() (const KeyRef& key) const {
+            size_t hash_value = 0;
+            for (size_t i = 0; i < key.n; ++i) {
+                hash_value = butil::HashInts64(
+                    hash_value, butil::Hash(key.labels_value[i].data(),
+                                            key.labels_value[i].size()));
             }
             return hash_value;
         }
     };
+
+    struct KeyEqualTo {
+        bool operator() (const key_type& k1, const key_type& k2) const {
+            return k1 == k2;
+        }
+        bool operator() (const key_type& k1, const KeyRef& k2) const {
+            if (k1.size() != k2.n) {
+                return false;
+            }
+            size_t i = 0;
+            for (auto &k : k1) {
+                if (k2.labels_value[i++] != k) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
     
     typedef value_ptr_type op_value_type;
-    typedef typename butil::FlatMap<key_type, op_value_type, KeyHash> MetricMap;
+    typedef typename butil::FlatMap<key_type, op_value_type,
+                                    KeyHash, KeyEqualTo> MetricMap;
 
     typedef typename MetricMap::const_iterator MetricMapConstIterator;
     typedef typename butil::DoublyBufferedData<MetricMap> MetricMapDBD;
@@ -85,6 +130,15 @@ public:
         return get_stats_impl(labels_value, READ_OR_INSERT);
     }
 
+    // Same as above but takes `n' label values in an array, e.g.
+    //   butil::StringPiece labels_value[] = { method, status };
+    //   T* stats = md.get_stats(labels_value, arraysize(labels_value));
+    // No memory is allocated unless the stats is created. Stats got are
+    // cached in a per-thread cache, repeated calls with the same label
+    // values from a thread return the cached stats without reading the
+    // shared map.
+    T* get_stats(const butil::StringPiece* labels_value, size_t n);
+
     // Get number of stats
     size_t count_stats();
 
@@ -112,7 +166,13 @@ public:
 #endif
 
 private:
-    T* get_stats_impl(const key_type& labels_value, STATS_OP stats_op = READ_ONLY, bool* do_write = NULL);
+    template <typename K>
+    T* get_stats_impl(const K& labels_value, STATS_OP stats_op = READ_ONLY, bool* do_write = NULL);
+
+    static const key_type& to_key(const key_type& labels_value, key_type*) {
+        return labels_value;
+    }
+    static const key_type& to_key(const KeyRef& labels_value, key_type* buf);
 
     void make_dump_key(std::ostream& os, 
                        const key_type& labels_value, 
@@ -123,14 +183,37 @@ private:
                        const key_type& labels_value, 
                        const int quantile);
 
-    bool is_valid_lables_value(const key_type& labels_value) const;
+    template <typename K>
+    bool is_valid_lables_value(const K& labels_value) const;
     
     void delete_stats();
     
     static size_t init_flatmap(MetricMap& bg);
+
+    // Invalidate stats cached in all threads.
+    void renew_cache_version();
+
+    static const size_t STATS_CACHE_SIZE = 256;
+
+    struct CachedStats {
+        CachedStats() : version(0), hash(0), stats(NULL) {}
+        uint64_t version;
+        size_t hash;
+        std::vector<std::string> labels_value;
+        T* stats;
+    };
+
+    // Direct-mapped per-thread cache shared by all MultiDimension<T>,
+    // entries are told apart by versions of MultiDimension.
+    struct StatsCache {
+        CachedStats entries[STATS_CACHE_SIZE];
+    };
     
 private:
     MetricMapDBD _metric_map;
+    // Unique in the process and renewed when stats are deleted, so that
+    // cached stats of deleted stats or destroyed MultiDimension never match.
+    butil::atomic<uint64_t> _cache_version;
 };
 
 } // namespace bvar
@@ -33,10 +33,18 @@ static const std::string ALLOW_UNUSED METRIC_TYPE_SUMMARY = "summary";
 static const std::string ALLOW_UNUSED METRIC_TYPE_HISTOGRAM = "histogram";
 static const std::string ALLOW_UNUSED METRIC_TYPE_GAUGE = "gauge";
 
+namespace detail {
+inline uint64_t new_multi_dimension_cache_version() {
+    static butil::atomic<uint64_t> s_version(0);
+    return s_version.fetch_add(1, butil::memory_order_relaxed) + 1;
+}
+} // namespace detail
+
 template <typename T>
 inline
 MultiDimension<T>::MultiDimension(const key_type& labels)
     : Base(labels)
+    , _cache_version(detail::new_multi_dimension_cache_version())
 {
     _metric_map.Modify(init_flatmap);
 }
@@ -46,6 +54,7 @@ inline
 MultiDimension<T>::MultiDimension(const butil::StringPiece& name,
                                   const key_type& labels)
     : Base(labels)
+    , _cache_version(detail::new_multi_dimension_cache_version())
 {
     _metric_map.Modify(init_flatmap);
     this->expose(name);
@@ -57,6 +66,7 @@ MultiDimension<T>::MultiDimension(const butil::StringPiece& prefix,
                                   const butil::StringPiece& name,
                                   const key_type& labels)
     : Base(labels)
+    , _cache_version(detail::new_multi_dimension_cache_version())
 {
     _metric_map.Modify(init_flatmap);
     this->expose_as(prefix, name);
@@ -87,11 +97,19 @@ size_t MultiDimension<T>::count_stats() {
     return metric_map_ptr->size();
 }
 
+template <typename T>
+inline
+void MultiDimension<T>::renew_cache_version() {
+    _cache_version.store(detail::new_multi_dimension_cache_version(),
+                         butil::memory_order_release);
+}
+
 #ifdef UNIT_TEST
 template <typename T>
 inline
 void MultiDimension<T>::delete_stats(const key_type& labels_value) {
     if (is_valid_lables_value(labels_value)) {
+        renew_cache_version();
         // Because there are two copies(foreground and background) in DBD, we need to use an empty tmp_metric,
         // get the deleted value of second copy into tmp_metric, which can prevent the bvar object from being deleted twice.
         op_value_type tmp_metric = NULL;
@@ -105,6 +123,10 @@ void MultiDimension<T>::delete_stats(const key_type& labels_value) {
             return 0;
         };
         _metric_map.Modify(erase_fn);
+        // A reader may have loaded the version renewed above and cached the
+        // stats read before Modify() under it, renew again after no reader
+        // can find the stats in _metric_map.
+        renew_cache_version();
         if (tmp_metric) {
             delete tmp_metric;
         }
@@ -119,6 +141,7 @@ void MultiDimension<T>::delete_stats() {
     // swap two copies with empty, and get the value of second copy into tmp_map,
     // then traversal tmp_map and delete bvar object,
     // which can prevent the bvar object from being deleted twice.
+    renew_cache_version();
     MetricMap tmp_map;
     auto clear_fn = [&tmp_map](MetricMap& map) {
         if (!tmp_map.empty()) {
@@ -129,6 +152,9 @@ void MultiDimension<T>::delete_stats() {
     };
     int ret = _metric_map.Modify(clear_fn);
     CHECK_EQ(1, ret);
+    // Stats cached under the version renewed above before Modify() are
+    // invalidated as well.
+    renew_cache_version();
     for (auto &kv : tmp_map) {
         delete kv.second;
     }
@@ -154,7 +180,50 @@ void MultiDimension<T>::list_stats(std::vector<key_type>* names) {
 
 template <typename T>
 inline
-T* MultiDimension<T>::get_stats_impl(const key_type& labels_value, STATS_OP stats_op, bool* do_write) {
+const typename MultiDimension<T>::key_type&
+MultiDimension<T>::to_key(const KeyRef& labels_value, key_type* buf) {
+    buf->clear();
+    for (size_t i = 0; i < labels_value.n; ++i) {
+        buf->push_back(labels_value.labels_value[i].as_string());
+    }
+    return *buf;
+}
+
+template <typename T>
+inline
+T* MultiDimension<T>::get_stats(const butil::StringPiece* labels_value, size_t n) {
+    const KeyRef key = { labels_value, n };
+    if (!is_valid_lables_value(key)) {
+        return nullptr;
+    }
+    const size_t hash = KeyHash()(key);
+    const uint64_t version = _cache_version.load(butil::memory_order_acquire);
+    StatsCache* cache = butil::get_thread_local<StatsCache>();
+    CachedStats& c = cache->entries[
+        butil::HashInts64(hash, version) & (STATS_CACHE_SIZE - 1)];
+    if (c.version == version && c.hash == hash &&
+        c.labels_value.size() == n &&
+        std::equal(c.labels_value.begin(), c.labels_value.end(), labels_value)) {
+        return c.stats;
+    }
+    T* stats = get_stats_impl(key, READ_OR_INSERT);
+    if (stats != NULL) {
+        c.version = version;
+        c.hash = hash;
+        // Reuse memory of strings cached before.
+        c.labels_value.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            c.labels_value[i].assign(labels_value[i].data(), labels_value[i].size());
+        }
+        c.stats = stats;
+    }
+    return stats;
+}
+
+template <typename T>
+template <typename K>
+inline
+T* MultiDimension<T>::get_stats_impl(const K& labels_value, STATS_OP stats_op, bool* do_write) {
     if (!is_valid_lables_value(labels_value)) {
         return nullptr;
     }
@@ -181,9 +250,11 @@ T* MultiDimension<T>::get_stats_impl(const key_type& labels_value, STATS_OP stat
     // Because DBD has two copies(foreground and background) MetricMap, both copies need to be modify,
     // In order to avoid new duplicate bvar object, need use cache_metric to cache the new bvar object,
     // In this way, when modifying the second copy, can directly use the cache_metric bvar object.
+    key_type key_buf;
+    const key_type& key = to_key(labels_value, &key_buf);
     op_value_type cache_metric = NULL;
-    auto insert_fn = [&labels_value, &cache_metric, &do_write](MetricMap& bg) {
-        auto bg_metric = bg.seek(labels_value);
+    auto insert_fn = [&key, &cache_metric, &do_write](MetricMap& bg) {
+        auto bg_metric = bg.seek(key);
         if (NULL != bg_metric) {
             cache_metric = *bg_metric;
             return 0;
@@ -192,10 +263,10 @@ T* MultiDimension<T>::get_stats_impl(const key_type& labels_value, STATS_OP stat
             *do_write = true;
         }
         if (NULL != cache_metric) {
-            bg.insert(labels_value, cache_metric);
+            bg.insert(key, cache_metric);
         } else {
             T* add_metric = new T();
-            bg.insert(labels_value, add_metric);
+            bg.insert(key, add_metric);
             cache_metric = add_metric;
         }
         return 1;
@@ -348,8 +419,9 @@ void MultiDimension<T>::make_labels_kvpair_string(std::ostream& os,
 }
 
 template <typename T>
+template <typename K>
 inline
-bool MultiDimension<T>::is_valid_lables_value(const key_type& labels_value) const {
+bool MultiDimension<T>::is_valid_lables_value(const K& labels_value) const {
     if (count_labels() != labels_value.size()) {
         LOG(ERROR) << "Invalid labels count";
         return false;
@@ -0,0 +1,217 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_PACKED_REDUCER_H
+#define  BVAR_PACKED_REDUCER_H
+
+#include <limits>                          // std::numeric_limits
+#include <vector>                          // std::vector
+#include "butil/logging.h"                 // LOG
+#include "butil/macros.h"                  // DISALLOW_COPY_AND_ASSIGN
+#include "bvar/variable.h"                 // Variable
+#include "bvar/reducer.h"                  // detail::AddTo, detail::MaxTo
+#include "bvar/detail/packed_combiner.h"   // detail::PackedCombiner
+
+namespace bvar {
+
+// A group of `n' reducers sharing thread-local storage. Each thread keeps
+// values of all reducers in one cacheline-aligned array, so that updating
+// reducers which are often updated together (e.g. counters of a module)
+// touches few cachelines, and all values are combined in one pass over the
+// threads instead of one pass per reducer.
+// Prefer Adder/Maxer unless there're thousands of reducers.
+//
+// bvar::PackedAdder<int64_t> counters(3);
+// counters.expose(0, "my_request_count");
+// counters.expose(1, "my_error_count");
+// counters.expose(2, "my_byte_count");
+// counters.add(0, 1);
+// counters.add(2, 1024);
+// // Updating several values of a thread without looking up tls repeatedly.
+// bvar::PackedAdder<int64_t>::Local local(&counters);
+// local.add(0, 1);
+// local.add(1, 1);
+// std::vector<int64_t> values;
+// counters.get_values(&values);  // [2, 1, 1024]
+//
+// NOTE: values can't be reset and can't be used with Window/PerSecond.
+template <typename T, typename Op>
+class PackedReducer {
+public:
+    typedef detail::PackedCombiner<T, Op> combiner_type;
+    typedef typename combiner_type::Agent agent_type;
+
+    // Values of the calling thread. Valid until the thread quits or the
+    // reducer is destroyed, don't pass it to other threads.
+    class Local {
+    public:
+        explicit Local(PackedReducer* r)
+            : _agent(r->_combiner.get_or_create_tls_agent())
+            , _op(r->_combiner.op()) {}
+
+        void update(size_t index, const T& value) {
+            if (__builtin_expect(_agent != NULL, 1)) {
+                _agent->modify(_op, index, value);
+            }
+        }
+    private:
+        agent_type* _agent;
+        const Op& _op;
+    };
+
+    // The `identity' must satisfy: identity Op a == a
+    PackedReducer(size_t n, const T& identity = T(), const Op& op = Op())
+        : _combiner(n, identity, op)
+        , _slots(n, (Slot*)NULL)
+        , _snapshot_dump_id(0) {
+    }
+
+    ~PackedReducer() {
+        for (size_t i = 0; i < _slots.size(); ++i) {
+            delete _slots[i];
+        }
+    }
+
+    // Update the index-th value with `value'. index must be less than size().
+    void update(size_t index, const T& value) {
+        agent_type* agent = _combiner.get_or_create_tls_agent();
+        if (__builtin_expect(!agent, 0)) {
+            LOG(FATAL) << "Fail to create agent";
+            return;
+        }
+        agent->modify(_combiner.op(), index, value);
+    }
+
+    // Get the index-th reduced value.
+    // Notice that this function walks through threads that ever update values
+    // of this reducer. Use get_values() to get many values.
+    T get_value(size_t index) const { return _combiner.combine_agents(index); }
+
+    // Get all reduced values in one pass.
+    void get_values(std::vector<T>* values) const {
+        _combiner.combine_agents(values);
+    }
+
+    // Expose the index-th value as a variable. Returns 0 on success, -1
+    // otherwise. The variable is hidden when this reducer is destroyed.
+    int expose(size_t index, const butil::StringPiece& name) {
+        return expose_as(index, butil::StringPiece(), name);
+    }
+    int expose_as(size_t index, const butil::StringPiece& prefix,
+                  const butil::StringPiece& name) {
+        if (index >= _slots.size()) {
+            LOG(ERROR) << "index=" << index << " is out of range";
+            return -1;
+        }
+        if (_slots[index] == NULL) {
+            _slots[index] = new Slot(this, index);
+        }
+        return _slots[index]->expose_as(prefix, name);
+    }
+
+    // Hide the index-th value. Returns true if it was exposed.
+    bool hide(size_t index) {
+        return index < _slots.size() && _slots[index] != NULL &&
+            _slots[index]->hide();
+    }
+
+    // Number of values.
+    size_t size() const { return _combiner.size(); }
+
+    // True if this reducer is constructed successfully.
+    bool valid() const { return _combiner.valid(); }
+
+    const Op& op() const { return _combiner.op(); }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(PackedReducer);
+
+    // Get the index-th value when describing slots. All values are combined
+    // once per dump and shared by slots dumped later, instead of walking
+    // through threads for each slot.
+    T get_value_for_describe(size_t index) const {
+        const uint64_t dump_id = detail::current_dump_id();
+        if (dump_id == 0) {
+            return get_value(index);
+        }
+        butil::AutoLock guard(_snapshot_lock);
+        if (_snapshot_dump_id != dump_id) {
+            get_values(&_snapshot);
+            _snapshot_dump_id = dump_id;
+        }
+        return _snapshot[index];
+    }
+
+    class Slot : public Variable {
+    public:
+        Slot(const PackedReducer* owner, size_t index)
+            : _owner(owner), _index(index) {}
+        ~Slot() { hide(); }
+        void describe(std::ostream& os, bool /*quote_string*/) const override {
+            os << _owner->get_value_for_describe(_index);
+        }
+    private:
+        const PackedReducer* _owner;
+        size_t _index;
+    };
+
+    combiner_type _combiner;
+    std::vector<Slot*> _slots;
+    // Values combined in the dump identified by _snapshot_dump_id.
+    mutable butil::Lock _snapshot_lock;
+    mutable uint64_t _snapshot_dump_id;
+    mutable std::vector<T> _snapshot;
+};
+
+// bvar::PackedAdder<int> sums(2);
+// sums.add(0, 1);
+// sums.add(1, 2);
+// sums.add(0, 3);
+// LOG(INFO) << sums.get_value(0); // 4
+template <typename T>
+class PackedAdder : public PackedReducer<T, detail::AddTo<T> > {
+public:
+    typedef PackedReducer<T, detail::AddTo<T> > Base;
+    typedef T value_type;
+
+    class Local : public Base::Local {
+    public:
+        explicit Local(PackedAdder* r) : Base::Local(r) {}
+        void add(size_t index, const T& value) { this->update(index, value); }
+    };
+
+    explicit PackedAdder(size_t n) : Base(n) {}
+
+    void add(size_t index, const T& value) { this->update(index, value); }
+};
+
+// bvar::PackedMaxer<int> max_values(2);
+// max_values.update(0, 1);
+// max_values.update(0, 3);
+// LOG(INFO) << max_values.get_value(0); // 3
+template <typename T>
+class PackedMaxer : public PackedReducer<T, detail::MaxTo<T> > {
+public:
+    typedef PackedReducer<T, detail::MaxTo<T> > Base;
+    typedef T value_type;
+
+    explicit PackedMaxer(size_t n) : Base(n, std::numeric_limits<T>::min()) {}
+};
+
+}  // namespace bvar
+
+#endif  //BVAR_PACKED_REDUCER_H
@@ -23,6 +23,7 @@
 #include <sstream>                              // std::ostringstream
 #include <gflags/gflags.h>
 #include "butil/macros.h"                        // BAIDU_CASSERT
+#include "butil/atomicops.h"                     // butil::static_atomic
 #include "butil/containers/flat_map.h"           // butil::FlatMap
 #include "butil/scoped_lock.h"                   // BAIDU_SCOPE_LOCK
 #include "butil/string_splitter.h"               // butil::StringSplitter
@@ -453,6 +454,26 @@ private:
     std::set<std::string> _exact;
 };
 
+static butil::static_atomic<uint64_t> s_last_dump_id = BUTIL_STATIC_ATOMIC_INIT(0);
+static __thread uint64_t tls_dump_id = 0;
+
+namespace detail {
+uint64_t current_dump_id() { return tls_dump_id; }
+}  // namespace detail
+
+// Assign a new id to the dump in the scope, restore the previous one (of the
+// enclosing dump, if any) at exit.
+class DumpIdScope {
+public:
+    DumpIdScope() : _saved_id(tls_dump_id) {
+        tls_dump_id = s_last_dump_id.fetch_add(1, butil::memory_order_relaxed) + 1;
+    }
+    ~DumpIdScope() { tls_dump_id = _saved_id; }
+private:
+    DISALLOW_COPY_AND_ASSIGN(DumpIdScope);
+    uint64_t _saved_id;
+};
+
 DumpOptions::DumpOptions()
     : quote_string(true)
     , question_mark('?')
@@ -468,6 +489,7 @@ int Variable::dump_exposed(Dumper* dumper, const DumpOptions* poptions) {
     if (poptions) {
         opt = *poptions;
     }
+    DumpIdScope dump_id_scope;
     CharArrayStreamBuf streambuf;
     std::ostream os(&streambuf);
     int count = 0;
@@ -533,6 +555,53 @@ int Variable::dump_exposed(Dumper* dumper, const DumpOptions* poptions) {
     return count;
 }
 
+int Variable::dump_exposed_unsorted(Dumper* dumper,
+                                    DisplayFilter display_filter) {
+    if (NULL == dumper) {
+        LOG(ERROR) << "Parameter[dumper] is NULL";
+        return -1;
+    }
+    DumpIdScope dump_id_scope;
+    CharArrayStreamBuf streambuf;
+    std::ostream os(&streambuf);
+    int count = 0;
+    // Names of one sub map, reused for all sub maps.
+    std::vector<std::string> names;
+    VarMapWithLock* var_maps = get_var_maps();
+    for (size_t i = 0; i < SUB_MAP_COUNT; ++i) {
+        VarMapWithLock& m = var_maps[i];
+        names.clear();
+        {
+            BAIDU_SCOPED_LOCK(m.mutex);
+            names.reserve(m.size());
+            for (VarMap::const_iterator it = m.begin(); it != m.end(); ++it) {
+                if (it->second.display_filter & display_filter) {
+                    names.push_back(it->first);
+                }
+            }
+        }
+        // Variables are described like describe_exposed() since they may be
+        // hidden and destroyed after the lock is released, and dumped
+        // without the lock so that the dumper may expose or hide variables.
+        for (size_t j = 0; j < names.size(); ++j) {
+            {
+                BAIDU_SCOPED_LOCK(m.mutex);
+                VarEntry* p = m.seek(names[j]);
+                if (p == NULL) {
+                    continue;
+                }
+                p->var->describe(os, true);
+            }
+            if (!dumper->dump(names[j], streambuf.data())) {
+                return -1;
+            }
+            streambuf.reset();
+            ++count;
+        }
+    }
+    return count;
+}
+
 
 // ============= export to files ==============
 
@@ -43,6 +43,10 @@ enum SeriesFrequency {
 };
 
 namespace detail {
+// Specialize this to be true_type for values that can't be plotted.
+template <typename T>
+struct NoSeries : public butil::false_type {};
+
 // Just for constructor reusing of Window<>
 template <typename R, SeriesFrequency series_freq>
 class WindowBase : public Variable {
@@ -153,6 +157,7 @@ protected:
         const int rc = Variable::expose_impl(prefix, name, display_filter);
         if (rc == 0 &&
             _series_sampler == NULL &&
+            !NoSeries<value_type>::value &&
             FLAGS_save_series) {
             _series_sampler = new SeriesSampler(this, _var);
             _series_sampler->schedule();
@@ -36,6 +36,7 @@
 #include "brpc/policy/most_common_message.h"
 #include "brpc/channel.h"
 #include "brpc/details/load_balancer_with_naming.h"
+#include "brpc/details/channel_limiter.h"
 #include "brpc/parallel_channel.h"
 #include "brpc/selective_channel.h"
 #include "brpc/socket_map.h"
@@ -2680,4 +2681,124 @@ TEST_F(ChannelTest, adaptive_protocol_type) {
     ASSERT_EQ("", ptype.param());
 }
 
+TEST_F(ChannelTest, client_side_max_concurrency) {
+    ASSERT_EQ(0, StartAccept(_ep));
+    brpc::ChannelOptions opt;
+    opt.max_concurrency = 2;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init(_ep, &opt));
+    ASSERT_TRUE(channel._limiter != NULL);
+    ASSERT_EQ(2, channel._limiter->MaxConcurrency());
+
+    test::EchoService_Stub stub(&channel);
+    test::EchoRequest req;
+    req.set_message(__FUNCTION__);
+    req.set_sleep_us(100000); // 100ms
+    const size_t N = 3;
+    brpc::Controller cntl[N];
+    test::EchoResponse res[N];
+    for (size_t i = 0; i < N; ++i) {
+        stub.Echo(&cntl[i], &req, &res[i], brpc::DoNothing());
+    }
+    // The third call fails immediately without retrying, which would be
+    // rejected by the same limit.
+    ASSERT_TRUE(cntl[2].Failed());
+    ASSERT_EQ(brpc::ELIMIT, cntl[2].ErrorCode()) << cntl[2].ErrorText();
+    ASSERT_EQ(0, cntl[2].retried_count());
+    ASSERT_EQ(2, channel._limiter->current_concurrency());
+    for (size_t i = 0; i < N; ++i) {
+        brpc::Join(cntl[i].call_id());
+    }
+    ASSERT_FALSE(cntl[0].Failed()) << cntl[0].ErrorText();
+    ASSERT_FALSE(cntl[1].Failed()) << cntl[1].ErrorText();
+    ASSERT_EQ(0, channel._limiter->current_concurrency());
+
+    // Slots are released after the calls end.
+    brpc::Controller cntl2;
+    req.set_sleep_us(0);
+    stub.Echo(&cntl2, &req, &res[0], NULL);
+    ASSERT_FALSE(cntl2.Failed()) << cntl2.ErrorText();
+    StopAndJoin();
+}
+
+TEST_F(ChannelTest, client_side_max_concurrency_backup_request) {
+    ASSERT_EQ(0, StartAccept(_ep));
+    brpc::ChannelOptions opt;
+    opt.max_concurrency = 1;
+    opt.backup_request_ms = 10;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init(_ep, &opt));
+
+    test::EchoService_Stub stub(&channel);
+    test::EchoRequest req;
+    req.set_message(__FUNCTION__);
+    req.set_sleep_us(50000); // 50ms
+    test::EchoResponse res;
+    brpc::Controller cntl;
+    stub.Echo(&cntl, &req, &res, NULL);
+    // The backup request is not sent and the original call succeeds.
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_FALSE(cntl.has_backup_request());
+    ASSERT_EQ(0, cntl.retried_count());
+    ASSERT_EQ(0, channel._limiter->current_concurrency());
+
+    // The backup request is sent when the limit allows.
+    brpc::Channel channel2;
+    opt.max_concurrency = 2;
+    ASSERT_EQ(0, channel2.Init(_ep, &opt));
+    test::EchoService_Stub stub2(&channel2);
+    cntl.Reset();
+    stub2.Echo(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_TRUE(cntl.has_backup_request());
+    bthread_usleep(60000);
+    ASSERT_EQ(0, channel2._limiter->current_concurrency());
+    StopAndJoin();
+}
+
+TEST_F(ChannelTest, client_side_max_qps) {
+    ASSERT_EQ(0, StartAccept(_ep));
+    brpc::ChannelOptions opt;
+    // The bucket holds one token only.
+    opt.max_qps = 5;
+    opt.max_retry = 0;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init(_ep, &opt));
+    ASSERT_TRUE(channel._limiter != NULL);
+
+    test::EchoService_Stub stub(&channel);
+    test::EchoRequest req;
+    req.set_message(__FUNCTION__);
+    test::EchoResponse res;
+    brpc::Controller cntl;
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    cntl.Reset();
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_EQ(brpc::ELIMIT, cntl.ErrorCode()) << cntl.ErrorText();
+    // A token is refilled after 200ms.
+    bthread_usleep(250000);
+    cntl.Reset();
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    StopAndJoin();
+}
+
+TEST_F(ChannelTest, client_side_limiter_options) {
+    brpc::ChannelOptions opt;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init(_ep, &opt));
+    ASSERT_TRUE(channel._limiter == NULL);
+
+    opt.max_concurrency = "auto";
+    brpc::Channel channel2;
+    ASSERT_EQ(0, channel2.Init(_ep, &opt));
+    ASSERT_TRUE(channel2._limiter != NULL);
+    ASSERT_GT(channel2._limiter->MaxConcurrency(), 0);
+
+    opt.max_concurrency = "no_such_limiter";
+    brpc::Channel channel3;
+    ASSERT_EQ(-1, channel3.Init(_ep, &opt));
+}
+
 } //namespace
@@ -0,0 +1,147 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <vector>
+#include <gtest/gtest.h>
+#include "brpc/details/cpu_profile_ring.h"
+
+namespace {
+
+const char* const MAPS = "00400000-00452000 r-xp 00000000 08:02 173521 /a.out\n";
+
+class ProfileBuilder {
+public:
+    explicit ProfileBuilder(uintptr_t period_us) {
+        append(0); append(3); append(0); append(period_us); append(0);
+    }
+    void add(uintptr_t count, const std::vector<uintptr_t>& stack) {
+        append(count);
+        append(stack.size());
+        for (size_t i = 0; i < stack.size(); ++i) {
+            append(stack[i]);
+        }
+    }
+    std::string finish() {
+        append(0); append(1); append(0);
+        _data.append(MAPS);
+        return _data;
+    }
+private:
+    void append(uintptr_t slot) { _data.append((const char*)&slot, sizeof(slot)); }
+    std::string _data;
+};
+
+// Returns stack -> count in a profile written by DumpProfile().
+std::map<std::vector<uintptr_t>, uintptr_t> ParseProfile(const std::string& data,
+                                                        std::string* maps) {
+    std::map<std::vector<uintptr_t>, uintptr_t> result;
+    const uintptr_t* slots = (const uintptr_t*)data.data();
+    size_t i = 5;
+    while (true) {
+        const uintptr_t count = slots[i];
+        const uintptr_t depth = slots[i + 1];
+        i += 2;
+        if (slots[i] == 0) {
+            i += depth;
+            break;
+        }
+        result[std::vector<uintptr_t>(slots + i, slots + i + depth)] += count;
+        i += depth;
+    }
+    maps->assign(data, i * sizeof(uintptr_t), std::string::npos);
+    return result;
+}
+
+TEST(CpuProfileRingTest, add_and_dump) {
+    std::vector<uintptr_t> a;
+    a.push_back(0x400100);
+    a.push_back(0x400200);
+    std::vector<uintptr_t> b;
+    b.push_back(0x400300);
+
+    brpc::CpuProfileRing ring;
+    int64_t begin_us = 0;
+    int64_t end_us = 0;
+    ASSERT_FALSE(ring.GetTimeRange(&begin_us, &end_us));
+    butil::IOBuf out;
+    ASSERT_EQ(-1, ring.DumpProfile(0, 10000000, &out));
+
+    ProfileBuilder p1(10000);
+    p1.add(3, a);
+    p1.add(2, b);
+    // Same stacks may appear more than once.
+    p1.add(1, a);
+    ASSERT_EQ(0, ring.AddProfile(p1.finish(), 1000000, 2000000));
+    ProfileBuilder p2(10000);
+    p2.add(5, b);
+    ASSERT_EQ(0, ring.AddProfile(p2.finish(), 3000000, 4000000));
+    ASSERT_TRUE(ring.GetTimeRange(&begin_us, &end_us));
+    ASSERT_EQ(1000000, begin_us);
+    ASSERT_EQ(4000000, end_us);
+
+    ASSERT_EQ(11, ring.DumpProfile(0, 10000000, &out, &begin_us, &end_us));
+    ASSERT_EQ(1000000, begin_us);
+    ASSERT_EQ(4000000, end_us);
+    std::string maps;
+    std::map<std::vector<uintptr_t>, uintptr_t> samples =
+        ParseProfile(out.to_string(), &maps);
+    ASSERT_EQ(2u, samples.size());
+    ASSERT_EQ(4u, samples[a]);
+    ASSERT_EQ(7u, samples[b]);
+    ASSERT_EQ(MAPS, maps);
+    // The dumped profile can be added again.
+    brpc::CpuProfileRing ring2;
+    ASSERT_EQ(0, ring2.AddProfile(out.to_string(), 0, 1));
+    ASSERT_EQ(11, ring2.DumpProfile(0, 1, &out));
+
+    // Only the periods overlapping the range are merged.
+    ASSERT_EQ(5, ring.DumpProfile(2500000, 10000000, &out, &begin_us, &end_us));
+    ASSERT_EQ(3000000, begin_us);
+    ASSERT_EQ(4000000, end_us);
+    samples = ParseProfile(out.to_string(), &maps);
+    ASSERT_EQ(1u, samples.size());
+    ASSERT_EQ(5u, samples[b]);
+    ASSERT_EQ(-1, ring.DumpProfile(2000000, 3000000, &out));
+
+    ring.RemoveOlderThan(2500000);
+    ASSERT_TRUE(ring.GetTimeRange(&begin_us, &end_us));
+    ASSERT_EQ(3000000, begin_us);
+    ASSERT_EQ(5, ring.DumpProfile(0, 10000000, &out));
+}
+
+TEST(CpuProfileRingTest, invalid_profile) {
+    brpc::CpuProfileRing ring;
+    ASSERT_EQ(-1, ring.AddProfile("", 0, 1));
+    std::vector<uintptr_t> a(1, 0x400100);
+    ProfileBuilder p(10000);
+    p.add(1, a);
+    const std::string data = p.finish();
+    // No trailer.
+    ASSERT_EQ(-1, ring.AddProfile(
+                  data.substr(0, data.size() - strlen(MAPS) - 3 * sizeof(uintptr_t)),
+                  0, 1));
+    std::string bad_depth = data;
+    const uintptr_t depth = 100000;
+    bad_depth.replace(6 * sizeof(uintptr_t), sizeof(uintptr_t),
+                      (const char*)&depth, sizeof(depth));
+    ASSERT_EQ(-1, ring.AddProfile(bad_depth, 0, 1));
+    int64_t begin_us = 0;
+    int64_t end_us = 0;
+    ASSERT_FALSE(ring.GetTimeRange(&begin_us, &end_us));
+}
+
+} // namespace
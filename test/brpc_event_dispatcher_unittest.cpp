@@ -29,6 +29,10 @@
 #include "butil/fd_utility.h"
 #include "brpc/event_dispatcher.h"
 #include "brpc/details/has_epollrdhup.h"
+#include "brpc/details/io_uring.h"
+#ifdef BRPC_HAS_IO_URING_RECV
+#include <linux/io_uring.h>
+#endif
 
 class EventDispatcherTest : public ::testing::Test{
 protected:
@@ -267,3 +271,213 @@ TEST_F(EventDispatcherTest, dispatch_tasks) {
     ASSERT_EQ(NCLIENT, info.free_item_num - old_info.free_item_num);
 #endif
 }
+
+#ifdef BRPC_HAS_IO_URING
+TEST_F(EventDispatcherTest, io_uring_poller) {
+    if (!brpc::IoUringSupported()) {
+        LOG(WARNING) << "io_uring is not supported, skip";
+        return;
+    }
+    brpc::IoUringPoller poller;
+    ASSERT_EQ(0, poller.Init());
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    butil::make_non_blocking(fds[0]);
+    const brpc::SocketId in_id = 123;
+    const brpc::SocketId out_id = 456;
+    ASSERT_EQ(0, poller.AddConsumer(in_id, fds[0]));
+    ASSERT_EQ(-1, poller.AddConsumer(in_id, fds[0]));
+    ASSERT_EQ(EEXIST, errno);
+
+    epoll_event e[32];
+    // Multishot poll keeps reporting without being re-armed.
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_EQ(1, write(fds[1], "x", 1));
+        ASSERT_EQ(1, poller.Wait(e, ARRAY_SIZE(e)));
+        ASSERT_TRUE(e[0].events & EPOLLIN);
+        ASSERT_EQ(in_id, e[0].data.u64);
+        char c;
+        ASSERT_EQ(1, read(fds[0], &c, 1));
+    }
+
+    // pollin=true requires a consumer on the fd, same as EPOLL_CTL_MOD.
+    ASSERT_EQ(-1, poller.AddEpollOut(out_id, fds[1], true));
+    ASSERT_EQ(ENOENT, errno);
+    ASSERT_EQ(0, poller.AddEpollOut(out_id, fds[1], false));
+    ASSERT_EQ(1, poller.Wait(e, ARRAY_SIZE(e)));
+    ASSERT_TRUE(e[0].events & EPOLLOUT);
+    ASSERT_EQ(out_id, e[0].data.u64);
+    ASSERT_EQ(0, poller.RemoveEpollOut(out_id, fds[1], false));
+
+    ASSERT_EQ(0, poller.RemoveConsumer(fds[0]));
+    ASSERT_EQ(-1, poller.RemoveConsumer(fds[0]));
+    // Nothing is reported after removal, only the internal completions
+    // and the wakeup.
+    ASSERT_EQ(1, write(fds[1], "x", 1));
+    poller.Wakeup();
+    ASSERT_EQ(0, poller.Wait(e, ARRAY_SIZE(e)));
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// Same interfaces as IoUringPoller, implemented with epoll as
+// EventDispatcher does.
+class EpollPoller {
+public:
+    EpollPoller() : _epfd(epoll_create(1024)) {}
+    ~EpollPoller() { close(_epfd); }
+
+    int AddConsumer(brpc::SocketId socket_id, int fd) {
+        epoll_event evt;
+        evt.events = EPOLLIN | EPOLLET;
+        evt.data.u64 = socket_id;
+        return epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &evt);
+    }
+    int Wait(epoll_event* events, int max) {
+        return epoll_wait(_epfd, events, max, -1);
+    }
+
+private:
+    int _epfd;
+};
+
+// Echo small messages over many connections, each read and echoed on
+// readiness notified by `poller'.
+template <typename Poller>
+void EchoThroughPoller(Poller* poller, const char* name) {
+    const int NCONN = 256;
+    const int NROUND = 1000;
+    const char MSG[] = "hello world, hello world, hello world, hello world";
+    const ssize_t MSG_LEN = sizeof(MSG);
+    int fds[NCONN][2];
+    for (int i = 0; i < NCONN; ++i) {
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]));
+        butil::make_non_blocking(fds[i][0]);
+        ASSERT_EQ(0, poller->AddConsumer(i, fds[i][0]));
+    }
+    char buf[256];
+    size_t nwait = 0;
+    butil::Timer tm;
+    tm.start();
+    for (int r = 0; r < NROUND; ++r) {
+        for (int i = 0; i < NCONN; ++i) {
+            ASSERT_EQ(MSG_LEN, write(fds[i][1], MSG, MSG_LEN));
+        }
+        int nechoed = 0;
+        while (nechoed < NCONN) {
+            epoll_event e[64];
+            const int n = poller->Wait(e, ARRAY_SIZE(e));
+            ASSERT_GE(n, 0);
+            ++nwait;
+            for (int j = 0; j < n; ++j) {
+                const int fd = fds[e[j].data.u64][0];
+                const ssize_t nr = read(fd, buf, sizeof(buf));
+                if (nr < 0 && errno == EAGAIN) {
+                    continue;
+                }
+                ASSERT_EQ(MSG_LEN, nr);
+                ASSERT_EQ(nr, write(fd, buf, nr));
+                ++nechoed;
+            }
+        }
+        for (int i = 0; i < NCONN; ++i) {
+            ASSERT_EQ(MSG_LEN, read(fds[i][1], buf, sizeof(buf)));
+        }
+    }
+    tm.stop();
+    LOG(INFO) << name << ": " << NCONN * NROUND * 1000000.0 / tm.u_elapsed()
+              << " echo/s, " << (double)nwait / NROUND << " waits/round";
+    for (int i = 0; i < NCONN; ++i) {
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+}
+
+TEST_F(EventDispatcherTest, io_uring_poller_vs_epoll) {
+    if (!brpc::IoUringSupported()) {
+        LOG(WARNING) << "io_uring is not supported, skip";
+        return;
+    }
+    EpollPoller epoll_poller;
+    EchoThroughPoller(&epoll_poller, "epoll");
+    brpc::IoUringPoller uring_poller;
+    ASSERT_EQ(0, uring_poller.Init());
+    EchoThroughPoller(&uring_poller, "io_uring");
+}
+#endif  // BRPC_HAS_IO_URING
+
+#ifdef BRPC_HAS_IO_URING_RECV
+TEST_F(EventDispatcherTest, io_uring_buffer_ring) {
+    if (!brpc::IoUringRecvSupported()) {
+        LOG(WARNING) << "io_uring recv is not supported, skip";
+        return;
+    }
+    brpc::IoUring ring;
+    ASSERT_EQ(0, ring.Init(8, 16));
+    brpc::IoUringBufferRing br;
+    // Number of buffers must be power of 2.
+    ASSERT_EQ(-1, br.Init(&ring, 1, 3));
+    ASSERT_EQ(0, br.Init(&ring, 1, 4));
+    ASSERT_EQ(1, br.bgid());
+    // The kernel has not filled anything, taking only checks that data is
+    // cut from the provided block and the rest of the block is provided.
+    butil::IOBuf out;
+    br.Take(0, 16, &out);
+    ASSERT_EQ(16u, out.size());
+    br.Take(0, 16, &out);
+    ASSERT_EQ(32u, out.size());
+    ASSERT_EQ(1u, out.backing_block_num());
+    // A new block is provided when the rest is too small.
+    br.Take(1, butil::IOBuf::BRPC_DEFAULT_BLOCK_SIZE - 100, &out);
+    br.Take(1, 16, &out);
+    ASSERT_EQ(3u, out.backing_block_num());
+    br.Commit();
+}
+
+TEST_F(EventDispatcherTest, io_uring_buffer_ring_recv) {
+    if (!brpc::IoUringRecvSupported()) {
+        LOG(WARNING) << "io_uring recv is not supported, skip";
+        return;
+    }
+    brpc::IoUring ring;
+    ASSERT_EQ(0, ring.Init(8, 64));
+    brpc::IoUringBufferRing br;
+    ASSERT_EQ(0, br.Init(&ring, 2, 1));
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    io_uring_sqe* sqe = ring.GetSqe();
+    ASSERT_TRUE(sqe != NULL);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fds[0];
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = br.bgid();
+    ASSERT_EQ(1, ring.Submit(0));
+
+    // More messages than buffers, which works only if buffers are provided
+    // again after being taken.
+    const int NMSG = 16;
+    butil::IOBuf received;
+    std::string expected;
+    for (int i = 0; i < NMSG; ++i) {
+        char msg[32];
+        const int len = snprintf(msg, sizeof(msg), "message-%d;", i);
+        expected.append(msg, len);
+        ASSERT_EQ(len, write(fds[1], msg, len));
+        io_uring_cqe cqe;
+        ASSERT_EQ(0, ring.WaitCqe());
+        ASSERT_EQ(1, ring.PeekCqes(&cqe, 1));
+        ASSERT_EQ(len, cqe.res);
+        ASSERT_TRUE(cqe.flags & IORING_CQE_F_BUFFER);
+        ASSERT_TRUE(cqe.flags & IORING_CQE_F_MORE);
+        br.Take(cqe.flags >> IORING_CQE_BUFFER_SHIFT, cqe.res, &received);
+        br.Commit();
+    }
+    ASSERT_EQ(expected, received.to_string());
+    // Small messages are received into the same block one after another
+    // rather than a new block each.
+    ASSERT_EQ(1u, received.backing_block_num());
+    close(fds[0]);
+    close(fds[1]);
+}
+#endif  // BRPC_HAS_IO_URING_RECV
@@ -22,10 +22,12 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <map>
+#include <set>
 #include <gtest/gtest.h>
 #include "bthread/bthread.h"
 #include "butil/gperftools_profiler.h"
 #include "butil/time.h"
+#include "butil/string_printf.h"
 #include "butil/fast_rand.h"
 #include "butil/containers/doubly_buffered_data.h"
 #include "brpc/describable.h"
@@ -40,6 +42,8 @@
 #include "brpc/policy/weighted_randomized_load_balancer.h"
 #include "brpc/policy/randomized_load_balancer.h"
 #include "brpc/policy/locality_aware_load_balancer.h"
+#include "brpc/policy/p2c_load_balancer.h"
+#include "brpc/policy/maglev_load_balancer.h"
 #include "brpc/policy/consistent_hashing_load_balancer.h"
 #include "brpc/policy/hasher.h"
 #include "brpc/errno.pb.h"
@@ -621,6 +625,228 @@ TEST_F(LoadBalancerTest, consistent_hashing) {
     }
 }
 
+TEST_F(LoadBalancerTest, maglev) {
+    brpc::policy::MaglevLoadBalancer lb;
+    brpc::SocketUniquePtr ptr;
+    brpc::LoadBalancer::SelectOut out(&ptr);
+    brpc::LoadBalancer::SelectIn in = { 0, false, false, 0u, NULL };
+    ASSERT_EQ(EINVAL, lb.SelectServer(in, &out));
+    in.has_request_code = true;
+    ASSERT_EQ(ENODATA, lb.SelectServer(in, &out));
+
+    const size_t N = 50;
+    std::vector<brpc::ServerId> ids;
+    for (size_t i = 0; i < N; ++i) {
+        char addr[32];
+        snprintf(addr, sizeof(addr), "192.168.1.%d:8080", (int)i);
+        butil::EndPoint dummy;
+        ASSERT_EQ(0, str2endpoint(addr, &dummy));
+        brpc::ServerId id(8888);
+        brpc::SocketOptions options;
+        options.remote_side = dummy;
+        options.user = new SaveRecycle;
+        ASSERT_EQ(0, brpc::Socket::Create(options, &id.id));
+        ids.push_back(id);
+    }
+    ASSERT_EQ(N, lb.AddServersInBatch(ids));
+    // Slots are almost evenly distributed.
+    std::map<butil::EndPoint, double> load_map;
+    lb.GetLoads(&load_map);
+    ASSERT_EQ(N, load_map.size());
+    for (std::map<butil::EndPoint, double>::iterator
+             it = load_map.begin(); it != load_map.end(); ++it) {
+        ASSERT_LT(fabs(it->second * N - 1), 0.05) << it->first;
+    }
+
+    const size_t SELECT_TIMES = 100000;
+    std::vector<brpc::SocketId> chosen(SELECT_TIMES);
+    for (size_t i = 0; i < SELECT_TIMES; ++i) {
+        in.request_code = brpc::policy::MurmurHash32(&i, sizeof(i));
+        ASSERT_EQ(0, lb.SelectServer(in, &out));
+        ASSERT_FALSE(out.need_feedback);
+        chosen[i] = ptr->id();
+    }
+
+    // Another LB with servers added in a different order chooses same
+    // servers.
+    brpc::policy::MaglevLoadBalancer lb2;
+    for (size_t i = N; i > 0; --i) {
+        ASSERT_TRUE(lb2.AddServer(ids[i - 1]));
+    }
+    for (size_t i = 0; i < SELECT_TIMES; ++i) {
+        in.request_code = brpc::policy::MurmurHash32(&i, sizeof(i));
+        ASSERT_EQ(0, lb2.SelectServer(in, &out));
+        ASSERT_EQ(chosen[i], ptr->id());
+    }
+
+    // Removing a server moves requests of the server and few others.
+    ASSERT_TRUE(lb.RemoveServer(ids[0]));
+    size_t nmoved = 0;
+    size_t nremoved = 0;
+    for (size_t i = 0; i < SELECT_TIMES; ++i) {
+        in.request_code = brpc::policy::MurmurHash32(&i, sizeof(i));
+        ASSERT_EQ(0, lb.SelectServer(in, &out));
+        ASSERT_NE(ids[0].id, ptr->id());
+        if (chosen[i] == ids[0].id) {
+            ++nremoved;
+        } else if (chosen[i] != ptr->id()) {
+            ++nmoved;
+        }
+    }
+    std::cout << "removed=" << nremoved << " moved=" << nmoved << std::endl;
+    ASSERT_LT(nmoved, SELECT_TIMES / 50);
+
+    // Excluded and failed servers are skipped.
+    in.request_code = 0;
+    ASSERT_EQ(0, lb.SelectServer(in, &out));
+    const brpc::SocketId first = ptr->id();
+    brpc::ExcludedServers* excluded = brpc::ExcludedServers::Create(1);
+    excluded->Add(first);
+    in.excluded = excluded;
+    ASSERT_EQ(0, lb.SelectServer(in, &out));
+    ASSERT_NE(first, ptr->id());
+    brpc::ExcludedServers::Destroy(excluded);
+    in.excluded = NULL;
+    ASSERT_EQ(0, brpc::Socket::SetFailed(first));
+    ASSERT_EQ(0, lb.SelectServer(in, &out));
+    ASSERT_NE(first, ptr->id());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        brpc::Socket::SetFailed(ids[i].id);
+    }
+    ASSERT_EQ(EHOSTDOWN, lb.SelectServer(in, &out));
+}
+
+TEST_F(LoadBalancerTest, maglev_bounded_load) {
+    const brpc::policy::MaglevLoadBalancer factory;
+    ASSERT_TRUE(NULL == factory.New("table_size=100"));
+    ASSERT_TRUE(NULL == factory.New("load_factor=0.5"));
+    brpc::LoadBalancer* lb = factory.New("table_size=1009 load_factor=1.25");
+    ASSERT_TRUE(lb != NULL);
+
+    const size_t N = 8;
+    std::vector<brpc::ServerId> ids;
+    for (size_t i = 0; i < N; ++i) {
+        char addr[32];
+        snprintf(addr, sizeof(addr), "192.168.1.%d:8080", (int)i);
+        butil::EndPoint dummy;
+        ASSERT_EQ(0, str2endpoint(addr, &dummy));
+        brpc::ServerId id(8888);
+        brpc::SocketOptions options;
+        options.remote_side = dummy;
+        options.user = new SaveRecycle;
+        ASSERT_EQ(0, brpc::Socket::Create(options, &id.id));
+        ids.push_back(id);
+    }
+    ASSERT_EQ(N, lb->AddServersInBatch(ids));
+
+    // All requests have the same code, the hot server takes no more than
+    // 1.25 times the average inflight requests.
+    brpc::SocketUniquePtr ptr;
+    brpc::LoadBalancer::SelectOut out(&ptr);
+    brpc::LoadBalancer::SelectIn in = { 0, true, true, 12345u, NULL };
+    const size_t REQUESTS = 800;
+    std::map<brpc::SocketId, size_t> inflight;
+    std::vector<brpc::SocketId> chosen;
+    for (size_t i = 0; i < REQUESTS; ++i) {
+        ASSERT_EQ(0, lb->SelectServer(in, &out));
+        ASSERT_TRUE(out.need_feedback);
+        chosen.push_back(ptr->id());
+        ++inflight[ptr->id()];
+        for (std::map<brpc::SocketId, size_t>::iterator
+                 it = inflight.begin(); it != inflight.end(); ++it) {
+            ASSERT_LE(it->second, ceil(1.25 * (i + 1) / N));
+        }
+    }
+    // The hot server is full while others share the rest.
+    ASSERT_EQ(ceil(1.25 * REQUESTS / N), inflight[chosen[0]]);
+    ASSERT_LE(N - 1, inflight.size());
+
+    // The hot server gets requests again after responses.
+    brpc::Controller cntl;
+    for (size_t i = 0; i < chosen.size(); ++i) {
+        const brpc::LoadBalancer::CallInfo info = { 0, chosen[i], 0, &cntl };
+        lb->Feedback(info);
+    }
+    ASSERT_EQ(0, lb->SelectServer(in, &out));
+    ASSERT_EQ(chosen[0], ptr->id());
+    const brpc::LoadBalancer::CallInfo info = { 0, chosen[0], 0, &cntl };
+    lb->Feedback(info);
+    lb->Destroy();
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ASSERT_EQ(0, brpc::Socket::SetFailed(ids[i].id));
+    }
+}
+
+TEST_F(LoadBalancerTest, maglev_bounded_load_readd_server) {
+    brpc::policy::MaglevLoadBalancer lb;
+    ASSERT_TRUE(lb.SetParameters("table_size=1009 load_factor=1.25"));
+    const size_t N = 4;
+    std::vector<brpc::ServerId> ids;
+    for (size_t i = 0; i < N; ++i) {
+        char addr[32];
+        snprintf(addr, sizeof(addr), "192.168.2.%d:8080", (int)i);
+        butil::EndPoint dummy;
+        ASSERT_EQ(0, str2endpoint(addr, &dummy));
+        brpc::ServerId id(8888);
+        brpc::SocketOptions options;
+        options.remote_side = dummy;
+        options.user = new SaveRecycle;
+        ASSERT_EQ(0, brpc::Socket::Create(options, &id.id));
+        ids.push_back(id);
+    }
+    ASSERT_EQ(N, lb.AddServersInBatch(ids));
+
+    brpc::SocketUniquePtr ptr;
+    brpc::LoadBalancer::SelectOut out(&ptr);
+    brpc::LoadBalancer::SelectIn in = { 0, true, true, 12345u, NULL };
+    std::vector<brpc::SocketId> chosen;
+    for (size_t i = 0; i < 40; ++i) {
+        ASSERT_EQ(0, lb.SelectServer(in, &out));
+        ASSERT_TRUE(out.need_feedback);
+        chosen.push_back(ptr->id());
+    }
+    ASSERT_EQ(40, lb._total_inflight.load());
+
+    // The hot server is removed and added again with the same SocketId
+    // while its requests are inflight, another one is just removed.
+    brpc::ServerId hot(chosen[0]);
+    brpc::ServerId removed(chosen[0] == ids[0].id ? ids[1].id : ids[0].id);
+    size_t hot_inflight = 0;
+    size_t removed_inflight = 0;
+    for (size_t i = 0; i < chosen.size(); ++i) {
+        hot_inflight += (chosen[i] == hot.id);
+        removed_inflight += (chosen[i] == removed.id);
+    }
+    ASSERT_TRUE(lb.RemoveServer(hot));
+    ASSERT_TRUE(lb.RemoveServer(removed));
+    ASSERT_EQ(40 - hot_inflight - removed_inflight,
+              (size_t)lb._total_inflight.load());
+    ASSERT_TRUE(lb.AddServer(hot));
+    ASSERT_EQ(40 - removed_inflight, (size_t)lb._total_inflight.load());
+
+    // Feedback of requests before removal decreases the counters
+    // increased by them, nothing drifts.
+    brpc::Controller cntl;
+    for (size_t i = 0; i < chosen.size(); ++i) {
+        const brpc::LoadBalancer::CallInfo info = { 0, chosen[i], 0, &cntl };
+        lb.Feedback(info);
+    }
+    ASSERT_EQ(0, lb._total_inflight.load());
+    ASSERT_TRUE(lb._detached.empty());
+    {
+        butil::DoublyBufferedData<
+            brpc::policy::MaglevLoadBalancer::Servers>::ScopedPtr s;
+        ASSERT_EQ(0, lb._db_servers.Read(&s));
+        ASSERT_EQ(N - 1, s->server_list.size());
+        for (size_t i = 0; i < s->server_list.size(); ++i) {
+            ASSERT_EQ(0, s->server_list[i].inflight->load());
+        }
+    }
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ASSERT_EQ(0, brpc::Socket::SetFailed(ids[i].id));
+    }
+}
+
 TEST_F(LoadBalancerTest, weighted_round_robin) {
     const char* servers[] = { 
             "10.92.115.19:8831", 
@@ -1101,4 +1327,281 @@ TEST_F(LoadBalancerTest, la_selection_too_long) {
     ASSERT_EQ(EHOSTDOWN, lb.SelectServer(in, &out));
 }
 
+TEST_F(LoadBalancerTest, subset) {
+    brpc::GlobalInitializeOrDie();
+    std::string url = "list://";
+    for (int i = 0; i < 20; ++i) {
+        url.append(butil::string_printf("127.0.0.1:%d,", 9300 + i));
+    }
+    brpc::SubsetOptions subset_opt;
+    subset_opt.subset_size = 5;
+    butil::intrusive_ptr<brpc::LoadBalancerWithNaming> lb(
+        new brpc::LoadBalancerWithNaming);
+    ASSERT_EQ(0, lb->Init(url.c_str(), "rr", NULL, NULL, &subset_opt));
+    ASSERT_EQ(20u, lb->_candidates.size());
+    ASSERT_EQ(5u, lb->_subset.size());
+    std::ostringstream os;
+    lb->Describe(os, brpc::DescribeOptions());
+    ASSERT_NE(std::string::npos, os.str().find("subset=5/20")) << os.str();
+
+    // Only servers in the subset are selected.
+    brpc::LoadBalancer::SelectIn in = { 0, false, false, 0u, NULL };
+    brpc::SocketUniquePtr ptr;
+    brpc::LoadBalancer::SelectOut out(&ptr);
+    std::set<brpc::SocketId> selected;
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(0, lb->SelectServer(in, &out));
+        selected.insert(ptr->id());
+    }
+    ASSERT_EQ(5u, selected.size());
+    for (size_t i = 0; i < lb->_subset.size(); ++i) {
+        ASSERT_EQ(1u, selected.count(lb->_subset[i].id));
+    }
+
+    // Another lb with same servers chooses the same subset.
+    butil::intrusive_ptr<brpc::LoadBalancerWithNaming> lb2(
+        new brpc::LoadBalancerWithNaming);
+    ASSERT_EQ(0, lb2->Init(url.c_str(), "rr", NULL, NULL, &subset_opt));
+    ASSERT_EQ(lb->_subset, lb2->_subset);
+
+    // Removing a server out of the subset does not change the subset, and
+    // removing one in the subset replaces just the server.
+    const std::vector<brpc::ServerId> old_subset = lb->_subset;
+    std::vector<brpc::ServerId> removed(1, lb->_candidates.back().server);
+    lb->OnRemovedServers(removed);
+    ASSERT_EQ(old_subset, lb->_subset);
+    removed[0] = lb->_candidates.front().server;
+    lb->OnRemovedServers(removed);
+    ASSERT_EQ(5u, lb->_subset.size());
+    std::vector<brpc::ServerId> common;
+    std::set_intersection(old_subset.begin(), old_subset.end(),
+                          lb->_subset.begin(), lb->_subset.end(),
+                          std::back_inserter(common));
+    ASSERT_EQ(4u, common.size());
+    lb->OnAddedServers(removed);
+    ASSERT_EQ(old_subset, lb->_subset);
+
+    // The subset grows to have 5 healthy servers.
+    subset_opt.grow_on_unhealthy = true;
+    butil::intrusive_ptr<brpc::LoadBalancerWithNaming> lb3(
+        new brpc::LoadBalancerWithNaming);
+    ASSERT_EQ(0, lb3->Init(url.c_str(), "rr", NULL, NULL, &subset_opt));
+    ASSERT_EQ(old_subset, lb3->_subset);
+    ASSERT_EQ(0, brpc::Socket::SetFailed(lb3->_candidates[0].server.id));
+    ASSERT_EQ(0, brpc::Socket::SetFailed(lb3->_candidates[1].server.id));
+    lb3->RefreshSubset();
+    ASSERT_EQ(7u, lb3->_subset.size());
+    selected.clear();
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(0, lb3->SelectServer(in, &out));
+        selected.insert(ptr->id());
+    }
+    ASSERT_EQ(5u, selected.size());
+    ASSERT_EQ(0u, selected.count(lb3->_candidates[0].server.id));
+}
+
+TEST_F(LoadBalancerTest, p2c_sanity) {
+    brpc::policy::P2CLoadBalancer lb;
+    brpc::SocketUniquePtr ptr;
+    brpc::LoadBalancer::SelectOut out(&ptr);
+    brpc::LoadBalancer::SelectIn in = { 0, true, false, 0u, NULL };
+    ASSERT_EQ(ENODATA, lb.SelectServer(in, &out));
+
+    std::vector<brpc::ServerId> ids;
+    for (int i = 0; i < 2; ++i) {
+        char addr[32];
+        snprintf(addr, sizeof(addr), "192.168.1.%d:8080", i);
+        butil::EndPoint dummy;
+        ASSERT_EQ(0, str2endpoint(addr, &dummy));
+        brpc::ServerId id(8888);
+        brpc::SocketOptions options;
+        options.remote_side = dummy;
+        ASSERT_EQ(0, brpc::Socket::Create(options, &id.id));
+        ids.push_back(id);
+        ASSERT_TRUE(lb.AddServer(id));
+    }
+    // A server having an inflight request without latency measured is
+    // avoided, so both servers are chosen in turn at first.
+    brpc::Controller cntl;
+    in.begin_time_us = butil::gettimeofday_us();
+    ASSERT_EQ(0, lb.SelectServer(in, &out));
+    ASSERT_TRUE(out.need_feedback);
+    const brpc::SocketId first = ptr->id();
+    ASSERT_EQ(0, lb.SelectServer(in, &out));
+    ASSERT_NE(first, ptr->id());
+    // The first server is 100 times faster.
+    const brpc::LoadBalancer::CallInfo info1 =
+        { in.begin_time_us - 1000, ids[0].id, 0, &cntl };
+    lb.Feedback(info1);
+    const brpc::LoadBalancer::CallInfo info2 =
+        { in.begin_time_us - 100000, ids[1].id, 0, &cntl };
+    lb.Feedback(info2);
+    for (int i = 0; i < 100; ++i) {
+        in.begin_time_us = butil::gettimeofday_us();
+        ASSERT_EQ(0, lb.SelectServer(in, &out));
+        ASSERT_EQ(ids[0].id, ptr->id());
+        const brpc::LoadBalancer::CallInfo info =
+            { in.begin_time_us - 1000, ptr->id(), 0, &cntl };
+        lb.Feedback(info);
+    }
+    std::ostringstream os;
+    brpc::DescribeOptions opt;
+    opt.verbose = true;
+    lb.Describe(os, opt);
+    LOG(INFO) << os.str();
+
+    // Excluded servers are not chosen unless there's no other choice.
+    brpc::ExcludedServers* excluded = brpc::ExcludedServers::Create(1);
+    excluded->Add(ids[0].id);
+    in.excluded = excluded;
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(0, lb.SelectServer(in, &out));
+        ASSERT_EQ(ids[1].id, ptr->id());
+    }
+    ASSERT_TRUE(lb.RemoveServer(ids[1]));
+    ASSERT_EQ(0, lb.SelectServer(in, &out));
+    ASSERT_EQ(ids[0].id, ptr->id());
+    brpc::ExcludedServers::Destroy(excluded);
+    in.excluded = NULL;
+
+    ASSERT_EQ(0, brpc::Socket::SetFailed(ids[0].id));
+    ASSERT_EQ(EHOSTDOWN, lb.SelectServer(in, &out));
+    ASSERT_TRUE(lb.RemoveServer(ids[0]));
+    ASSERT_EQ(ENODATA, lb.SelectServer(in, &out));
+    ASSERT_EQ(0, brpc::Socket::SetFailed(ids[1].id));
+}
+
+// Simulated servers whose latencies grow with the number of concurrent
+// requests, like real servers with limited capacity.
+struct SimulatedCluster {
+    brpc::LoadBalancer* lb;
+    std::map<brpc::SocketId, size_t> index;
+    std::vector<int64_t> base_latency_us;
+    std::vector<butil::atomic<int>*> inflight;
+    butil::atomic<int64_t> nslow_chosen;
+    std::vector<int64_t>* latencies;
+    pthread_mutex_t mutex;
+};
+
+void* simulate_client(void* arg) {
+    SimulatedCluster* c = (SimulatedCluster*)arg;
+    std::vector<int64_t> latencies;
+    brpc::SocketUniquePtr ptr;
+    brpc::Controller cntl;
+    while (!global_stop) {
+        brpc::LoadBalancer::SelectIn in =
+            { butil::gettimeofday_us(), true, false, 0u, NULL };
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        if (c->lb->SelectServer(in, &out) != 0) {
+            LOG(ERROR) << "Fail to select server";
+            break;
+        }
+        const size_t i = c->index[ptr->id()];
+        const int concurrency = c->inflight[i]->fetch_add(1) + 1;
+        // Every server handles 4 requests in parallel without slowing down.
+        const int64_t latency_us =
+            c->base_latency_us[i] * std::max(concurrency, 4) / 4;
+        bthread_usleep(latency_us);
+        c->inflight[i]->fetch_sub(1);
+        if (c->base_latency_us[i] != c->base_latency_us[0]) {
+            c->nslow_chosen.fetch_add(1);
+        }
+        if (out.need_feedback) {
+            const brpc::LoadBalancer::CallInfo info =
+                { in.begin_time_us, ptr->id(), 0, &cntl };
+            c->lb->Feedback(info);
+        }
+        latencies.push_back(butil::gettimeofday_us() - in.begin_time_us);
+    }
+    BAIDU_SCOPED_LOCK(c->mutex);
+    c->latencies->insert(c->latencies->end(), latencies.begin(), latencies.end());
+    return NULL;
+}
+
+// Compare p2c with la in a cluster with a few slow servers.
+TEST_F(LoadBalancerTest, p2c_vs_la_simulation) {
+    const size_t NSERVER = 32;
+    const size_t NSLOW = 4;
+    const size_t NCLIENT = 64;
+    int64_t p2c_avg_latency = 0;
+    int64_t la_avg_latency = 0;
+    for (int round = 0; round < 2; ++round) {
+        brpc::LoadBalancer* lb = NULL;
+        if (round == 0) {
+            lb = new brpc::policy::P2CLoadBalancer;
+        } else {
+            lb = new LALB;
+        }
+        std::vector<int64_t> latencies;
+        SimulatedCluster c;
+        c.lb = lb;
+        c.nslow_chosen.store(0);
+        c.latencies = &latencies;
+        pthread_mutex_init(&c.mutex, NULL);
+        std::vector<brpc::ServerId> ids;
+        for (size_t i = 0; i < NSERVER; ++i) {
+            char addr[32];
+            snprintf(addr, sizeof(addr), "192.168.2.%d:8080", (int)i);
+            butil::EndPoint dummy;
+            ASSERT_EQ(0, str2endpoint(addr, &dummy));
+            brpc::ServerId id(8888);
+            brpc::SocketOptions options;
+            options.remote_side = dummy;
+            ASSERT_EQ(0, brpc::Socket::Create(options, &id.id));
+            ids.push_back(id);
+            c.index[id.id] = i;
+            // The last NSLOW servers are 10 times slower.
+            c.base_latency_us.push_back(i + NSLOW < NSERVER ? 1000 : 10000);
+            c.inflight.push_back(new butil::atomic<int>(0));
+        }
+        ASSERT_EQ(NSERVER, lb->AddServersInBatch(ids));
+
+        global_stop = false;
+        bthread_t th[NCLIENT];
+        butil::Timer tm;
+        tm.start();
+        for (size_t i = 0; i < NCLIENT; ++i) {
+            ASSERT_EQ(0, bthread_start_background(&th[i], NULL, simulate_client, &c));
+        }
+        bthread_usleep(2000000);
+        global_stop = true;
+        for (size_t i = 0; i < NCLIENT; ++i) {
+            ASSERT_EQ(0, bthread_join(th[i], NULL));
+        }
+        tm.stop();
+
+        ASSERT_FALSE(latencies.empty());
+        std::sort(latencies.begin(), latencies.end());
+        int64_t sum = 0;
+        for (size_t i = 0; i < latencies.size(); ++i) {
+            sum += latencies[i];
+        }
+        const int64_t avg = sum / (int64_t)latencies.size();
+        const double slow_ratio =
+            c.nslow_chosen.load() / (double)latencies.size();
+        LOG(INFO) << (round == 0 ? "p2c" : "la") << ": qps="
+                  << latencies.size() * 1000 / tm.m_elapsed()
+                  << " avg=" << avg << "us"
+                  << " p99=" << latencies[latencies.size() * 99 / 100] << "us"
+                  << " max=" << latencies.back() << "us"
+                  << " slow_servers=" << slow_ratio * 100 << '%'
+                  << " (fair share=" << NSLOW * 100.0 / NSERVER << "%)";
+        if (round == 0) {
+            p2c_avg_latency = avg;
+            // Slow servers get much less traffic than fair share.
+            ASSERT_LT(slow_ratio, NSLOW / (double)NSERVER / 2);
+        } else {
+            la_avg_latency = avg;
+        }
+        for (size_t i = 0; i < ids.size(); ++i) {
+            ASSERT_EQ(0, brpc::Socket::SetFailed(ids[i].id));
+            delete c.inflight[i];
+        }
+        pthread_mutex_destroy(&c.mutex);
+        delete lb;
+    }
+    LOG(INFO) << "Average latency of p2c=" << p2c_avg_latency
+              << "us la=" << la_avg_latency << "us";
+}
+
 } //namespace
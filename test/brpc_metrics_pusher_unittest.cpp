@@ -0,0 +1,223 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/time.h"
+#include "bvar/bvar.h"
+#include "brpc/server.h"
+#include "brpc/controller.h"
+#include "brpc/metrics_pusher.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+// A stand-in collector keeping the last request and state of one source.
+class CollectorImpl : public brpc::MetricsCollectorService {
+public:
+    CollectorImpl() : npush(0), interval(0) {}
+
+    void Push(google::protobuf::RpcController* cntl_base,
+              const brpc::MetricsPushRequest* request,
+              brpc::MetricsPushResponse* response,
+              google::protobuf::Closure* done) override {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
+        last_compress_type = cntl->request_compress_type();
+        last_request = *request;
+        ++npush;
+        if (state.Apply(*request) != 0) {
+            response->set_resync(true);
+        }
+        if (interval > 0) {
+            response->set_new_interval(interval);
+        }
+    }
+
+    // Value of `name' in the state, -1 if not found.
+    int64_t Find(const std::string& name) const {
+        std::vector<const brpc::MetricsPushState::Series*> series;
+        state.List(&series);
+        for (size_t i = 0; i < series.size(); ++i) {
+            if (series[i]->name == name) {
+                return series[i]->is_int ? series[i]->int_value
+                    : (int64_t)series[i]->float_value;
+            }
+        }
+        return -1;
+    }
+
+    int npush;
+    int interval;
+    brpc::CompressType last_compress_type;
+    brpc::MetricsPushRequest last_request;
+    brpc::MetricsPushState state;
+};
+
+class MetricsPusherTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_EQ(0, _server.AddService(&_collector,
+                                        brpc::SERVER_DOESNT_OWN_SERVICE));
+        ASSERT_EQ(0, _server.Start("127.0.0.1:8619", NULL));
+    }
+    void TearDown() override {
+        _server.Stop(0);
+        _server.Join();
+    }
+
+    brpc::Server _server;
+    CollectorImpl _collector;
+};
+
+TEST_F(MetricsPusherTest, push_changes_only) {
+    bvar::Adder<int> a("metrics_pusher_a");
+    bvar::Status<double> d("metrics_pusher_d", 0.5);
+    bvar::Status<std::string> str("metrics_pusher_str", "text");
+    a << 10;
+    brpc::MetricsPusher pusher;
+    ASSERT_EQ(0, pusher.Init("127.0.0.1:8619", "", NULL));
+    ASSERT_EQ(0, pusher.PushOnce());
+    ASSERT_TRUE(_collector.last_request.full());
+    ASSERT_EQ(brpc::COMPRESS_TYPE_SNAPPY, _collector.last_compress_type);
+    ASSERT_EQ(10, _collector.Find("metrics_pusher_a"));
+    ASSERT_EQ(0, _collector.Find("metrics_pusher_d"));
+    ASSERT_EQ(-1, _collector.Find("metrics_pusher_str"));
+    const size_t nseries = _collector.state.size();
+
+    // Only the changed series are pushed.
+    a << 5;
+    d.set_value(2.5);
+    ASSERT_EQ(0, pusher.PushOnce());
+    const brpc::MetricsPushRequest& req = _collector.last_request;
+    ASSERT_FALSE(req.full());
+    for (int i = 0; i < req.new_names_size(); ++i) {
+        ASSERT_NE("metrics_pusher_a", req.new_names(i));
+    }
+    ASSERT_LT((size_t)(req.int_id_deltas_size() + req.float_id_deltas_size()),
+              nseries / 2);
+    ASSERT_EQ(15, _collector.Find("metrics_pusher_a"));
+    ASSERT_EQ(2, _collector.Find("metrics_pusher_d"));
+
+    // New and removed series.
+    bvar::Adder<int>* b = new bvar::Adder<int>("metrics_pusher_b");
+    *b << 3;
+    ASSERT_EQ(0, pusher.PushOnce());
+    ASSERT_EQ(3, _collector.Find("metrics_pusher_b"));
+    const size_t nseries2 = _collector.state.size();
+    delete b;
+    ASSERT_EQ(0, pusher.PushOnce());
+    ASSERT_EQ(-1, _collector.Find("metrics_pusher_b"));
+    ASSERT_EQ(nseries2 - 1, _collector.state.size());
+}
+
+TEST_F(MetricsPusherTest, resync) {
+    bvar::Adder<int> a("metrics_pusher_resync");
+    a << 1;
+    brpc::MetricsPusher pusher;
+    ASSERT_EQ(0, pusher.Init("127.0.0.1:8619", "", NULL));
+    ASSERT_EQ(0, pusher.PushOnce());
+    ASSERT_EQ(1, _collector.Find("metrics_pusher_resync"));
+
+    // The collector restarted and lost all states.
+    _collector.state = brpc::MetricsPushState();
+    a << 1;
+    ASSERT_EQ(0, pusher.PushOnce());
+    ASSERT_EQ(0u, _collector.state.size());
+    ASSERT_EQ(0, pusher.PushOnce());
+    ASSERT_TRUE(_collector.last_request.full());
+    ASSERT_EQ(2, _collector.Find("metrics_pusher_resync"));
+
+    // A lost push makes the following one full.
+    _server.Stop(0);
+    _server.Join();
+    a << 1;
+    ASSERT_EQ(-1, pusher.PushOnce());
+    ASSERT_EQ(0, _server.Start("127.0.0.1:8619", NULL));
+    // Wait for the health checking of the channel.
+    int rc = -1;
+    for (int i = 0; i < 100 && rc != 0; ++i) {
+        usleep(100000);
+        rc = pusher.PushOnce();
+    }
+    ASSERT_EQ(0, rc);
+    ASSERT_TRUE(_collector.last_request.full());
+    ASSERT_EQ(3, _collector.Find("metrics_pusher_resync"));
+}
+
+TEST_F(MetricsPusherTest, state_rejects_gaps) {
+    brpc::MetricsPushState state;
+    brpc::MetricsPushRequest req;
+    req.set_epoch(1);
+    req.set_sequence(1);
+    req.set_full(true);
+    req.set_first_new_id(0);
+    req.add_new_names("x");
+    req.add_int_id_deltas(0);
+    req.add_int_value_deltas(7);
+    ASSERT_EQ(0, state.Apply(req));
+    ASSERT_EQ(1u, state.size());
+
+    req.Clear();
+    req.set_epoch(1);
+    req.set_sequence(3);
+    req.add_int_id_deltas(0);
+    req.add_int_value_deltas(1);
+    ASSERT_EQ(-1, state.Apply(req));
+    req.set_sequence(2);
+    ASSERT_EQ(0, state.Apply(req));
+    std::vector<const brpc::MetricsPushState::Series*> series;
+    state.List(&series);
+    ASSERT_EQ(8, series[0]->int_value);
+
+    // Unknown id.
+    req.set_sequence(3);
+    req.set_int_id_deltas(0, 5);
+    ASSERT_EQ(-1, state.Apply(req));
+    req.set_epoch(2);
+    req.set_int_id_deltas(0, 0);
+    ASSERT_EQ(-1, state.Apply(req));
+}
+
+TEST_F(MetricsPusherTest, start_and_stop) {
+    bvar::Adder<int> a("metrics_pusher_periodic");
+    a << 1;
+    _collector.interval = 1;
+    brpc::MetricsPusherOptions options;
+    options.interval_s = 1;
+    options.compress_type = brpc::COMPRESS_TYPE_GZIP;
+    brpc::MetricsPusher pusher;
+    ASSERT_EQ(0, pusher.Init("127.0.0.1:8619", "", &options));
+    ASSERT_EQ(0, pusher.Start());
+    ASSERT_EQ(-1, pusher.Start());
+    usleep(2500000);
+    pusher.Stop();
+    const int npush = _collector.npush;
+    ASSERT_GE(npush, 2);
+    ASSERT_EQ(brpc::COMPRESS_TYPE_GZIP, _collector.last_compress_type);
+    ASSERT_EQ(1, _collector.Find("metrics_pusher_periodic"));
+    usleep(1100000);
+    ASSERT_EQ(npush, _collector.npush);
+}
+
+} // namespace
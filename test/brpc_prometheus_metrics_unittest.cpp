@@ -17,13 +17,23 @@
 
 // brpc - A framework to host and access services throughout Baidu.
 
+#include <map>
 #include <gtest/gtest.h>
+#include <gflags/gflags.h>
 #include "brpc/server.h"
 #include "brpc/channel.h"
 #include "brpc/controller.h"
+#include "brpc/builtin/prometheus_metrics_service.h"
 #include "butil/strings/string_piece.h"
+#include "butil/time.h"
+#include "bvar/bvar.h"
+#include "bvar/multi_dimension.h"
 #include "echo.pb.h"
 
+namespace bvar {
+DECLARE_int32(bvar_max_dump_multi_dimension_metric_number);
+}
+
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -142,3 +152,304 @@ TEST(PrometheusMetrics, sanity) {
     ASSERT_EQ(0, server.Stop(0));
     ASSERT_EQ(0, server.Join());
 }
+
+// Returns value of `series' in the OpenMetrics output, or -1 if not found.
+static int64_t FindSeries(const std::string& res, const std::string& series) {
+    const std::string line = "\n" + series + " ";
+    const size_t pos = res.find(line);
+    if (pos == std::string::npos) {
+        return -1;
+    }
+    return strtoll(res.c_str() + pos + line.size(), NULL, 10);
+}
+
+TEST(PrometheusMetrics, openmetrics) {
+    bvar::FLAGS_bvar_max_dump_multi_dimension_metric_number = 1000;
+    bvar::Adder<int> a("prometheus_openmetrics_a");
+    bvar::Status<std::string> str("prometheus_openmetrics_str", "text");
+    bvar::MultiDimension<bvar::Adder<int> > md(
+        "prometheus_openmetrics_md", {"method", "code"});
+    *md.get_stats({"echo", "200"}) << 3;
+    a << 1;
+
+    butil::IOBuf buf;
+    uint64_t dump_id = 0;
+    ASSERT_EQ(0, brpc::DumpMetricsToIOBuf(&buf, brpc::METRICS_FORMAT_OPENMETRICS,
+                                          0, &dump_id));
+    std::string res = buf.to_string();
+    ASSERT_TRUE(butil::StringPiece(res).ends_with("# EOF\n"));
+    ASSERT_NE(std::string::npos,
+              res.find("# TYPE prometheus_openmetrics_a gauge\n"
+                       "prometheus_openmetrics_a 1\n"));
+    ASSERT_EQ(3, FindSeries(res, "prometheus_openmetrics_md{method=\"echo\",code=\"200\"}"));
+    ASSERT_EQ(std::string::npos, res.find("prometheus_openmetrics_str"));
+
+    // Only changed series are dumped.
+    a << 1;
+    buf.clear();
+    uint64_t dump_id2 = 0;
+    ASSERT_EQ(0, brpc::DumpMetricsToIOBuf(&buf, brpc::METRICS_FORMAT_OPENMETRICS,
+                                          dump_id, &dump_id2));
+    ASSERT_GT(dump_id2, dump_id);
+    res = buf.to_string();
+    ASSERT_EQ(2, FindSeries(res, "prometheus_openmetrics_a"));
+    ASSERT_EQ(-1, FindSeries(res, "prometheus_openmetrics_md{method=\"echo\",code=\"200\"}"));
+
+    // Nothing changed.
+    buf.clear();
+    ASSERT_EQ(0, brpc::DumpMetricsToIOBuf(&buf, brpc::METRICS_FORMAT_OPENMETRICS,
+                                          dump_id2, &dump_id));
+    res = buf.to_string();
+    ASSERT_EQ(-1, FindSeries(res, "prometheus_openmetrics_a"));
+
+    // Full dump again.
+    buf.clear();
+    ASSERT_EQ(0, brpc::DumpMetricsToIOBuf(&buf, brpc::METRICS_FORMAT_OPENMETRICS,
+                                          0, NULL));
+    res = buf.to_string();
+    ASSERT_EQ(2, FindSeries(res, "prometheus_openmetrics_a"));
+    ASSERT_EQ(3, FindSeries(res, "prometheus_openmetrics_md{method=\"echo\",code=\"200\"}"));
+
+    // Hidden variables are removed from the cache and dumped again after
+    // being re-exposed.
+    a.hide();
+    buf.clear();
+    ASSERT_EQ(0, brpc::DumpMetricsToIOBuf(&buf, brpc::METRICS_FORMAT_OPENMETRICS,
+                                          0, &dump_id));
+    ASSERT_EQ(-1, FindSeries(buf.to_string(), "prometheus_openmetrics_a"));
+    a.expose("prometheus_openmetrics_a");
+    buf.clear();
+    ASSERT_EQ(0, brpc::DumpMetricsToIOBuf(&buf, brpc::METRICS_FORMAT_OPENMETRICS,
+                                          dump_id, NULL));
+    ASSERT_EQ(2, FindSeries(buf.to_string(), "prometheus_openmetrics_a"));
+}
+
+static uint64_t ReadVarint(const std::string& data, size_t* pos) {
+    uint64_t value = 0;
+    for (int shift = 0; *pos < data.size(); shift += 7) {
+        const uint8_t c = data[(*pos)++];
+        value |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            break;
+        }
+    }
+    return value;
+}
+
+TEST(PrometheusMetrics, protobuf) {
+    bvar::FLAGS_bvar_max_dump_multi_dimension_metric_number = 1000;
+    bvar::Adder<int> a("prometheus_protobuf_a");
+    bvar::MultiDimension<bvar::Adder<int> > md(
+        "prometheus_protobuf_md", {"method"});
+    *md.get_stats({"echo"}) << 7;
+    *md.get_stats({"ping"}) << 8;
+    a << 5;
+    butil::IOBuf buf;
+    ASSERT_EQ(0, brpc::DumpMetricsToIOBuf(&buf, brpc::METRICS_FORMAT_PROTOBUF,
+                                          0, NULL));
+    const std::string res = buf.to_string();
+    // Decode the length-delimited MetricFamily messages by hand.
+    std::map<std::string, double> values;
+    size_t pos = 0;
+    while (pos < res.size()) {
+        const size_t end = ReadVarint(res, &pos) + pos;
+        ASSERT_LE(end, res.size());
+        ASSERT_EQ(0x0A, res[pos++]);
+        const size_t name_len = ReadVarint(res, &pos);
+        const std::string name = res.substr(pos, name_len);
+        pos += name_len;
+        ASSERT_EQ(0x18, res[pos++]);
+        ASSERT_EQ(1, res[pos++]);   // GAUGE
+        while (pos < end) {
+            ASSERT_EQ(0x22, res[pos++]);
+            const size_t metric_end = ReadVarint(res, &pos) + pos;
+            std::string labels;
+            while (res[pos] == 0x0A) {
+                ++pos;
+                ReadVarint(res, &pos);
+                for (int i = 0; i < 2; ++i) {
+                    ++pos;
+                    const size_t len = ReadVarint(res, &pos);
+                    labels.append(res, pos, len).push_back(i == 0 ? '=' : ',');
+                    pos += len;
+                }
+            }
+            ASSERT_EQ("\x12\x09\x09", res.substr(pos, 3));
+            pos += 3;
+            double value = 0;
+            memcpy(&value, res.data() + pos, sizeof(value));
+            pos += sizeof(value);
+            ASSERT_EQ(metric_end, pos);
+            values[name + "{" + labels + "}"] = value;
+        }
+        ASSERT_EQ(end, pos);
+    }
+    ASSERT_EQ(5, values["prometheus_protobuf_a{}"]);
+    ASSERT_EQ(7, values["prometheus_protobuf_md{method=echo,}"]);
+    ASSERT_EQ(8, values["prometheus_protobuf_md{method=ping,}"]);
+}
+
+TEST(PrometheusMetrics, query_format) {
+    bvar::Adder<int> a("prometheus_query_format_a");
+    a << 1;
+    brpc::Server server;
+    DummyEchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(&echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start("127.0.0.1:8616", NULL));
+    brpc::Channel channel;
+    brpc::ChannelOptions channel_opts;
+    channel_opts.protocol = "http";
+    ASSERT_EQ(0, channel.Init("127.0.0.1:8616", &channel_opts));
+
+    brpc::Controller cntl;
+    cntl.http_request().uri() = "/brpc_metrics?format=openmetrics";
+    channel.CallMethod(NULL, &cntl, NULL, NULL, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(brpc::MetricsContentType(brpc::METRICS_FORMAT_OPENMETRICS),
+              cntl.http_response().content_type());
+    ASSERT_EQ(1, FindSeries(cntl.response_attachment().to_string(),
+                            "prometheus_query_format_a"));
+    const std::string* dump_id_str = cntl.http_response().GetHeader("x-bvar-dump-id");
+    ASSERT_TRUE(dump_id_str != NULL);
+    const std::string dump_id = *dump_id_str;
+
+    cntl.Reset();
+    cntl.http_request().uri() = "/brpc_metrics?format=openmetrics&changed_since=" + dump_id;
+    channel.CallMethod(NULL, &cntl, NULL, NULL, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(-1, FindSeries(cntl.response_attachment().to_string(),
+                             "prometheus_query_format_a"));
+
+    cntl.Reset();
+    cntl.http_request().uri() = "/brpc_metrics?format=json";
+    channel.CallMethod(NULL, &cntl, NULL, NULL, NULL);
+    ASSERT_TRUE(cntl.Failed());
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+TEST(PrometheusMetrics, histogram) {
+    // Buckets: 1, 2, 3, 4, 6, 8, +Inf
+    bvar::Histogram h("prometheus_histogram", bvar::HistogramBuckets(1, 8, 1));
+    h << 1 << 3 << 5 << 100;
+    const std::string expected =
+        "# TYPE prometheus_histogram histogram\n"
+        "prometheus_histogram_bucket{le=\"1\"} 1\n"
+        "prometheus_histogram_bucket{le=\"2\"} 1\n"
+        "prometheus_histogram_bucket{le=\"3\"} 2\n"
+        "prometheus_histogram_bucket{le=\"4\"} 2\n"
+        "prometheus_histogram_bucket{le=\"6\"} 3\n"
+        "prometheus_histogram_bucket{le=\"8\"} 3\n"
+        "prometheus_histogram_bucket{le=\"+Inf\"} 4\n"
+        "prometheus_histogram_sum 109\n"
+        "prometheus_histogram_count 4\n";
+
+    butil::IOBuf buf;
+    ASSERT_EQ(0, brpc::DumpPrometheusMetricsToIOBuf(&buf));
+    ASSERT_NE(std::string::npos, buf.to_string().find(expected));
+
+    buf.clear();
+    uint64_t dump_id = 0;
+    ASSERT_EQ(0, brpc::DumpMetricsToIOBuf(&buf, brpc::METRICS_FORMAT_OPENMETRICS,
+                                          0, &dump_id));
+    ASSERT_NE(std::string::npos, buf.to_string().find(expected));
+    // Unchanged histograms are not dumped.
+    buf.clear();
+    ASSERT_EQ(0, brpc::DumpMetricsToIOBuf(&buf, brpc::METRICS_FORMAT_OPENMETRICS,
+                                          dump_id, &dump_id));
+    ASSERT_EQ(std::string::npos, buf.to_string().find("prometheus_histogram"));
+    h << 2;
+    buf.clear();
+    ASSERT_EQ(0, brpc::DumpMetricsToIOBuf(&buf, brpc::METRICS_FORMAT_OPENMETRICS,
+                                          dump_id, &dump_id));
+    ASSERT_EQ(2, FindSeries(buf.to_string(), "prometheus_histogram_bucket{le=\"2\"}"));
+
+    buf.clear();
+    ASSERT_EQ(0, brpc::DumpMetricsToIOBuf(&buf, brpc::METRICS_FORMAT_PROTOBUF,
+                                          0, NULL));
+    const std::string res = buf.to_string();
+    const std::string name = "prometheus_histogram";
+    size_t pos = res.find(std::string(1, (char)name.size()) + name);
+    ASSERT_NE(std::string::npos, pos);
+    pos += name.size() + 1;
+    ASSERT_EQ(0x18, res[pos++]);
+    ASSERT_EQ(4, res[pos++]);   // HISTOGRAM
+    ASSERT_EQ(0x22, res[pos++]);
+    ReadVarint(res, &pos);
+    ASSERT_EQ(0x3A, res[pos++]);
+    const size_t end = ReadVarint(res, &pos) + pos;
+    ASSERT_EQ(0x08, res[pos++]);
+    ASSERT_EQ(5u, ReadVarint(res, &pos));
+    ASSERT_EQ(0x11, res[pos++]);
+    double sum = 0;
+    memcpy(&sum, res.data() + pos, sizeof(sum));
+    pos += sizeof(sum);
+    ASSERT_EQ(111, sum);
+    const uint64_t cumulative_counts[] = { 1, 2, 3, 3, 4, 4 };
+    const double upper_bounds[] = { 1, 2, 3, 4, 6, 8 };
+    for (size_t i = 0; i < arraysize(cumulative_counts); ++i) {
+        ASSERT_EQ(0x1A, res[pos++]);
+        ReadVarint(res, &pos);
+        ASSERT_EQ(0x08, res[pos++]);
+        ASSERT_EQ(cumulative_counts[i], ReadVarint(res, &pos));
+        ASSERT_EQ(0x11, res[pos++]);
+        double upper_bound = 0;
+        memcpy(&upper_bound, res.data() + pos, sizeof(upper_bound));
+        pos += sizeof(upper_bound);
+        ASSERT_EQ(upper_bounds[i], upper_bound);
+    }
+    ASSERT_EQ(end, pos);
+}
+
+TEST(PrometheusMetrics, scrape_cost) {
+    const size_t counts[] = { 1000, 10000, 30000 };
+    std::vector<bvar::Adder<int>*> vars;
+    for (size_t i = 0; i < arraysize(counts); ++i) {
+        while (vars.size() < counts[i]) {
+            bvar::Adder<int>* a = new bvar::Adder<int>;
+            a->expose_as("prometheus_scrape_cost", std::to_string(vars.size()));
+            *a << 1;
+            vars.push_back(a);
+        }
+        butil::IOBuf buf;
+        butil::Timer tm;
+        tm.start();
+        ASSERT_EQ(0, brpc::DumpPrometheusMetricsToIOBuf(&buf));
+        tm.stop();
+        const int64_t text_us = tm.u_elapsed();
+        const size_t text_size = buf.size();
+        int64_t us[2] = { 0, 0 };
+        size_t size[2] = { 0, 0 };
+        const brpc::MetricsFormat formats[2] = {
+            brpc::METRICS_FORMAT_OPENMETRICS, brpc::METRICS_FORMAT_PROTOBUF };
+        uint64_t dump_id = 0;
+        for (int j = 0; j < 2; ++j) {
+            // The first dump fills the cache.
+            buf.clear();
+            ASSERT_EQ(0, brpc::DumpMetricsToIOBuf(&buf, formats[j], 0, NULL));
+            buf.clear();
+            tm.start();
+            ASSERT_EQ(0, brpc::DumpMetricsToIOBuf(&buf, formats[j], 0, &dump_id));
+            tm.stop();
+            us[j] = tm.u_elapsed();
+            size[j] = buf.size();
+        }
+        // 1% of the series changed.
+        for (size_t j = 0; j < vars.size(); j += 100) {
+            *vars[j] << 1;
+        }
+        buf.clear();
+        tm.start();
+        ASSERT_EQ(0, brpc::DumpMetricsToIOBuf(
+                      &buf, brpc::METRICS_FORMAT_PROTOBUF, dump_id, NULL));
+        tm.stop();
+        LOG(INFO) << "series=" << vars.size()
+                  << " text=" << text_us << "us/" << text_size << "B"
+                  << " openmetrics=" << us[0] << "us/" << size[0] << "B"
+                  << " protobuf=" << us[1] << "us/" << size[1] << "B"
+                  << " changed_only=" << tm.u_elapsed() << "us/" << buf.size() << "B";
+    }
+    for (size_t i = 0; i < vars.size(); ++i) {
+        delete vars[i];
+    }
+}
@@ -29,6 +29,7 @@
 #include "butil/fd_guard.h"
 #include "butil/files/scoped_file.h"
 #include "brpc/socket.h"
+#include "brpc/acceptor.h"
 #include "brpc/builtin/version_service.h"
 #include "brpc/builtin/health_service.h"
 #include "brpc/builtin/list_service.h"
@@ -51,11 +52,18 @@
 #include "brpc/channel.h"
 #include "brpc/socket_map.h"
 #include "brpc/controller.h"
+#include "brpc/details/method_status.h"
+#include "brpc/details/codel_shedder.h"
 #include "echo.pb.h"
 #include "v1.pb.h"
 #include "v2.pb.h"
 
+namespace bthread {
+DECLARE_string(bthread_worker_groups);
+}
+
 int main(int argc, char* argv[]) {
+    bthread::FLAGS_bthread_worker_groups = "rt:2,batch:2";
     testing::InitGoogleTest(&argc, argv);
     GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
     return RUN_ALL_TESTS();
@@ -67,6 +75,7 @@ DECLARE_bool(enable_dir_service);
 
 namespace policy {
 DECLARE_bool(use_http_error_code);
+DECLARE_bool(baidu_std_protocol_deliver_timeout_ms);
 }
 
 }
@@ -1383,6 +1392,410 @@ TEST_F(ServerTest, serving_requests) {
     ASSERT_EQ(0, server.Join());
 }
 
+TEST_F(ServerTest, reuse_port_listeners) {
+    EchoServiceImpl echo_svc;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&echo_svc,
+                                   brpc::SERVER_DOESNT_OWN_SERVICE));
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8614", &ep));
+    brpc::ServerOptions opt;
+    opt.num_reuse_port_listeners = 4;
+    ASSERT_EQ(0, server.Start(ep, &opt));
+    ASSERT_EQ(4u, server._am->ListenerCount());
+
+    // Connections accepted from any listener stay in its dispatcher.
+    const int NCONN = 16;
+    butil::fd_guard cfds[NCONN];
+    for (int i = 0; i < NCONN; ++i) {
+        cfds[i].reset(tcp_connect(ep, NULL));
+        ASSERT_GT(cfds[i], 0);
+    }
+    usleep(10000);
+    std::vector<brpc::SocketId> conns;
+    server._am->ListConnections(&conns);
+    ASSERT_EQ((size_t)NCONN, conns.size());
+    for (size_t i = 0; i < conns.size(); ++i) {
+        brpc::SocketUniquePtr sock;
+        ASSERT_EQ(0, brpc::Socket::Address(conns[i], &sock));
+        ASSERT_GE(sock->_event_dispatcher_index, 0);
+        ASSERT_LT(sock->_event_dispatcher_index, 4);
+    }
+
+    brpc::ChannelOptions copt;
+    copt.connection_type = brpc::CONNECTION_TYPE_SHORT;
+    brpc::Channel chan;
+    ASSERT_EQ(0, chan.Init(ep, &copt));
+    test::EchoService_Stub stub(&chan);
+    const int COUNT = 32;
+    for (int i = 0; i < COUNT; ++i) {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(EXP_REQUEST);
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(EXP_RESPONSE, res.message());
+    }
+    ASSERT_EQ(COUNT, echo_svc.count.load());
+    for (int i = 0; i < NCONN; ++i) {
+        cfds[i].reset(-1);
+    }
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+    ASSERT_EQ(-1, server._am->listened_fd());
+}
+
+TEST_F(ServerTest, reuse_port_listeners_join_existing_group) {
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8615", &ep));
+    // Another member of the SO_REUSEPORT group, e.g. of another process.
+    butil::fd_guard foreign_fd(tcp_listen(ep, true));
+    ASSERT_GE(foreign_fd, 0);
+
+    EchoServiceImpl echo_svc;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&echo_svc,
+                                   brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::ServerOptions opt;
+    opt.num_reuse_port_listeners = 2;
+    ASSERT_EQ(0, server.Start(ep, &opt));
+    ASSERT_TRUE(server.IsRunning());
+    ASSERT_EQ(2u, server._am->ListenerCount());
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+    ASSERT_FALSE(server.IsRunning());
+
+    // The server can start again after the group is gone.
+    foreign_fd.reset(-1);
+    ASSERT_EQ(0, server.Start(ep, &opt));
+    ASSERT_EQ(2u, server._am->ListenerCount());
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+class TagEchoService : public test::EchoService {
+public:
+    TagEchoService() : tag(BTHREAD_TAG_INVALID) {}
+    void Echo(google::protobuf::RpcController*,
+              const test::EchoRequest* request,
+              test::EchoResponse* response,
+              google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        tag = bthread_self_tag();
+        response->set_message(request->message());
+    }
+    bthread_tag_t tag;
+};
+
+TEST_F(ServerTest, worker_groups) {
+    const bthread_tag_t rt = bthread_worker_group_tag("rt");
+    const bthread_tag_t batch = bthread_worker_group_tag("batch");
+    ASSERT_NE(BTHREAD_TAG_INVALID, rt);
+    ASSERT_NE(BTHREAD_TAG_INVALID, batch);
+
+    TagEchoService echo_svc;
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8615", &ep));
+    {
+        brpc::Server server;
+        brpc::ServiceOptions svc_opt;
+        svc_opt.bthread_worker_group = "not_exist";
+        ASSERT_EQ(-1, server.AddService(&echo_svc, svc_opt));
+        ASSERT_EQ(0, server.AddService(&echo_svc,
+                                       brpc::SERVER_DOESNT_OWN_SERVICE));
+        brpc::ServerOptions opt;
+        opt.bthread_worker_group = "not_exist";
+        ASSERT_EQ(-1, server.Start(ep, &opt));
+    }
+    const char* const protocols[] = { "baidu_std", "http" };
+    for (int use_svc_opt = 0; use_svc_opt < 2; ++use_svc_opt) {
+        brpc::Server server;
+        brpc::ServiceOptions svc_opt;
+        brpc::ServerOptions opt;
+        // Either the whole server or only the service runs in a group.
+        if (use_svc_opt) {
+            svc_opt.bthread_worker_group = "batch";
+        } else {
+            opt.bthread_worker_group = "rt";
+        }
+        ASSERT_EQ(0, server.AddService(&echo_svc, svc_opt));
+        ASSERT_EQ(0, server.Start(ep, &opt));
+        brpc::Channel chans[ARRAY_SIZE(protocols)];
+        for (size_t i = 0; i < ARRAY_SIZE(protocols); ++i) {
+            brpc::ChannelOptions copt;
+            copt.protocol = protocols[i];
+            ASSERT_EQ(0, chans[i].Init(ep, &copt));
+            test::EchoService_Stub stub(&chans[i]);
+            brpc::Controller cntl;
+            test::EchoRequest req;
+            test::EchoResponse res;
+            req.set_message(EXP_REQUEST);
+            echo_svc.tag = BTHREAD_TAG_INVALID;
+            stub.Echo(&cntl, &req, &res, NULL);
+            ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+            ASSERT_EQ(EXP_REQUEST, res.message());
+            ASSERT_EQ(use_svc_opt ? batch : rt, echo_svc.tag) << protocols[i];
+        }
+        std::vector<brpc::SocketId> conns;
+        server._am->ListConnections(&conns);
+        ASSERT_FALSE(conns.empty());
+        for (size_t i = 0; i < conns.size(); ++i) {
+            brpc::SocketUniquePtr sock;
+            ASSERT_EQ(0, brpc::Socket::Address(conns[i], &sock));
+            ASSERT_EQ(use_svc_opt ? BTHREAD_TAG_DEFAULT : rt, sock->_bthread_tag);
+        }
+        ASSERT_EQ(0, server.Stop(0));
+        ASSERT_EQ(0, server.Join());
+    }
+}
+
+class PriorityEchoService : public test::EchoService {
+public:
+    PriorityEchoService() : priority(-100) {}
+    void Echo(google::protobuf::RpcController*,
+              const test::EchoRequest* request,
+              test::EchoResponse* response,
+              google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        bthread_attr_t attr;
+        EXPECT_EQ(0, bthread_getattr(bthread_self(), &attr));
+        priority = attr.priority;
+        response->set_message(request->message());
+    }
+    bthread_priority_t priority;
+};
+
+TEST_F(ServerTest, method_priority) {
+    PriorityEchoService echo_svc;
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8615", &ep));
+    {
+        brpc::Server server;
+        brpc::ServiceOptions svc_opt;
+        svc_opt.bthread_priority = BTHREAD_PRIORITY_HIGH + 1;
+        ASSERT_EQ(-1, server.AddService(&echo_svc, svc_opt));
+        ASSERT_EQ(0, server.AddService(&echo_svc,
+                                       brpc::SERVER_DOESNT_OWN_SERVICE));
+        ASSERT_EQ(-1, server.SetMethodPriority("test.EchoService.NotExist",
+                                               BTHREAD_PRIORITY_LOW));
+        ASSERT_EQ(-1, server.SetMethodPriority("test.EchoService.Echo",
+                                               BTHREAD_PRIORITY_LOW - 1));
+    }
+    const char* const protocols[] = { "baidu_std", "http" };
+    const bthread_priority_t priorities[] = {
+        BTHREAD_PRIORITY_LOW, BTHREAD_PRIORITY_NORMAL, BTHREAD_PRIORITY_HIGH };
+    for (size_t p = 0; p < ARRAY_SIZE(priorities); ++p) {
+        brpc::Server server;
+        brpc::ServiceOptions svc_opt;
+        // Overridden by SetMethodPriority() below.
+        svc_opt.bthread_priority = BTHREAD_PRIORITY_LOW;
+        ASSERT_EQ(0, server.AddService(&echo_svc, svc_opt));
+        ASSERT_EQ(0, server.SetMethodPriority("test.EchoService.Echo",
+                                              priorities[p]));
+        ASSERT_EQ(0, server.Start(ep, NULL));
+        ASSERT_EQ(-1, server.SetMethodPriority("test.EchoService.Echo",
+                                               BTHREAD_PRIORITY_NORMAL));
+        const brpc::Server::MethodProperty* health_mp =
+            server.FindMethodPropertyByFullName(
+                brpc::HealthService::descriptor()->method(0)->full_name());
+        ASSERT_TRUE(health_mp != NULL);
+        ASSERT_EQ(BTHREAD_PRIORITY_HIGH, health_mp->bthread_priority);
+        for (size_t i = 0; i < ARRAY_SIZE(protocols); ++i) {
+            brpc::Channel chan;
+            brpc::ChannelOptions copt;
+            copt.protocol = protocols[i];
+            ASSERT_EQ(0, chan.Init(ep, &copt));
+            test::EchoService_Stub stub(&chan);
+            brpc::Controller cntl;
+            test::EchoRequest req;
+            test::EchoResponse res;
+            req.set_message(EXP_REQUEST);
+            echo_svc.priority = -100;
+            stub.Echo(&cntl, &req, &res, NULL);
+            ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+            ASSERT_EQ(EXP_REQUEST, res.message());
+            ASSERT_EQ(priorities[p], echo_svc.priority) << protocols[i];
+        }
+        ASSERT_EQ(0, server.Stop(0));
+        ASSERT_EQ(0, server.Join());
+    }
+}
+
+TEST_F(ServerTest, method_stage_latency) {
+    EchoServiceImpl echo_svc;
+    // Methods of low priority are called in new bthreads.
+    const bthread_priority_t priorities[] = {
+        BTHREAD_PRIORITY_NORMAL, BTHREAD_PRIORITY_LOW };
+    for (size_t p = 0; p < ARRAY_SIZE(priorities); ++p) {
+        brpc::Server server;
+        brpc::ServiceOptions svc_opt;
+        svc_opt.ownership = brpc::SERVER_DOESNT_OWN_SERVICE;
+        svc_opt.bthread_priority = priorities[p];
+        ASSERT_EQ(0, server.AddService(&echo_svc, svc_opt));
+        ASSERT_EQ(0, server.Start(8616, NULL));
+        const brpc::Server::MethodProperty* mp =
+            server.FindMethodPropertyByFullName("test.EchoService.Echo");
+        ASSERT_TRUE(mp != NULL && mp->status != NULL);
+        ASSERT_TRUE(mp->status->_stage_latency != NULL);
+
+        brpc::Channel chan;
+        ASSERT_EQ(0, chan.Init("127.0.0.1:8616", NULL));
+        test::EchoService_Stub stub(&chan);
+        const int N = 5;
+        for (int i = 0; i < N; ++i) {
+            brpc::Controller cntl;
+            test::EchoRequest req;
+            test::EchoResponse res;
+            req.set_message(EXP_REQUEST);
+            req.set_sleep_us(20000);
+            stub.Echo(&cntl, &req, &res, NULL);
+            ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        }
+        // The response is written before the client is notified, but the
+        // stages are recorded after that.
+        usleep(10000);
+        typedef brpc::MethodStatus MS;
+        const MS::StageLatency* stages = mp->status->_stage_latency.get();
+        for (int i = 0; i < MS::STAGE_COUNT; ++i) {
+            ASSERT_EQ(N, stages[i].recorder.get_value().num) << i;
+        }
+        // Time is spent on the user code.
+        ASSERT_GE(stages[MS::STAGE_PROCESS].recorder.average(), 20000);
+        ASSERT_LT(stages[MS::STAGE_PARSE].recorder.average(), 20000);
+        ASSERT_LT(stages[MS::STAGE_QUEUE].recorder.average(), 20000);
+
+        std::ostringstream os;
+        mp->status->Describe(os, brpc::DescribeOptions());
+        ASSERT_NE(std::string::npos, os.str().find("\nprocess_latency: "))
+            << os.str();
+        ASSERT_EQ(0, server.Stop(0));
+        ASSERT_EQ(0, server.Join());
+    }
+}
+
+TEST_F(ServerTest, deadline_aware_admission) {
+    EchoServiceImpl echo_svc;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::ServerOptions opt;
+    opt.deadline_aware_admission = true;
+    ASSERT_EQ(0, server.Start(8617, &opt));
+    const brpc::Server::MethodProperty* mp =
+        server.FindMethodPropertyByFullName("test.EchoService.Echo");
+    ASSERT_TRUE(mp != NULL && mp->status != NULL);
+
+    const bool saved_deliver_timeout =
+        brpc::policy::FLAGS_baidu_std_protocol_deliver_timeout_ms;
+    brpc::policy::FLAGS_baidu_std_protocol_deliver_timeout_ms = true;
+    brpc::Channel chan;
+    ASSERT_EQ(0, chan.Init("127.0.0.1:8617", NULL));
+    test::EchoService_Stub stub(&chan);
+    test::EchoRequest req;
+    req.set_message(EXP_REQUEST);
+    req.set_sleep_us(50000);
+    for (int i = 0; i < 3; ++i) {
+        brpc::Controller cntl;
+        test::EchoResponse res;
+        cntl.set_timeout_ms(1000);
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    }
+    // Latencies of stages are sampled every second.
+    for (int i = 0; i < 50 &&
+             mp->status->ExpectedLatency(butil::cpuwide_time_us()) < 50000; ++i) {
+        usleep(100000);
+    }
+    ASSERT_GE(mp->status->ExpectedLatency(butil::cpuwide_time_us()), 50000);
+
+    // The server rejects the request which can't be finished before the
+    // deadline, without calling the method.
+    const int64_t ncalled = echo_svc.count.load();
+    brpc::Controller cntl;
+    test::EchoResponse res;
+    cntl.set_timeout_ms(30);
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_EQ(brpc::ERPCTIMEDOUT, cntl.ErrorCode());
+    ASSERT_NE(std::string::npos, cntl.ErrorText().find("expected latency"))
+        << cntl.ErrorText();
+    ASSERT_EQ(ncalled, echo_svc.count.load());
+
+    cntl.Reset();
+    cntl.set_timeout_ms(1000);
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(ncalled + 1, echo_svc.count.load());
+
+    brpc::policy::FLAGS_baidu_std_protocol_deliver_timeout_ms =
+        saved_deliver_timeout;
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+TEST_F(ServerTest, codel_shedder) {
+    const int64_t target_us = brpc::FLAGS_server_codel_target_ms * 1000L;
+    const int64_t interval_us = brpc::FLAGS_server_codel_interval_ms * 1000L;
+    brpc::CoDelShedder codel;
+    int64_t now_us = 1000000;
+    // Short delays are never dropped.
+    for (int i = 0; i < 100; ++i, now_us += 1000) {
+        ASSERT_FALSE(codel.OnDequeued(target_us / 2, now_us));
+    }
+    // Nor a burst shorter than the interval.
+    const int64_t burst_end_us = now_us + interval_us / 2;
+    for (; now_us < burst_end_us; now_us += 1000) {
+        ASSERT_FALSE(codel.OnDequeued(target_us * 2, now_us));
+    }
+    ASSERT_FALSE(codel.OnDequeued(target_us / 2, now_us));
+    ASSERT_FALSE(codel.dropping());
+
+    // A standing queue.
+    int ndropped = 0;
+    const int64_t standing_end_us = now_us + interval_us * 4;
+    for (; now_us < standing_end_us; now_us += 1000) {
+        if (codel.OnDequeued(target_us * 2, now_us)) {
+            ++ndropped;
+        }
+    }
+    ASSERT_TRUE(codel.dropping());
+    // Drops start after the first interval, get more frequent but still
+    // leave most requests processed.
+    ASSERT_GT(ndropped, 3);
+    ASSERT_LT(ndropped, 20);
+
+    // The delay is below the target again.
+    ASSERT_FALSE(codel.OnDequeued(target_us / 2, now_us));
+    ASSERT_FALSE(codel.dropping());
+    ASSERT_FALSE(codel.OnDequeued(target_us * 2, now_us + 1000));
+}
+
+TEST_F(ServerTest, codel_shedding) {
+    EchoServiceImpl echo_svc;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(8618, NULL));
+    ASSERT_TRUE(server._codel == NULL);
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+
+    brpc::ServerOptions opt;
+    opt.codel_shedding = true;
+    ASSERT_EQ(0, server.Start(8618, &opt));
+    ASSERT_TRUE(server._codel != NULL);
+    brpc::Channel chan;
+    ASSERT_EQ(0, chan.Init("127.0.0.1:8618", NULL));
+    test::EchoService_Stub stub(&chan);
+    brpc::Controller cntl;
+    test::EchoRequest req;
+    test::EchoResponse res;
+    req.set_message(EXP_REQUEST);
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_FALSE(server._codel->dropping());
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
 TEST_F(ServerTest, create_pid_file) {
     {
         brpc::Server server;
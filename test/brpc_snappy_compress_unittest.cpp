@@ -25,9 +25,17 @@
 #include "butil/macros.h"
 #include "butil/iobuf.h"
 #include "butil/time.h"
+#include "butil/string_printf.h"
 #include "snappy_message.pb.h"
 #include "brpc/policy/snappy_compress.h"
 #include "brpc/policy/gzip_compress.h"
+#include "brpc/policy/lz4_compress.h"
+#include "brpc/policy/zstd_compress.h"
+#include "brpc/compress.h"
+#include "echo.pb.h"
+#if BRPC_WITH_ZSTD
+#include <zdict.h>
+#endif
 
 typedef bool (*Compress)(const google::protobuf::Message&, butil::IOBuf*);
 typedef bool (*Decompress)(const butil::IOBuf&, google::protobuf::Message*);
@@ -103,6 +111,40 @@ TEST_F(test_compress_method, snappy_iobuf) {
     ASSERT_STREQ(check_buf.to_string().c_str(), test);
 }
 
+TEST_F(test_compress_method, snappy_untrusted_length) {
+    // Header claims 4GB of output while there're only a few bytes.
+    butil::IOBuf bad;
+    const char header[] = { '\xff', '\xff', '\xff', '\xff', '\x0f' };
+    bad.append(header, sizeof(header));
+    bad.append("\x00a", 2);
+    butil::IOBuf out;
+    out.append("prefix");
+    ASSERT_FALSE(brpc::policy::SnappyDecompress(bad, &out));
+    // Partial output is not appended.
+    ASSERT_EQ("prefix", out.to_string());
+
+    // The whole output is not allocated beyond the limit.
+    char scratch;
+    size_t allocated_size = 0;
+    butil::IOBuf buf;
+    butil::IOBufAsSnappySink sink(buf);
+    ASSERT_EQ(&scratch, sink.GetAppendBufferVariable(
+                  1, 0xFFFFFFFFUL, &scratch, 1, &allocated_size));
+    ASSERT_EQ(1UL, allocated_size);
+    ASSERT_TRUE(sink._user_buf == NULL);
+
+    // Valid large output is still decompressed.
+    std::string large;
+    for (int i = 0; large.size() < 1000000; ++i) {
+        butil::string_appendf(&large, "%d,", i);
+    }
+    butil::IOBuf large_buf, compressed, check_buf;
+    large_buf.append(large);
+    ASSERT_TRUE(brpc::policy::SnappyCompress(large_buf, &compressed));
+    ASSERT_TRUE(brpc::policy::SnappyDecompress(compressed, &check_buf));
+    ASSERT_EQ(large, check_buf.to_string());
+}
+
 TEST_F(test_compress_method, mass_snappy) {
     snappy_message::SnappyMessageProto old_msg;
     int len = 12435; 
@@ -194,6 +236,16 @@ TEST_F(test_compress_method, throughput_compare) {
         CompressMessage("Zlib", k, old_msg, len, 
                          brpc::policy::ZlibCompress, 
                          brpc::policy::ZlibDecompress);
+#if BRPC_WITH_LZ4
+        CompressMessage("Lz4", k, old_msg, len,
+                         brpc::policy::Lz4Compress,
+                         brpc::policy::Lz4Decompress);
+#endif
+#if BRPC_WITH_ZSTD
+        CompressMessage("Zstd", k, old_msg, len,
+                         brpc::policy::ZstdCompress,
+                         brpc::policy::ZstdDecompress);
+#endif
         printf("\n");
         delete [] text;
     }
@@ -228,6 +280,16 @@ TEST_F(test_compress_method, throughput_compare_complete_random) {
         CompressMessage("Zlib", k, old_msg, len, 
                          brpc::policy::ZlibCompress, 
                          brpc::policy::ZlibDecompress);
+#if BRPC_WITH_LZ4
+        CompressMessage("Lz4", k, old_msg, len,
+                         brpc::policy::Lz4Compress,
+                         brpc::policy::Lz4Decompress);
+#endif
+#if BRPC_WITH_ZSTD
+        CompressMessage("Zstd", k, old_msg, len,
+                         brpc::policy::ZstdCompress,
+                         brpc::policy::ZstdDecompress);
+#endif
         printf("\n");
         delete [] text;
     }
@@ -253,3 +315,137 @@ TEST_F(test_compress_method, mass_snappy_iobuf) {
     ASSERT_TRUE(strcmp(check_str.c_str(), text) == 0);
     delete [] text;
 }
+
+// IOBuf made of many small blocks to make sure that compressors don't rely
+// on contiguous input.
+static void MakeFragmentedIOBuf(size_t len, butil::IOBuf* buf,
+                                std::string* expected) {
+    for (size_t i = 0; i < len;) {
+        char piece[97];
+        size_t n = 0;
+        for (; n < sizeof(piece) && i < len; ++n, ++i) {
+            piece[n] = (i % 1000 < 500 ? 'a' + i % 26 : (char)rand());
+        }
+        butil::IOBuf tmp;
+        tmp.append(piece, n);
+        buf->append(tmp);
+        expected->append(piece, n);
+    }
+}
+
+TEST_F(test_compress_method, lz4_zstd_not_built) {
+    butil::IOBuf buf, output_buf;
+    buf.append("this is a test");
+#if !BRPC_WITH_LZ4
+    ASSERT_FALSE(brpc::policy::Lz4Compress(buf, &output_buf));
+#endif
+#if !BRPC_WITH_ZSTD
+    ASSERT_FALSE(brpc::policy::ZstdCompress(buf, &output_buf, NULL));
+    ASSERT_EQ(-1, brpc::RegisterZstdDictionary(
+                  test::EchoService::descriptor(), "dict"));
+#endif
+}
+
+#if BRPC_WITH_LZ4
+TEST_F(test_compress_method, lz4) {
+    snappy_message::SnappyMessageProto old_msg;
+    old_msg.set_text("Hello World!");
+    old_msg.add_numbers(2);
+    old_msg.add_numbers(7);
+    butil::IOBuf buf;
+    ASSERT_TRUE(brpc::policy::Lz4Compress(old_msg, &buf));
+    snappy_message::SnappyMessageProto new_msg;
+    ASSERT_TRUE(brpc::policy::Lz4Decompress(buf, &new_msg));
+    ASSERT_EQ("Hello World!", new_msg.text());
+    ASSERT_EQ(2, new_msg.numbers_size());
+}
+
+TEST_F(test_compress_method, lz4_iobuf) {
+    const size_t lens[] = { 0, 1, 1000, 65536, 65537, 3 * 1024 * 1024 + 7 };
+    for (size_t i = 0; i < ARRAY_SIZE(lens); ++i) {
+        butil::IOBuf buf, output_buf, check_buf;
+        std::string expected;
+        MakeFragmentedIOBuf(lens[i], &buf, &expected);
+        ASSERT_TRUE(brpc::policy::Lz4Compress(buf, &output_buf));
+        ASSERT_TRUE(brpc::policy::Lz4Decompress(output_buf, &check_buf));
+        ASSERT_EQ(expected, check_buf.to_string()) << lens[i];
+
+        // Truncated frames must be rejected.
+        if (output_buf.size() > 1) {
+            butil::IOBuf truncated;
+            output_buf.append_to(&truncated, output_buf.size() - 1);
+            check_buf.clear();
+            ASSERT_FALSE(brpc::policy::Lz4Decompress(truncated, &check_buf));
+        }
+    }
+}
+#endif  // BRPC_WITH_LZ4
+
+#if BRPC_WITH_ZSTD
+TEST_F(test_compress_method, zstd_iobuf) {
+    const size_t lens[] = { 0, 1, 1000, 131072, 131073, 3 * 1024 * 1024 + 7 };
+    for (size_t i = 0; i < ARRAY_SIZE(lens); ++i) {
+        butil::IOBuf buf, output_buf, check_buf;
+        std::string expected;
+        MakeFragmentedIOBuf(lens[i], &buf, &expected);
+        ASSERT_TRUE(brpc::policy::ZstdCompress(buf, &output_buf, NULL));
+        ASSERT_TRUE(brpc::policy::ZstdDecompress(output_buf, &check_buf));
+        ASSERT_EQ(expected, check_buf.to_string()) << lens[i];
+
+        butil::IOBuf truncated;
+        output_buf.append_to(&truncated, output_buf.size() - 1);
+        check_buf.clear();
+        ASSERT_FALSE(brpc::policy::ZstdDecompress(truncated, &check_buf));
+    }
+}
+
+TEST_F(test_compress_method, zstd_dictionary) {
+    // Train a dictionary from requests looking alike.
+    std::string samples;
+    std::vector<size_t> sample_sizes;
+    for (int i = 0; i < 2000; ++i) {
+        test::EchoRequest req;
+        char msg[128];
+        snprintf(msg, sizeof(msg), "{\"user\":\"user_%d\",\"action\":"
+                 "\"query\",\"region\":\"region_%d\",\"status\":\"ok\"}",
+                 i, i % 17);
+        req.set_message(msg);
+        req.set_code(i);
+        const size_t old_size = samples.size();
+        req.AppendToString(&samples);
+        sample_sizes.push_back(samples.size() - old_size);
+    }
+    std::string dict(4096, '\0');
+    const size_t dict_size = ZDICT_trainFromBuffer(
+        &dict[0], dict.size(), samples.data(), &sample_sizes[0],
+        sample_sizes.size());
+    ASSERT_FALSE(ZDICT_isError(dict_size));
+    dict.resize(dict_size);
+    ASSERT_EQ(0, brpc::RegisterZstdDictionary(
+                  test::EchoService::descriptor(), dict));
+    // Messages of the service can't be bound to another dictionary.
+    ASSERT_EQ(-1, brpc::RegisterZstdDictionary(
+                  test::EchoService::descriptor(), dict));
+
+    test::EchoRequest req;
+    req.set_message("{\"user\":\"user_12345\",\"action\":\"query\","
+                    "\"region\":\"region_3\",\"status\":\"ok\"}");
+    req.set_code(12345);
+    butil::IOBuf with_dict;
+    ASSERT_TRUE(brpc::policy::ZstdCompress(req, &with_dict));
+    butil::IOBuf serialized, without_dict;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&serialized);
+    ASSERT_TRUE(req.SerializeToZeroCopyStream(&wrapper));
+    ASSERT_TRUE(brpc::policy::ZstdCompress(serialized, &without_dict, NULL));
+    ASSERT_LT(with_dict.size(), without_dict.size());
+
+    // The dictionary is found by the id inside the frame.
+    test::EchoRequest req2;
+    ASSERT_TRUE(brpc::policy::ZstdDecompress(with_dict, &req2));
+    ASSERT_EQ(req.message(), req2.message());
+    ASSERT_EQ(req.code(), req2.code());
+    butil::IOBuf check_buf;
+    ASSERT_TRUE(brpc::policy::ZstdDecompress(with_dict, &check_buf));
+    ASSERT_EQ(serialized.to_string(), check_buf.to_string());
+}
+#endif  // BRPC_WITH_ZSTD
@@ -0,0 +1,386 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <gtest/gtest.h>
+#if BRPC_WITH_LZ4
+#include <lz4frame.h>
+#endif
+#if BRPC_WITH_ZSTD
+#include <zstd.h>
+#endif
+#include "butil/fast_rand.h"
+#include "butil/iobuf.h"
+#include "butil/macros.h"
+#include "butil/memory/scoped_ptr.h"
+#include "butil/third_party/snappy/snappy.h"
+#include "butil/time.h"
+#include "brpc/compress.h"
+#include "brpc/policy/gzip_compress.h"
+#include "brpc/policy/lz4_compress.h"
+#include "brpc/policy/snappy_compress.h"
+#include "brpc/policy/zstd_compress.h"
+#include "echo.pb.h"
+
+namespace {
+
+struct Codec {
+    const char* name;
+    brpc::StreamingCompressor* (*NewCompressor)(const google::protobuf::Descriptor*);
+    brpc::StreamingDecompressor* (*NewDecompressor)();
+};
+
+const Codec g_codecs[] = {
+    { "gzip", brpc::policy::NewGzipCompressor, brpc::policy::NewGzipDecompressor },
+    { "zlib", brpc::policy::NewZlibCompressor, brpc::policy::NewZlibDecompressor },
+#if BRPC_WITH_LZ4
+    { "lz4", brpc::policy::NewLz4Compressor, brpc::policy::NewLz4Decompressor },
+#endif
+#if BRPC_WITH_ZSTD
+    { "zstd", brpc::policy::NewZstdCompressor, brpc::policy::NewZstdDecompressor },
+#endif
+};
+
+// Text compressed to roughly 1/3 by the codecs above, made of many small
+// blocks.
+void MakePayload(size_t len, butil::IOBuf* buf) {
+    static const char* const words[] = {
+        "brpc", "bthread", "bvar", "iobuf", "compress", "stream", "block",
+        "channel", "server", "latency", "qps", "socket", "event", "butex"
+    };
+    butil::IOBufAppender appender;
+    size_t n = 0;
+    while (n < len) {
+        const char* w = words[butil::fast_rand_less_than(ARRAY_SIZE(words))];
+        const size_t wlen = std::min(strlen(w), len - n);
+        appender.append(w, wlen);
+        n += wlen;
+        if (n < len) {
+            appender.push_back(butil::fast_rand_less_than(10) == 0 ?
+                               (char)butil::fast_rand() : ' ');
+            ++n;
+        }
+    }
+    appender.move_to(*buf);
+}
+
+// Feed `in' to `c' in pieces of random sizes.
+bool FeedInPieces(brpc::StreamingCompressor* c, const std::string& in,
+                  butil::IOBuf* out) {
+    butil::IOBufAppender appender;
+    for (size_t i = 0; i < in.size();) {
+        const size_t len = std::min(in.size() - i,
+                                    (size_t)butil::fast_rand_less_than(70000));
+        if (!c->Update(in.data() + i, len, &appender)) {
+            return false;
+        }
+        i += len;
+    }
+    if (!c->Finish(&appender)) {
+        return false;
+    }
+    appender.move_to(*out);
+    return true;
+}
+
+bool FeedInPieces(brpc::StreamingDecompressor* d, const std::string& in,
+                  butil::IOBuf* out) {
+    butil::IOBufAppender appender;
+    for (size_t i = 0; i < in.size();) {
+        const size_t len = std::min(in.size() - i,
+                                    (size_t)butil::fast_rand_less_than(100) + 1);
+        if (!d->Update(in.data() + i, len, &appender)) {
+            return false;
+        }
+        i += len;
+    }
+    if (!d->Finish(&appender)) {
+        return false;
+    }
+    appender.move_to(*out);
+    return true;
+}
+
+class StreamingCompressTest : public ::testing::Test {};
+
+TEST_F(StreamingCompressTest, round_trip) {
+    const size_t lens[] = { 0, 1, 100, 8192, 65536, 65537, 1024 * 1024 + 3 };
+    for (size_t i = 0; i < ARRAY_SIZE(g_codecs); ++i) {
+        const Codec& codec = g_codecs[i];
+        for (size_t j = 0; j < ARRAY_SIZE(lens); ++j) {
+            butil::IOBuf payload;
+            MakePayload(lens[j], &payload);
+            const std::string expected = payload.to_string();
+
+            // Compress blocks of IOBuf, decompress pieces.
+            scoped_ptr<brpc::StreamingCompressor> c(codec.NewCompressor(NULL));
+            ASSERT_TRUE(c);
+            butil::IOBuf compressed;
+            ASSERT_TRUE(brpc::StreamingCompress(c.get(), payload, &compressed))
+                << codec.name;
+            scoped_ptr<brpc::StreamingDecompressor> d(codec.NewDecompressor());
+            ASSERT_TRUE(d);
+            butil::IOBuf decompressed;
+            ASSERT_TRUE(FeedInPieces(d.get(), compressed.to_string(),
+                                     &decompressed)) << codec.name;
+            ASSERT_EQ(expected, decompressed.to_string())
+                << codec.name << " len=" << lens[j];
+
+            // Compress pieces, decompress blocks of IOBuf.
+            c.reset(codec.NewCompressor(NULL));
+            compressed.clear();
+            ASSERT_TRUE(FeedInPieces(c.get(), expected, &compressed));
+            d.reset(codec.NewDecompressor());
+            decompressed.clear();
+            ASSERT_TRUE(brpc::StreamingDecompress(d.get(), compressed,
+                                                  &decompressed));
+            ASSERT_EQ(expected, decompressed.to_string())
+                << codec.name << " len=" << lens[j];
+
+            // Truncated data must be rejected.
+            if (compressed.size() > 1) {
+                butil::IOBuf truncated;
+                compressed.append_to(&truncated, compressed.size() - 1);
+                d.reset(codec.NewDecompressor());
+                decompressed.clear();
+                ASSERT_FALSE(brpc::StreamingDecompress(d.get(), truncated,
+                                                       &decompressed))
+                    << codec.name << " len=" << lens[j];
+            }
+        }
+    }
+}
+
+TEST_F(StreamingCompressTest, all_small_sizes) {
+    // Including compressed data as short as the zstd frame header, and
+    // output ending exactly at the end of a block shared by the thread.
+    std::string pattern;
+    for (int i = 0; i < 26; ++i) {
+        pattern.push_back('a' + i);
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(g_codecs); ++i) {
+        const Codec& codec = g_codecs[i];
+        butil::IOBuf payload;
+        for (size_t len = 1; len <= 3000; ++len) {
+            payload.push_back(pattern[len % pattern.size()]);
+            scoped_ptr<brpc::StreamingCompressor> c(codec.NewCompressor(NULL));
+            butil::IOBuf compressed;
+            ASSERT_TRUE(brpc::StreamingCompress(c.get(), payload, &compressed));
+            scoped_ptr<brpc::StreamingDecompressor> d(codec.NewDecompressor());
+            butil::IOBuf decompressed;
+            ASSERT_TRUE(brpc::StreamingDecompress(d.get(), compressed,
+                                                  &decompressed))
+                << codec.name << " len=" << len;
+            ASSERT_EQ(payload.to_string(), decompressed.to_string());
+        }
+    }
+}
+
+TEST_F(StreamingCompressTest, compatible_with_one_shot) {
+    butil::IOBuf payload;
+    MakePayload(300 * 1024, &payload);
+    // Streaming gzip must be readable by GzipInputStream and vice versa.
+    test::BytesRequest req;
+    req.set_databytes(payload.to_string());
+    scoped_ptr<brpc::StreamingCompressor> c(
+        brpc::policy::NewGzipCompressor(NULL));
+    butil::IOBuf compressed;
+    ASSERT_TRUE(brpc::StreamingCompress(c.get(), req, &compressed));
+    test::BytesRequest req2;
+    ASSERT_TRUE(brpc::policy::GzipDecompress(compressed, &req2));
+    ASSERT_EQ(req.databytes(), req2.databytes());
+
+    compressed.clear();
+    ASSERT_TRUE(brpc::policy::GzipCompress(req, &compressed));
+    butil::IOBuf decompressed;
+    ASSERT_TRUE(brpc::policy::GzipDecompress(compressed, &decompressed));
+    req2.Clear();
+    ASSERT_TRUE(req2.ParseFromString(decompressed.to_string()));
+    ASSERT_EQ(req.databytes(), req2.databytes());
+
+    // Concatenated gzip members are decompressed as a whole.
+    butil::IOBuf part1, part2;
+    payload.cutn(&part1, payload.size() / 2);
+    part2 = payload;
+    compressed.clear();
+    ASSERT_TRUE(brpc::policy::GzipCompress(part1, &compressed, NULL));
+    ASSERT_TRUE(brpc::policy::GzipCompress(part2, &compressed, NULL));
+    decompressed.clear();
+    ASSERT_TRUE(brpc::policy::GzipDecompress(compressed, &decompressed));
+    ASSERT_EQ(part1.to_string() + part2.to_string(), decompressed.to_string());
+
+    // Snappy decompresses into a single user-data block.
+    compressed.clear();
+    ASSERT_TRUE(brpc::policy::SnappyCompress(payload, &compressed));
+    decompressed.clear();
+    ASSERT_TRUE(brpc::policy::SnappyDecompress(compressed, &decompressed));
+    ASSERT_EQ(payload.to_string(), decompressed.to_string());
+    ASSERT_EQ(1u, decompressed.backing_block_num());
+}
+
+TEST_F(StreamingCompressTest, registered_handler) {
+    const brpc::CompressType type = (brpc::CompressType)(1000 - 1);
+    const brpc::CompressHandler handler = {
+        brpc::policy::GzipCompress, brpc::policy::GzipDecompress, "gzip_test",
+        brpc::policy::NewGzipCompressor, brpc::policy::NewGzipDecompressor };
+    ASSERT_EQ(0, brpc::RegisterCompressHandler(type, handler));
+    scoped_ptr<brpc::StreamingCompressor> c(brpc::NewStreamingCompressor(type));
+    ASSERT_TRUE(c);
+    scoped_ptr<brpc::StreamingDecompressor> d(brpc::NewStreamingDecompressor(type));
+    ASSERT_TRUE(d);
+    // Not registered.
+    ASSERT_FALSE(brpc::NewStreamingCompressor((brpc::CompressType)(1000 - 2)));
+}
+
+// Compress `payload' the way of flattening it: copy into a contiguous
+// buffer and compress it into another contiguous buffer of the worst size.
+bool FlatCompress(const char* name, const butil::IOBuf& payload,
+                  butil::IOBuf* out) {
+    const std::string flat = payload.to_string();
+    size_t max_size = 0;
+    size_t size = 0;
+    char* buf = NULL;
+    if (strcmp(name, "gzip") == 0 || strcmp(name, "zlib") == 0) {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                         15 + (name[0] == 'g' ? 16 : 0), 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+        max_size = deflateBound(&zs, flat.size()) + 32;
+        buf = (char*)malloc(max_size);
+        zs.next_in = (Bytef*)flat.data();
+        zs.avail_in = flat.size();
+        zs.next_out = (Bytef*)buf;
+        zs.avail_out = max_size;
+        const int rc = deflate(&zs, Z_FINISH);
+        size = zs.total_out;
+        deflateEnd(&zs);
+        if (rc != Z_STREAM_END) {
+            free(buf);
+            return false;
+        }
+#if BRPC_WITH_LZ4
+    } else if (strcmp(name, "lz4") == 0) {
+        max_size = LZ4F_compressFrameBound(flat.size(), NULL);
+        buf = (char*)malloc(max_size);
+        size = LZ4F_compressFrame(buf, max_size, flat.data(), flat.size(), NULL);
+#endif
+#if BRPC_WITH_ZSTD
+    } else if (strcmp(name, "zstd") == 0) {
+        max_size = ZSTD_compressBound(flat.size());
+        buf = (char*)malloc(max_size);
+        size = ZSTD_compress(buf, max_size, flat.data(), flat.size(), 3);
+#endif
+    } else {
+        return false;
+    }
+    out->append(buf, size);
+    free(buf);
+    return true;
+}
+
+long CurrentRssKB() {
+    long pages = 0;
+    long rss = 0;
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    if (fscanf(fp, "%ld %ld", &pages, &rss) != 2) {
+        rss = 0;
+    }
+    fclose(fp);
+    return rss * (getpagesize() / 1024);
+}
+
+struct BenchResult {
+    long extra_rss_kb;
+    int64_t elapsed_us;
+};
+
+// Run one compression in a child process so that its peak RSS is not
+// polluted by other cases.
+bool RunBenchmark(const Codec& codec, size_t len, bool streaming,
+                  BenchResult* result) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        butil::IOBuf payload;
+        MakePayload(len, &payload);
+        BenchResult r = { 0, 0 };
+        const long base_rss = CurrentRssKB();
+        butil::IOBuf compressed;
+        butil::Timer tm;
+        tm.start();
+        bool ok = false;
+        if (streaming) {
+            scoped_ptr<brpc::StreamingCompressor> c(codec.NewCompressor(NULL));
+            ok = brpc::StreamingCompress(c.get(), payload, &compressed);
+        } else {
+            ok = FlatCompress(codec.name, payload, &compressed);
+        }
+        tm.stop();
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        r.extra_rss_kb = usage.ru_maxrss - base_rss;
+        r.elapsed_us = (ok ? tm.u_elapsed() : -1);
+        ssize_t nw = write(fds[1], &r, sizeof(r));
+        (void)nw;
+        _exit(0);
+    }
+    close(fds[1]);
+    const ssize_t nr = read(fds[0], result, sizeof(*result));
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return nr == (ssize_t)sizeof(*result) && result->elapsed_us >= 0;
+}
+
+TEST_F(StreamingCompressTest, rss_and_throughput) {
+    const size_t lens[] = { 64 * 1024, 1024 * 1024, 16 * 1024 * 1024,
+                            64 * 1024 * 1024 };
+    printf("%8s%12s%12s%22s%22s\n", "Method", "Size(KB)", "Mode",
+           "Extra peak RSS(KB)", "Throughput(MB/s)");
+    for (size_t i = 0; i < ARRAY_SIZE(g_codecs); ++i) {
+        if (strcmp(g_codecs[i].name, "zlib") == 0) {
+            continue;  // Same as gzip.
+        }
+        for (size_t j = 0; j < ARRAY_SIZE(lens); ++j) {
+            for (int streaming = 0; streaming < 2; ++streaming) {
+                BenchResult r;
+                ASSERT_TRUE(RunBenchmark(g_codecs[i], lens[j], streaming, &r));
+                printf("%8s%12lu%12s%22ld%22.1f\n", g_codecs[i].name,
+                       lens[j] / 1024, (streaming ? "streaming" : "flat"),
+                       r.extra_rss_kb,
+                       lens[j] / 1048576.0 / std::max(r.elapsed_us, (int64_t)1) * 1000000);
+            }
+        }
+    }
+}
+
+} // namespace
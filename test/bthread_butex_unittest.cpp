@@ -16,6 +16,8 @@
 // under the License.
 
 #include <gtest/gtest.h>
+#include "butil/file_util.h"
+#include "butil/strings/string_util.h"
 #include "butil/atomicops.h"
 #include "butil/time.h"
 #include "butil/macros.h"
@@ -31,6 +33,8 @@ extern butil::atomic<TaskControl*> g_task_control;
 inline TaskControl* get_task_control() {
     return g_task_control.load(butil::memory_order_consume);
 }
+bool ButexWaitProfilerStart(const char* filename);
+void ButexWaitProfilerStop();
 } // namespace bthread
 
 namespace {
@@ -394,4 +398,52 @@ TEST(ButexTest, stop_before_sleeping) {
         ASSERT_EQ(EINVAL, bthread_stop(th));
     }
 }
+void* timed_waiter(void* arg) {
+    butil::atomic<int>* butex = (butil::atomic<int>*)arg;
+    for (int i = 0; i < 5; ++i) {
+        const timespec abstime = butil::milliseconds_from_now(10);
+        EXPECT_EQ(-1, bthread::butex_wait(butex, 0, &abstime));
+        EXPECT_EQ(ETIMEDOUT, errno);
+    }
+    return NULL;
+}
+
+TEST(ButexTest, wait_profiler) {
+    butil::atomic<int>* butex = bthread::butex_create_checked<butil::atomic<int> >();
+    ASSERT_TRUE(butex);
+    *butex = 0;
+    const char* const filename = "butex_wait_profiler_test.prof";
+    ASSERT_TRUE(bthread::ButexWaitProfilerStart(filename));
+    // Only one profiler at the same time.
+    ASSERT_FALSE(bthread::ButexWaitProfilerStart(filename));
+    bthread_t th[4];
+    for (size_t i = 0; i < arraysize(th); ++i) {
+        const bthread_attr_t attr = (i == 0 ? BTHREAD_ATTR_PTHREAD : BTHREAD_ATTR_NORMAL);
+        ASSERT_EQ(0, bthread_start_urgent(&th[i], &attr, timed_waiter, butex));
+    }
+    for (size_t i = 0; i < arraysize(th); ++i) {
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+    }
+    // Waits not collected before stopping are dropped.
+    usleep(1000000);
+    bthread::ButexWaitProfilerStop();
+    bthread::butex_destroy(butex);
+
+    std::string content;
+    ASSERT_TRUE(butil::ReadFileToString(butil::FilePath(filename), &content));
+    ASSERT_TRUE(StartsWithASCII(
+        content, "--- contention\ncycles/second=1000000000\n", true)) << content;
+    int64_t total_ns = 0;
+    size_t nline = 0;
+    std::istringstream is(content.substr(content.find('\n', 15) + 1));
+    std::string line;
+    while (std::getline(is, line) && line.find(" @ ") != std::string::npos) {
+        total_ns += strtoll(line.c_str(), NULL, 10);
+        ++nline;
+    }
+    ASSERT_GT(nline, 0u);
+    // 20 waits of 10ms each.
+    ASSERT_GE(total_ns, 150000000L) << content;
+    ASSERT_TRUE(butil::DeleteFile(butil::FilePath(filename), false));
+}
 } // namespace
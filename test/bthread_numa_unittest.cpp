@@ -0,0 +1,159 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <pthread.h>
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/atomicops.h"
+#include "butil/iobuf.h"
+#include "butil/numa.h"
+#include "bvar/variable.h"
+#include "bthread/bthread.h"
+
+namespace bthread {
+DECLARE_bool(bthread_numa_aware);
+}
+
+namespace butil {
+namespace iobuf {
+extern int get_tls_block_count();
+extern void remove_tls_block_chain();
+}
+}
+
+int main(int argc, char* argv[]) {
+    // Must be set before the first bthread is created.
+    bthread::FLAGS_bthread_numa_aware = true;
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+TEST(NumaTest, parse_cpu_list) {
+    std::vector<int> cpus;
+    ASSERT_EQ(0, butil::parse_cpu_list("0-3,8,10-11\n", &cpus));
+    const int expected[] = { 0, 1, 2, 3, 8, 10, 11 };
+    ASSERT_EQ(std::vector<int>(expected, expected + arraysize(expected)), cpus);
+    ASSERT_EQ(0, butil::parse_cpu_list("", &cpus));
+    ASSERT_TRUE(cpus.empty());
+    ASSERT_EQ(-1, butil::parse_cpu_list("3-1", &cpus));
+    ASSERT_EQ(-1, butil::parse_cpu_list("a-b", &cpus));
+}
+
+TEST(NumaTest, topology) {
+    const int nnode = butil::numa_node_count();
+    ASSERT_GE(nnode, 1);
+    for (int node = 0; node < nnode; ++node) {
+        const std::vector<int>& cpus = butil::numa_node_cpus(node);
+        for (size_t i = 0; i < cpus.size(); ++i) {
+            ASSERT_EQ(node, butil::numa_node_of_cpu(cpus[i]));
+        }
+    }
+    ASSERT_FALSE(butil::numa_node_cpus(0).empty());
+    ASSERT_TRUE(butil::numa_node_cpus(nnode).empty());
+}
+
+void* bind_to_invalid_node(void*) {
+    EXPECT_EQ(EINVAL, butil::bind_thread_to_numa_node(-1));
+    EXPECT_EQ(EINVAL, butil::bind_thread_to_numa_node(butil::numa_node_count()));
+    EXPECT_EQ(-1, butil::numa_thread_node());
+    return NULL;
+}
+
+TEST(NumaTest, bind_thread) {
+    ASSERT_EQ(-1, butil::numa_thread_node());
+    pthread_t th;
+    ASSERT_EQ(0, pthread_create(&th, NULL, bind_to_invalid_node, NULL));
+    ASSERT_EQ(0, pthread_join(th, NULL));
+}
+
+int tls_block_count_after_release() {
+    butil::IOBuf buf;
+    butil::IOBufAsZeroCopyOutputStream stream(&buf);
+    void* data = NULL;
+    int size = 0;
+    EXPECT_TRUE(stream.Next(&data, &size));
+    stream.BackUp(size - 1);
+    return butil::iobuf::get_tls_block_count();
+}
+
+void* release_blocks_of_other_node(void*) {
+    butil::iobuf::remove_tls_block_chain();
+    // Block created before binding is not cached after binding.
+    butil::IOBuf buf;
+    butil::IOBufAsZeroCopyOutputStream* stream =
+        new butil::IOBufAsZeroCopyOutputStream(&buf);
+    void* data = NULL;
+    int size = 0;
+    EXPECT_TRUE(stream->Next(&data, &size));
+    EXPECT_EQ(0, butil::bind_thread_to_numa_node(0));
+    EXPECT_EQ(0, butil::numa_thread_node());
+    delete stream;
+    EXPECT_EQ(0, butil::iobuf::get_tls_block_count());
+    // Blocks created on the node are cached.
+    EXPECT_EQ(1, tls_block_count_after_release());
+    butil::iobuf::remove_tls_block_chain();
+    return NULL;
+}
+
+TEST(NumaTest, iobuf_tls_blocks_are_node_local) {
+    pthread_t th;
+    ASSERT_EQ(0, pthread_create(&th, NULL, release_blocks_of_other_node, NULL));
+    ASSERT_EQ(0, pthread_join(th, NULL));
+}
+
+struct NodeRecord {
+    butil::atomic<int> nrun;
+    butil::atomic<int> wrong_node;
+};
+
+void* record_node(void* arg) {
+    NodeRecord* r = static_cast<NodeRecord*>(arg);
+    const int node = butil::numa_thread_node();
+    if (node < 0 || node >= butil::numa_node_count()) {
+        r->wrong_node.fetch_add(1);
+    }
+    // Switch stacks between workers.
+    bthread_usleep(100);
+    if (butil::numa_thread_node() < 0) {
+        r->wrong_node.fetch_add(1);
+    }
+    r->nrun.fetch_add(1);
+    return NULL;
+}
+
+TEST(NumaTest, workers_are_bound) {
+    NodeRecord r;
+    r.nrun = 0;
+    r.wrong_node = 0;
+    const int N = 200;
+    bthread_t ths[N];
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread_start_background(&ths[i], NULL, record_node, &r));
+    }
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread_join(ths[i], NULL));
+    }
+    ASSERT_EQ(N, r.nrun.load());
+    ASSERT_EQ(0, r.wrong_node.load());
+    ASSERT_FALSE(bvar::Variable::describe_exposed(
+                     "bthread_numa_remote_steal_count").empty());
+}
+
+} // namespace
@@ -0,0 +1,171 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <sched.h>
+#include <vector>
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/atomicops.h"
+#include "butil/scoped_lock.h"
+#include "bthread/bthread.h"
+
+namespace bthread {
+DECLARE_string(bthread_worker_groups);
+}
+
+int main(int argc, char* argv[]) {
+    // Must be set before the first bthread is created. Bthreads in a group
+    // with only one worker run in the order they're scheduled.
+    bthread::FLAGS_bthread_worker_groups = "single:1";
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+bthread_attr_t attr_of(bthread_priority_t priority) {
+    bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+    attr.tag = bthread_worker_group_tag("single");
+    attr.priority = priority;
+    return attr;
+}
+
+TEST(PriorityTest, invalid_priority) {
+    bthread_t th;
+    bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+    ASSERT_EQ(BTHREAD_PRIORITY_NORMAL, attr.priority);
+    attr.priority = BTHREAD_PRIORITY_HIGH + 1;
+    ASSERT_EQ(EINVAL, bthread_start_background(&th, &attr, NULL, NULL));
+    attr.priority = BTHREAD_PRIORITY_LOW - 1;
+    ASSERT_EQ(EINVAL, bthread_start_urgent(&th, &attr, NULL, NULL));
+}
+
+void* get_priority(void* arg) {
+    bthread_attr_t attr;
+    EXPECT_EQ(0, bthread_getattr(bthread_self(), &attr));
+    *static_cast<bthread_priority_t*>(arg) = attr.priority;
+    return NULL;
+}
+
+TEST(PriorityTest, getattr) {
+    const bthread_priority_t priorities[] = {
+        BTHREAD_PRIORITY_LOW, BTHREAD_PRIORITY_NORMAL, BTHREAD_PRIORITY_HIGH };
+    for (size_t i = 0; i < arraysize(priorities); ++i) {
+        bthread_priority_t p = -100;
+        bthread_t th;
+        bthread_attr_t attr = attr_of(priorities[i]);
+        ASSERT_EQ(0, bthread_start_background(&th, &attr, get_priority, &p));
+        ASSERT_EQ(0, bthread_join(th, NULL));
+        ASSERT_EQ(priorities[i], p);
+    }
+}
+
+struct RunOrder {
+    pthread_mutex_t mutex;
+    std::vector<bthread_priority_t> order;
+    butil::atomic<bool> blocked;
+    bthread_t ths[6];
+
+    RunOrder() : blocked(false) {
+        pthread_mutex_init(&mutex, NULL);
+    }
+    ~RunOrder() {
+        pthread_mutex_destroy(&mutex);
+    }
+};
+
+RunOrder* g_order = NULL;
+
+void* record_priority(void*) {
+    bthread_attr_t attr;
+    EXPECT_EQ(0, bthread_getattr(bthread_self(), &attr));
+    BAIDU_SCOPED_LOCK(g_order->mutex);
+    g_order->order.push_back(attr.priority);
+    return NULL;
+}
+
+const bthread_priority_t SCHEDULE_ORDER[] = {
+    BTHREAD_PRIORITY_LOW, BTHREAD_PRIORITY_NORMAL, BTHREAD_PRIORITY_HIGH,
+    BTHREAD_PRIORITY_NORMAL, BTHREAD_PRIORITY_LOW, BTHREAD_PRIORITY_HIGH };
+
+void start_in_schedule_order() {
+    for (size_t i = 0; i < arraysize(SCHEDULE_ORDER); ++i) {
+        bthread_attr_t attr = attr_of(SCHEDULE_ORDER[i]);
+        EXPECT_EQ(0, bthread_start_background(
+                      &g_order->ths[i], &attr, record_priority, NULL));
+    }
+}
+
+void check_run_order() {
+    for (size_t i = 0; i < arraysize(SCHEDULE_ORDER); ++i) {
+        ASSERT_EQ(0, bthread_join(g_order->ths[i], NULL));
+    }
+    const bthread_priority_t expected[] = {
+        BTHREAD_PRIORITY_HIGH, BTHREAD_PRIORITY_HIGH,
+        BTHREAD_PRIORITY_NORMAL, BTHREAD_PRIORITY_NORMAL,
+        BTHREAD_PRIORITY_LOW, BTHREAD_PRIORITY_LOW };
+    ASSERT_EQ(std::vector<bthread_priority_t>(
+                  expected, expected + arraysize(expected)),
+              g_order->order);
+}
+
+void* start_in_worker(void*) {
+    // Queued in the local runqueue of the only worker, run after this
+    // bthread quits.
+    start_in_schedule_order();
+    return NULL;
+}
+
+TEST(PriorityTest, local_queue_runs_higher_priority_first) {
+    RunOrder r;
+    g_order = &r;
+    bthread_t th;
+    bthread_attr_t attr = attr_of(BTHREAD_PRIORITY_NORMAL);
+    ASSERT_EQ(0, bthread_start_background(&th, &attr, start_in_worker, NULL));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    check_run_order();
+    g_order = NULL;
+}
+
+void* block_worker(void*) {
+    g_order->blocked.store(true);
+    while (g_order->blocked.load()) {
+        sched_yield();
+    }
+    return NULL;
+}
+
+TEST(PriorityTest, remote_queue_runs_higher_priority_first) {
+    RunOrder r;
+    g_order = &r;
+    // Occupy the only worker so that bthreads started below wait in the
+    // remote runqueue.
+    bthread_t blocker;
+    bthread_attr_t attr = attr_of(BTHREAD_PRIORITY_NORMAL);
+    ASSERT_EQ(0, bthread_start_background(&blocker, &attr, block_worker, NULL));
+    while (!r.blocked.load()) {
+        sched_yield();
+    }
+    start_in_schedule_order();
+    r.blocked.store(false);
+    ASSERT_EQ(0, bthread_join(blocker, NULL));
+    check_run_order();
+    g_order = NULL;
+}
+
+} // namespace
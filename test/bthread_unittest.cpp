@@ -409,6 +409,114 @@ TEST_F(BthreadTest, start_latency_when_high_idle) {
               << elp2 / REP << "ns";
 }
 
+void* add_to_sum(void* arg) {
+    static_cast<butil::atomic<int>*>(arg)->fetch_add(1);
+    return NULL;
+}
+
+struct StartBatchAndJoinArgs {
+    butil::atomic<int>* sums;
+    const bthread_attr_t* attr;
+};
+
+void* start_batch_and_join(void* void_args) {
+    StartBatchAndJoinArgs* a = static_cast<StartBatchAndJoinArgs*>(void_args);
+    const size_t N = 100;
+    bthread_t ths[N];
+    void* args[N];
+    for (size_t i = 0; i < N; ++i) {
+        args[i] = &a->sums[i];
+    }
+    EXPECT_EQ(0, bthread_start_batch(ths, a->attr, add_to_sum, args, N));
+    if (a->attr != NULL && (a->attr->flags & BTHREAD_NOSIGNAL)) {
+        // Otherwise the bthreads may never run when started from a pthread.
+        bthread_flush();
+    }
+    for (size_t i = 0; i < N; ++i) {
+        EXPECT_NE(INVALID_BTHREAD, ths[i]);
+        EXPECT_EQ(0, bthread_join(ths[i], NULL));
+    }
+    return NULL;
+}
+
+TEST_F(BthreadTest, start_batch) {
+    bthread_t th;
+    ASSERT_EQ(EINVAL, bthread_start_batch(&th, NULL, NULL, NULL, 1));
+    ASSERT_EQ(0, bthread_start_batch(NULL, NULL, add_to_sum, NULL, 0));
+
+    butil::atomic<int> sums[100];
+    for (size_t i = 0; i < ARRAY_SIZE(sums); ++i) {
+        sums[i] = 0;
+    }
+    StartBatchAndJoinArgs args = { sums, NULL };
+    // From non-worker.
+    start_batch_and_join(&args);
+    // From worker.
+    ASSERT_EQ(0, bthread_start_urgent(&th, NULL, start_batch_and_join, &args));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+
+    // Batches with BTHREAD_NOSIGNAL are not signalled until bthread_flush().
+    const bthread_attr_t nosignal_attr = BTHREAD_ATTR_NORMAL | BTHREAD_NOSIGNAL;
+    StartBatchAndJoinArgs nosignal_args = { sums, &nosignal_attr };
+    // From non-worker.
+    start_batch_and_join(&nosignal_args);
+    // From worker.
+    ASSERT_EQ(0, bthread_start_urgent(&th, NULL, start_batch_and_join,
+                                      &nosignal_args));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    for (size_t i = 0; i < ARRAY_SIZE(sums); ++i) {
+        ASSERT_EQ(4, sums[i].load());
+    }
+}
+
+struct StartBatchArgs {
+    bool batch;
+    int64_t elapsed_ns;
+};
+
+void* start_fan_out(void* void_arg) {
+    StartBatchArgs* args = static_cast<StartBatchArgs*>(void_arg);
+    const size_t N = 64;
+    bthread_t ths[N];
+    void* fn_args[N];
+    butil::atomic<int> sum(0);
+    for (size_t i = 0; i < N; ++i) {
+        fn_args[i] = &sum;
+    }
+    butil::Timer tm;
+    tm.start();
+    if (args->batch) {
+        EXPECT_EQ(0, bthread_start_batch(ths, NULL, add_to_sum, fn_args, N));
+    } else {
+        for (size_t i = 0; i < N; ++i) {
+            EXPECT_EQ(0, bthread_start_background(
+                          &ths[i], NULL, add_to_sum, fn_args[i]));
+        }
+    }
+    tm.stop();
+    for (size_t i = 0; i < N; ++i) {
+        bthread_join(ths[i], NULL);
+    }
+    args->elapsed_ns += tm.n_elapsed();
+    return NULL;
+}
+
+TEST_F(BthreadTest, start_batch_vs_start_background) {
+    // Compare costs of starting 64 bthreads in a worker.
+    const int REP = 2000;
+    StartBatchArgs args[2] = { { false, 0 }, { true, 0 } };
+    for (int i = 0; i < REP; ++i) {
+        for (size_t j = 0; j < ARRAY_SIZE(args); ++j) {
+            bthread_t th;
+            ASSERT_EQ(0, bthread_start_urgent(&th, NULL, start_fan_out, &args[j]));
+            ASSERT_EQ(0, bthread_join(th, NULL));
+        }
+    }
+    LOG(INFO) << "start_background=" << args[0].elapsed_ns / REP / 64
+              << "ns start_batch=" << args[1].elapsed_ns / REP / 64
+              << "ns per bthread";
+}
+
 void* sleep_for_awhile_with_sleep(void* arg) {
     bthread_usleep((intptr_t)arg);
     return NULL;
@@ -513,7 +621,7 @@ TEST_F(BthreadTest, bthread_usleep) {
 }
 
 static const bthread_attr_t BTHREAD_ATTR_NORMAL_WITH_SPAN =
-{ BTHREAD_STACKTYPE_NORMAL, BTHREAD_INHERIT_SPAN, NULL };
+    BTHREAD_ATTR_NORMAL | BTHREAD_INHERIT_SPAN;
 
 void* test_parent_span(void* p) {
     uint64_t *q = (uint64_t *)p;
@@ -131,4 +131,31 @@ TEST(WSQTest, sanity) {
               << " popped=" << npopped
               << " left=" << (N - nstolen - npopped)  << std::endl;
 }
+
+TEST(WSQTest, push_batch) {
+    bthread::WorkStealingQueue<value_type> q;
+    ASSERT_EQ(0, q.init(CAP));
+    value_type xs[CAP + 3];
+    for (size_t i = 0; i < ARRAY_SIZE(xs); ++i) {
+        xs[i] = i;
+    }
+    ASSERT_EQ(0u, q.push_batch(xs, 0));
+    ASSERT_EQ(3u, q.push_batch(xs, 3));
+    // Only pushes until the queue is full.
+    ASSERT_EQ(CAP - 3, q.push_batch(xs + 3, ARRAY_SIZE(xs) - 3));
+    ASSERT_EQ(0u, q.push_batch(xs, 1));
+    ASSERT_EQ(CAP, q.volatile_size());
+
+    value_type val;
+    ASSERT_TRUE(q.steal(&val));
+    ASSERT_EQ(0u, val);
+    ASSERT_EQ(1u, q.push_batch(xs + CAP, 2));
+    ASSERT_TRUE(q.pop(&val));
+    ASSERT_EQ(CAP, val);
+    for (size_t i = CAP - 1; i > 0; --i) {
+        ASSERT_TRUE(q.pop(&val));
+        ASSERT_EQ(i, val);
+    }
+    ASSERT_FALSE(q.pop(&val));
+}
 } // namespace
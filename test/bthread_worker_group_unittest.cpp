@@ -0,0 +1,210 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <set>
+#include <pthread.h>
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/atomicops.h"
+#include "butil/time.h"
+#include "butil/scoped_lock.h"
+#include "bvar/variable.h"
+#include "bthread/bthread.h"
+#include "bthread/butex.h"
+
+namespace bthread {
+DECLARE_string(bthread_worker_groups);
+}
+
+int main(int argc, char* argv[]) {
+    // Must be set before the first bthread is created.
+    bthread::FLAGS_bthread_worker_groups = "io:2, batch:3";
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+bthread_tag_t io_tag() { return bthread_worker_group_tag("io"); }
+bthread_tag_t batch_tag() { return bthread_worker_group_tag("batch"); }
+
+bthread_attr_t attr_of(bthread_tag_t tag) {
+    bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+    attr.tag = tag;
+    return attr;
+}
+
+TEST(WorkerGroupTest, tags) {
+    ASSERT_EQ(BTHREAD_TAG_DEFAULT, bthread_worker_group_tag("default"));
+    ASSERT_EQ(1, io_tag());
+    ASSERT_EQ(2, batch_tag());
+    ASSERT_EQ(BTHREAD_TAG_INVALID, bthread_worker_group_tag("not_exist"));
+    ASSERT_EQ(bthread_getconcurrency(),
+              bthread_worker_group_concurrency(BTHREAD_TAG_DEFAULT));
+    ASSERT_EQ(2, bthread_worker_group_concurrency(io_tag()));
+    ASSERT_EQ(3, bthread_worker_group_concurrency(batch_tag()));
+    ASSERT_EQ(-1, bthread_worker_group_concurrency(3));
+    ASSERT_EQ(BTHREAD_TAG_INVALID, bthread_self_tag());
+
+    bthread_t th;
+    bthread_attr_t attr = attr_of(3);
+    ASSERT_EQ(EINVAL, bthread_start_background(&th, &attr, NULL, NULL));
+}
+
+struct TagRecord {
+    bthread_tag_t self;
+    bthread_tag_t inherited;
+    bthread_tag_t specified;
+};
+
+void* get_tag(void* arg) {
+    *static_cast<bthread_tag_t*>(arg) = bthread_self_tag();
+    return NULL;
+}
+
+void* record_tags(void* arg) {
+    TagRecord* r = static_cast<TagRecord*>(arg);
+    r->self = bthread_self_tag();
+    bthread_t th;
+    EXPECT_EQ(0, bthread_start_urgent(&th, NULL, get_tag, &r->inherited));
+    EXPECT_EQ(0, bthread_join(th, NULL));
+    bthread_attr_t attr = attr_of(batch_tag());
+    EXPECT_EQ(0, bthread_start_urgent(&th, &attr, get_tag, &r->specified));
+    EXPECT_EQ(0, bthread_join(th, NULL));
+    return NULL;
+}
+
+TEST(WorkerGroupTest, start_in_group) {
+    TagRecord r = { BTHREAD_TAG_INVALID, BTHREAD_TAG_INVALID, BTHREAD_TAG_INVALID };
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_background(&th, NULL, record_tags, &r));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    ASSERT_EQ(BTHREAD_TAG_DEFAULT, r.self);
+    ASSERT_EQ(BTHREAD_TAG_DEFAULT, r.inherited);
+    ASSERT_EQ(batch_tag(), r.specified);
+
+    bthread_attr_t attr = attr_of(io_tag());
+    ASSERT_EQ(0, bthread_start_background(&th, &attr, record_tags, &r));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    ASSERT_EQ(io_tag(), r.self);
+    ASSERT_EQ(io_tag(), r.inherited);
+    ASSERT_EQ(batch_tag(), r.specified);
+
+    bthread_attr_t got;
+    ASSERT_EQ(0, bthread_start_background(&th, &attr, record_tags, &r));
+    if (bthread_getattr(th, &got) == 0) {
+        ASSERT_EQ(io_tag(), got.tag);
+    }
+    ASSERT_EQ(0, bthread_join(th, NULL));
+}
+
+struct PingPong {
+    butil::atomic<int>* butex;
+    int rounds;
+    bthread_tag_t tag;
+    pthread_mutex_t mutex;
+    std::set<pthread_t> workers;
+    bool wrong_tag;
+};
+
+void record_worker(PingPong* p) {
+    if (bthread_self_tag() != p->tag) {
+        p->wrong_tag = true;
+    }
+    BAIDU_SCOPED_LOCK(p->mutex);
+    p->workers.insert(pthread_self());
+}
+
+// Wakes up each other with butex and sleeps in-between, the task must be
+// put back to its own group after each wakeup.
+void* ping_pong(void* arg) {
+    PingPong* p = static_cast<PingPong*>(arg);
+    for (int i = 0; i < p->rounds; ++i) {
+        record_worker(p);
+        const int expected = p->butex->load(butil::memory_order_acquire);
+        if (expected & 1) {
+            p->butex->fetch_add(1, butil::memory_order_release);
+            bthread::butex_wake_all(p->butex);
+        } else {
+            const timespec abstime = butil::milliseconds_from_now(10);
+            bthread::butex_wait(p->butex, expected, &abstime);
+        }
+        if (i % 16 == 0) {
+            bthread_usleep(100);
+        } else {
+            bthread_yield();
+        }
+    }
+    return NULL;
+}
+
+void* stop_pinging(void* arg) {
+    butil::atomic<int>* butex = static_cast<butil::atomic<int>*>(arg);
+    for (int i = 0; i < 2000; ++i) {
+        butex->fetch_add(1, butil::memory_order_release);
+        bthread::butex_wake_all(butex);
+        bthread_usleep(50);
+    }
+    return NULL;
+}
+
+TEST(WorkerGroupTest, never_leave_group) {
+    butil::atomic<int>* butex = bthread::butex_create_checked<butil::atomic<int> >();
+    butex->store(0);
+    PingPong io = { butex, 500, io_tag(), PTHREAD_MUTEX_INITIALIZER, {}, false };
+    PingPong batch = { butex, 500, batch_tag(), PTHREAD_MUTEX_INITIALIZER, {}, false };
+    const int N = 8;
+    bthread_t ths[2 * N];
+    bthread_attr_t io_attr = attr_of(io_tag());
+    bthread_attr_t batch_attr = attr_of(batch_tag());
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread_start_background(&ths[i], &io_attr, ping_pong, &io));
+        ASSERT_EQ(0, bthread_start_background(
+                      &ths[N + i], &batch_attr, ping_pong, &batch));
+    }
+    // Wakers running in the default group.
+    bthread_t waker;
+    ASSERT_EQ(0, bthread_start_background(&waker, NULL, stop_pinging, butex));
+    for (int i = 0; i < 2 * N; ++i) {
+        ASSERT_EQ(0, bthread_join(ths[i], NULL));
+    }
+    ASSERT_EQ(0, bthread_join(waker, NULL));
+    bthread::butex_destroy(butex);
+
+    ASSERT_FALSE(io.wrong_tag);
+    ASSERT_FALSE(batch.wrong_tag);
+    ASSERT_LE(io.workers.size(), 2ul);
+    ASSERT_LE(batch.workers.size(), 3ul);
+    for (std::set<pthread_t>::const_iterator it = io.workers.begin();
+         it != io.workers.end(); ++it) {
+        ASSERT_EQ(0ul, batch.workers.count(*it));
+    }
+}
+
+TEST(WorkerGroupTest, exposed_vars) {
+    ASSERT_EQ("2", bvar::Variable::describe_exposed(
+                  "bthread_worker_group_io_count"));
+    ASSERT_EQ("3", bvar::Variable::describe_exposed(
+                  "bthread_worker_group_batch_count"));
+    ASSERT_FALSE(bvar::Variable::describe_exposed(
+                     "bthread_worker_group_batch_usage").empty());
+    ASSERT_FALSE(bvar::Variable::describe_exposed(
+                     "bthread_worker_group_default_queue_depth").empty());
+}
+
+} // namespace
@@ -0,0 +1,187 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <pthread.h>
+#include <gtest/gtest.h>
+#include "butil/time.h"
+#include "butil/macros.h"
+#include "butil/logging.h"
+#include "bvar/bvar.h"
+
+namespace {
+
+TEST(HistogramTest, buckets) {
+    bvar::HistogramBuckets b(16, 2000000, 3);
+    ASSERT_EQ(16, b.resolution());
+    ASSERT_EQ(121u, b.size());
+    // Linear buckets of `resolution'.
+    ASSERT_EQ(16, b.upper_bound(0));
+    ASSERT_EQ(128, b.upper_bound(7));
+    // Then 8 buckets in each power of 2.
+    ASSERT_EQ(144, b.upper_bound(8));
+    ASSERT_EQ(256, b.upper_bound(15));
+    ASSERT_EQ(288, b.upper_bound(16));
+    ASSERT_EQ(2097152, b.upper_bound(b.size() - 2));
+    ASSERT_EQ(std::numeric_limits<int64_t>::max(), b.upper_bound(b.size() - 1));
+
+    ASSERT_EQ(0u, b.index_of(-1));
+    ASSERT_EQ(0u, b.index_of(0));
+    ASSERT_EQ(0u, b.index_of(16));
+    ASSERT_EQ(1u, b.index_of(17));
+    ASSERT_EQ(b.size() - 2, b.index_of(2000000));
+    ASSERT_EQ(b.size() - 1, b.index_of(2097153));
+    ASSERT_EQ(b.size() - 1, b.index_of(std::numeric_limits<int64_t>::max()));
+
+    // Every value is in (upper_bound(i - 1), upper_bound(i)] and the width
+    // of a bucket is within 1/8 of its lower bound.
+    for (int64_t v = 1; v < 3000000; v += 7) {
+        const size_t i = b.index_of(v);
+        ASSERT_LE(v, b.upper_bound(i)) << v;
+        if (i > 0) {
+            ASSERT_GT(v, b.upper_bound(i - 1)) << v;
+        }
+        if (i > 8 && i + 1 < b.size()) {
+            ASSERT_LE(b.upper_bound(i) - b.upper_bound(i - 1),
+                      b.upper_bound(i - 1) / 8) << v;
+        }
+    }
+
+    // Resolution is rounded down to a power of 2.
+    bvar::HistogramBuckets b2(100, 50, 0);
+    ASSERT_EQ(64, b2.resolution());
+    ASSERT_EQ(2u, b2.size());
+    ASSERT_TRUE(bvar::HistogramBuckets() == bvar::HistogramBuckets());
+    ASSERT_TRUE(b2 != b);
+}
+
+TEST(HistogramTest, snapshot) {
+    bvar::HistogramSnapshot s(bvar::HistogramBuckets(1, 1000, 2));
+    ASSERT_EQ(0, s.get_number(0.5));
+    for (int i = 1; i <= 1000; ++i) {
+        s.add(i);
+    }
+    s.add(5000);
+    ASSERT_EQ(1001, s.count());
+    ASSERT_EQ(500500 + 5000, s.sum());
+    ASSERT_EQ(1, s.count(s.buckets().size() - 1));
+    // Within a quarter.
+    ASSERT_GE(s.get_number(0.5), 500);
+    ASSERT_LE(s.get_number(0.5), 500 * 5 / 4);
+    // Values in the last bucket are reported as the max value.
+    ASSERT_EQ(1000, s.get_number(1));
+
+    std::ostringstream oss;
+    oss << s;
+    LOG(INFO) << oss.str();
+    bvar::HistogramSnapshot s2;
+    ASSERT_EQ(0, s2.parse(oss.str()));
+    ASSERT_TRUE(s2.buckets() == s.buckets());
+    ASSERT_EQ(s.sum(), s2.sum());
+    for (size_t i = 0; i < s.buckets().size(); ++i) {
+        ASSERT_EQ(s.count(i), s2.count(i));
+    }
+    ASSERT_EQ(-1, s2.parse("{count=1 sum=1}"));
+    ASSERT_EQ(-1, s2.parse("{count=2 sum=1 resolution=1 max=1000 precision=2"
+                           " buckets=[1:1]}"));
+    ASSERT_EQ(-1, s2.parse("{count=1 sum=1 resolution=1 max=1000 precision=2"
+                           " buckets=[9:1]}"));
+    ASSERT_TRUE(s2.buckets() == bvar::HistogramBuckets());
+
+    ASSERT_EQ(0, s2.parse(oss.str()));
+    s2 -= s;
+    ASSERT_EQ(0, s2.count());
+    s2 += s;
+    s2 += s;
+    ASSERT_EQ(2 * s.count(), s2.count());
+    // Snapshots with different buckets are not merged.
+    s2 += bvar::HistogramSnapshot(bvar::HistogramBuckets());
+    ASSERT_EQ(2 * s.count(), s2.count());
+}
+
+void* record(void* arg) {
+    bvar::Histogram* h = (bvar::Histogram*)arg;
+    for (int i = 1; i <= 10000; ++i) {
+        *h << i;
+    }
+    return NULL;
+}
+
+TEST(HistogramTest, record_and_expose) {
+    bvar::Histogram h("histogram_test", bvar::HistogramBuckets(1, 100000, 3));
+    pthread_t th[4];
+    for (size_t i = 0; i < arraysize(th); ++i) {
+        ASSERT_EQ(0, pthread_create(&th[i], NULL, record, &h));
+    }
+    for (size_t i = 0; i < arraysize(th); ++i) {
+        ASSERT_EQ(0, pthread_join(th[i], NULL));
+    }
+    const bvar::HistogramSnapshot s = h.get_value();
+    ASSERT_EQ(40000, s.count());
+    ASSERT_EQ(4 * 50005000, s.sum());
+    const int64_t p99 = s.get_number(0.99);
+    ASSERT_GE(p99, 9900);
+    ASSERT_LE(p99, 9900 * 9 / 8);
+
+    bvar::HistogramSnapshot s2;
+    ASSERT_EQ(0, s2.parse(bvar::Variable::describe_exposed("histogram_test")));
+    ASSERT_EQ(s.count(), s2.count());
+    ASSERT_EQ(p99, s2.get_number(0.99));
+}
+
+TEST(HistogramTest, window) {
+    bvar::Histogram h;
+    bvar::Window<bvar::Histogram> w("histogram_test_window", &h, 2);
+    // No series for histograms.
+    std::ostringstream oss;
+    bvar::SeriesOptions opt;
+    ASSERT_EQ(1, w.describe_series(oss, opt));
+    for (int i = 0; i < 100; ++i) {
+        h << 1000;
+    }
+    usleep(3100000);
+    for (int i = 0; i < 10; ++i) {
+        h << 10;
+    }
+    usleep(1100000);
+    // The values before the window are excluded.
+    const bvar::HistogramSnapshot s = w.get_value();
+    ASSERT_EQ(10, s.count());
+    ASSERT_EQ(100, s.sum());
+    ASSERT_EQ(110, h.get_value().count());
+}
+
+TEST(HistogramTest, perf) {
+    const int N = 1000000;
+    bvar::Histogram h;
+    bvar::IntRecorder recorder;
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < N; ++i) {
+        h << (i & 0xFFFF);
+    }
+    tm.stop();
+    const int64_t histogram_ns = tm.n_elapsed() / N;
+    tm.start();
+    for (int i = 0; i < N; ++i) {
+        recorder << (i & 0xFFFF);
+    }
+    tm.stop();
+    LOG(INFO) << "Record into Histogram takes " << histogram_ns
+              << "ns, IntRecorder takes " << tm.n_elapsed() / N << "ns";
+}
+
+} // namespace
@@ -331,6 +331,85 @@ TEST_F(MultiDimensionTest, stats) {
     ASSERT_EQ(vec_labels_no_sort, ret_labels);
 }
 
+TEST_F(MultiDimensionTest, get_stats_by_string_pieces) {
+    bvar::MultiDimension<bvar::Adder<int> > my_madder("test_get_stats_by_string_pieces", labels);
+    std::list<std::string> labels_value = {"bj", "get", "200"};
+    bvar::Adder<int>* adder = my_madder.get_stats(labels_value);
+    ASSERT_TRUE(adder);
+    butil::StringPiece pieces[] = { "bj", "get", "200" };
+    ASSERT_EQ(adder, my_madder.get_stats(pieces, arraysize(pieces)));
+    // Cached.
+    ASSERT_EQ(adder, my_madder.get_stats(pieces, arraysize(pieces)));
+    ASSERT_TRUE(my_madder.get_stats(pieces, 2) == NULL);
+
+    // Permuted label values are different stats.
+    butil::StringPiece permuted[] = { "get", "bj", "200" };
+    bvar::Adder<int>* adder2 = my_madder.get_stats(permuted, arraysize(permuted));
+    ASSERT_TRUE(adder2);
+    ASSERT_NE(adder, adder2);
+    ASSERT_EQ(2u, my_madder.count_stats());
+    std::list<std::string> permuted_value = {"get", "bj", "200"};
+    ASSERT_EQ(adder2, my_madder.get_stats_read_only(permuted_value));
+
+    // Cached stats are invalidated after deletion.
+    my_madder.delete_stats(permuted_value);
+    ASSERT_TRUE(my_madder.get_stats_read_only(permuted_value) == NULL);
+    bvar::Adder<int>* adder3 = my_madder.get_stats(permuted, arraysize(permuted));
+    ASSERT_TRUE(adder3);
+    ASSERT_EQ(adder3, my_madder.get_stats_read_only(permuted_value));
+    ASSERT_EQ(2u, my_madder.count_stats());
+}
+
+static void* get_stats_by_string_pieces(void* arg) {
+    bvar::MultiDimension<bvar::Adder<int> >* md =
+        (bvar::MultiDimension<bvar::Adder<int> >*)arg;
+    const char* const methods[] = { "get", "post", "put", "delete" };
+    butil::Timer timer;
+    timer.start();
+    for (size_t i = 0; i < OPS_PER_THREAD; ++i) {
+        butil::StringPiece labels_value[] = { "bj", methods[i % arraysize(methods)], "200" };
+        *md->get_stats(labels_value, arraysize(labels_value)) << 1;
+    }
+    timer.stop();
+    return (void*)(timer.n_elapsed() / OPS_PER_THREAD);
+}
+
+static void* get_stats_by_list(void* arg) {
+    bvar::MultiDimension<bvar::Adder<int> >* md =
+        (bvar::MultiDimension<bvar::Adder<int> >*)arg;
+    const char* const methods[] = { "get", "post", "put", "delete" };
+    butil::Timer timer;
+    timer.start();
+    for (size_t i = 0; i < OPS_PER_THREAD; ++i) {
+        std::list<std::string> labels_value = { "bj", methods[i % arraysize(methods)], "200" };
+        *md->get_stats(labels_value) << 1;
+    }
+    timer.stop();
+    return (void*)(timer.n_elapsed() / OPS_PER_THREAD);
+}
+
+TEST_F(MultiDimensionTest, get_stats_perf) {
+    bvar::MultiDimension<bvar::Adder<int> > my_madder("test_get_stats_perf", labels);
+    void* (*fns[])(void*) = { get_stats_by_list, get_stats_by_string_pieces };
+    long elapsed_ns[arraysize(fns)];
+    for (size_t i = 0; i < arraysize(fns); ++i) {
+        pthread_t threads[4];
+        long total = 0;
+        for (size_t j = 0; j < arraysize(threads); ++j) {
+            ASSERT_EQ(0, pthread_create(&threads[j], NULL, fns[i], &my_madder));
+        }
+        for (size_t j = 0; j < arraysize(threads); ++j) {
+            void* ret = NULL;
+            pthread_join(threads[j], &ret);
+            total += (long)ret;
+        }
+        elapsed_ns[i] = total / arraysize(threads);
+    }
+    ASSERT_EQ(4u, my_madder.count_stats());
+    LOG(INFO) << "get_stats by list=" << elapsed_ns[0]
+              << "ns by string pieces=" << elapsed_ns[1] << "ns";
+}
+
 TEST_F(MultiDimensionTest, get_description) {
     bvar::MultiDimension<bvar::Adder<int> > my_madder("test_get_description", labels);
     std::list<std::string> labels_value1 = {"gz", "post", "200"};
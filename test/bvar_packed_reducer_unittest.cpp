@@ -0,0 +1,292 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <pthread.h>
+#include <gtest/gtest.h>
+#include "butil/time.h"
+#include "butil/macros.h"
+#include "butil/logging.h"
+#include "bvar/bvar.h"
+
+namespace {
+
+const size_t N = 64;
+
+void* add_all(void* arg) {
+    bvar::PackedAdder<int64_t>* adder = (bvar::PackedAdder<int64_t>*)arg;
+    for (int round = 0; round < 1000; ++round) {
+        bvar::PackedAdder<int64_t>::Local local(adder);
+        for (size_t i = 0; i < adder->size(); ++i) {
+            local.add(i, i);
+        }
+        adder->add(0, 1);
+    }
+    return NULL;
+}
+
+TEST(PackedReducerTest, adder) {
+    bvar::PackedAdder<int64_t> adder(N);
+    ASSERT_TRUE(adder.valid());
+    ASSERT_EQ(N, adder.size());
+    ASSERT_EQ(0, adder.get_value(N - 1));
+    adder.add(1, 10);
+    adder.add(1, -3);
+    ASSERT_EQ(7, adder.get_value(1));
+
+    pthread_t th[8];
+    for (size_t i = 0; i < arraysize(th); ++i) {
+        ASSERT_EQ(0, pthread_create(&th[i], NULL, add_all, &adder));
+    }
+    for (size_t i = 0; i < arraysize(th); ++i) {
+        ASSERT_EQ(0, pthread_join(th[i], NULL));
+    }
+    // Values of quitted threads are kept.
+    std::vector<int64_t> values;
+    adder.get_values(&values);
+    ASSERT_EQ(N, values.size());
+    ASSERT_EQ(8 * 1000, values[0]);
+    ASSERT_EQ(7 + 8 * 1000, values[1]);
+    for (size_t i = 2; i < N; ++i) {
+        ASSERT_EQ((int64_t)(8 * 1000 * i), values[i]);
+        ASSERT_EQ(values[i], adder.get_value(i));
+    }
+}
+
+void* max_all(void* arg) {
+    bvar::PackedMaxer<int>* maxer = (bvar::PackedMaxer<int>*)arg;
+    for (int i = 0; i < 10000; ++i) {
+        maxer->update(i % 2, i);
+    }
+    return NULL;
+}
+
+TEST(PackedReducerTest, maxer) {
+    bvar::PackedMaxer<int> maxer(3);
+    ASSERT_EQ(std::numeric_limits<int>::min(), maxer.get_value(0));
+    pthread_t th[4];
+    for (size_t i = 0; i < arraysize(th); ++i) {
+        ASSERT_EQ(0, pthread_create(&th[i], NULL, max_all, &maxer));
+    }
+    maxer.update(2, -1);
+    std::vector<int> values;
+    maxer.get_values(&values);
+    ASSERT_EQ(-1, values[2]);
+    for (size_t i = 0; i < arraysize(th); ++i) {
+        ASSERT_EQ(0, pthread_join(th[i], NULL));
+    }
+    ASSERT_EQ(9998, maxer.get_value(0));
+    ASSERT_EQ(9999, maxer.get_value(1));
+}
+
+TEST(PackedReducerTest, expose) {
+    {
+        bvar::PackedAdder<int> adder(2);
+        ASSERT_EQ(0, adder.expose(0, "packed_reducer_test_0"));
+        ASSERT_EQ(0, adder.expose_as(1, "packed_reducer_test", "1"));
+        ASSERT_EQ(-1, adder.expose(2, "packed_reducer_test_2"));
+        adder.add(0, 1);
+        adder.add(1, 2);
+        ASSERT_EQ("1", bvar::Variable::describe_exposed("packed_reducer_test_0"));
+        ASSERT_EQ("2", bvar::Variable::describe_exposed("packed_reducer_test_1"));
+        ASSERT_TRUE(adder.hide(1));
+        ASSERT_FALSE(adder.hide(1));
+        ASSERT_EQ("", bvar::Variable::describe_exposed("packed_reducer_test_1"));
+    }
+    ASSERT_EQ("", bvar::Variable::describe_exposed("packed_reducer_test_0"));
+}
+
+// Updates the reducer when dumping the first value.
+class UpdatingDumper : public bvar::Dumper {
+public:
+    explicit UpdatingDumper(bvar::PackedAdder<int>* adder) : _adder(adder) {}
+    bool dump(const std::string& name,
+              const butil::StringPiece& description) {
+        _values.push_back(description.as_string());
+        _adder->add(1, 10);
+        return true;
+    }
+    bvar::PackedAdder<int>* _adder;
+    std::vector<std::string> _values;
+};
+
+TEST(PackedReducerTest, dump) {
+    bvar::PackedAdder<int> adder(2);
+    ASSERT_EQ(0, adder.expose(0, "packed_reducer_dump_0"));
+    ASSERT_EQ(0, adder.expose(1, "packed_reducer_dump_1"));
+    adder.add(0, 1);
+    adder.add(1, 2);
+    bvar::DumpOptions options;
+    options.white_wildcards = "packed_reducer_dump_0;packed_reducer_dump_1";
+    {
+        // Values are combined once per dump, the update after dumping the
+        // first value is not seen by the second one.
+        UpdatingDumper dumper(&adder);
+        ASSERT_EQ(2, bvar::Variable::dump_exposed(&dumper, &options));
+        ASSERT_EQ(2UL, dumper._values.size());
+        ASSERT_EQ("1", dumper._values[0]);
+        ASSERT_EQ("2", dumper._values[1]);
+    }
+    {
+        // But seen by next dump.
+        UpdatingDumper dumper(&adder);
+        ASSERT_EQ(2, bvar::Variable::dump_exposed(&dumper, &options));
+        ASSERT_EQ("1", dumper._values[0]);
+        ASSERT_EQ("22", dumper._values[1]);
+    }
+    // Not cached outside dumps.
+    ASSERT_EQ("42", bvar::Variable::describe_exposed("packed_reducer_dump_1"));
+}
+
+TEST(PackedReducerTest, reuse_agent) {
+    // Agents of destroyed reducers are reused by new reducers with the same
+    // id, which may have different sizes.
+    for (size_t n = 1; n < 1000; n *= 3) {
+        bvar::PackedAdder<int64_t> adder(n);
+        for (size_t i = 0; i < n; ++i) {
+            ASSERT_EQ(0, adder.get_value(i));
+            adder.add(i, i);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            ASSERT_EQ((int64_t)i, adder.get_value(i));
+        }
+    }
+}
+
+// Benchmark updating and combining many counters from many threads.
+const size_t NUM_COUNTERS = 10000;
+const size_t NUM_THREADS = 128;
+const int NUM_ROUNDS = 10;
+
+struct PerfArgs {
+    bvar::Adder<int64_t>* adders;
+    bvar::PackedAdder<int64_t>* packed;
+    bool use_local;
+    int64_t elapsed_ns;
+    butil::atomic<int>* done;
+    butil::atomic<bool>* stop;
+};
+
+void* perf_update(void* void_arg) {
+    PerfArgs* args = (PerfArgs*)void_arg;
+    butil::Timer tm;
+    // The first round creates agents.
+    for (int round = 0; round <= NUM_ROUNDS; ++round) {
+        if (round == 1) {
+            tm.start();
+        }
+        if (args->adders) {
+            for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+                args->adders[i] << 1;
+            }
+        } else if (args->use_local) {
+            bvar::PackedAdder<int64_t>::Local local(args->packed);
+            for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+                local.add(i, 1);
+            }
+        } else {
+            for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+                args->packed->add(i, 1);
+            }
+        }
+    }
+    tm.stop();
+    args->elapsed_ns = tm.n_elapsed();
+    args->done->fetch_add(1);
+    // Keep the thread (and its agents) alive until combining is measured.
+    while (!args->stop->load()) {
+        usleep(1000);
+    }
+    return NULL;
+}
+
+// Returns average nanoseconds per update.
+int64_t run_updates(bvar::Adder<int64_t>* adders,
+                    bvar::PackedAdder<int64_t>* packed,
+                    bool use_local,
+                    butil::atomic<bool>* stop,
+                    std::vector<pthread_t>* th) {
+    std::vector<PerfArgs> args(NUM_THREADS);
+    butil::atomic<int> done(0);
+    th->resize(NUM_THREADS);
+    for (size_t i = 0; i < NUM_THREADS; ++i) {
+        PerfArgs a = { adders, packed, use_local, 0, &done, stop };
+        args[i] = a;
+        EXPECT_EQ(0, pthread_create(&(*th)[i], NULL, perf_update, &args[i]));
+    }
+    while (done.load() != (int)NUM_THREADS) {
+        usleep(1000);
+    }
+    int64_t sum = 0;
+    for (size_t i = 0; i < NUM_THREADS; ++i) {
+        sum += args[i].elapsed_ns;
+    }
+    return sum / (NUM_THREADS * NUM_ROUNDS * NUM_COUNTERS);
+}
+
+void join_all(butil::atomic<bool>* stop, std::vector<pthread_t>* th) {
+    stop->store(true);
+    for (size_t i = 0; i < th->size(); ++i) {
+        pthread_join((*th)[i], NULL);
+    }
+    th->clear();
+}
+
+TEST(PackedReducerTest, perf) {
+    const int64_t expected = NUM_THREADS * (NUM_ROUNDS + 1);
+    std::vector<pthread_t> th;
+    butil::Timer tm;
+
+    bvar::Adder<int64_t>* adders = new bvar::Adder<int64_t>[NUM_COUNTERS];
+    butil::atomic<bool> stop(false);
+    const int64_t adder_update_ns = run_updates(adders, NULL, false, &stop, &th);
+    tm.start();
+    for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+        ASSERT_EQ(expected, adders[i].get_value());
+    }
+    tm.stop();
+    const int64_t adder_combine_us = tm.u_elapsed();
+    join_all(&stop, &th);
+    delete [] adders;
+
+    bvar::PackedAdder<int64_t> packed(NUM_COUNTERS);
+    stop.store(false);
+    const int64_t packed_update_ns = run_updates(NULL, &packed, false, &stop, &th);
+    std::vector<int64_t> values;
+    tm.start();
+    packed.get_values(&values);
+    tm.stop();
+    const int64_t packed_combine_us = tm.u_elapsed();
+    for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+        ASSERT_EQ(expected, values[i]);
+    }
+    join_all(&stop, &th);
+
+    bvar::PackedAdder<int64_t> packed2(NUM_COUNTERS);
+    stop.store(false);
+    const int64_t local_update_ns = run_updates(NULL, &packed2, true, &stop, &th);
+    join_all(&stop, &th);
+    ASSERT_EQ(expected, packed2.get_value(NUM_COUNTERS - 1));
+
+    LOG(INFO) << NUM_COUNTERS << " counters updated by " << NUM_THREADS
+              << " threads: Adder takes " << adder_update_ns
+              << "ns/update and " << adder_combine_us
+              << "us to get all values, PackedAdder takes " << packed_update_ns
+              << "ns/update (" << local_update_ns << "ns/update with Local) and "
+              << packed_combine_us << "us to get all values";
+}
+
+} // namespace
@@ -0,0 +1,207 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <pthread.h>
+#include <math.h>
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/time.h"
+#include "butil/logging.h"
+#include "bvar/latency_recorder.h"
+#include "bvar/detail/quantile_sketch.h"
+
+namespace bvar {
+DECLARE_bool(bvar_latency_use_sketch);
+}
+
+namespace {
+
+void expect_accurate(int64_t exact, int64_t value) {
+    // One more for rounding the value of a bin to an integer.
+    EXPECT_LE(fabs((double)(value - exact)),
+              exact * bvar::detail::QuantileSketch::RELATIVE_ACCURACY + 1)
+        << "exact=" << exact << " value=" << value;
+}
+
+TEST(QuantileSketchTest, relative_accuracy) {
+    bvar::detail::QuantileSketch s;
+    ASSERT_TRUE(s.empty());
+    ASSERT_EQ(0, s.get_number(0.5));
+    const int N = 100000;
+    for (int i = 1; i <= N; ++i) {
+        s.add(i);
+    }
+    ASSERT_EQ((uint64_t)N, s.count());
+    const double ratios[] = { 0.001, 0.1, 0.5, 0.8, 0.9, 0.99, 0.999, 0.9999, 1 };
+    for (size_t i = 0; i < arraysize(ratios); ++i) {
+        expect_accurate((int64_t)ceil(ratios[i] * N), s.get_number(ratios[i]));
+    }
+
+    // Zeros and values out of range.
+    bvar::detail::QuantileSketch s2;
+    s2.add(0);
+    s2.add(-1);
+    s2.add(std::numeric_limits<int64_t>::max());
+    ASSERT_EQ(0, s2.get_number(0.5));
+    expect_accurate(std::numeric_limits<uint32_t>::max(), s2.get_number(1));
+}
+
+TEST(QuantileSketchTest, merge_is_exact) {
+    bvar::detail::QuantileSketch all;
+    bvar::detail::QuantileSketch part[3];
+    for (int i = 0; i < 30000; ++i) {
+        // Long tail: 1% of the values are 100 times larger.
+        const int64_t x = (i % 100 == 0 ? 100000 + i : 1000 + i % 1000);
+        all.add(x);
+        part[i % 3].add(x);
+    }
+    bvar::detail::QuantileSketch merged;
+    for (size_t i = 0; i < arraysize(part); ++i) {
+        merged.merge(part[i]);
+    }
+    ASSERT_TRUE(merged == all);
+    ASSERT_EQ(all.get_number(0.9999), merged.get_number(0.9999));
+    ASSERT_GT(merged.get_number(0.995), 100000);
+
+    merged.clear();
+    ASSERT_TRUE(merged.empty());
+    ASSERT_TRUE(merged == bvar::detail::QuantileSketch());
+}
+
+TEST(QuantileSketchTest, serialize) {
+    bvar::detail::QuantileSketch s;
+    std::string str;
+    s.serialize(&str);
+    ASSERT_TRUE(str.empty());
+    for (int i = 0; i < 1000; ++i) {
+        s.add(i * i);
+    }
+    s.serialize(&str);
+    bvar::detail::QuantileSketch s2;
+    ASSERT_EQ(0, s2.parse(str));
+    ASSERT_TRUE(s == s2);
+    // Sketches from different processes are merged after parsing.
+    ASSERT_EQ(0, s2.parse(str + "," + str));
+    ASSERT_EQ(2 * s.count(), s2.count());
+    ASSERT_EQ(s.get_number(0.99), s2.get_number(0.99));
+
+    ASSERT_EQ(-1, s2.parse("1:2,3"));
+    ASSERT_TRUE(s2.empty());
+    ASSERT_EQ(-1, s2.parse("100000:1"));
+    ASSERT_EQ(-1, s2.parse("a:b"));
+
+    // Counts beyond 32 bits, e.g. sketches merged from many processes.
+    ASSERT_EQ(0, s2.parse("10:4294967295,10:4294967295,20:1"));
+    ASSERT_EQ(8589934591UL, s2.count());
+    ASSERT_EQ(0, s.parse("20:8589934590"));
+    s.merge(s2);
+    ASSERT_EQ(17179869181UL, s.count());
+    ASSERT_EQ(s2.get_number(0.5), s.get_number(0.25));
+    ASSERT_EQ(s.get_number(1), s2.get_number(1));
+    s.serialize(&str);
+    ASSERT_EQ("10:8589934590,20:8589934591", str);
+    // Overflowed count is rejected.
+    ASSERT_EQ(-1, s2.parse("10:18446744073709551615,20:1"));
+}
+
+TEST(QuantileSketchTest, allocate_bins_in_range) {
+    bvar::detail::QuantileSketch s;
+    ASSERT_TRUE(s._bins.empty());
+    // Latencies between 1ms and 2ms fall into few bins.
+    for (int i = 1000; i <= 2000; ++i) {
+        s.add(i);
+    }
+    ASSERT_LT(s._bins.size(), 60UL);
+    s.add(1);
+    s.add(std::numeric_limits<uint32_t>::max());
+    ASSERT_EQ(bvar::detail::QuantileSketch::NUM_BINS, s._bins.size());
+    ASSERT_EQ(1, s.get_number(0.0001));
+    expect_accurate(std::numeric_limits<uint32_t>::max(), s.get_number(1));
+    s.clear();
+    ASSERT_TRUE(s._bins.empty());
+}
+
+void* record(void* arg) {
+    bvar::detail::PercentileSketch* p = (bvar::detail::PercentileSketch*)arg;
+    for (int i = 1; i <= 10000; ++i) {
+        *p << i;
+    }
+    return NULL;
+}
+
+TEST(QuantileSketchTest, multiple_threads) {
+    bvar::detail::PercentileSketch p;
+    pthread_t th[4];
+    for (size_t i = 0; i < arraysize(th); ++i) {
+        ASSERT_EQ(0, pthread_create(&th[i], NULL, record, &p));
+    }
+    for (size_t i = 0; i < arraysize(th); ++i) {
+        ASSERT_EQ(0, pthread_join(th[i], NULL));
+    }
+    p << -1;
+    bvar::detail::QuantileSketch s = p.reset();
+    ASSERT_EQ(40000u, s.count());
+    expect_accurate(9900, s.get_number(0.99));
+    ASSERT_TRUE(p.get_value().empty());
+}
+
+TEST(QuantileSketchTest, latency_recorder) {
+    bvar::FLAGS_bvar_latency_use_sketch = true;
+    bvar::LatencyRecorder rec("quantile_sketch_test");
+    bvar::FLAGS_bvar_latency_use_sketch = false;
+    for (int i = 1; i <= 100000; ++i) {
+        rec << i;
+    }
+    usleep(1100000);
+    expect_accurate(99990, rec.latency_percentile(0.9999));
+    const bvar::Vector<int64_t, 4> v = rec.latency_percentiles();
+    expect_accurate(80000, v[0]);
+    expect_accurate(99900, v[3]);
+    ASSERT_EQ(100000u, rec.latency_sketch().count());
+
+    bvar::detail::QuantileSketch s;
+    ASSERT_EQ(0, s.parse(bvar::Variable::describe_exposed(
+                             "quantile_sketch_test_latency_sketch")));
+    ASSERT_TRUE(s == rec.latency_sketch());
+
+    // Recorders created with the gflag off are not affected.
+    bvar::LatencyRecorder rec2;
+    rec2 << 1;
+    ASSERT_TRUE(rec2.latency_sketch().empty());
+}
+
+TEST(QuantileSketchTest, perf) {
+    const int N = 1000000;
+    bvar::detail::Percentile percentile;
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < N; ++i) {
+        percentile << (i & 0xFFFF);
+    }
+    tm.stop();
+    const int64_t percentile_ns = tm.n_elapsed() / N;
+    bvar::detail::PercentileSketch sketch;
+    tm.start();
+    for (int i = 0; i < N; ++i) {
+        sketch << (i & 0xFFFF);
+    }
+    tm.stop();
+    LOG(INFO) << "Record into Percentile takes " << percentile_ns
+              << "ns, PercentileSketch takes " << tm.n_elapsed() / N << "ns";
+}
+
+} // namespace
@@ -16,11 +16,19 @@
 // under the License.
 
 #include <limits>                           //std::numeric_limits
+#include <set>
+#include <gflags/gflags.h>
 #include "bvar/detail/sampler.h"
 #include "butil/time.h"
 #include "butil/logging.h"
 #include <gtest/gtest.h>
 
+namespace bvar {
+namespace detail {
+DECLARE_int32(bvar_sampler_thread_num);
+}
+}
+
 namespace {
 
 TEST(SamplerTest, linked_list) {
@@ -136,4 +144,43 @@ TEST(SamplerTest, multi_threaded) {
     }
 #endif
 }
+
+class ThreadSampler : public bvar::detail::Sampler {
+public:
+    ThreadSampler() : _ncalled(0), _tid(0) {}
+    void take_sample() {
+        ++_ncalled;
+        _tid = pthread_self();
+        // Make sampling costly.
+        usleep(100);
+    }
+    int called_count() const { return _ncalled; }
+    pthread_t tid() const { return _tid; }
+private:
+    int _ncalled;
+    pthread_t _tid;
+};
+
+TEST(SamplerTest, sharded) {
+    bvar::detail::FLAGS_bvar_sampler_thread_num = 4;
+    // Wait for creation of sampling threads.
+    usleep(1100000);
+    const int N = 2000;
+    ThreadSampler* s[N];
+    for (int i = 0; i < N; ++i) {
+        s[i] = new ThreadSampler;
+        s[i]->schedule();
+    }
+    // Sampling 2000 samplers in one thread takes more than 0.2 seconds.
+    usleep(2100000);
+    std::set<pthread_t> tids;
+    for (int i = 0; i < N; ++i) {
+        ASSERT_LE(1, s[i]->called_count()) << "i=" << i;
+        tids.insert(s[i]->tid());
+    }
+    ASSERT_EQ(4u, tids.size());
+    for (int i = 0; i < N; ++i) {
+        s[i]->destroy();
+    }
+}
 } // namespace
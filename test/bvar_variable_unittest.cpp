@@ -28,6 +28,7 @@
 #include <memory>
 #include <iostream>
 #include <sstream>
+#include <set>
 #include "butil/time.h"
 #include "butil/macros.h"
 
@@ -317,6 +318,53 @@ TEST_F(VariableTest, dump) {
     ASSERT_EQ(0UL, d._list.size());
 }
 
+// Exposes and hides variables in dump().
+class ExposingDumper : public bvar::Dumper {
+public:
+    ExposingDumper(bvar::Variable* to_expose, bvar::Variable* to_hide)
+        : _to_expose(to_expose), _to_hide(to_hide) {}
+
+    bool dump(const std::string& name, const butil::StringPiece&) {
+        _names.insert(name);
+        if (_to_expose) {
+            EXPECT_EQ(0, _to_expose->expose("dump_unsorted_var3"));
+            _to_expose = NULL;
+        }
+        if (_to_hide) {
+            EXPECT_TRUE(_to_hide->hide());
+            _to_hide = NULL;
+        }
+        return true;
+    }
+
+    bvar::Variable* _to_expose;
+    bvar::Variable* _to_hide;
+    std::set<std::string> _names;
+};
+
+TEST_F(VariableTest, dump_unsorted) {
+    bvar::Adder<int> v1("dump_unsorted_var1");
+    bvar::Adder<int> v2("dump_unsorted_var2");
+    bvar::Adder<int> v3;
+    ExposingDumper d(&v3, &v2);
+    ASSERT_GE(bvar::Variable::dump_exposed_unsorted(
+                  &d, bvar::DISPLAY_ON_PLAIN_TEXT), 1);
+    ASSERT_EQ("dump_unsorted_var3", v3.name());
+    ASSERT_TRUE(v2.name().empty());
+
+    MyDumper d2;
+    const int n = bvar::Variable::dump_exposed_unsorted(
+        &d2, bvar::DISPLAY_ON_PLAIN_TEXT);
+    ASSERT_EQ((size_t)n, d2._list.size());
+    std::set<std::string> names;
+    for (size_t i = 0; i < d2._list.size(); ++i) {
+        names.insert(d2._list[i].first);
+    }
+    ASSERT_EQ(1UL, names.count("dump_unsorted_var1"));
+    ASSERT_EQ(0UL, names.count("dump_unsorted_var2"));
+    ASSERT_EQ(1UL, names.count("dump_unsorted_var3"));
+}
+
 TEST_F(VariableTest, latency_recorder) {
     bvar::LatencyRecorder rec;
     rec << 1 << 2 << 3;
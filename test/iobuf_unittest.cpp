@@ -30,6 +30,10 @@
 #include <butil/fd_guard.h>
 #include <butil/errno.h>
 #include <butil/fast_rand.h>
+#include <butil/endpoint.h>             // tcp_listen
+#if defined(OS_LINUX)
+#include <linux/errqueue.h>            // sock_extended_err
+#endif
 #if BAZEL_TEST
 #include "test/iobuf.pb.h"
 #else
@@ -796,6 +800,75 @@ TEST_F(IOBufTest, cut_multiple_into_fd_tiny) {
     close(fds[1]);
 }
 
+#if defined(OS_LINUX)
+TEST_F(IOBufTest, cut_multiple_into_socket_zerocopy) {
+    butil::EndPoint ep;
+    ASSERT_EQ(0, butil::str2endpoint("127.0.0.1:0", &ep));
+    butil::fd_guard listen_fd(butil::tcp_listen(ep));
+    ASSERT_GE(listen_fd, 0);
+    ASSERT_EQ(0, butil::get_local_side(listen_fd, &ep));
+    butil::fd_guard client_fd(butil::tcp_connect(ep, NULL));
+    ASSERT_GE(client_fd, 0);
+    butil::fd_guard server_fd(accept(listen_fd, NULL, NULL));
+    ASSERT_GE(server_fd, 0);
+    const int on = 1;
+    if (setsockopt(client_fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) != 0) {
+        PLOG(WARNING) << "SO_ZEROCOPY is not supported, skip";
+        return;
+    }
+
+    butil::IOBuf b1[3];
+    butil::IOBuf* pieces[ARRAY_SIZE(b1)];
+    std::string ref;
+    for (size_t j = 0; j < ARRAY_SIZE(b1); ++j) {
+        std::string s(64 * 1024, 'a' + j);
+        ref.append(s);
+        b1[j].append(s);
+        pieces[j] = &b1[j];
+    }
+    butil::IOBuf sent;
+    const ssize_t nw = butil::IOBuf::cut_multiple_into_socket_zerocopy(
+        client_fd, pieces, ARRAY_SIZE(pieces), &sent);
+    ASSERT_GT(nw, 0);
+    ASSERT_EQ((size_t)nw, sent.size());
+    ASSERT_EQ(ref.substr(0, nw), sent.to_string());
+    size_t left = 0;
+    for (size_t j = 0; j < ARRAY_SIZE(b1); ++j) {
+        left += b1[j].size();
+    }
+    ASSERT_EQ(ref.size() - nw, left);
+
+    butil::IOPortal received;
+    while (received.size() < (size_t)nw) {
+        ASSERT_GT(received.append_from_file_descriptor(server_fd, nw), 0);
+    }
+    ASSERT_EQ(ref.substr(0, nw), received.to_string());
+
+    // The kernel notifies that the first send(numbered 0) is done.
+    bool notified = false;
+    for (int i = 0; i < 100 && !notified; ++i) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(client_fd, &msg, MSG_ERRQUEUE) < 0) {
+            ASSERT_EQ(EAGAIN, errno);
+            usleep(10000);
+            continue;
+        }
+        struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+        ASSERT_TRUE(cm != NULL);
+        const sock_extended_err* serr = (const sock_extended_err*)CMSG_DATA(cm);
+        ASSERT_EQ(SO_EE_ORIGIN_ZEROCOPY, serr->ee_origin);
+        ASSERT_EQ(0u, serr->ee_info);
+        ASSERT_EQ(0u, serr->ee_data);
+        notified = true;
+    }
+    ASSERT_TRUE(notified);
+}
+#endif  // OS_LINUX
+
 TEST_F(IOBufTest, cut_into_fd_a_lot_of_data) {
     install_debug_allocator();
 
@@ -1476,6 +1549,31 @@ TEST_F(IOBufTest, appender) {
     ASSERT_EQ(str, buf3);
 }
 
+TEST_F(IOBufTest, appender_reserve) {
+    butil::IOBufAppender appender;
+    ASSERT_EQ(0, appender.append("hello", 5));
+    std::string str = "hello";
+    for (int i = 0; i < 1000; ++i) {
+        void* data = NULL;
+        size_t size = 0;
+        ASSERT_EQ(0, appender.reserve(&data, &size));
+        ASSERT_GT(size, 0ul);
+        // Write part of the space only.
+        const size_t n = std::min(size, (size_t)(i % 97 + 1));
+        memset(data, 'a' + i % 26, n);
+        appender.commit(n);
+        str.append(n, 'a' + i % 26);
+        if (i % 100 == 0) {
+            ASSERT_EQ(str, appender.buf());
+        }
+    }
+    ASSERT_EQ(0, appender.push_back('!'));
+    str.push_back('!');
+    butil::IOBuf buf;
+    appender.move_to(buf);
+    ASSERT_EQ(str, buf);
+}
+
 TEST_F(IOBufTest, appender_perf) {
     const size_t N1 = 100000;
     butil::Timer tm1;
@@ -0,0 +1,144 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+// A sample server receiving variables pushed by brpc::MetricsPusher
+// (-metrics_push_server) and writing the latest values into a file.
+
+#include <gflags/gflags.h>
+#include <map>
+#include <memory>
+#include <butil/logging.h>
+#include <butil/files/file_path.h>
+#include <butil/file_util.h>
+#include <bvar/bvar.h>
+#include <brpc/server.h>
+#include <brpc/metrics_pusher.h>
+
+DEFINE_int32(port, 8878, "TCP Port of this server");
+DEFINE_int32(push_interval, 10, "Pushing interval of clients in seconds");
+DEFINE_string(dump_file, "./collected_metrics",
+              "Write latest values of all sources into this file");
+DEFINE_int32(dump_interval, 10, "Write -dump_file every so many seconds");
+DEFINE_int32(source_timeout, 600, "Remove sources not pushing for so many seconds");
+
+class MetricsCollectorImpl : public brpc::MetricsCollectorService {
+public:
+    MetricsCollectorImpl()
+        : _push_count("metrics_collector_push_count")
+        , _resync_count("metrics_collector_resync_count")
+        , _push_bytes("metrics_collector_request_bytes")
+        , _push_bytes_second("metrics_collector_request_bytes_second", &_push_bytes) {
+        pthread_mutex_init(&_mutex, NULL);
+    }
+    ~MetricsCollectorImpl() {
+        pthread_mutex_destroy(&_mutex);
+    }
+
+    void Push(google::protobuf::RpcController*,
+              const brpc::MetricsPushRequest* request,
+              brpc::MetricsPushResponse* response,
+              google::protobuf::Closure* done) override {
+        brpc::ClosureGuard done_guard(done);
+        _push_count << 1;
+        _push_bytes << request->ByteSize();
+        response->set_new_interval(FLAGS_push_interval);
+        BAIDU_SCOPED_LOCK(_mutex);
+        std::unique_ptr<brpc::MetricsPushState>& state = _sources[request->source()];
+        if (state == NULL) {
+            state.reset(new brpc::MetricsPushState);
+        }
+        if (state->Apply(*request) != 0) {
+            // Restarted or lost some pushes, ask for all series.
+            _resync_count << 1;
+            response->set_resync(true);
+            return;
+        }
+    }
+
+    // Write values of all sources into `path'.
+    void Dump(const std::string& path) {
+        std::string content;
+        std::vector<const brpc::MetricsPushState::Series*> series;
+        const int64_t now = butil::gettimeofday_us();
+        BAIDU_SCOPED_LOCK(_mutex);
+        for (SourceMap::iterator it = _sources.begin(); it != _sources.end();) {
+            if (now - it->second->last_timestamp_us() >
+                FLAGS_source_timeout * 1000000L) {
+                LOG(INFO) << "Remove source=" << it->first;
+                _sources.erase(it++);
+                continue;
+            }
+            it->second->List(&series);
+            for (size_t i = 0; i < series.size(); ++i) {
+                content.append(it->first).push_back(' ');
+                content.append(series[i]->name).push_back(' ');
+                if (series[i]->is_int) {
+                    content.append(std::to_string(series[i]->int_value));
+                } else {
+                    content.append(std::to_string(series[i]->float_value));
+                }
+                content.push_back('\n');
+            }
+            ++it;
+        }
+        // Write into a temporary file and rename it so that readers never
+        // see a partial file.
+        const std::string tmp_path = path + ".tmp";
+        const int nw = butil::WriteFile(butil::FilePath(tmp_path),
+                                        content.data(), content.size());
+        if (nw != (int)content.size() ||
+            !butil::Move(butil::FilePath(tmp_path), butil::FilePath(path))) {
+            PLOG(WARNING) << "Fail to write `" << path << '\'';
+        }
+    }
+
+private:
+    typedef std::map<std::string, std::unique_ptr<brpc::MetricsPushState> > SourceMap;
+    pthread_mutex_t _mutex;
+    SourceMap _sources;
+    bvar::Adder<int64_t> _push_count;
+    bvar::Adder<int64_t> _resync_count;
+    bvar::Adder<int64_t> _push_bytes;
+    bvar::PerSecond<bvar::Adder<int64_t> > _push_bytes_second;
+};
+
+int main(int argc, char* argv[]) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+
+    brpc::Server server;
+    server.set_version("metrics_collector");
+    MetricsCollectorImpl collector;
+    if (server.AddService(&collector, brpc::SERVER_DOESNT_OWN_SERVICE) != 0) {
+        LOG(ERROR) << "Fail to add service";
+        return -1;
+    }
+    brpc::ServerOptions options;
+    // Pushers keep short connections by default.
+    options.idle_timeout_sec = FLAGS_push_interval * 2;
+    if (server.Start(FLAGS_port, &options) != 0) {
+        LOG(ERROR) << "Fail to start MetricsCollector";
+        return -1;
+    }
+    while (!brpc::IsAskedToQuit()) {
+        sleep(FLAGS_dump_interval);
+        collector.Dump(FLAGS_dump_file);
+    }
+    server.Stop(0);
+    server.Join();
+    return 0;
+}